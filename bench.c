@@ -0,0 +1,818 @@
+/*-
+ * Copyright (c) 2023, Collin Funk
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHORS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * Throughput benchmark for md5 and md4. Every case is written as one
+ * JSON object per line inside a "results" array so runs from different
+ * releases can be diffed or loaded into anything that reads JSON.
+ *
+ * The relay cases forward up to 16 MiB from one local socket pair to
+ * another through mdrelay, once with read and write and once with
+ * splice and tee.
+ *
+ * With -d every regular file under dir is also hashed by the thread
+ * pool with 1, 2, 4, ... threads up to the number of online CPUs, and
+ * from one thread with io_uring and with pread, from the page cache
+ * after a first warming pass.
+ *
+ * usage: mdbench [-a md5|md4] [-d dir] [-k kernel] [-m maxsize]
+ *            [-t seconds]
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#include <x86intrin.h>
+#define HAVE_RDTSC
+#endif
+
+#include "md4.h"
+#include "md4-mb.h"
+#include "md5.h"
+#include "md5-hmac.h"
+#include "md5-mb.h"
+#include "md5-uuid.h"
+#include "mdfiles.h"
+#include "mdprefix.h"
+#include "mdrelay.h"
+#include "mduring.h"
+
+struct algo {
+	const char *name;
+	int id;
+	void (*digest)(uint8_t [16], const void *, size_t);
+	void (*oneshot)(uint8_t [16], const void *, size_t);
+	void (*chunked)(uint8_t [16], const void *, size_t, size_t);
+	void (*vectored)(uint8_t [16], const void *, size_t, size_t);
+	void (*many)(const uint8_t *, size_t, size_t, size_t);
+	void (*shortdigest)(uint8_t [16], const void *, size_t);
+	void (*keys)(const uint8_t *, size_t, size_t);
+	void (*hmac)(const uint8_t *, size_t, size_t, int);
+	void (*nthash)(const uint8_t *, size_t, size_t, int);
+	void (*uuid)(const uint8_t *, size_t, size_t, int);
+	int (*select)(const char *);
+	int (*mb_select)(const char *);
+};
+
+struct sample {
+	double seconds;
+	uint64_t cycles;
+	uint64_t iters;
+};
+
+static const char *transform_kernels[] = { "generic", "le", "ilp", "bmi" };
+static const char *mb_kernels[] = { "scalar", "sse2", "avx2", "avx512",
+    "generic" };
+static const size_t chunk_sizes[] = { 1, 7, 64, 100, 1024, 4096, 65536 };
+
+static const char *opt_algo;
+static const char *opt_dir;
+static const char *opt_kernel;
+static size_t opt_max = (size_t)1 << 30;
+static double opt_time = 0.25;
+static int first_result = 1;
+
+static double
+now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (ts.tv_sec + ts.tv_nsec * 1e-9);
+}
+
+static uint64_t
+cycles(void)
+{
+
+#ifdef HAVE_RDTSC
+	return (__rdtsc());
+#else
+	return (0);
+#endif
+}
+
+static void
+md5_digest_ref(uint8_t digest[16], const void *data, size_t len)
+{
+	struct md5_ctx ctx;
+
+	md5_init(&ctx);
+	md5_update(&ctx, data, len);
+	md5_final(digest, &ctx);
+}
+
+static void
+md5_digest_chunked(uint8_t digest[16], const void *data, size_t len,
+    size_t chunk)
+{
+	struct md5_ctx ctx;
+	const uint8_t *p;
+	size_t n;
+
+	p = data;
+	md5_init(&ctx);
+	for (; len != 0; len -= n, p += n) {
+		n = len < chunk ? len : chunk;
+		md5_update(&ctx, p, n);
+	}
+	md5_final(digest, &ctx);
+}
+
+/*
+ * The same pieces as md5_digest_chunked, handed to md5_updatev up to 64
+ * at a time.
+ */
+static void
+md5_digest_vectored(uint8_t digest[16], const void *data, size_t len,
+    size_t chunk)
+{
+	struct md5_ctx ctx;
+	struct iovec iov[64];
+	const uint8_t *p;
+	size_t n;
+	int i;
+
+	p = data;
+	md5_init(&ctx);
+	while (len != 0) {
+		for (i = 0; i < 64 && len != 0; i++, len -= n, p += n) {
+			n = len < chunk ? len : chunk;
+			iov[i].iov_base = (void *)p;
+			iov[i].iov_len = n;
+		}
+		md5_updatev(&ctx, iov, i);
+	}
+	md5_final(digest, &ctx);
+}
+
+/*
+ * Hash count messages of len bytes taken from consecutive offsets of
+ * data[bufsize], wrapping around.
+ */
+static void
+md5_digest_many(const uint8_t *data, size_t bufsize, size_t len, size_t count)
+{
+	struct md5_mb_job jobs[256];
+	size_t i;
+	size_t n;
+
+	for (; count != 0; count -= n) {
+		n = count < 256 ? count : 256;
+		for (i = 0; i < n; i++) {
+			jobs[i].data = &data[(i * len) % (bufsize - len + 1)];
+			jobs[i].len = len;
+		}
+		md5_mb_digest(jobs, n);
+	}
+}
+
+/*
+ * Hash count keys of len bytes stored back to back at data.
+ */
+static void
+md5_digest_keys(const uint8_t *data, size_t len, size_t count)
+{
+	static uint8_t digests[256][16];
+
+	md5_mb_digest_short(digests, data, len, count);
+}
+
+/*
+ * Tag count messages of len bytes stored back to back at data under one
+ * key, one at a time or as a batch.
+ */
+static void
+md5_hmac_many(const uint8_t *data, size_t len, size_t count, int batch)
+{
+	static struct md5_hmac_key hk;
+	static const struct md5_hmac_key *keys[256];
+	static const void *msgs[256];
+	static size_t lens[256];
+	static uint8_t tags[256][16];
+	size_t i;
+
+	if (keys[0] == NULL)
+		md5_hmac_init(&hk, "key", 3);
+	for (i = 0; i < count; i++) {
+		keys[i] = &hk;
+		msgs[i] = &data[i * len];
+		lens[i] = len;
+	}
+	if (batch)
+		md5_hmac_batch(tags, keys, msgs, lens, count);
+	else {
+		for (i = 0; i < count; i++)
+			md5_hmac(tags[i], &hk, msgs[i], len);
+	}
+}
+
+/*
+ * Canonical version 3 UUIDs of count names of len bytes stored back to
+ * back at data, one at a time or as a batch.
+ */
+static void
+md5_uuid_many(const uint8_t *data, size_t len, size_t count, int batch)
+{
+	static struct md5_uuid_ns ns;
+	static const void *names[256];
+	static size_t lens[256];
+	static uint8_t uuids[256][16];
+	static char strs[256][MD5_UUID_STRLEN + 1];
+	size_t i;
+
+	if (names[0] == NULL)
+		md5_uuid_ns_init(&ns, md5_uuid_ns_url);
+	for (i = 0; i < count; i++) {
+		names[i] = &data[i * len];
+		lens[i] = len;
+	}
+	if (batch)
+		md5_uuid3_batch(uuids, &ns, names, lens, count);
+	else {
+		for (i = 0; i < count; i++)
+			md5_uuid3(uuids[i], &ns, names[i], len);
+	}
+	md5_uuid_format(strs, (const uint8_t (*)[16])uuids, count);
+}
+
+static void
+md4_digest_ref(uint8_t digest[16], const void *data, size_t len)
+{
+	struct md4_ctx ctx;
+
+	md4_init(&ctx);
+	md4_update(&ctx, data, len);
+	md4_final(digest, &ctx);
+}
+
+static void
+md4_digest_chunked(uint8_t digest[16], const void *data, size_t len,
+    size_t chunk)
+{
+	struct md4_ctx ctx;
+	const uint8_t *p;
+	size_t n;
+
+	p = data;
+	md4_init(&ctx);
+	for (; len != 0; len -= n, p += n) {
+		n = len < chunk ? len : chunk;
+		md4_update(&ctx, p, n);
+	}
+	md4_final(digest, &ctx);
+}
+
+/*
+ * The same pieces as md4_digest_chunked, handed to md4_updatev up to 64
+ * at a time.
+ */
+static void
+md4_digest_vectored(uint8_t digest[16], const void *data, size_t len,
+    size_t chunk)
+{
+	struct md4_ctx ctx;
+	struct iovec iov[64];
+	const uint8_t *p;
+	size_t n;
+	int i;
+
+	p = data;
+	md4_init(&ctx);
+	while (len != 0) {
+		for (i = 0; i < 64 && len != 0; i++, len -= n, p += n) {
+			n = len < chunk ? len : chunk;
+			iov[i].iov_base = (void *)p;
+			iov[i].iov_len = n;
+		}
+		md4_updatev(&ctx, iov, i);
+	}
+	md4_final(digest, &ctx);
+}
+
+/*
+ * NT hashes of count ASCII passwords of len characters made from data,
+ * one at a time or as a batch.
+ */
+static void
+md4_nthash_many(const uint8_t *data, size_t len, size_t count, int batch)
+{
+	static char pw[256][64];
+	static const void *pwp[256];
+	static size_t lens[256];
+	static uint8_t digests[256][16];
+	size_t i;
+	size_t j;
+
+	for (i = 0; i < count && lens[i] != len; i++) {
+		for (j = 0; j < len; j++)
+			pw[i][j] = 0x20 + data[i * len + j] % 95;
+		pwp[i] = pw[i];
+		lens[i] = len;
+	}
+	if (batch)
+		md4_mb_nthash(digests, pwp, lens, count);
+	else {
+		for (i = 0; i < count; i++)
+			md4_nthash(digests[i], pw[i], len);
+	}
+}
+
+/*
+ * Hash count messages of len bytes taken from consecutive offsets of
+ * data[bufsize], wrapping around.
+ */
+static void
+md4_digest_many(const uint8_t *data, size_t bufsize, size_t len, size_t count)
+{
+	struct md4_mb_job jobs[256];
+	size_t i;
+	size_t n;
+
+	for (; count != 0; count -= n) {
+		n = count < 256 ? count : 256;
+		for (i = 0; i < n; i++) {
+			jobs[i].data = &data[(i * len) % (bufsize - len + 1)];
+			jobs[i].len = len;
+		}
+		md4_mb_digest(jobs, n);
+	}
+}
+
+static const struct algo algos[] = {
+	{ "md5", MDFILE_MD5, md5_digest_ref, md5_digest, md5_digest_chunked,
+	    md5_digest_vectored, md5_digest_many, md5_digest_short,
+	    md5_digest_keys, md5_hmac_many, NULL, md5_uuid_many,
+	    md5_transform_select, md5_mb_select },
+	{ "md4", MDFILE_MD4, md4_digest_ref, md4_digest, md4_digest_chunked,
+	    md4_digest_vectored, md4_digest_many, NULL, NULL, NULL,
+	    md4_nthash_many, NULL, md4_transform_select, md4_mb_select },
+};
+
+static void
+report(const char *algo, const char *kernel, const char *mode, size_t size,
+    size_t chunk, size_t count, const struct sample *s)
+{
+	double bytes;
+
+	bytes = (double)size * count * s->iters;
+	printf("%s\n    {\"algo\": \"%s\", \"kernel\": \"%s\", "
+	    "\"mode\": \"%s\", \"size\": %zu, \"chunk\": %zu, "
+	    "\"messages\": %zu, \"iterations\": %llu, \"seconds\": %.6f, "
+	    "\"mb_per_s\": %.2f, \"ns_per_message\": %.2f, ",
+	    first_result ? "" : ",", algo, kernel, mode, size, chunk, count,
+	    (unsigned long long)s->iters, s->seconds,
+	    bytes / s->seconds / 1e6,
+	    s->seconds * 1e9 / ((double)count * s->iters));
+	if (s->cycles != 0 && bytes != 0)
+		printf("\"cycles_per_byte\": %.3f}", s->cycles / bytes);
+	else
+		printf("\"cycles_per_byte\": null}");
+	fflush(stdout);
+	first_result = 0;
+}
+
+/*
+ * Run one case until opt_time has passed, at least once. The clock is
+ * read between batches that double in size so reading it does not
+ * show up in the time of tiny messages.
+ */
+#define MEASURE(s, stmt) do { \
+	double t0_; \
+	uint64_t c0_; \
+	uint64_t batch_; \
+	uint64_t i_; \
+	(s).iters = 0; \
+	batch_ = 1; \
+	t0_ = now(); \
+	c0_ = cycles(); \
+	do { \
+		for (i_ = 0; i_ < batch_; i_++) \
+			stmt; \
+		(s).iters += batch_; \
+		batch_ *= 2; \
+		(s).seconds = now() - t0_; \
+	} while ((s).seconds < opt_time); \
+	(s).cycles = cycles() - c0_; \
+} while (0)
+
+static void
+bench_algo(const struct algo *a, const uint8_t *buf)
+{
+	struct mdprefix_cache cache;
+	struct sample s;
+	uint8_t digest[16];
+	size_t size;
+	size_t count;
+	size_t i;
+	size_t k;
+
+	for (k = 0; k < sizeof(transform_kernels) /
+	    sizeof(transform_kernels[0]); k++) {
+		if (opt_kernel != NULL &&
+		    strcmp(opt_kernel, transform_kernels[k]) != 0)
+			continue;
+		if (a->select(transform_kernels[k]) != 0)
+			continue;
+
+		/* Whole message with init, one update and final. */
+		for (size = 0; size <= opt_max; size = size ? size * 4 : 1) {
+			MEASURE(s, a->digest(digest, buf, size));
+			report(a->name, transform_kernels[k], "oneshot",
+			    size, 0, 1, &s);
+		}
+
+		/* The same through the context-free one-shot call. */
+		for (size = 0; size <= opt_max; size = size ? size * 4 : 1) {
+			MEASURE(s, a->oneshot(digest, buf, size));
+			report(a->name, transform_kernels[k], "digest",
+			    size, 0, 1, &s);
+		}
+
+		/* Single block messages through the fixed length kernels. */
+		for (size = 0; a->shortdigest != NULL && size <= 55 &&
+		    size <= opt_max; size += size < 16 ? 1 : 8) {
+			MEASURE(s, a->shortdigest(digest, buf, size));
+			report(a->name, transform_kernels[k], "short",
+			    size, 0, 1, &s);
+		}
+
+		/*
+		 * A 32 byte suffix after a 64 B to 4 KiB prefix, hashed whole
+		 * and from the cached context after the prefix. The chunk
+		 * field holds the prefix length.
+		 */
+		for (size = 64; size <= 4096 && size + 32 <= opt_max;
+		    size *= 4) {
+			MEASURE(s, a->oneshot(digest, buf, size + 32));
+			report(a->name, transform_kernels[k], "prefix-full",
+			    size + 32, size, 1, &s);
+			mdprefix_init(&cache, a->id);
+			MEASURE(s, mdprefix_digest(&cache, digest, buf, size,
+			    buf + size, 32));
+			report(a->name, transform_kernels[k], "prefix-cached",
+			    size + 32, size, 1, &s);
+			mdprefix_free(&cache);
+		}
+
+		/* HMAC tags of 256 messages, one at a time. */
+		for (size = 16; a->hmac != NULL && size <= 1024 &&
+		    size * 256 <= opt_max; size *= 4) {
+			count = 256;
+			MEASURE(s, a->hmac(buf, size, count, 0));
+			report(a->name, transform_kernels[k], "hmac", size, 0,
+			    count, &s);
+		}
+
+		/* NT hashes of 256 passwords, one at a time. */
+		for (size = 8; a->nthash != NULL && size <= 32 &&
+		    size * 256 <= opt_max; size *= 2) {
+			count = 256;
+			MEASURE(s, a->nthash(buf, size, count, 0));
+			report(a->name, transform_kernels[k], "nthash", size, 0,
+			    count, &s);
+		}
+
+		/* Version 3 UUIDs of 256 names, one at a time. */
+		for (size = 8; a->uuid != NULL && size <= 64 &&
+		    size * 256 <= opt_max; size *= 2) {
+			count = 256;
+			MEASURE(s, a->uuid(buf, size, count, 0));
+			report(a->name, transform_kernels[k], "uuid3", size, 0,
+			    count, &s);
+		}
+
+		/* The same 16 MiB (or less) fed in pieces. */
+		size = opt_max < ((size_t)16 << 20) ? opt_max :
+		    ((size_t)16 << 20);
+		for (i = 0; i < sizeof(chunk_sizes) / sizeof(chunk_sizes[0]);
+		    i++) {
+			MEASURE(s, a->chunked(digest, buf, size,
+			    chunk_sizes[i]));
+			report(a->name, transform_kernels[k], "chunked", size,
+			    chunk_sizes[i], 1, &s);
+			MEASURE(s, a->vectored(digest, buf, size,
+			    chunk_sizes[i]));
+			report(a->name, transform_kernels[k], "vectored", size,
+			    chunk_sizes[i], 1, &s);
+		}
+	}
+
+	/* Many independent messages through the multi-buffer engine. */
+	for (k = 0; k < sizeof(mb_kernels) / sizeof(mb_kernels[0]); k++) {
+		if (opt_kernel != NULL && strcmp(opt_kernel, mb_kernels[k]) != 0)
+			continue;
+		if (a->mb_select(mb_kernels[k]) != 0)
+			continue;
+		for (size = 16; size <= 65536 && size <= opt_max; size *= 4) {
+			count = 256;
+			MEASURE(s, a->many(buf, opt_max, size, count));
+			report(a->name, mb_kernels[k], "multibuffer", size, 0,
+			    count, &s);
+		}
+		for (size = 8; a->keys != NULL && size <= 55 &&
+		    size * 256 <= opt_max; size *= 2) {
+			count = 256;
+			MEASURE(s, a->keys(buf, size, count));
+			report(a->name, mb_kernels[k], "keys", size, 0, count,
+			    &s);
+		}
+		for (size = 16; a->hmac != NULL && size <= 1024 &&
+		    size * 256 <= opt_max; size *= 4) {
+			count = 256;
+			MEASURE(s, a->hmac(buf, size, count, 1));
+			report(a->name, mb_kernels[k], "hmac-batch", size, 0,
+			    count, &s);
+		}
+		for (size = 8; a->nthash != NULL && size <= 32 &&
+		    size * 256 <= opt_max; size *= 2) {
+			count = 256;
+			MEASURE(s, a->nthash(buf, size, count, 1));
+			report(a->name, mb_kernels[k], "nthash-batch", size, 0,
+			    count, &s);
+		}
+		for (size = 8; a->uuid != NULL && size <= 64 &&
+		    size * 256 <= opt_max; size *= 2) {
+			count = 256;
+			MEASURE(s, a->uuid(buf, size, count, 1));
+			report(a->name, mb_kernels[k], "uuid3-batch", size, 0,
+			    count, &s);
+		}
+	}
+}
+
+struct relay_end {
+	int fd;
+	const uint8_t *buf;
+	size_t len;
+};
+
+static void *
+relay_feed(void *arg)
+{
+	struct relay_end *e;
+	size_t off;
+	ssize_t n;
+
+	e = arg;
+	for (off = 0; off < e->len; off += n) {
+		if ((n = write(e->fd, e->buf + off, e->len - off)) < 0)
+			break;
+	}
+	shutdown(e->fd, SHUT_WR);
+	return (NULL);
+}
+
+static void *
+relay_drain(void *arg)
+{
+	static uint8_t sink[65536];
+	struct relay_end *e;
+
+	e = arg;
+	while (read(e->fd, sink, sizeof(sink)) > 0)
+		;
+	return (NULL);
+}
+
+/*
+ * Relay size bytes from one local socket pair to another, with a thread
+ * writing at one end and another reading at the far end.
+ */
+static void
+relay_once(const struct algo *a, const uint8_t *buf, size_t size,
+    int method)
+{
+	struct mdrelay_opts opts;
+	struct relay_end feed;
+	struct relay_end drain;
+	pthread_t ft;
+	pthread_t dt;
+	uint8_t digest[16];
+	int in[2];
+	int out[2];
+
+	if (socketpair(AF_UNIX, SOCK_STREAM, 0, in) != 0)
+		return;
+	if (socketpair(AF_UNIX, SOCK_STREAM, 0, out) != 0) {
+		close(in[0]);
+		close(in[1]);
+		return;
+	}
+	feed.fd = in[0];
+	feed.buf = buf;
+	feed.len = size;
+	drain.fd = out[1];
+	pthread_create(&ft, NULL, relay_feed, &feed);
+	pthread_create(&dt, NULL, relay_drain, &drain);
+
+	mdrelay_opts_init(&opts);
+	opts.algo = a->id;
+	opts.method = method;
+	mdrelay(digest, in[1], out[0], &opts, NULL);
+	shutdown(out[0], SHUT_WR);
+	pthread_join(ft, NULL);
+	pthread_join(dt, NULL);
+	close(in[0]);
+	close(in[1]);
+	close(out[0]);
+	close(out[1]);
+}
+
+/*
+ * Up to 16 MiB forwarded between socket pairs and hashed on the way,
+ * through the read and write loop and through splice and tee.
+ */
+static void
+bench_relay(const struct algo *a, const uint8_t *buf)
+{
+	struct sample s;
+	size_t size;
+
+	size = opt_max < ((size_t)16 << 20) ? opt_max : ((size_t)16 << 20);
+	MEASURE(s, relay_once(a, buf, size, MDRELAY_COPY));
+	report(a->name, "none", "relay-copy", size, MDRELAY_BUFSIZE, 1, &s);
+	MEASURE(s, relay_once(a, buf, size, MDRELAY_SPLICE));
+	report(a->name, "none", "relay-splice", size, MDRELAY_BUFSIZE, 1,
+	    &s);
+}
+
+static void
+count_file(const struct mdfiles_result *r, void *arg)
+{
+
+	*(uint64_t *)arg += r->size;
+}
+
+static void
+report_files(const char *algo, const char *mode, long threads, size_t files,
+    uint64_t bytes, const struct sample *s)
+{
+
+	printf("%s\n    {\"algo\": \"%s\", \"mode\": \"%s\", "
+	    "\"threads\": %ld, \"files\": %zu, \"bytes\": %llu, "
+	    "\"iterations\": %llu, \"seconds\": %.6f, "
+	    "\"mb_per_s\": %.2f, \"files_per_s\": %.0f}",
+	    first_result ? "" : ",", algo, mode, threads, files,
+	    (unsigned long long)bytes, (unsigned long long)s->iters,
+	    s->seconds, (double)bytes * s->iters / s->seconds / 1e6,
+	    (double)files * s->iters / s->seconds);
+	fflush(stdout);
+	first_result = 0;
+}
+
+/*
+ * Hash the files under opt_dir with more and more threads, then from
+ * one thread through io_uring and through its pread fallback.
+ */
+static void
+bench_files(const struct algo *a, const struct mdfiles_list *list)
+{
+	struct mduring_opts uring;
+	struct mdfiles_opts opts;
+	struct sample s;
+	uint64_t bytes;
+	uint64_t sink;
+	long ncpu;
+	long n;
+
+	mdfiles_opts_init(&opts);
+	opts.algo = mdfile_algo(a->name);
+	bytes = 0;
+	mdfiles_hash_list(list, &opts, count_file, &bytes);
+
+	ncpu = sysconf(_SC_NPROCESSORS_ONLN);
+	if (ncpu < 1)
+		ncpu = 1;
+	for (n = 1;; n *= 2) {
+		if (n > ncpu)
+			n = ncpu;
+		opts.nthreads = n;
+		MEASURE(s, mdfiles_hash_list(list, &opts, count_file, &sink));
+		report_files(a->name, "files", n, list->n, bytes, &s);
+		if (n == ncpu)
+			break;
+	}
+
+	mduring_opts_init(&uring);
+	uring.algo = opts.algo;
+	uring.ordered = 0;
+	if (mduring_available()) {
+		MEASURE(s, mduring_hash((const char *const *)list->paths,
+		    list->n, &uring, count_file, &sink));
+		report_files(a->name, "uring", 1, list->n, bytes, &s);
+	}
+	uring.pread = 1;
+	MEASURE(s, mduring_hash((const char *const *)list->paths, list->n,
+	    &uring, count_file, &sink));
+	report_files(a->name, "pread", 1, list->n, bytes, &s);
+}
+
+static void
+usage(void)
+{
+
+	fprintf(stderr, "usage: mdbench [-a md5|md4] [-d dir] [-k kernel] "
+	    "[-m maxsize] [-t seconds]\n");
+	exit(1);
+}
+
+int
+main(int argc, char **argv)
+{
+	struct mdfiles_list list;
+	uint8_t *buf;
+	size_t i;
+	int ch;
+
+	while ((ch = getopt(argc, argv, "a:d:k:m:t:")) != -1) {
+		switch (ch) {
+		case 'a':
+			opt_algo = optarg;
+			break;
+		case 'd':
+			opt_dir = optarg;
+			break;
+		case 'k':
+			opt_kernel = optarg;
+			break;
+		case 'm':
+			opt_max = strtoull(optarg, NULL, 0);
+			break;
+		case 't':
+			opt_time = strtod(optarg, NULL);
+			break;
+		default:
+			usage();
+		}
+	}
+	if (opt_max == 0)
+		usage();
+
+	if ((buf = malloc(opt_max)) == NULL) {
+		fprintf(stderr, "mdbench: cannot allocate %zu bytes\n", opt_max);
+		exit(1);
+	}
+	for (i = 0; i < opt_max; i++)
+		buf[i] = (i * 131 + 7) & 0xff;
+
+	printf("{\n  \"timer\": \"%s\",\n  \"results\": [",
+#ifdef HAVE_RDTSC
+	    "rdtsc"
+#else
+	    "none"
+#endif
+	    );
+	memset(&list, 0, sizeof(list));
+	if (opt_dir != NULL && mdfiles_list_add(&list, opt_dir) != 0) {
+		fprintf(stderr, "mdbench: cannot list %s\n", opt_dir);
+		exit(1);
+	}
+	for (i = 0; i < sizeof(algos) / sizeof(algos[0]); i++) {
+		if (opt_algo != NULL && strcmp(opt_algo, algos[i].name) != 0)
+			continue;
+		bench_algo(&algos[i], buf);
+		bench_relay(&algos[i], buf);
+		if (opt_dir != NULL)
+			bench_files(&algos[i], &list);
+	}
+	printf("\n  ]\n}\n");
+	mdfiles_list_free(&list);
+
+	free(buf);
+	return 0;
+}
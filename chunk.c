@@ -0,0 +1,178 @@
+/*-
+ * Copyright (c) 2023, Collin Funk
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHORS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * Cut files into content-defined chunks and print one line per chunk
+ * with its digest, offset and length. Chunks of all the files go into
+ * one index, and -v reports how many were repeats. No file or "-" is
+ * standard input.
+ *
+ * usage: mdchunk [-qv] [-a md5|md4] [-j threads] [-s avgsize] [file ...]
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "mdchunk.h"
+#include "mdfile.h"
+
+struct chunk_file {
+	const char *name;
+	struct mdchunk_index *idx;
+	int quiet;
+};
+
+static void
+usage(void)
+{
+
+	fprintf(stderr, "usage: mdchunk [-qv] [-a md5|md4] [-j threads] "
+	    "[-s avgsize] [file ...]\n");
+	exit(1);
+}
+
+static uint64_t
+parse_size(const char *arg)
+{
+	uint64_t n;
+
+	if (mdfile_size(&n, arg, SIZE_MAX) != 0 || n == 0)
+		usage();
+	return (n);
+}
+
+static int
+print_chunks(const struct mdchunk *chunks, size_t n, void *arg)
+{
+	struct chunk_file *f;
+	size_t i;
+	int j;
+
+	f = arg;
+	for (i = 0; i < n; i++) {
+		if (mdchunk_index_add(f->idx, chunks[i].digest,
+		    chunks[i].len) < 0)
+			return (-1);
+		if (f->quiet)
+			continue;
+		for (j = 0; j < 16; j++)
+			printf("%02x", chunks[i].digest[j]);
+		printf(" %llu %zu  %s\n", (unsigned long long)chunks[i].offset,
+		    chunks[i].len, f->name);
+	}
+	return (0);
+}
+
+int
+main(int argc, char **argv)
+{
+	struct mdchunk_index idx;
+	struct mdchunk_opts opts;
+	struct chunk_file f;
+	const char *path;
+	char *end;
+	int verbose;
+	int ret;
+	int ch;
+	int fd;
+	int i;
+
+	mdchunk_opts_init(&opts);
+	memset(&f, 0, sizeof(f));
+	verbose = 0;
+	while ((ch = getopt(argc, argv, "a:j:qs:v")) != -1) {
+		switch (ch) {
+		case 'a':
+			if ((opts.algo = mdfile_algo(optarg)) < 0)
+				usage();
+			break;
+		case 'j':
+			opts.nthreads = strtol(optarg, &end, 10);
+			if (*end != '\0' || opts.nthreads < 0)
+				usage();
+			break;
+		case 'q':
+			f.quiet = 1;
+			break;
+		case 's':
+			opts.avg = parse_size(optarg);
+			opts.min = opts.avg / 4;
+			opts.max = opts.avg * 8;
+			break;
+		case 'v':
+			verbose = 1;
+			break;
+		default:
+			usage();
+		}
+	}
+	argc -= optind;
+	argv += optind;
+
+	if (mdchunk_index_init(&idx, 0) != 0) {
+		fprintf(stderr, "mdchunk: %s\n", strerror(errno));
+		return (1);
+	}
+	f.idx = &idx;
+	ret = 0;
+	for (i = 0; i < (argc == 0 ? 1 : argc); i++) {
+		path = argc == 0 ? "-" : argv[i];
+		f.name = path;
+		if (strcmp(path, "-") == 0)
+			fd = STDIN_FILENO;
+		else if ((fd = open(path, O_RDONLY)) < 0) {
+			fprintf(stderr, "mdchunk: %s: %s\n", path,
+			    strerror(errno));
+			ret = 1;
+			continue;
+		}
+		if (mdchunk_fd(fd, &opts, print_chunks, &f) != 0) {
+			fprintf(stderr, "mdchunk: %s: %s\n", path,
+			    strerror(errno));
+			ret = 1;
+		}
+		if (fd != STDIN_FILENO)
+			close(fd);
+	}
+
+	if (verbose) {
+		fprintf(stderr, "%llu chunks, %zu distinct, %llu bytes, "
+		    "%llu distinct bytes, dedup ratio %.2f\n",
+		    (unsigned long long)idx.chunks, idx.used,
+		    (unsigned long long)idx.bytes,
+		    (unsigned long long)idx.unique,
+		    idx.unique != 0 ? (double)idx.bytes / idx.unique : 1.0);
+	}
+	mdchunk_index_free(&idx);
+
+	return (ret);
+}
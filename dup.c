@@ -0,0 +1,167 @@
+/*-
+ * Copyright (c) 2023, Collin Funk
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHORS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * Print the sets of identical files under the given paths, one file per
+ * line in the format of md5sum with a blank line between sets, largest
+ * files first.
+ *
+ * usage: mddup [-v] [-a md5|md4] [-C cache] [-e edge] [-j threads]
+ *              [-m minsize] path ...
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <errno.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "mddup.h"
+#include "mdfile.h"
+#include "mdfiles.h"
+
+static void
+usage(void)
+{
+
+	fprintf(stderr, "usage: mddup [-v] [-a md5|md4] [-C cache] "
+	    "[-e edge] [-j threads]\n"
+	    "             [-m minsize] path ...\n");
+	exit(1);
+}
+
+static uint64_t
+parse_size(const char *arg, int zero)
+{
+	uint64_t n;
+
+	if (mdfile_size(&n, arg, SIZE_MAX) != 0 || (n == 0 && !zero))
+		usage();
+	return (n);
+}
+
+static void
+print_set(struct mddup_file *const set[], size_t n, void *arg)
+{
+	int *nsets;
+	size_t i;
+	int j;
+
+	nsets = arg;
+	if ((*nsets)++ != 0)
+		printf("\n");
+	for (i = 0; i < n; i++) {
+		for (j = 0; j < 16; j++)
+			printf("%02x", set[i]->digest[j]);
+		printf("  %s\n", set[i]->path);
+	}
+}
+
+static void
+print_error(const struct mddup_file *f, void *arg)
+{
+
+	(void)arg;
+	fprintf(stderr, "mddup: %s: %s\n", f->path, strerror(f->error));
+}
+
+int
+main(int argc, char **argv)
+{
+	struct mdfiles_list list;
+	struct mddup_stats stats;
+	struct mddup_opts opts;
+	char *end;
+	int verbose;
+	int nsets;
+	int ret;
+	int ch;
+	int i;
+
+	mddup_opts_init(&opts);
+	opts.error = print_error;
+	verbose = 0;
+	while ((ch = getopt(argc, argv, "a:C:e:j:m:v")) != -1) {
+		switch (ch) {
+		case 'a':
+			if ((opts.algo = mdfile_algo(optarg)) < 0)
+				usage();
+			break;
+		case 'C':
+			opts.cache = optarg;
+			break;
+		case 'e':
+			opts.edge = parse_size(optarg, 0);
+			break;
+		case 'j':
+			opts.nthreads = strtol(optarg, &end, 10);
+			if (*end != '\0' || opts.nthreads < 0)
+				usage();
+			break;
+		case 'm':
+			opts.minsize = parse_size(optarg, 1);
+			break;
+		case 'v':
+			verbose = 1;
+			break;
+		default:
+			usage();
+		}
+	}
+	argc -= optind;
+	argv += optind;
+	if (argc == 0)
+		usage();
+
+	memset(&list, 0, sizeof(list));
+	for (i = 0; i < argc; i++) {
+		if (mdfiles_list_add(&list, argv[i]) != 0) {
+			fprintf(stderr, "mddup: %s\n", strerror(errno));
+			return (1);
+		}
+	}
+
+	nsets = 0;
+	ret = mddup_find((const char *const *)list.paths, list.n, &opts,
+	    print_set, &nsets, &stats);
+	if (ret < 0)
+		fprintf(stderr, "mddup: %s\n", strerror(errno));
+	if (verbose) {
+		fprintf(stderr, "%zu files, %zu links, %zu failed, "
+		    "%zu ends read, %zu read whole, %zu from cache\n"
+		    "%zu sets, %zu duplicates, %llu bytes wasted, "
+		    "%llu bytes read\n", stats.files, stats.links,
+		    stats.failed, stats.edged, stats.hashed, stats.cached,
+		    stats.sets, stats.dups,
+		    (unsigned long long)stats.wasted,
+		    (unsigned long long)stats.bytes);
+	}
+	mdfiles_list_free(&list);
+
+	return (ret != 0);
+}
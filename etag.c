@@ -0,0 +1,153 @@
+/*-
+ * Copyright (c) 2023, Collin Funk
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHORS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * Print the S3 ETag each file would get if uploaded in parts, or with -c
+ * check one file against a known ETag, working out the part size.
+ *
+ * usage: mdetag [-j threads] [-p partsize] [-t threshold] [file ...]
+ *        mdetag [-j threads] -c etag file
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "mdetag.h"
+#include "mdfile.h"
+
+static void
+usage(void)
+{
+
+	fprintf(stderr, "usage: mdetag [-j threads] [-p partsize] "
+	    "[-t threshold] [file ...]\n"
+	    "       mdetag [-j threads] -c etag file\n");
+	exit(1);
+}
+
+static size_t
+parse_size(const char *arg, int zero)
+{
+	uint64_t n;
+
+	if (mdfile_size(&n, arg, SIZE_MAX) != 0 || (n == 0 && !zero))
+		usage();
+	return (n);
+}
+
+static int
+check(const char *etag, const char *path, int nthreads)
+{
+	size_t partsize;
+	int fd;
+	int ret;
+
+	if (strcmp(path, "-") == 0)
+		fd = STDIN_FILENO;
+	else if ((fd = open(path, O_RDONLY)) < 0) {
+		fprintf(stderr, "mdetag: %s: %s\n", path, strerror(errno));
+		return (1);
+	}
+	ret = mdetag_check(fd, etag, nthreads, &partsize);
+	if (ret < 0)
+		fprintf(stderr, "mdetag: %s: %s\n", path, strerror(errno));
+	else if (ret > 0)
+		printf("%s: FAILED\n", path);
+	else if (partsize == 0)
+		printf("%s: OK (single part)\n", path);
+	else
+		printf("%s: OK (part size %zu)\n", path, partsize);
+	if (fd != STDIN_FILENO)
+		close(fd);
+
+	return (ret != 0);
+}
+
+int
+main(int argc, char **argv)
+{
+	struct mdetag_opts opts;
+	char etag[MDETAG_MAX];
+	const char *expected;
+	const char *name;
+	char *end;
+	int ret;
+	int ch;
+	int i;
+
+	mdetag_opts_init(&opts);
+	expected = NULL;
+	while ((ch = getopt(argc, argv, "c:j:p:t:")) != -1) {
+		switch (ch) {
+		case 'c':
+			expected = optarg;
+			break;
+		case 'j':
+			opts.nthreads = strtol(optarg, &end, 10);
+			if (*end != '\0' || opts.nthreads < 0)
+				usage();
+			break;
+		case 'p':
+			opts.partsize = parse_size(optarg, 0);
+			break;
+		case 't':
+			opts.threshold = parse_size(optarg, 1);
+			break;
+		default:
+			usage();
+		}
+	}
+	argc -= optind;
+	argv += optind;
+
+	if (expected != NULL) {
+		if (argc != 1)
+			usage();
+		return (check(expected, argv[0], opts.nthreads));
+	}
+
+	ret = 0;
+	for (i = 0; i < argc || (i == 0 && argc == 0); i++) {
+		name = argc == 0 ? "-" : argv[i];
+		if ((strcmp(name, "-") == 0 ?
+		    mdetag_fd(etag, STDIN_FILENO, &opts) :
+		    mdetag_path(etag, name, &opts)) != 0) {
+			fprintf(stderr, "mdetag: %s: %s\n", name,
+			    strerror(errno));
+			ret = 1;
+			continue;
+		}
+		printf("%s  %s\n", etag, name);
+	}
+
+	return (ret);
+}
@@ -0,0 +1,222 @@
+/*-
+ * Copyright (c) 2023, Collin Funk
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHORS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * Build a database of known digests from reference lists, and triage
+ * files against one: the unknown files are printed in the format of
+ * md5sum, or the known ones with -k. A list that is missing or "-" is
+ * standard input.
+ *
+ * usage: mdknown [-v] [-a md5|md4] [-b bits] build db [list ...]
+ *        mdknown [-kv] [-j threads] check db path ...
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <errno.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "mdfile.h"
+#include "mdfiles.h"
+#include "mdknown.h"
+
+struct triage {
+	int want; /* Print files whose known flag is this */
+	int failed;
+};
+
+static void
+usage(void)
+{
+
+	fprintf(stderr, "usage: mdknown [-v] [-a md5|md4] [-b bits] "
+	    "build db [list ...]\n"
+	    "       mdknown [-kv] [-j threads] check db path ...\n");
+	exit(1);
+}
+
+static int
+build(const char *db, int algo, unsigned bits, char **lists, int n,
+    int verbose)
+{
+	struct mdknown_list list;
+	FILE *fp;
+	int ret;
+	int i;
+
+	memset(&list, 0, sizeof(list));
+	ret = 0;
+	for (i = 0; i < (n == 0 ? 1 : n); i++) {
+		if (n == 0 || strcmp(lists[i], "-") == 0)
+			fp = stdin;
+		else if ((fp = fopen(lists[i], "r")) == NULL) {
+			fprintf(stderr, "mdknown: %s: %s\n", lists[i],
+			    strerror(errno));
+			ret = 1;
+			break;
+		}
+		if (mdknown_parse(&list, fp) != 0) {
+			fprintf(stderr, "mdknown: %s: %s\n",
+			    fp == stdin ? "-" : lists[i], strerror(errno));
+			ret = 1;
+		}
+		if (fp != stdin)
+			fclose(fp);
+		if (ret != 0)
+			break;
+	}
+
+	if (ret == 0 && mdknown_write(db, algo, &list, bits) != 0) {
+		fprintf(stderr, "mdknown: %s: %s\n", db, strerror(errno));
+		ret = 1;
+	}
+	if (ret == 0 && verbose)
+		fprintf(stderr, "%zu digests, %zu lines without one\n",
+		    list.n, list.invalid);
+	mdknown_list_free(&list);
+
+	return (ret);
+}
+
+static void
+print_file(const struct mdfiles_result *r, int known, void *arg)
+{
+	struct triage *t;
+	int i;
+
+	t = arg;
+	if (r->error != 0) {
+		fprintf(stderr, "mdknown: %s: %s\n", r->path,
+		    strerror(r->error));
+		t->failed = 1;
+		return;
+	}
+	if (known != t->want)
+		return;
+	for (i = 0; i < 16; i++)
+		printf("%02x", r->digest[i]);
+	printf("  %s\n", r->path);
+}
+
+static int
+check(const char *db, int nthreads, int want, char **paths, int n,
+    int verbose)
+{
+	struct mdknown_stats stats;
+	struct mdfiles_list list;
+	struct mdfiles_opts opts;
+	struct mdknown known;
+	struct triage t;
+	int ret;
+	int i;
+
+	if (mdknown_open(&known, db) != 0) {
+		fprintf(stderr, "mdknown: %s: %s\n", db, strerror(errno));
+		return (1);
+	}
+	memset(&list, 0, sizeof(list));
+	for (i = 0; i < n; i++) {
+		if (mdfiles_list_add(&list, paths[i]) != 0) {
+			fprintf(stderr, "mdknown: %s\n", strerror(errno));
+			mdknown_close(&known);
+			return (1);
+		}
+	}
+
+	mdfiles_opts_init(&opts);
+	opts.nthreads = nthreads;
+	t.want = want;
+	t.failed = 0;
+	ret = mdknown_check(&known, (const char *const *)list.paths, list.n,
+	    &opts, print_file, &t, &stats);
+	if (ret != 0)
+		fprintf(stderr, "mdknown: %s\n", strerror(errno));
+	if (verbose)
+		fprintf(stderr, "%zu known, %zu unknown, %zu unreadable\n",
+		    stats.known, stats.unknown, stats.unreadable);
+	mdfiles_list_free(&list);
+	mdknown_close(&known);
+
+	return (ret != 0 || t.failed);
+}
+
+int
+main(int argc, char **argv)
+{
+	unsigned long bits;
+	char *end;
+	int nthreads;
+	int verbose;
+	int want;
+	int algo;
+	int ch;
+
+	algo = MDFILE_MD5;
+	bits = 0;
+	nthreads = 0;
+	verbose = 0;
+	want = 0;
+	while ((ch = getopt(argc, argv, "a:b:j:kv")) != -1) {
+		switch (ch) {
+		case 'a':
+			if ((algo = mdfile_algo(optarg)) < 0)
+				usage();
+			break;
+		case 'b':
+			bits = strtoul(optarg, &end, 10);
+			if (*end != '\0' || bits == 0 || bits > 64)
+				usage();
+			break;
+		case 'j':
+			nthreads = strtol(optarg, &end, 10);
+			if (*end != '\0' || nthreads < 0)
+				usage();
+			break;
+		case 'k':
+			want = 1;
+			break;
+		case 'v':
+			verbose = 1;
+			break;
+		default:
+			usage();
+		}
+	}
+	argc -= optind;
+	argv += optind;
+
+	if (argc >= 2 && strcmp(argv[0], "build") == 0)
+		return (build(argv[1], algo, bits, argv + 2, argc - 2,
+		    verbose));
+	if (argc >= 3 && strcmp(argv[0], "check") == 0)
+		return (check(argv[1], nthreads, want, argv + 2, argc - 2,
+		    verbose));
+	usage();
+	return (1);
+}
@@ -0,0 +1,146 @@
+/*-
+ * Copyright (c) 2023, Collin Funk
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHORS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * Lane-parallel MD4 compression function. This file is included by
+ * md4-mb.c once per instruction set with the following defined:
+ *
+ *   MB_FN     Name of the kernel.
+ *   MB_VEC    Name of the vector type to declare.
+ *   MB_LANES  Number of 32-bit lanes in MB_VEC.
+ *   MB_ATTR   Function attributes, e.g. the target instruction set.
+ *   MB_LOAD   Statement setting x[i] to word i of every lane's block
+ *             at byte offset off.
+ *
+ * Lane l compresses nblocks consecutive blocks starting at data[l]
+ * into state[l]. Every lane advances by the same number of blocks.
+ */
+
+typedef uint32_t MB_VEC __attribute__((vector_size(MB_LANES * 4)));
+
+MB_ATTR static void
+MB_FN(uint32_t *const state[], const uint8_t *const data[], size_t nblocks)
+{
+	MB_VEC a;
+	MB_VEC b;
+	MB_VEC c;
+	MB_VEC d;
+	MB_VEC aa;
+	MB_VEC bb;
+	MB_VEC cc;
+	MB_VEC dd;
+	MB_VEC x[16];
+	size_t off;
+	int l;
+
+	a = b = c = d = (MB_VEC){ 0 };
+	for (l = 0; l < MB_LANES; l++) {
+		a[l] = state[l][0];
+		b[l] = state[l][1];
+		c[l] = state[l][2];
+		d[l] = state[l][3];
+	}
+
+	for (off = 0; off < nblocks * 64; off += 64) {
+		/* Transpose word i of every lane into x[i]. */
+		MB_LOAD(x, data, off);
+
+		aa = a;
+		bb = b;
+		cc = c;
+		dd = d;
+
+		/* Round 1 */
+		R1(a, b, c, d, x[ 0],  3);
+		R1(d, a, b, c, x[ 1],  7);
+		R1(c, d, a, b, x[ 2], 11);
+		R1(b, c, d, a, x[ 3], 19);
+		R1(a, b, c, d, x[ 4],  3);
+		R1(d, a, b, c, x[ 5],  7);
+		R1(c, d, a, b, x[ 6], 11);
+		R1(b, c, d, a, x[ 7], 19);
+		R1(a, b, c, d, x[ 8],  3);
+		R1(d, a, b, c, x[ 9],  7);
+		R1(c, d, a, b, x[10], 11);
+		R1(b, c, d, a, x[11], 19);
+		R1(a, b, c, d, x[12],  3);
+		R1(d, a, b, c, x[13],  7);
+		R1(c, d, a, b, x[14], 11);
+		R1(b, c, d, a, x[15], 19);
+
+		/* Round 2 */
+		R2(a, b, c, d, x[ 0],  3);
+		R2(d, a, b, c, x[ 4],  5);
+		R2(c, d, a, b, x[ 8],  9);
+		R2(b, c, d, a, x[12], 13);
+		R2(a, b, c, d, x[ 1],  3);
+		R2(d, a, b, c, x[ 5],  5);
+		R2(c, d, a, b, x[ 9],  9);
+		R2(b, c, d, a, x[13], 13);
+		R2(a, b, c, d, x[ 2],  3);
+		R2(d, a, b, c, x[ 6],  5);
+		R2(c, d, a, b, x[10], 9);
+		R2(b, c, d, a, x[14], 13);
+		R2(a, b, c, d, x[ 3],  3);
+		R2(d, a, b, c, x[ 7],  5);
+		R2(c, d, a, b, x[11],  9);
+		R2(b, c, d, a, x[15], 13);
+
+		/* Round 3 */
+		R3(a, b, c, d, x[ 0],  3);
+		R3(d, a, b, c, x[ 8],  9);
+		R3(c, d, a, b, x[ 4], 11);
+		R3(b, c, d, a, x[12], 15);
+		R3(a, b, c, d, x[ 2],  3);
+		R3(d, a, b, c, x[10],  9);
+		R3(c, d, a, b, x[ 6], 11);
+		R3(b, c, d, a, x[14], 15);
+		R3(a, b, c, d, x[ 1],  3);
+		R3(d, a, b, c, x[ 9],  9);
+		R3(c, d, a, b, x[ 5], 11);
+		R3(b, c, d, a, x[13], 15);
+		R3(a, b, c, d, x[ 3],  3);
+		R3(d, a, b, c, x[11],  9);
+		R3(c, d, a, b, x[ 7], 11);
+		R3(b, c, d, a, x[15], 15);
+
+		a += aa;
+		b += bb;
+		c += cc;
+		d += dd;
+	}
+
+	for (l = 0; l < MB_LANES; l++) {
+		state[l][0] = a[l];
+		state[l][1] = b[l];
+		state[l][2] = c[l];
+		state[l][3] = d[l];
+	}
+
+	/*
+	 * Zero out x.
+	 */
+	memset(x, 0, sizeof(x));
+}
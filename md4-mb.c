@@ -0,0 +1,759 @@
+/*-
+ * Copyright (c) 2023, Collin Funk
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHORS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "md4.h"
+#include "md4-mb.h"
+
+#ifdef __GNUC__
+#define MD4_MB_LOAD(p) __atomic_load_n((p), __ATOMIC_ACQUIRE)
+#define MD4_MB_STORE(p, v) __atomic_store_n((p), (v), __ATOMIC_RELEASE)
+#else
+#define MD4_MB_LOAD(p) (*(p))
+#define MD4_MB_STORE(p, v) (*(p) = (v))
+#endif
+
+/*
+ * Round functions. These are the same as in md4.c but are applied to
+ * vectors holding one 32-bit word per lane.
+ */
+#define R1(a, b, c, d, data, shift) do { \
+	(a) += (((b) & (c)) | ((~b) & (d))) + (data); \
+	(a) = (((a) << shift) | ((a) >> (32 - (shift)))); \
+} while (0)
+
+#define R2(a, b, c, d, data, shift) do { \
+	(a) += (((b) & (c)) | ((b) & (d)) | ((c) & (d))) + (data) + \
+		0x5a827999; \
+	(a) = (((a) << shift) | ((a) >> (32 - (shift)))); \
+} while (0)
+
+#define R3(a, b, c, d, data, shift) do { \
+	(a) += ((b) ^ (c) ^ (d)) + (data) + 0x6ed9eba1; \
+	(a) = (((a) << shift) | ((a) >> (32 - (shift)))); \
+} while (0)
+
+#define MB_LOAD32(p) \
+	((uint32_t)(p)[0] | ((uint32_t)(p)[1] << 8) | \
+	((uint32_t)(p)[2] << 16) | ((uint32_t)(p)[3] << 24))
+
+typedef void md4_mb_fn(uint32_t *const [], const uint8_t *const [], size_t);
+
+struct md4_mb_kernel {
+	const char *name;
+	int lanes;
+	md4_mb_fn *fn;
+	int (*supported)(void);
+};
+
+/*
+ * Kernels are built from md4-mb-kernel.h using GCC vector extensions.
+ * On x86 each width is compiled for its own instruction set and picked
+ * at runtime, elsewhere a single 4 lane kernel is left to the compiler.
+ * Compilers without vector extensions only get the scalar path.
+ */
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+
+#include <immintrin.h>
+
+/*
+ * The loads below gather the same 16 bytes from four lanes and do a
+ * 4x4 transpose inside each 128-bit half, so a group of four words of
+ * every lane costs four loads per 128 bits instead of one per word.
+ */
+#define MB_TRANSPOSE4(op, t, r, x) do { \
+	(t)[0] = op##unpacklo_epi32((r)[0], (r)[1]); \
+	(t)[1] = op##unpackhi_epi32((r)[0], (r)[1]); \
+	(t)[2] = op##unpacklo_epi32((r)[2], (r)[3]); \
+	(t)[3] = op##unpackhi_epi32((r)[2], (r)[3]); \
+	(x)[0] = op##unpacklo_epi64((t)[0], (t)[2]); \
+	(x)[1] = op##unpackhi_epi64((t)[0], (t)[2]); \
+	(x)[2] = op##unpacklo_epi64((t)[1], (t)[3]); \
+	(x)[3] = op##unpackhi_epi64((t)[1], (t)[3]); \
+} while (0)
+
+__attribute__((target("sse2"))) static inline void
+md4_mb_load_sse2(__m128i x[16], const uint8_t *const data[], size_t off)
+{
+	__m128i r[4];
+	__m128i t[4];
+	int g;
+	int q;
+
+	for (g = 0; g < 4; g++) {
+		for (q = 0; q < 4; q++) {
+			r[q] = _mm_loadu_si128((const __m128i *)
+			    (data[q] + off + 16 * g));
+		}
+		MB_TRANSPOSE4(_mm_, t, r, &x[4 * g]);
+	}
+}
+
+__attribute__((target("avx2"))) static inline void
+md4_mb_load_avx2(__m256i x[16], const uint8_t *const data[], size_t off)
+{
+	__m256i r[4];
+	__m256i t[4];
+	int g;
+	int q;
+
+	for (g = 0; g < 4; g++) {
+		for (q = 0; q < 4; q++) {
+			r[q] = _mm256_loadu2_m128i(
+			    (const __m128i *)(data[q + 4] + off + 16 * g),
+			    (const __m128i *)(data[q] + off + 16 * g));
+		}
+		MB_TRANSPOSE4(_mm256_, t, r, &x[4 * g]);
+	}
+}
+
+__attribute__((target("avx512f"))) static inline void
+md4_mb_load_avx512(__m512i x[16], const uint8_t *const data[], size_t off)
+{
+	__m512i r[4];
+	__m512i t[4];
+	int g;
+	int q;
+
+	for (g = 0; g < 4; g++) {
+		for (q = 0; q < 4; q++) {
+			r[q] = _mm512_castsi128_si512(_mm_loadu_si128(
+			    (const __m128i *)(data[q] + off + 16 * g)));
+			r[q] = _mm512_inserti32x4(r[q], _mm_loadu_si128(
+			    (const __m128i *)(data[q + 4] + off + 16 * g)), 1);
+			r[q] = _mm512_inserti32x4(r[q], _mm_loadu_si128(
+			    (const __m128i *)(data[q + 8] + off + 16 * g)), 2);
+			r[q] = _mm512_inserti32x4(r[q], _mm_loadu_si128(
+			    (const __m128i *)(data[q + 12] + off + 16 * g)), 3);
+		}
+		MB_TRANSPOSE4(_mm512_, t, r, &x[4 * g]);
+	}
+}
+
+#define MB_FN md4_mb_x4_sse2
+#define MB_VEC md4_mb_v4
+#define MB_LANES 4
+#define MB_ATTR __attribute__((target("sse2")))
+#define MB_LOAD(x, data, off) md4_mb_load_sse2((__m128i *)(x), data, off)
+#include "md4-mb-kernel.h"
+#undef MB_FN
+#undef MB_VEC
+#undef MB_LANES
+#undef MB_ATTR
+#undef MB_LOAD
+
+#define MB_FN md4_mb_x8_avx2
+#define MB_VEC md4_mb_v8
+#define MB_LANES 8
+#define MB_ATTR __attribute__((target("avx2")))
+#define MB_LOAD(x, data, off) md4_mb_load_avx2((__m256i *)(x), data, off)
+#include "md4-mb-kernel.h"
+#undef MB_FN
+#undef MB_VEC
+#undef MB_LANES
+#undef MB_ATTR
+#undef MB_LOAD
+
+#define MB_FN md4_mb_x16_avx512
+#define MB_VEC md4_mb_v16
+#define MB_LANES 16
+#define MB_ATTR __attribute__((target("avx512f")))
+#define MB_LOAD(x, data, off) md4_mb_load_avx512((__m512i *)(x), data, off)
+#include "md4-mb-kernel.h"
+#undef MB_FN
+#undef MB_VEC
+#undef MB_LANES
+#undef MB_ATTR
+#undef MB_LOAD
+
+static int
+md4_mb_has_sse2(void)
+{
+
+	return (__builtin_cpu_supports("sse2"));
+}
+
+static int
+md4_mb_has_avx2(void)
+{
+
+	return (__builtin_cpu_supports("avx2"));
+}
+
+static int
+md4_mb_has_avx512(void)
+{
+
+	return (__builtin_cpu_supports("avx512f"));
+}
+
+static const struct md4_mb_kernel md4_mb_kernels[] = {
+	{ "sse2", 4, md4_mb_x4_sse2, md4_mb_has_sse2 },
+	{ "avx2", 8, md4_mb_x8_avx2, md4_mb_has_avx2 },
+	{ "avx512", 16, md4_mb_x16_avx512, md4_mb_has_avx512 },
+	{ NULL, 0, NULL, NULL }
+};
+
+#elif defined(__GNUC__)
+
+#define MB_FN md4_mb_x4_generic
+#define MB_VEC md4_mb_v4
+#define MB_LANES 4
+#define MB_ATTR
+#define MB_LOAD(x, data, off) do { \
+	for (int i_ = 0; i_ < 16; i_++) { \
+		for (int l_ = 0; l_ < MB_LANES; l_++) \
+			(x)[i_][l_] = MB_LOAD32((data)[l_] + (off) + 4 * i_); \
+	} \
+} while (0)
+#include "md4-mb-kernel.h"
+#undef MB_FN
+#undef MB_VEC
+#undef MB_LANES
+#undef MB_ATTR
+#undef MB_LOAD
+
+static int
+md4_mb_has_generic(void)
+{
+
+	return (1);
+}
+
+static const struct md4_mb_kernel md4_mb_kernels[] = {
+	{ "generic", 4, md4_mb_x4_generic, md4_mb_has_generic },
+	{ NULL, 0, NULL, NULL }
+};
+
+#else
+
+static const struct md4_mb_kernel md4_mb_kernels[] = {
+	{ NULL, 0, NULL, NULL }
+};
+
+#endif
+
+static void
+md4_mb_encode(uint8_t digest[16], const uint32_t state[4])
+{
+	int i;
+
+	for (i = 0; i < 4; i++) {
+		digest[4 * i + 0] = (state[i]) & 0xff;
+		digest[4 * i + 1] = (state[i] >> 8) & 0xff;
+		digest[4 * i + 2] = (state[i] >> 16) & 0xff;
+		digest[4 * i + 3] = (state[i] >> 24) & 0xff;
+	}
+}
+
+/*
+ * Pick the narrowest kernel of at most nlanes lanes that covers nactive
+ * lanes. A single lane is cheaper to run through md4_transform_blocks.
+ */
+static const struct md4_mb_kernel *
+md4_mb_pick(int nlanes, int nactive)
+{
+	const struct md4_mb_kernel *k;
+
+	if (nactive < 2)
+		return (NULL);
+	for (k = md4_mb_kernels; k->lanes != 0; k++) {
+		if (k->lanes >= nactive && k->lanes <= nlanes &&
+		    k->supported())
+			return (k);
+	}
+	return (NULL);
+}
+
+static int
+md4_mb_free_lane(const struct md4_mb_mgr *mgr)
+{
+	int i;
+
+	for (i = 0; i < mgr->nlanes; i++) {
+		if (mgr->lane[i].state == NULL)
+			return (i);
+	}
+	return (-1);
+}
+
+static int
+md4_mb_busy(const struct md4_mb_mgr *mgr)
+{
+	int i;
+
+	for (i = 0; i < mgr->nlanes; i++) {
+		if (mgr->lane[i].state != NULL)
+			return (1);
+	}
+	return (0);
+}
+
+/*
+ * Advance every busy lane by the number of blocks the shortest one has
+ * left. At least one lane either moves on to its padded tail or
+ * finishes. Lanes running a context are released as soon as they
+ * finish, lanes running a job wait in the done state to be returned.
+ */
+static void
+md4_mb_run(struct md4_mb_mgr *mgr)
+{
+	uint32_t *state[MD4_MB_MAX_LANES];
+	const uint8_t *data[MD4_MB_MAX_LANES];
+	uint32_t scratch[MD4_MB_MAX_LANES][4];
+	const struct md4_mb_kernel *k;
+	struct md4_mb_lane *lane;
+	size_t n;
+	int active[MD4_MB_MAX_LANES];
+	int nactive;
+	int l;
+
+	nactive = 0;
+	n = SIZE_MAX;
+	for (l = 0; l < mgr->nlanes; l++) {
+		lane = &mgr->lane[l];
+		if (lane->state == NULL || lane->done)
+			continue;
+		active[nactive++] = l;
+		if (lane->nblocks < n)
+			n = lane->nblocks;
+	}
+	if (nactive == 0)
+		return;
+
+	k = md4_mb_pick(mgr->nlanes, nactive);
+	if (k == NULL) {
+		for (l = 0; l < nactive; l++) {
+			lane = &mgr->lane[active[l]];
+			md4_transform_blocks(lane->state, lane->data, n);
+		}
+	} else {
+		for (l = 0; l < nactive; l++) {
+			lane = &mgr->lane[active[l]];
+			state[l] = lane->state;
+			data[l] = lane->data;
+		}
+
+		/* Idle lanes shadow the first lane's data. */
+		for (; l < k->lanes && l < MD4_MB_MAX_LANES; l++) {
+			memcpy(scratch[l], state[0], sizeof(scratch[l]));
+			state[l] = scratch[l];
+			data[l] = data[0];
+		}
+		k->fn(state, data, n);
+	}
+
+	for (l = 0; l < nactive; l++) {
+		lane = &mgr->lane[active[l]];
+		lane->data += n * 64;
+		lane->nblocks -= n;
+		if (lane->nblocks != 0)
+			continue;
+		if (lane->ntail != 0) {
+			lane->data = lane->tail;
+			lane->nblocks = lane->ntail;
+			lane->ntail = 0;
+		} else if (lane->job != NULL) {
+			md4_mb_encode(lane->job->digest, lane->state);
+			lane->done = 1;
+		} else {
+			lane->state = NULL;
+		}
+	}
+}
+
+/*
+ * Return a finished job and release its lane, or NULL if no job is
+ * finished.
+ */
+static struct md4_mb_job *
+md4_mb_reap(struct md4_mb_mgr *mgr)
+{
+	struct md4_mb_lane *lane;
+	struct md4_mb_job *job;
+	int i;
+
+	for (i = 0; i < mgr->nlanes; i++) {
+		lane = &mgr->lane[i];
+		if (lane->state == NULL || !lane->done)
+			continue;
+		job = lane->job;
+
+		/*
+		 * Zero out lane.
+		 */
+		memset(lane, 0, sizeof(*lane));
+		return (job);
+	}
+	return (NULL);
+}
+
+/*
+ * Widest kernel managers may use, with md4_mb_scalar standing for none,
+ * or NULL until resolved. It is published with a release store and read
+ * with an acquire load, so any thread may be the first to resolve it;
+ * racing resolutions all store the same kernel.
+ */
+static const struct md4_mb_kernel md4_mb_scalar = { "scalar", 1, NULL, NULL };
+static const struct md4_mb_kernel *md4_mb_kernel;
+
+static const struct md4_mb_kernel *
+md4_mb_lookup(const char *name)
+{
+	const struct md4_mb_kernel *k;
+
+	if (strcmp(name, "scalar") == 0)
+		return (&md4_mb_scalar);
+	for (k = md4_mb_kernels; k->lanes != 0; k++) {
+		if (strcmp(k->name, name) == 0)
+			return (k->supported() ? k : NULL);
+	}
+	return (NULL);
+}
+
+/*
+ * Use the kernel named by $MD4_MB_KERNEL if set and supported, "scalar"
+ * meaning none, otherwise the widest supported one.
+ */
+static const struct md4_mb_kernel *
+md4_mb_resolve(void)
+{
+	const struct md4_mb_kernel *best;
+	const struct md4_mb_kernel *k;
+	const char *env;
+
+	best = NULL;
+	if ((env = getenv("MD4_MB_KERNEL")) != NULL)
+		best = md4_mb_lookup(env);
+	if (best == NULL) {
+		best = &md4_mb_scalar;
+		for (k = md4_mb_kernels; k->lanes != 0; k++) {
+			if (k->supported() && k->lanes > best->lanes)
+				best = k;
+		}
+	}
+	MD4_MB_STORE(&md4_mb_kernel, best);
+	return (best);
+}
+
+static const struct md4_mb_kernel *
+md4_mb_current(void)
+{
+	const struct md4_mb_kernel *k;
+
+	if ((k = MD4_MB_LOAD(&md4_mb_kernel)) == NULL)
+		k = md4_mb_resolve();
+	return (k);
+}
+
+/*
+ * Limit managers initialized from now on to the named kernel and the
+ * narrower ones. Returns -1 if it is unknown or the CPU does not
+ * support it.
+ */
+int
+md4_mb_select(const char *name)
+{
+	const struct md4_mb_kernel *k;
+
+	if ((k = md4_mb_lookup(name)) == NULL)
+		return (-1);
+	MD4_MB_STORE(&md4_mb_kernel, k);
+	return (0);
+}
+
+const char *
+md4_mb_name(void)
+{
+
+	return (md4_mb_current()->name);
+}
+
+void
+md4_mb_init(struct md4_mb_mgr *mgr)
+{
+
+	memset(mgr, 0, sizeof(*mgr));
+	mgr->nlanes = md4_mb_current()->lanes;
+}
+
+/*
+ * Hand a job to the engine. Returns a finished job, which may be an
+ * earlier one, or NULL if every job submitted so far is still running.
+ * The job and its data must stay valid until the job is returned.
+ */
+struct md4_mb_job *
+md4_mb_submit(struct md4_mb_mgr *mgr, struct md4_mb_job *job)
+{
+	struct md4_mb_lane *lane;
+	const uint8_t *input;
+	uint64_t bits;
+	size_t full;
+	size_t rem;
+	int i;
+
+	lane = &mgr->lane[md4_mb_free_lane(mgr)];
+	input = job->data;
+	full = job->len / 64;
+	rem = job->len % 64;
+
+	lane->job = job;
+	lane->state = lane->hash;
+	lane->hash[0] = 0x67452301;
+	lane->hash[1] = 0xefcdab89;
+	lane->hash[2] = 0x98badcfe;
+	lane->hash[3] = 0x10325476;
+
+	/* Build the padded final block(s), same as md4_final. */
+	memset(lane->tail, 0, sizeof(lane->tail));
+	if (rem != 0)
+		memcpy(lane->tail, &input[full * 64], rem);
+	lane->tail[rem] = 0x80;
+	lane->ntail = (rem < 56) ? 1 : 2;
+	bits = (uint64_t)job->len << 3;
+	for (i = 0; i < 8; i++)
+		lane->tail[lane->ntail * 64 - 8 + i] = (bits >> (8 * i)) & 0xff;
+
+	if (full != 0) {
+		lane->data = input;
+		lane->nblocks = full;
+	} else {
+		lane->data = lane->tail;
+		lane->nblocks = lane->ntail;
+		lane->ntail = 0;
+	}
+
+	if ((job = md4_mb_reap(mgr)) != NULL)
+		return (job);
+	if (md4_mb_free_lane(mgr) >= 0)
+		return (NULL);
+	while ((job = md4_mb_reap(mgr)) == NULL)
+		md4_mb_run(mgr);
+	return (job);
+}
+
+/*
+ * Finish the remaining jobs one at a time. Returns NULL once the
+ * engine is empty.
+ */
+struct md4_mb_job *
+md4_mb_flush(struct md4_mb_mgr *mgr)
+{
+	struct md4_mb_job *job;
+
+	while ((job = md4_mb_reap(mgr)) == NULL) {
+		if (!md4_mb_busy(mgr))
+			return (NULL);
+		md4_mb_run(mgr);
+	}
+	return (job);
+}
+
+/*
+ * Hash n independent messages.
+ */
+void
+md4_mb_digest(struct md4_mb_job *jobs, size_t n)
+{
+	struct md4_mb_mgr mgr;
+	size_t i;
+
+	md4_mb_init(&mgr);
+	for (i = 0; i < n; i++)
+		md4_mb_submit(&mgr, &jobs[i]);
+	while (md4_mb_flush(&mgr) != NULL)
+		;
+}
+
+/*
+ * Equivalent to calling md4_update(ctx[i], data[i], len[i]) for each i.
+ * The full blocks of every input are compressed side by side. The
+ * contexts must be distinct.
+ */
+void
+md4_mb_update(struct md4_ctx *const ctx[], const void *const data[],
+    const size_t len[], size_t n)
+{
+	struct md4_mb_mgr mgr;
+	struct md4_mb_lane *lane;
+	const uint8_t *input;
+	size_t inputlen;
+	size_t partlen;
+	size_t index;
+	size_t nblocks;
+	size_t i;
+	size_t j;
+	int l;
+
+	md4_mb_init(&mgr);
+	for (j = 0; j < n; j++) {
+		input = data[j];
+		inputlen = len[j];
+
+		/* index = (ctx->count[0] / 8) % 64; */
+		index = (size_t)((ctx[j]->count[0] >> 3) & 0x3f);
+
+		if ((ctx[j]->count[0] += ((uint32_t)inputlen << 3)) <
+		    ((uint32_t)inputlen << 3))
+			ctx[j]->count[1]++;
+		ctx[j]->count[1] += (uint32_t)((uint64_t)inputlen >> 29);
+
+		partlen = 64 - index;
+		if (inputlen < partlen) {
+			memcpy(&ctx[j]->buffer[index], input, inputlen);
+			continue;
+		}
+
+		/* A partly filled buffer is completed and compressed first. */
+		i = 0;
+		if (index != 0) {
+			memcpy(&ctx[j]->buffer[index], input, partlen);
+			md4_transform(ctx[j]->state, ctx[j]->buffer);
+			i = partlen;
+		}
+
+		/* Every full block left can go to a lane. */
+		nblocks = (inputlen - i) / 64;
+		if (nblocks != 0) {
+			while ((l = md4_mb_free_lane(&mgr)) < 0)
+				md4_mb_run(&mgr);
+			lane = &mgr.lane[l];
+			lane->state = ctx[j]->state;
+			lane->data = &input[i];
+			lane->nblocks = nblocks;
+			i += nblocks * 64;
+		}
+		memcpy(ctx[j]->buffer, &input[i], inputlen - i);
+	}
+
+	while (md4_mb_flush(&mgr) != NULL)
+		;
+}
+
+/*
+ * Expand an ASCII password of up to 27 characters to UTF-16LE in a
+ * padded single block. Returns -1 for anything longer or not ASCII.
+ */
+static int
+md4_mb_nt_block(uint8_t block[64], const uint8_t *pw, size_t len)
+{
+	uint8_t high;
+	size_t i;
+
+	if (len > 27)
+		return (-1);
+	high = 0;
+	for (i = 0; i < len; i++)
+		high |= pw[i];
+	if (high >= 0x80)
+		return (-1);
+
+	memset(block, 0, 64);
+	for (i = 0; i < len; i++)
+		block[2 * i] = pw[i];
+	block[2 * len] = 0x80;
+	block[56] = (len << 4) & 0xff;
+	block[57] = (len << 4) >> 8;
+	return (0);
+}
+
+/*
+ * Compress the first nfull blocks, the digest of block l going to
+ * password owner[l]. Idle lanes hash whatever their block last held.
+ */
+static void
+md4_mb_nt_run(const struct md4_mb_kernel *k, uint8_t (*digest)[16],
+    const size_t owner[], int nfull, uint8_t block[][64])
+{
+	uint32_t hash[MD4_MB_MAX_LANES][4];
+	uint32_t *state[MD4_MB_MAX_LANES];
+	const uint8_t *data[MD4_MB_MAX_LANES];
+	int l;
+
+	for (l = 0; l < k->lanes; l++) {
+		hash[l][0] = 0x67452301;
+		hash[l][1] = 0xefcdab89;
+		hash[l][2] = 0x98badcfe;
+		hash[l][3] = 0x10325476;
+		state[l] = hash[l];
+		data[l] = block[l];
+	}
+	k->fn(state, data, 1);
+	for (l = 0; l < nfull; l++)
+		md4_mb_encode(digest[owner[l]], hash[l]);
+}
+
+/*
+ * NT hashes of n UTF-8 passwords. ASCII passwords of up to 27 characters
+ * are widened into single padded blocks and compressed a full kernel
+ * width at a time, the rest go through md4_nthash. Returns the number of
+ * passwords that are not valid UTF-8, whose digests are zeroed.
+ */
+size_t
+md4_mb_nthash(uint8_t (*digest)[16], const void *const pw[],
+    const size_t len[], size_t n)
+{
+	uint8_t block[MD4_MB_MAX_LANES][64];
+	size_t owner[MD4_MB_MAX_LANES];
+	const struct md4_mb_kernel *k;
+	size_t nbad;
+	size_t i;
+	int lanes;
+	int nfull;
+
+	lanes = md4_mb_current()->lanes;
+	k = md4_mb_pick(lanes, lanes);
+	memset(block, 0, sizeof(block));
+
+	nbad = 0;
+	nfull = 0;
+	for (i = 0; i < n; i++) {
+		if (k == NULL ||
+		    md4_mb_nt_block(block[nfull], pw[i], len[i]) != 0) {
+			if (md4_nthash(digest[i], pw[i], len[i]) != 0) {
+				memset(digest[i], 0, 16);
+				nbad++;
+			}
+			continue;
+		}
+		owner[nfull++] = i;
+		if (nfull == k->lanes) {
+			md4_mb_nt_run(k, digest, owner, nfull, block);
+			nfull = 0;
+		}
+	}
+	if (nfull != 0)
+		md4_mb_nt_run(k, digest, owner, nfull, block);
+
+	/*
+	 * Zero out block.
+	 */
+	memset(block, 0, sizeof(block));
+	return (nbad);
+}
@@ -23,12 +23,25 @@
  * SUCH DAMAGE.
  */
 
+#include <sys/uio.h>
+
 #include <stdint.h>
 #include <stddef.h>
+#include <stdlib.h>
 #include <string.h>
 
 #include "md4.h"
 
+#ifdef __GNUC__
+#define MD4_INLINE inline __attribute__((always_inline))
+#define MD4_LOAD(p) __atomic_load_n((p), __ATOMIC_ACQUIRE)
+#define MD4_STORE(p, v) __atomic_store_n((p), (v), __ATOMIC_RELEASE)
+#else
+#define MD4_INLINE inline
+#define MD4_LOAD(p) (*(p))
+#define MD4_STORE(p, v) (*(p) = (v))
+#endif
+
 /*
  * Round functions.
  */
@@ -48,6 +61,29 @@
 	(a) = (((a) << shift) | ((a) >> (32 - (shift)))); \
 } while (0)
 
+/*
+ * Round functions with shorter dependency chains. The message word and
+ * constant are added first and F and G are rewritten so that only one
+ * operation of the boolean function waits on b from the previous step.
+ */
+#define Q1(a, b, c, d, data, shift) do { \
+	(a) += (data); \
+	(a) += (d) ^ ((b) & ((c) ^ (d))); \
+	(a) = (((a) << shift) | ((a) >> (32 - (shift)))); \
+} while (0)
+
+#define Q2(a, b, c, d, data, shift) do { \
+	(a) += (data) + 0x5a827999; \
+	(a) += ((b) & ((c) | (d))) | ((c) & (d)); \
+	(a) = (((a) << shift) | ((a) >> (32 - (shift)))); \
+} while (0)
+
+#define Q3(a, b, c, d, data, shift) do { \
+	(a) += (data) + 0x6ed9eba1; \
+	(a) += (b) ^ ((c) ^ (d)); \
+	(a) = (((a) << shift) | ((a) >> (32 - (shift)))); \
+} while (0)
+
 static uint8_t md4_padding[64] = {
 	0x80, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
 	0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
@@ -66,24 +102,10 @@ md4_init(struct md4_ctx *ctx)
 	ctx->count[1] = 0;
 }
 
-void
-md4_transform(uint32_t state[4], const uint8_t block[64])
+static MD4_INLINE void
+md4_decode(uint32_t x[16], const uint8_t block[64])
 {
-	uint32_t a;
-	uint32_t b;
-	uint32_t c;
-	uint32_t d;
-	uint32_t x[16];
 
-	/*
-	 * Little endian can just memcpy blocks[] into x[].
-	 * The other mess works wherever but might be slower
-	 * on little endian depending on your compiler and optimization
-	 * settings.
-	 */
-#ifdef MD4_LITTLE_ENDIAN
-	memcpy(x, block, sizeof(x));
-#else
 	x[ 0]  =  (uint32_t)block[ 0];
 	x[ 0] |= ((uint32_t)block[ 1]) <<  8;
 	x[ 0] |= ((uint32_t)block[ 2]) << 16;
@@ -148,7 +170,15 @@ md4_transform(uint32_t state[4], const uint8_t block[64])
 	x[15] |= ((uint32_t)block[61]) <<  8;
 	x[15] |= ((uint32_t)block[62]) << 16;
 	x[15] |= ((uint32_t)block[63]) << 24;
-#endif
+}
+
+static MD4_INLINE void
+md4_rounds(uint32_t state[4], const uint32_t x[16])
+{
+	uint32_t a;
+	uint32_t b;
+	uint32_t c;
+	uint32_t d;
 
 	a = state[0];
 	b = state[1];
@@ -214,10 +244,315 @@ md4_transform(uint32_t state[4], const uint8_t block[64])
 	state[2] += c;
 	state[3] += d;
 
+}
+
+static MD4_INLINE void
+md4_rounds_ilp(uint32_t state[4], const uint32_t x[16])
+{
+	uint32_t a;
+	uint32_t b;
+	uint32_t c;
+	uint32_t d;
+
+	a = state[0];
+	b = state[1];
+	c = state[2];
+	d = state[3];
+
+	/* Round 1 */
+	Q1(a, b, c, d, x[ 0],  3);
+	Q1(d, a, b, c, x[ 1],  7);
+	Q1(c, d, a, b, x[ 2], 11);
+	Q1(b, c, d, a, x[ 3], 19);
+	Q1(a, b, c, d, x[ 4],  3);
+	Q1(d, a, b, c, x[ 5],  7);
+	Q1(c, d, a, b, x[ 6], 11);
+	Q1(b, c, d, a, x[ 7], 19);
+	Q1(a, b, c, d, x[ 8],  3);
+	Q1(d, a, b, c, x[ 9],  7);
+	Q1(c, d, a, b, x[10], 11);
+	Q1(b, c, d, a, x[11], 19);
+	Q1(a, b, c, d, x[12],  3);
+	Q1(d, a, b, c, x[13],  7);
+	Q1(c, d, a, b, x[14], 11);
+	Q1(b, c, d, a, x[15], 19);
+
+	/* Round 2 */
+	Q2(a, b, c, d, x[ 0],  3);
+	Q2(d, a, b, c, x[ 4],  5);
+	Q2(c, d, a, b, x[ 8],  9);
+	Q2(b, c, d, a, x[12], 13);
+	Q2(a, b, c, d, x[ 1],  3);
+	Q2(d, a, b, c, x[ 5],  5);
+	Q2(c, d, a, b, x[ 9],  9);
+	Q2(b, c, d, a, x[13], 13);
+	Q2(a, b, c, d, x[ 2],  3);
+	Q2(d, a, b, c, x[ 6],  5);
+	Q2(c, d, a, b, x[10], 9);
+	Q2(b, c, d, a, x[14], 13);
+	Q2(a, b, c, d, x[ 3],  3);
+	Q2(d, a, b, c, x[ 7],  5);
+	Q2(c, d, a, b, x[11],  9);
+	Q2(b, c, d, a, x[15], 13);
+
+	/* Round 3 */
+	Q3(a, b, c, d, x[ 0],  3);
+	Q3(d, a, b, c, x[ 8],  9);
+	Q3(c, d, a, b, x[ 4], 11);
+	Q3(b, c, d, a, x[12], 15);
+	Q3(a, b, c, d, x[ 2],  3);
+	Q3(d, a, b, c, x[10],  9);
+	Q3(c, d, a, b, x[ 6], 11);
+	Q3(b, c, d, a, x[14], 15);
+	Q3(a, b, c, d, x[ 1],  3);
+	Q3(d, a, b, c, x[ 9],  9);
+	Q3(c, d, a, b, x[ 5], 11);
+	Q3(b, c, d, a, x[13], 15);
+	Q3(a, b, c, d, x[ 3],  3);
+	Q3(d, a, b, c, x[11],  9);
+	Q3(c, d, a, b, x[ 7], 11);
+	Q3(b, c, d, a, x[15], 15);
+
+	state[0] += a;
+	state[1] += b;
+	state[2] += c;
+	state[3] += d;
+
+}
+
+/*
+ * Transform kernels. They only differ in how x[] is loaded and which
+ * round functions are used, all of them give the same result. The
+ * state is kept in s[] so it can stay in registers from one block to
+ * the next, stores to state[] could otherwise alias data.
+ */
+static void
+md4_transform_generic(uint32_t state[4], const uint8_t *data, size_t nblocks)
+{
+	uint32_t s[4];
+	uint32_t x[16];
+
+	memcpy(s, state, sizeof(s));
+	for (; nblocks != 0; nblocks--, data += 64) {
+		md4_decode(x, data);
+		md4_rounds(s, x);
+	}
+	memcpy(state, s, sizeof(s));
+
+	/*
+	 * Zero out x and s.
+	 */
+	memset(x, 0, sizeof(x));
+	memset(s, 0, sizeof(s));
+}
+
+/*
+ * Little endian can just memcpy data[] into x[].
+ */
+static void
+md4_transform_le(uint32_t state[4], const uint8_t *data, size_t nblocks)
+{
+	uint32_t s[4];
+	uint32_t x[16];
+
+	memcpy(s, state, sizeof(s));
+	for (; nblocks != 0; nblocks--, data += 64) {
+		memcpy(x, data, sizeof(x));
+		md4_rounds(s, x);
+	}
+	memcpy(state, s, sizeof(s));
+
+	/*
+	 * Zero out x and s.
+	 */
+	memset(x, 0, sizeof(x));
+	memset(s, 0, sizeof(s));
+}
+
+static void
+md4_transform_ilp(uint32_t state[4], const uint8_t *data, size_t nblocks)
+{
+	uint32_t s[4];
+	uint32_t x[16];
+
+	memcpy(s, state, sizeof(s));
+	for (; nblocks != 0; nblocks--, data += 64) {
+		md4_decode(x, data);
+		md4_rounds_ilp(s, x);
+	}
+	memcpy(state, s, sizeof(s));
+
 	/*
-	 * Zero out x.
+	 * Zero out x and s.
 	 */
 	memset(x, 0, sizeof(x));
+	memset(s, 0, sizeof(s));
+}
+
+static int
+md4_has_any(void)
+{
+
+	return (1);
+}
+
+static int
+md4_has_le(void)
+{
+	const uint32_t one = 1;
+
+	return (*(const uint8_t *)&one == 1);
+}
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+/*
+ * Same as ilp but lets the compiler use andn and rorx, which saves a
+ * move per step since neither overwrites its source.
+ */
+__attribute__((target("bmi,bmi2"))) static void
+md4_transform_bmi(uint32_t state[4], const uint8_t *data, size_t nblocks)
+{
+	uint32_t s[4];
+	uint32_t x[16];
+
+	memcpy(s, state, sizeof(s));
+	for (; nblocks != 0; nblocks--, data += 64) {
+		md4_decode(x, data);
+		md4_rounds_ilp(s, x);
+	}
+	memcpy(state, s, sizeof(s));
+
+	/*
+	 * Zero out x and s.
+	 */
+	memset(x, 0, sizeof(x));
+	memset(s, 0, sizeof(s));
+}
+
+static int
+md4_has_bmi(void)
+{
+
+	return (__builtin_cpu_supports("bmi") && __builtin_cpu_supports("bmi2"));
+}
+#endif
+
+struct md4_kernel {
+	const char *name;
+	void (*transform)(uint32_t [4], const uint8_t *, size_t);
+	int (*supported)(void);
+};
+
+/*
+ * In order of preference.
+ */
+static const struct md4_kernel md4_kernels[] = {
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+	{ "bmi", md4_transform_bmi, md4_has_bmi },
+#endif
+	{ "ilp", md4_transform_ilp, md4_has_any },
+	{ "le", md4_transform_le, md4_has_le },
+	{ "generic", md4_transform_generic, md4_has_any },
+	{ NULL, NULL, NULL }
+};
+
+/*
+ * The selected kernel, or NULL until the first call resolves it. It is
+ * published with a release store and read with an acquire load, so any
+ * thread may be the first to hash; racing first calls all store the
+ * same kernel.
+ */
+static const struct md4_kernel *md4_kernel;
+
+static const struct md4_kernel *
+md4_kernel_lookup(const char *name)
+{
+	const struct md4_kernel *k;
+
+	for (k = md4_kernels; k->name != NULL; k++) {
+		if (strcmp(k->name, name) == 0)
+			return (k->supported() ? k : NULL);
+	}
+	return (NULL);
+}
+
+/*
+ * Use the kernel named by $MD4_TRANSFORM if set and supported,
+ * otherwise the first supported one.
+ */
+static const struct md4_kernel *
+md4_kernel_resolve(void)
+{
+	const struct md4_kernel *k;
+	const char *env;
+
+	k = NULL;
+	if ((env = getenv("MD4_TRANSFORM")) != NULL)
+		k = md4_kernel_lookup(env);
+	if (k == NULL) {
+		for (k = md4_kernels; !k->supported(); k++)
+			;
+	}
+	MD4_STORE(&md4_kernel, k);
+	return (k);
+}
+
+static MD4_INLINE const struct md4_kernel *
+md4_kernel_current(void)
+{
+	const struct md4_kernel *k;
+
+	if ((k = MD4_LOAD(&md4_kernel)) == NULL)
+		k = md4_kernel_resolve();
+	return (k);
+}
+
+static MD4_INLINE void
+md4_transform_fn(uint32_t state[4], const uint8_t *data, size_t nblocks)
+{
+
+	md4_kernel_current()->transform(state, data, nblocks);
+}
+
+void
+md4_transform(uint32_t state[4], const uint8_t block[64])
+{
+
+	md4_transform_fn(state, block, 1);
+}
+
+/*
+ * Same as calling md4_transform on each of the nblocks 64-byte blocks at
+ * data, without reloading the state or clearing scratch space in
+ * between.
+ */
+void
+md4_transform_blocks(uint32_t state[4], const uint8_t *data, size_t nblocks)
+{
+
+	md4_transform_fn(state, data, nblocks);
+}
+
+/*
+ * Force a kernel by name. Returns -1 if it is unknown or the CPU does
+ * not support it.
+ */
+int
+md4_transform_select(const char *name)
+{
+	const struct md4_kernel *k;
+
+	if ((k = md4_kernel_lookup(name)) == NULL)
+		return (-1);
+	MD4_STORE(&md4_kernel, k);
+	return (0);
+}
+
+const char *
+md4_transform_name(void)
+{
+
+	return (md4_kernel_current()->name);
 }
 
 void
@@ -226,7 +561,8 @@ md4_update(struct md4_ctx *ctx, const void *inputptr, size_t inputlen)
 	const uint8_t *input;
 	size_t partlen;
 	size_t index;
-	uint32_t i;
+	size_t nblocks;
+	size_t i;
 
 	input = inputptr;
 
@@ -237,25 +573,106 @@ md4_update(struct md4_ctx *ctx, const void *inputptr, size_t inputlen)
 	 * ctx->count[0] += (inputlen * 8);
 	 * If ctx->count[0] overflows increment ctx->count[1].
 	 */
-	if ((ctx->count[0] += ((uint32_t)inputlen << 3)) < (uint32_t)inputlen)
+	if ((ctx->count[0] += ((uint32_t)inputlen << 3)) <
+	    ((uint32_t)inputlen << 3))
 		ctx->count[1]++;
-	ctx->count[1] += ((uint32_t)inputlen >> 29);
+	ctx->count[1] += (uint32_t)((uint64_t)inputlen >> 29);
 
 	partlen = 64 - index;
 	i = 0;
 
 	if (inputlen >= partlen) {
 		memcpy(&ctx->buffer[index], input, partlen);
-		md4_transform(ctx->state, ctx->buffer);
+		md4_transform_fn(ctx->state, ctx->buffer, 1);
 
-		for (i = partlen; i + 63 < inputlen; i += 64)
-			md4_transform(ctx->state, &input[i]);
+		i = partlen;
+		nblocks = (inputlen - i) / 64;
+		md4_transform_fn(ctx->state, &input[i], nblocks);
+		i += nblocks * 64;
 		index = 0;
 	}
 
 	memcpy(&ctx->buffer[index], &input[i], inputlen - i);
 }
 
+/*
+ * Same as md4_update over each of the iovcnt buffers of iov in turn. A
+ * block that straddles buffers is assembled in ctx->buffer, whole blocks
+ * are transformed where they lie.
+ */
+void
+md4_updatev(struct md4_ctx *ctx, const struct iovec *iov, int iovcnt)
+{
+	const uint8_t *input;
+	uint64_t total;
+	size_t inputlen;
+	size_t partlen;
+	size_t index;
+	size_t nblocks;
+	int i;
+
+	total = 0;
+	for (i = 0; i < iovcnt; i++)
+		total += iov[i].iov_len;
+
+	/* index = (ctx->count[0] / 8) % 64; */
+	index = (size_t)((ctx->count[0] >> 3) & 0x3f);
+
+	if ((ctx->count[0] += ((uint32_t)total << 3)) < ((uint32_t)total << 3))
+		ctx->count[1]++;
+	ctx->count[1] += (uint32_t)(total >> 29);
+
+	for (i = 0; i < iovcnt; i++) {
+		input = iov[i].iov_base;
+		inputlen = iov[i].iov_len;
+
+		if (index != 0) {
+			partlen = 64 - index;
+			if (inputlen < partlen) {
+				memcpy(&ctx->buffer[index], input, inputlen);
+				index += inputlen;
+				continue;
+			}
+			memcpy(&ctx->buffer[index], input, partlen);
+			md4_transform_fn(ctx->state, ctx->buffer, 1);
+			input += partlen;
+			inputlen -= partlen;
+			index = 0;
+		}
+
+		nblocks = inputlen / 64;
+		if (nblocks != 0) {
+			md4_transform_fn(ctx->state, input, nblocks);
+			input += nblocks * 64;
+			inputlen -= nblocks * 64;
+		}
+		memcpy(ctx->buffer, input, inputlen);
+		index = inputlen;
+	}
+}
+
+static void
+md4_encode(uint8_t digest[16], const uint32_t state[4])
+{
+
+	digest[ 0] = (state[0]) & 0xff;
+	digest[ 1] = (state[0] >> 8) & 0xff;
+	digest[ 2] = (state[0] >> 16) & 0xff;
+	digest[ 3] = (state[0] >> 24)& 0xff;
+	digest[ 4] = (state[1]) & 0xff;
+	digest[ 5] = (state[1] >> 8) & 0xff;
+	digest[ 6] = (state[1] >> 16) & 0xff;
+	digest[ 7] = (state[1] >> 24)& 0xff;
+	digest[ 8] = (state[2]) & 0xff;
+	digest[ 9] = (state[2] >> 8) & 0xff;
+	digest[10] = (state[2] >> 16) & 0xff;
+	digest[11] = (state[2] >> 24)& 0xff;
+	digest[12] = (state[3]) & 0xff;
+	digest[13] = (state[3] >> 8) & 0xff;
+	digest[14] = (state[3] >> 16) & 0xff;
+	digest[15] = (state[3] >> 24)& 0xff;
+}
+
 void
 md4_final(uint8_t digest[16], struct md4_ctx *ctx)
 {
@@ -280,24 +697,8 @@ md4_final(uint8_t digest[16], struct md4_ctx *ctx)
 	md4_update(ctx, md4_padding, (padlen - 8));
 	md4_update(ctx, bits, 8);
 
-	if (digest != NULL) {
-		digest[ 0] = (ctx->state[0]) & 0xff;
-		digest[ 1] = (ctx->state[0] >> 8) & 0xff;
-		digest[ 2] = (ctx->state[0] >> 16) & 0xff;
-		digest[ 3] = (ctx->state[0] >> 24)& 0xff;
-		digest[ 4] = (ctx->state[1]) & 0xff;
-		digest[ 5] = (ctx->state[1] >> 8) & 0xff;
-		digest[ 6] = (ctx->state[1] >> 16) & 0xff;
-		digest[ 7] = (ctx->state[1] >> 24)& 0xff;
-		digest[ 8] = (ctx->state[2]) & 0xff;
-		digest[ 9] = (ctx->state[2] >> 8) & 0xff;
-		digest[10] = (ctx->state[2] >> 16) & 0xff;
-		digest[11] = (ctx->state[2] >> 24)& 0xff;
-		digest[12] = (ctx->state[3]) & 0xff;
-		digest[13] = (ctx->state[3] >> 8) & 0xff;
-		digest[14] = (ctx->state[3] >> 16) & 0xff;
-		digest[15] = (ctx->state[3] >> 24)& 0xff;
-	}
+	if (digest != NULL)
+		md4_encode(digest, ctx->state);
 
 	/*
 	 * Zero out context.
@@ -305,3 +706,259 @@ md4_final(uint8_t digest[16], struct md4_ctx *ctx)
 	memset(ctx, 0, sizeof(*ctx));
 }
 
+/*
+ * Copy src to dst, so a message prefix hashed once can be finished with
+ * many suffixes. Only the bytes buffered in src are copied.
+ */
+void
+md4_ctx_copy(struct md4_ctx *dst, const struct md4_ctx *src)
+{
+
+	memcpy(dst->state, src->state, sizeof(dst->state));
+	dst->count[0] = src->count[0];
+	dst->count[1] = src->count[1];
+	memcpy(dst->buffer, src->buffer, (src->count[0] >> 3) & 0x3f);
+}
+
+/*
+ * Same as md4_init, md4_update and md4_final on a whole message, but
+ * full blocks are compressed straight from data and only the padded
+ * final one or two blocks are built on the stack.
+ */
+void
+md4_digest(uint8_t digest[16], const void *data, size_t len)
+{
+	const uint8_t *input;
+	uint32_t state[4];
+	uint8_t block[128];
+	uint64_t bits;
+	size_t nblocks;
+	size_t rem;
+	int i;
+
+	input = data;
+	state[0] = 0x67452301;
+	state[1] = 0xefcdab89;
+	state[2] = 0x98badcfe;
+	state[3] = 0x10325476;
+
+	nblocks = len / 64;
+	md4_transform_fn(state, input, nblocks);
+	input += nblocks * 64;
+
+	/* Pad to 56 mod 64 and append the length in bits. */
+	rem = len % 64;
+	nblocks = (rem < 56) ? 1 : 2;
+	memcpy(block, input, rem);
+	block[rem] = 0x80;
+	memset(&block[rem + 1], 0, nblocks * 64 - 8 - (rem + 1));
+	bits = (uint64_t)len << 3;
+	for (i = 0; i < 8; i++)
+		block[nblocks * 64 - 8 + i] = (bits >> (8 * i)) & 0xff;
+	md4_transform_fn(state, block, nblocks);
+
+	md4_encode(digest, state);
+
+	/*
+	 * Zero out state and block.
+	 */
+	memset(state, 0, sizeof(state));
+	memset(block, 0, sizeof(block));
+}
+
+/*
+ * Decode the UTF-8 sequence at *pp, which ends before end, into one or
+ * two UTF-16 code units. Returns the number of units, or 0 for an
+ * invalid, overlong or truncated sequence or an encoded surrogate.
+ */
+static int
+md4_utf8_next(uint16_t unit[2], const uint8_t **pp, const uint8_t *end)
+{
+	const uint8_t *p;
+	uint32_t c;
+	int n;
+	int i;
+
+	p = *pp;
+	if (p[0] < 0x80) {
+		c = p[0];
+		n = 1;
+	} else if ((p[0] & 0xe0) == 0xc0) {
+		c = p[0] & 0x1f;
+		n = 2;
+	} else if ((p[0] & 0xf0) == 0xe0) {
+		c = p[0] & 0x0f;
+		n = 3;
+	} else if ((p[0] & 0xf8) == 0xf0) {
+		c = p[0] & 0x07;
+		n = 4;
+	} else
+		return (0);
+	if (end - p < n)
+		return (0);
+	for (i = 1; i < n; i++) {
+		if ((p[i] & 0xc0) != 0x80)
+			return (0);
+		c = (c << 6) | (p[i] & 0x3f);
+	}
+	if ((n == 2 && c < 0x80) || (n == 3 && c < 0x800) ||
+	    (n == 4 && c < 0x10000) || (c >= 0xd800 && c < 0xe000) ||
+	    c > 0x10ffff)
+		return (0);
+	*pp = p + n;
+
+	if (c < 0x10000) {
+		unit[0] = c;
+		return (1);
+	}
+	c -= 0x10000;
+	unit[0] = 0xd800 | (c >> 10);
+	unit[1] = 0xdc00 | (c & 0x3ff);
+	return (2);
+}
+
+/*
+ * NT hash of a password given in UTF-8: the MD4 of its UTF-16LE form.
+ * ASCII passwords of up to 27 characters fill one block, so each pair of
+ * characters is widened straight into a message word and no UTF-16 copy
+ * is made. Others are converted a block at a time on the stack. Returns
+ * -1 if the password is not valid UTF-8.
+ */
+int
+md4_nthash(uint8_t digest[16], const void *password, size_t len)
+{
+	struct md4_ctx ctx;
+	const uint8_t *p;
+	const uint8_t *end;
+	uint32_t state[4];
+	uint32_t x[16];
+	uint8_t block[64];
+	uint16_t unit[2];
+	uint8_t high;
+	size_t i;
+	size_t n;
+	int k;
+
+	p = password;
+	high = 0;
+	for (i = 0; i < len && i <= 27; i++)
+		high |= p[i];
+	if (len <= 27 && high < 0x80) {
+		memset(x, 0, sizeof(x));
+		for (i = 0; i < len / 2; i++)
+			x[i] = (uint32_t)p[2 * i] | ((uint32_t)p[2 * i + 1] << 16);
+		if (len % 2 != 0)
+			x[i] = (uint32_t)p[2 * i] | ((uint32_t)0x80 << 16);
+		else
+			x[i] = 0x80;
+		x[14] = (uint32_t)len << 4;
+
+		state[0] = 0x67452301;
+		state[1] = 0xefcdab89;
+		state[2] = 0x98badcfe;
+		state[3] = 0x10325476;
+		md4_rounds_ilp(state, x);
+		md4_encode(digest, state);
+
+		/*
+		 * Zero out x.
+		 */
+		memset(x, 0, sizeof(x));
+		return (0);
+	}
+
+	md4_init(&ctx);
+	end = p + len;
+	n = 0;
+	while (p < end) {
+		if ((k = md4_utf8_next(unit, &p, end)) == 0) {
+			memset(block, 0, sizeof(block));
+			memset(&ctx, 0, sizeof(ctx));
+			return (-1);
+		}
+		for (i = 0; i < (size_t)k; i++) {
+			block[n++] = unit[i] & 0xff;
+			block[n++] = unit[i] >> 8;
+			if (n == sizeof(block)) {
+				md4_update(&ctx, block, n);
+				n = 0;
+			}
+		}
+	}
+	md4_update(&ctx, block, n);
+	md4_final(digest, &ctx);
+
+	/*
+	 * Zero out block.
+	 */
+	memset(block, 0, sizeof(block));
+	return (0);
+}
+
+/*
+ * Serialize a context. The layout does not depend on the host:
+ *
+ *   0   "md4c"     magic
+ *   4   1          version
+ *   5   0, 0, 0    reserved
+ *   8   state[4]   little-endian 32-bit words
+ *   24  count      little-endian 64-bit number of bits hashed
+ *   32  buffer     the count / 8 % 64 bytes not yet compressed, then zeros
+ */
+void
+md4_export(uint8_t out[MD4_EXPORT_SIZE], const struct md4_ctx *ctx)
+{
+	uint64_t count;
+	size_t used;
+	int i;
+
+	memset(out, 0, MD4_EXPORT_SIZE);
+	memcpy(out, "md4c", 4);
+	out[4] = MD4_EXPORT_VERSION;
+	for (i = 0; i < 16; i++)
+		out[8 + i] = (ctx->state[i / 4] >> (8 * (i % 4))) & 0xff;
+	count = ((uint64_t)ctx->count[1] << 32) | ctx->count[0];
+	for (i = 0; i < 8; i++)
+		out[24 + i] = (count >> (8 * i)) & 0xff;
+	used = (count >> 3) & 0x3f;
+	memcpy(out + 32, ctx->buffer, used);
+}
+
+/*
+ * Restore a context saved by md4_export. Returns -1 if in is not an
+ * exported md4 context of a version we know.
+ */
+int
+md4_import(struct md4_ctx *ctx, const uint8_t in[MD4_EXPORT_SIZE])
+{
+	uint64_t count;
+	size_t used;
+	int i;
+
+	if (memcmp(in, "md4c", 4) != 0 || in[4] != MD4_EXPORT_VERSION ||
+	    in[5] != 0 || in[6] != 0 || in[7] != 0)
+		return (-1);
+	count = 0;
+	for (i = 0; i < 8; i++)
+		count |= (uint64_t)in[24 + i] << (8 * i);
+	if ((count & 7) != 0)
+		return (-1);
+	used = (count >> 3) & 0x3f;
+	for (i = 32 + used; i < MD4_EXPORT_SIZE; i++) {
+		if (in[i] != 0)
+			return (-1);
+	}
+
+	for (i = 0; i < 4; i++) {
+		ctx->state[i] = (uint32_t)in[8 + 4 * i] |
+		    (uint32_t)in[9 + 4 * i] << 8 |
+		    (uint32_t)in[10 + 4 * i] << 16 |
+		    (uint32_t)in[11 + 4 * i] << 24;
+	}
+	ctx->count[0] = count & 0xffffffff;
+	ctx->count[1] = count >> 32;
+	memset(ctx->buffer, 0, sizeof(ctx->buffer));
+	memcpy(ctx->buffer, in + 32, used);
+
+	return (0);
+}
@@ -29,6 +29,11 @@
 #include <stdint.h>
 #include <stddef.h>
 
+#define MD4_EXPORT_SIZE 96
+#define MD4_EXPORT_VERSION 1
+
+struct iovec;
+
 struct md4_ctx {
 	uint32_t state[4]; /* 4 32-bit state words */
 	uint32_t count[2]; /* Number of bits mod 2^64 */
@@ -37,8 +42,17 @@ struct md4_ctx {
 
 void md4_init(struct md4_ctx *);
 void md4_transform(uint32_t [4], const uint8_t [64]);
+void md4_transform_blocks(uint32_t [4], const uint8_t *, size_t);
+int md4_transform_select(const char *);
+const char *md4_transform_name(void);
 void md4_update(struct md4_ctx *, const void *, size_t);
+void md4_updatev(struct md4_ctx *, const struct iovec *, int);
 void md4_final(uint8_t [16], struct md4_ctx *);
+void md4_ctx_copy(struct md4_ctx *, const struct md4_ctx *);
+void md4_digest(uint8_t [16], const void *, size_t);
+int md4_nthash(uint8_t [16], const void *, size_t);
+void md4_export(uint8_t [MD4_EXPORT_SIZE], const struct md4_ctx *);
+int md4_import(struct md4_ctx *, const uint8_t [MD4_EXPORT_SIZE]);
 
 #endif /* CRYPTO_MD4_H */
 
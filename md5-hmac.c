@@ -0,0 +1,215 @@
+/*-
+ * Copyright (c) 2023, Collin Funk
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHORS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * HMAC-MD5 from RFC 2104. The contexts after the key xor ipad and key
+ * xor opad blocks are computed once per key, so a tag costs the message
+ * and two final blocks rather than four blocks more. Batches of messages
+ * are run side by side through the multi-buffer engine.
+ */
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+
+#include "md5.h"
+#include "md5-hmac.h"
+#include "md5-mb.h"
+
+#define MD5_HMAC_BATCH (4 * MD5_MB_MAX_LANES)
+
+void
+md5_hmac_init(struct md5_hmac_key *hk, const void *key, size_t keylen)
+{
+	uint8_t block[64];
+	int i;
+
+	/* Keys longer than a block are replaced by their digest. */
+	memset(block, 0, sizeof(block));
+	if (keylen > sizeof(block))
+		md5_digest(block, key, keylen);
+	else
+		memcpy(block, key, keylen);
+
+	for (i = 0; i < 64; i++)
+		block[i] ^= 0x36;
+	md5_init(&hk->inner);
+	md5_update(&hk->inner, block, sizeof(block));
+
+	for (i = 0; i < 64; i++)
+		block[i] ^= 0x36 ^ 0x5c;
+	md5_init(&hk->outer);
+	md5_update(&hk->outer, block, sizeof(block));
+
+	/*
+	 * Zero out block.
+	 */
+	memset(block, 0, sizeof(block));
+}
+
+void
+md5_hmac_clear(struct md5_hmac_key *hk)
+{
+
+	/*
+	 * Zero out key.
+	 */
+	memset(hk, 0, sizeof(*hk));
+}
+
+void
+md5_hmac(uint8_t tag[16], const struct md5_hmac_key *hk, const void *data,
+    size_t len)
+{
+	struct md5_ctx ctx;
+	uint8_t inner[16];
+
+	md5_ctx_copy(&ctx, &hk->inner);
+	md5_update(&ctx, data, len);
+	md5_final(inner, &ctx);
+
+	md5_ctx_copy(&ctx, &hk->outer);
+	md5_update(&ctx, inner, sizeof(inner));
+	md5_final(tag, &ctx);
+
+	/*
+	 * Zero out inner.
+	 */
+	memset(inner, 0, sizeof(inner));
+}
+
+/*
+ * Returns 1 if the len bytes at a and b are equal and 0 otherwise, taking
+ * the same time wherever they differ.
+ */
+int
+md5_hmac_equal(const void *a, const void *b, size_t len)
+{
+	const volatile uint8_t *pa;
+	const volatile uint8_t *pb;
+	uint8_t diff;
+	size_t i;
+
+	pa = a;
+	pb = b;
+	diff = 0;
+	for (i = 0; i < len; i++)
+		diff |= pa[i] ^ pb[i];
+	return (diff == 0);
+}
+
+/*
+ * Returns 1 if tag, possibly truncated to taglen bytes, is the tag of the
+ * message and 0 if it is not or taglen is out of range.
+ */
+int
+md5_hmac_verify(const struct md5_hmac_key *hk, const void *data, size_t len,
+    const uint8_t *tag, size_t taglen)
+{
+	uint8_t expected[16];
+	int ok;
+
+	if (taglen < MD5_HMAC_MINTAG || taglen > sizeof(expected))
+		return (0);
+	md5_hmac(expected, hk, data, len);
+	ok = md5_hmac_equal(expected, tag, taglen);
+
+	/*
+	 * Zero out expected.
+	 */
+	memset(expected, 0, sizeof(expected));
+	return (ok);
+}
+
+/*
+ * Tag n messages, message i with key[i]. The inner hashes run side by
+ * side, then the outer ones, which are a single block each.
+ */
+void
+md5_hmac_batch(uint8_t (*tag)[16], const struct md5_hmac_key *const key[],
+    const void *const data[], const size_t len[], size_t n)
+{
+	struct md5_ctx ctx[MD5_HMAC_BATCH];
+	struct md5_ctx *ctxp[MD5_HMAC_BATCH];
+	uint8_t inner[MD5_HMAC_BATCH][16];
+	size_t i;
+	size_t j;
+	size_t m;
+
+	for (i = 0; i < MD5_HMAC_BATCH; i++)
+		ctxp[i] = &ctx[i];
+
+	for (i = 0; i < n; i += m) {
+		m = n - i < MD5_HMAC_BATCH ? n - i : MD5_HMAC_BATCH;
+		for (j = 0; j < m; j++)
+			md5_ctx_copy(&ctx[j], &key[i + j]->inner);
+		md5_mb_update(ctxp, &data[i], &len[i], m);
+		md5_mb_final(inner, ctxp, m);
+
+		for (j = 0; j < m; j++) {
+			md5_ctx_copy(&ctx[j], &key[i + j]->outer);
+			md5_update(&ctx[j], inner[j], 16);
+		}
+		md5_mb_final(&tag[i], ctxp, m);
+	}
+
+	/*
+	 * Zero out ctx and inner.
+	 */
+	memset(ctx, 0, sizeof(ctx));
+	memset(inner, 0, sizeof(inner));
+}
+
+/*
+ * Check n full length tags, setting ok[i] to 1 if tag[i] is the tag of
+ * message i and to 0 otherwise. Returns the number that matched.
+ */
+size_t
+md5_hmac_verify_batch(int ok[], const struct md5_hmac_key *const key[],
+    const void *const data[], const size_t len[], const uint8_t (*tag)[16],
+    size_t n)
+{
+	uint8_t expected[MD5_HMAC_BATCH][16];
+	size_t nok;
+	size_t i;
+	size_t j;
+	size_t m;
+
+	nok = 0;
+	for (i = 0; i < n; i += m) {
+		m = n - i < MD5_HMAC_BATCH ? n - i : MD5_HMAC_BATCH;
+		md5_hmac_batch(expected, &key[i], &data[i], &len[i], m);
+		for (j = 0; j < m; j++) {
+			ok[i + j] = md5_hmac_equal(expected[j], tag[i + j], 16);
+			nok += ok[i + j];
+		}
+	}
+
+	/*
+	 * Zero out expected.
+	 */
+	memset(expected, 0, sizeof(expected));
+	return (nok);
+}
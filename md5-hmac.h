@@ -0,0 +1,53 @@
+/*-
+ * Copyright (c) 2023, Collin Funk
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHORS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#ifndef CRYPTO_MD5_HMAC_H
+#define CRYPTO_MD5_HMAC_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include "md5.h"
+
+#define MD5_HMAC_MINTAG 10 /* Shortest truncated tag accepted, RFC 2104 */
+
+struct md5_hmac_key {
+	struct md5_ctx inner; /* Context after the key xor ipad block */
+	struct md5_ctx outer; /* Context after the key xor opad block */
+};
+
+void md5_hmac_init(struct md5_hmac_key *, const void *, size_t);
+void md5_hmac_clear(struct md5_hmac_key *);
+void md5_hmac(uint8_t [16], const struct md5_hmac_key *, const void *,
+    size_t);
+int md5_hmac_equal(const void *, const void *, size_t);
+int md5_hmac_verify(const struct md5_hmac_key *, const void *, size_t,
+    const uint8_t *, size_t);
+void md5_hmac_batch(uint8_t (*)[16], const struct md5_hmac_key *const [],
+    const void *const [], const size_t [], size_t);
+size_t md5_hmac_verify_batch(int [], const struct md5_hmac_key *const [],
+    const void *const [], const size_t [], const uint8_t (*)[16], size_t);
+
+#endif /* CRYPTO_MD5_HMAC_H */
@@ -0,0 +1,164 @@
+/*-
+ * Copyright (c) 2023, Collin Funk
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHORS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * Lane-parallel MD5 compression function. This file is included by
+ * md5-mb.c once per instruction set with the following defined:
+ *
+ *   MB_FN     Name of the kernel.
+ *   MB_VEC    Name of the vector type to declare.
+ *   MB_LANES  Number of 32-bit lanes in MB_VEC.
+ *   MB_ATTR   Function attributes, e.g. the target instruction set.
+ *   MB_LOAD   Statement setting x[i] to word i of every lane's block
+ *             at byte offset off.
+ *
+ * Lane l compresses nblocks consecutive blocks starting at data[l]
+ * into state[l]. Every lane advances by the same number of blocks.
+ */
+
+typedef uint32_t MB_VEC __attribute__((vector_size(MB_LANES * 4)));
+
+MB_ATTR static void
+MB_FN(uint32_t *const state[], const uint8_t *const data[], size_t nblocks)
+{
+	MB_VEC a;
+	MB_VEC b;
+	MB_VEC c;
+	MB_VEC d;
+	MB_VEC aa;
+	MB_VEC bb;
+	MB_VEC cc;
+	MB_VEC dd;
+	MB_VEC x[16];
+	size_t off;
+	int l;
+
+	a = b = c = d = (MB_VEC){ 0 };
+	for (l = 0; l < MB_LANES; l++) {
+		a[l] = state[l][0];
+		b[l] = state[l][1];
+		c[l] = state[l][2];
+		d[l] = state[l][3];
+	}
+
+	for (off = 0; off < nblocks * 64; off += 64) {
+		/* Transpose word i of every lane into x[i]. */
+		MB_LOAD(x, data, off);
+
+		aa = a;
+		bb = b;
+		cc = c;
+		dd = d;
+
+		/* Round 1 */
+		R1(a, b, c, d, x[ 0], 0xd76aa478,  7);
+		R1(d, a, b, c, x[ 1], 0xe8c7b756, 12);
+		R1(c, d, a, b, x[ 2], 0x242070db, 17);
+		R1(b, c, d, a, x[ 3], 0xc1bdceee, 22);
+		R1(a, b, c, d, x[ 4], 0xf57c0faf,  7);
+		R1(d, a, b, c, x[ 5], 0x4787c62a, 12);
+		R1(c, d, a, b, x[ 6], 0xa8304613, 17);
+		R1(b, c, d, a, x[ 7], 0xfd469501, 22);
+		R1(a, b, c, d, x[ 8], 0x698098d8,  7);
+		R1(d, a, b, c, x[ 9], 0x8b44f7af, 12);
+		R1(c, d, a, b, x[10], 0xffff5bb1, 17);
+		R1(b, c, d, a, x[11], 0x895cd7be, 22);
+		R1(a, b, c, d, x[12], 0x6b901122,  7);
+		R1(d, a, b, c, x[13], 0xfd987193, 12);
+		R1(c, d, a, b, x[14], 0xa679438e, 17);
+		R1(b, c, d, a, x[15], 0x49b40821, 22);
+
+		/* Round 2 */
+		R2(a, b, c, d, x[ 1], 0xf61e2562,  5);
+		R2(d, a, b, c, x[ 6], 0xc040b340,  9);
+		R2(c, d, a, b, x[11], 0x265e5a51, 14);
+		R2(b, c, d, a, x[ 0], 0xe9b6c7aa, 20);
+		R2(a, b, c, d, x[ 5], 0xd62f105d,  5);
+		R2(d, a, b, c, x[10], 0x02441453,  9);
+		R2(c, d, a, b, x[15], 0xd8a1e681, 14);
+		R2(b, c, d, a, x[ 4], 0xe7d3fbc8, 20);
+		R2(a, b, c, d, x[ 9], 0x21e1cde6,  5);
+		R2(d, a, b, c, x[14], 0xc33707d6,  9);
+		R2(c, d, a, b, x[ 3], 0xf4d50d87, 14);
+		R2(b, c, d, a, x[ 8], 0x455a14ed, 20);
+		R2(a, b, c, d, x[13], 0xa9e3e905,  5);
+		R2(d, a, b, c, x[ 2], 0xfcefa3f8,  9);
+		R2(c, d, a, b, x[ 7], 0x676f02d9, 14);
+		R2(b, c, d, a, x[12], 0x8d2a4c8a, 20);
+
+		/* Round 3 */
+		R3(a, b, c, d, x[ 5], 0xfffa3942,  4);
+		R3(d, a, b, c, x[ 8], 0x8771f681, 11);
+		R3(c, d, a, b, x[11], 0x6d9d6122, 16);
+		R3(b, c, d, a, x[14], 0xfde5380c, 23);
+		R3(a, b, c, d, x[ 1], 0xa4beea44,  4);
+		R3(d, a, b, c, x[ 4], 0x4bdecfa9, 11);
+		R3(c, d, a, b, x[ 7], 0xf6bb4b60, 16);
+		R3(b, c, d, a, x[10], 0xbebfbc70, 23);
+		R3(a, b, c, d, x[13], 0x289b7ec6,  4);
+		R3(d, a, b, c, x[ 0], 0xeaa127fa, 11);
+		R3(c, d, a, b, x[ 3], 0xd4ef3085, 16);
+		R3(b, c, d, a, x[ 6], 0x04881d05, 23);
+		R3(a, b, c, d, x[ 9], 0xd9d4d039,  4);
+		R3(d, a, b, c, x[12], 0xe6db99e5, 11);
+		R3(c, d, a, b, x[15], 0x1fa27cf8, 16);
+		R3(b, c, d, a, x[ 2], 0xc4ac5665, 23);
+
+		/* Round 4 */
+		R4(a, b, c, d, x[ 0], 0xf4292244,  6);
+		R4(d, a, b, c, x[ 7], 0x432aff97, 10);
+		R4(c, d, a, b, x[14], 0xab9423a7, 15);
+		R4(b, c, d, a, x[ 5], 0xfc93a039, 21);
+		R4(a, b, c, d, x[12], 0x655b59c3,  6);
+		R4(d, a, b, c, x[ 3], 0x8f0ccc92, 10);
+		R4(c, d, a, b, x[10], 0xffeff47d, 15);
+		R4(b, c, d, a, x[ 1], 0x85845dd1, 21);
+		R4(a, b, c, d, x[ 8], 0x6fa87e4f,  6);
+		R4(d, a, b, c, x[15], 0xfe2ce6e0, 10);
+		R4(c, d, a, b, x[ 6], 0xa3014314, 15);
+		R4(b, c, d, a, x[13], 0x4e0811a1, 21);
+		R4(a, b, c, d, x[ 4], 0xf7537e82,  6);
+		R4(d, a, b, c, x[11], 0xbd3af235, 10);
+		R4(c, d, a, b, x[ 2], 0x2ad7d2bb, 15);
+		R4(b, c, d, a, x[ 9], 0xeb86d391, 21);
+
+		a += aa;
+		b += bb;
+		c += cc;
+		d += dd;
+	}
+
+	for (l = 0; l < MB_LANES; l++) {
+		state[l][0] = a[l];
+		state[l][1] = b[l];
+		state[l][2] = c[l];
+		state[l][3] = d[l];
+	}
+
+	/*
+	 * Zero out x.
+	 */
+	memset(x, 0, sizeof(x));
+}
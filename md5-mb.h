@@ -0,0 +1,70 @@
+/*-
+ * Copyright (c) 2023, Collin Funk
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHORS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#ifndef CRYPTO_MD5_MB_H
+#define CRYPTO_MD5_MB_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include "md5.h"
+
+#define MD5_MB_MAX_LANES 16
+
+struct md5_mb_job {
+	const void *data; /* Message to hash */
+	size_t len; /* Length of message in bytes */
+	uint8_t digest[16]; /* Message digest, set when the job is returned */
+	void *user; /* Not touched by the engine */
+};
+
+struct md5_mb_lane {
+	struct md5_mb_job *job; /* Job owning the lane or NULL */
+	uint32_t *state; /* Chaining value being advanced */
+	const uint8_t *data; /* Next block to compress */
+	size_t nblocks; /* Blocks left at data */
+	size_t ntail; /* Padded blocks left in tail[] after data */
+	int done; /* Job finished but not yet returned */
+	uint32_t hash[4]; /* Chaining value for jobs */
+	uint8_t tail[128]; /* Final one or two padded blocks */
+};
+
+struct md5_mb_mgr {
+	struct md5_mb_lane lane[MD5_MB_MAX_LANES];
+	int nlanes; /* Lanes of the widest kernel allowed */
+};
+
+void md5_mb_init(struct md5_mb_mgr *);
+int md5_mb_select(const char *);
+const char *md5_mb_name(void);
+struct md5_mb_job *md5_mb_submit(struct md5_mb_mgr *, struct md5_mb_job *);
+struct md5_mb_job *md5_mb_flush(struct md5_mb_mgr *);
+void md5_mb_digest(struct md5_mb_job *, size_t);
+void md5_mb_digest_short(uint8_t (*)[16], const void *, size_t, size_t);
+void md5_mb_update(struct md5_ctx *const [], const void *const [],
+    const size_t [], size_t);
+void md5_mb_final(uint8_t (*)[16], struct md5_ctx *const [], size_t);
+
+#endif /* CRYPTO_MD5_MB_H */
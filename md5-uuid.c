@@ -0,0 +1,222 @@
+/*-
+ * Copyright (c) 2023, Collin Funk
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHORS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * Name-based version 3 UUIDs from RFC 4122, the MD5 of a namespace UUID
+ * followed by a name. The namespace is hashed into a context once and
+ * copied for every name. At 16 bytes it never fills a block, so what is
+ * saved is the copy and count of the prefix rather than a compression.
+ * Batches of names are run side by side through the multi-buffer engine,
+ * where names of up to 39 bytes cost a single block in one lane.
+ */
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+
+#include "md5.h"
+#include "md5-mb.h"
+#include "md5-uuid.h"
+
+#define MD5_UUID_BATCH (4 * MD5_MB_MAX_LANES)
+
+/* Namespaces from appendix C of RFC 4122. */
+const uint8_t md5_uuid_ns_dns[16] = {
+	0x6b, 0xa7, 0xb8, 0x10, 0x9d, 0xad, 0x11, 0xd1,
+	0x80, 0xb4, 0x00, 0xc0, 0x4f, 0xd4, 0x30, 0xc8
+};
+const uint8_t md5_uuid_ns_url[16] = {
+	0x6b, 0xa7, 0xb8, 0x11, 0x9d, 0xad, 0x11, 0xd1,
+	0x80, 0xb4, 0x00, 0xc0, 0x4f, 0xd4, 0x30, 0xc8
+};
+const uint8_t md5_uuid_ns_oid[16] = {
+	0x6b, 0xa7, 0xb8, 0x12, 0x9d, 0xad, 0x11, 0xd1,
+	0x80, 0xb4, 0x00, 0xc0, 0x4f, 0xd4, 0x30, 0xc8
+};
+const uint8_t md5_uuid_ns_x500[16] = {
+	0x6b, 0xa7, 0xb8, 0x14, 0x9d, 0xad, 0x11, 0xd1,
+	0x80, 0xb4, 0x00, 0xc0, 0x4f, 0xd4, 0x30, 0xc8
+};
+
+/*
+ * Overwrite the version and variant fields of a digest.
+ */
+static void
+md5_uuid_stamp(uint8_t uuid[16])
+{
+
+	uuid[6] = (uuid[6] & 0x0f) | 0x30;
+	uuid[8] = (uuid[8] & 0x3f) | 0x80;
+}
+
+void
+md5_uuid_ns_init(struct md5_uuid_ns *ns, const uint8_t uuid[16])
+{
+
+	md5_init(&ns->ctx);
+	md5_update(&ns->ctx, uuid, 16);
+}
+
+void
+md5_uuid3(uint8_t uuid[16], const struct md5_uuid_ns *ns, const void *name,
+    size_t len)
+{
+	struct md5_ctx ctx;
+
+	md5_ctx_copy(&ctx, &ns->ctx);
+	md5_update(&ctx, name, len);
+	md5_final(uuid, &ctx);
+	md5_uuid_stamp(uuid);
+}
+
+/*
+ * UUIDs of n names in one namespace.
+ */
+void
+md5_uuid3_batch(uint8_t (*uuid)[16], const struct md5_uuid_ns *ns,
+    const void *const name[], const size_t len[], size_t n)
+{
+	struct md5_ctx ctx[MD5_UUID_BATCH];
+	struct md5_ctx *ctxp[MD5_UUID_BATCH];
+	size_t i;
+	size_t j;
+	size_t m;
+
+	for (i = 0; i < MD5_UUID_BATCH; i++)
+		ctxp[i] = &ctx[i];
+
+	for (i = 0; i < n; i += m) {
+		m = n - i < MD5_UUID_BATCH ? n - i : MD5_UUID_BATCH;
+		for (j = 0; j < m; j++)
+			md5_ctx_copy(&ctx[j], &ns->ctx);
+		md5_mb_update(ctxp, &name[i], &len[i], m);
+		md5_mb_final(&uuid[i], ctxp, m);
+		for (j = 0; j < m; j++)
+			md5_uuid_stamp(uuid[i + j]);
+	}
+}
+
+/*
+ * Eight lowercase hex digits of v, most significant first, one per byte
+ * of the result from the top down. The nibbles are spread a byte apart
+ * and turned into digits in parallel across the word: adding 6 carries
+ * into the high nibble of exactly the bytes holding 10 to 15.
+ */
+static uint64_t
+md5_uuid_hex8(uint32_t v)
+{
+	uint64_t x;
+
+	x = v;
+	x = (x | x << 16) & 0x0000ffff0000ffffULL;
+	x = (x | x << 8) & 0x00ff00ff00ff00ffULL;
+	x = (x | x << 4) & 0x0f0f0f0f0f0f0f0fULL;
+	return (x + 0x3030303030303030ULL +
+	    (((x + 0x0606060606060606ULL) >> 4) & 0x0101010101010101ULL) *
+	    ('a' - '0' - 10));
+}
+
+static uint32_t
+md5_uuid_get32(const uint8_t *p)
+{
+
+	return ((uint32_t)p[0] << 24 | (uint32_t)p[1] << 16 |
+	    (uint32_t)p[2] << 8 | p[3]);
+}
+
+static void
+md5_uuid_put64(char *p, uint64_t x)
+{
+	int i;
+
+	for (i = 0; i < 8; i++)
+		p[i] = (x >> (56 - 8 * i)) & 0xff;
+}
+
+/*
+ * Write n UUIDs in the canonical 8-4-4-4-12 form, each NUL terminated.
+ */
+void
+md5_uuid_format(char (*out)[MD5_UUID_STRLEN + 1], const uint8_t (*uuid)[16],
+    size_t n)
+{
+	char hex[32];
+	size_t i;
+	int j;
+
+	for (i = 0; i < n; i++) {
+		for (j = 0; j < 4; j++)
+			md5_uuid_put64(&hex[8 * j],
+			    md5_uuid_hex8(md5_uuid_get32(&uuid[i][4 * j])));
+		memcpy(&out[i][0], &hex[0], 8);
+		out[i][8] = '-';
+		memcpy(&out[i][9], &hex[8], 4);
+		out[i][13] = '-';
+		memcpy(&out[i][14], &hex[12], 4);
+		out[i][18] = '-';
+		memcpy(&out[i][19], &hex[16], 4);
+		out[i][23] = '-';
+		memcpy(&out[i][24], &hex[20], 12);
+		out[i][36] = '\0';
+	}
+}
+
+static int
+md5_uuid_nibble(int c)
+{
+
+	if (c >= '0' && c <= '9')
+		return (c - '0');
+	if (c >= 'a' && c <= 'f')
+		return (c - 'a' + 10);
+	if (c >= 'A' && c <= 'F')
+		return (c - 'A' + 10);
+	return (-1);
+}
+
+/*
+ * Read a UUID in the canonical form, in either case. Returns 0, or -1 if
+ * str is anything else.
+ */
+int
+md5_uuid_parse(uint8_t uuid[16], const char *str)
+{
+	int hi;
+	int lo;
+	int i;
+
+	for (i = 0; i < 16; i++) {
+		if (i == 4 || i == 6 || i == 8 || i == 10) {
+			if (*str++ != '-')
+				return (-1);
+		}
+		if ((hi = md5_uuid_nibble(str[0])) < 0 ||
+		    (lo = md5_uuid_nibble(str[1])) < 0)
+			return (-1);
+		uuid[i] = hi << 4 | lo;
+		str += 2;
+	}
+	return (*str == '\0' ? 0 : -1);
+}
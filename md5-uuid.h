@@ -0,0 +1,54 @@
+/*-
+ * Copyright (c) 2023, Collin Funk
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHORS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#ifndef CRYPTO_MD5_UUID_H
+#define CRYPTO_MD5_UUID_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include "md5.h"
+
+#define MD5_UUID_STRLEN 36 /* Canonical form without the NUL */
+
+struct md5_uuid_ns {
+	struct md5_ctx ctx; /* Context after the namespace UUID */
+};
+
+extern const uint8_t md5_uuid_ns_dns[16];
+extern const uint8_t md5_uuid_ns_url[16];
+extern const uint8_t md5_uuid_ns_oid[16];
+extern const uint8_t md5_uuid_ns_x500[16];
+
+void md5_uuid_ns_init(struct md5_uuid_ns *, const uint8_t [16]);
+void md5_uuid3(uint8_t [16], const struct md5_uuid_ns *, const void *,
+    size_t);
+void md5_uuid3_batch(uint8_t (*)[16], const struct md5_uuid_ns *,
+    const void *const [], const size_t [], size_t);
+void md5_uuid_format(char (*)[MD5_UUID_STRLEN + 1], const uint8_t (*)[16],
+    size_t);
+int md5_uuid_parse(uint8_t [16], const char *);
+
+#endif /* CRYPTO_MD5_UUID_H */
@@ -23,12 +23,25 @@
  * SUCH DAMAGE.
  */
 
+#include <sys/uio.h>
+
 #include <stdint.h>
 #include <stddef.h>
+#include <stdlib.h>
 #include <string.h>
 
 #include "md5.h"
 
+#ifdef __GNUC__
+#define MD5_INLINE inline __attribute__((always_inline))
+#define MD5_LOAD(p) __atomic_load_n((p), __ATOMIC_ACQUIRE)
+#define MD5_STORE(p, v) __atomic_store_n((p), (v), __ATOMIC_RELEASE)
+#else
+#define MD5_INLINE inline
+#define MD5_LOAD(p) (*(p))
+#define MD5_STORE(p, v) (*(p) = (v))
+#endif
+
 /*
  * Round functions.
  */
@@ -56,6 +69,40 @@
 	(a) += (b); \
 } while (0)
 
+/*
+ * Round functions with shorter dependency chains. The message word and
+ * constant are added first and F and G are rewritten so that only one
+ * operation of the boolean function waits on b from the previous step.
+ * G can use + since its two terms never have a bit set in common.
+ */
+#define Q1(a, b, c, d, data, constant, shift) do { \
+	(a) += (data) + (constant); \
+	(a) += (d) ^ ((b) & ((c) ^ (d))); \
+	(a) = (((a) << shift) | ((a) >> (32 - (shift)))); \
+	(a) += (b); \
+} while (0)
+
+#define Q2(a, b, c, d, data, constant, shift) do { \
+	(a) += (data) + (constant) + ((c) & (~d)); \
+	(a) += (b) & (d); \
+	(a) = (((a) << shift) | ((a) >> (32 - (shift)))); \
+	(a) += (b); \
+} while (0)
+
+#define Q3(a, b, c, d, data, constant, shift) do { \
+	(a) += (data) + (constant); \
+	(a) += (b) ^ ((c) ^ (d)); \
+	(a) = (((a) << shift) | ((a) >> (32 - (shift)))); \
+	(a) += (b); \
+} while (0)
+
+#define Q4(a, b, c, d, data, constant, shift) do { \
+	(a) += (data) + (constant); \
+	(a) += (c) ^ ((b) | (~d)); \
+	(a) = (((a) << shift) | ((a) >> (32 - (shift)))); \
+	(a) += (b); \
+} while (0)
+
 static uint8_t md5_padding[64] = {
 	0x80, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
 	0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
@@ -74,24 +121,10 @@ md5_init(struct md5_ctx *ctx)
 	ctx->count[1] = 0;
 }
 
-void
-md5_transform(uint32_t state[4], const uint8_t block[64])
+static MD5_INLINE void
+md5_decode(uint32_t x[16], const uint8_t block[64])
 {
-	uint32_t a;
-	uint32_t b;
-	uint32_t c;
-	uint32_t d;
-	uint32_t x[16];
 
-	/*
-	 * Little endian can just memcpy blocks[] into x[].
-	 * The other mess works wherever but might be slower
-	 * on little endian depending on your compiler and optimization
-	 * settings.
-	 */
-#ifdef MD5_LITTLE_ENDIAN
-	memcpy(x, block, sizeof(x));
-#else
 	x[ 0]  =  (uint32_t)block[ 0];
 	x[ 0] |= ((uint32_t)block[ 1]) <<  8;
 	x[ 0] |= ((uint32_t)block[ 2]) << 16;
@@ -156,7 +189,15 @@ md5_transform(uint32_t state[4], const uint8_t block[64])
 	x[15] |= ((uint32_t)block[61]) <<  8;
 	x[15] |= ((uint32_t)block[62]) << 16;
 	x[15] |= ((uint32_t)block[63]) << 24;
-#endif
+}
+
+static MD5_INLINE void
+md5_rounds(uint32_t state[4], const uint32_t x[16])
+{
+	uint32_t a;
+	uint32_t b;
+	uint32_t c;
+	uint32_t d;
 
 	a = state[0];
 	b = state[1];
@@ -240,10 +281,333 @@ md5_transform(uint32_t state[4], const uint8_t block[64])
 	state[2] += c;
 	state[3] += d;
 
+}
+
+static MD5_INLINE void
+md5_rounds_ilp(uint32_t state[4], const uint32_t x[16])
+{
+	uint32_t a;
+	uint32_t b;
+	uint32_t c;
+	uint32_t d;
+
+	a = state[0];
+	b = state[1];
+	c = state[2];
+	d = state[3];
+
+	/* Round 1 */
+	Q1(a, b, c, d, x[ 0], 0xd76aa478,  7);
+	Q1(d, a, b, c, x[ 1], 0xe8c7b756, 12);
+	Q1(c, d, a, b, x[ 2], 0x242070db, 17);
+	Q1(b, c, d, a, x[ 3], 0xc1bdceee, 22);
+	Q1(a, b, c, d, x[ 4], 0xf57c0faf,  7);
+	Q1(d, a, b, c, x[ 5], 0x4787c62a, 12);
+	Q1(c, d, a, b, x[ 6], 0xa8304613, 17);
+	Q1(b, c, d, a, x[ 7], 0xfd469501, 22);
+	Q1(a, b, c, d, x[ 8], 0x698098d8,  7);
+	Q1(d, a, b, c, x[ 9], 0x8b44f7af, 12);
+	Q1(c, d, a, b, x[10], 0xffff5bb1, 17);
+	Q1(b, c, d, a, x[11], 0x895cd7be, 22);
+	Q1(a, b, c, d, x[12], 0x6b901122,  7);
+	Q1(d, a, b, c, x[13], 0xfd987193, 12);
+	Q1(c, d, a, b, x[14], 0xa679438e, 17);
+	Q1(b, c, d, a, x[15], 0x49b40821, 22);
+
+	/* Round 2 */
+	Q2(a, b, c, d, x[ 1], 0xf61e2562,  5);
+	Q2(d, a, b, c, x[ 6], 0xc040b340,  9);
+	Q2(c, d, a, b, x[11], 0x265e5a51, 14);
+	Q2(b, c, d, a, x[ 0], 0xe9b6c7aa, 20);
+	Q2(a, b, c, d, x[ 5], 0xd62f105d,  5);
+	Q2(d, a, b, c, x[10], 0x02441453,  9);
+	Q2(c, d, a, b, x[15], 0xd8a1e681, 14);
+	Q2(b, c, d, a, x[ 4], 0xe7d3fbc8, 20);
+	Q2(a, b, c, d, x[ 9], 0x21e1cde6,  5);
+	Q2(d, a, b, c, x[14], 0xc33707d6,  9);
+	Q2(c, d, a, b, x[ 3], 0xf4d50d87, 14);
+	Q2(b, c, d, a, x[ 8], 0x455a14ed, 20);
+	Q2(a, b, c, d, x[13], 0xa9e3e905,  5);
+	Q2(d, a, b, c, x[ 2], 0xfcefa3f8,  9);
+	Q2(c, d, a, b, x[ 7], 0x676f02d9, 14);
+	Q2(b, c, d, a, x[12], 0x8d2a4c8a, 20);
+
+	/* Round 3 */
+	Q3(a, b, c, d, x[ 5], 0xfffa3942,  4);
+	Q3(d, a, b, c, x[ 8], 0x8771f681, 11);
+	Q3(c, d, a, b, x[11], 0x6d9d6122, 16);
+	Q3(b, c, d, a, x[14], 0xfde5380c, 23);
+	Q3(a, b, c, d, x[ 1], 0xa4beea44,  4);
+	Q3(d, a, b, c, x[ 4], 0x4bdecfa9, 11);
+	Q3(c, d, a, b, x[ 7], 0xf6bb4b60, 16);
+	Q3(b, c, d, a, x[10], 0xbebfbc70, 23);
+	Q3(a, b, c, d, x[13], 0x289b7ec6,  4);
+	Q3(d, a, b, c, x[ 0], 0xeaa127fa, 11);
+	Q3(c, d, a, b, x[ 3], 0xd4ef3085, 16);
+	Q3(b, c, d, a, x[ 6], 0x04881d05, 23);
+	Q3(a, b, c, d, x[ 9], 0xd9d4d039,  4);
+	Q3(d, a, b, c, x[12], 0xe6db99e5, 11);
+	Q3(c, d, a, b, x[15], 0x1fa27cf8, 16);
+	Q3(b, c, d, a, x[ 2], 0xc4ac5665, 23);
+
+	/* Round 4 */
+	Q4(a, b, c, d, x[ 0], 0xf4292244,  6);
+	Q4(d, a, b, c, x[ 7], 0x432aff97, 10);
+	Q4(c, d, a, b, x[14], 0xab9423a7, 15);
+	Q4(b, c, d, a, x[ 5], 0xfc93a039, 21);
+	Q4(a, b, c, d, x[12], 0x655b59c3,  6);
+	Q4(d, a, b, c, x[ 3], 0x8f0ccc92, 10);
+	Q4(c, d, a, b, x[10], 0xffeff47d, 15);
+	Q4(b, c, d, a, x[ 1], 0x85845dd1, 21);
+	Q4(a, b, c, d, x[ 8], 0x6fa87e4f,  6);
+	Q4(d, a, b, c, x[15], 0xfe2ce6e0, 10);
+	Q4(c, d, a, b, x[ 6], 0xa3014314, 15);
+	Q4(b, c, d, a, x[13], 0x4e0811a1, 21);
+	Q4(a, b, c, d, x[ 4], 0xf7537e82,  6);
+	Q4(d, a, b, c, x[11], 0xbd3af235, 10);
+	Q4(c, d, a, b, x[ 2], 0x2ad7d2bb, 15);
+	Q4(b, c, d, a, x[ 9], 0xeb86d391, 21);
+
+	state[0] += a;
+	state[1] += b;
+	state[2] += c;
+	state[3] += d;
+
+}
+
+/*
+ * Transform kernels. They only differ in how x[] is loaded and which
+ * round functions are used, all of them give the same result. The
+ * state is kept in s[] so it can stay in registers from one block to
+ * the next, stores to state[] could otherwise alias data.
+ */
+static void
+md5_transform_generic(uint32_t state[4], const uint8_t *data, size_t nblocks)
+{
+	uint32_t s[4];
+	uint32_t x[16];
+
+	memcpy(s, state, sizeof(s));
+	for (; nblocks != 0; nblocks--, data += 64) {
+		md5_decode(x, data);
+		md5_rounds(s, x);
+	}
+	memcpy(state, s, sizeof(s));
+
 	/*
-	 * Zero out x.
+	 * Zero out x and s.
+	 */
+	memset(x, 0, sizeof(x));
+	memset(s, 0, sizeof(s));
+}
+
+/*
+ * Little endian can just memcpy data[] into x[].
+ */
+static void
+md5_transform_le(uint32_t state[4], const uint8_t *data, size_t nblocks)
+{
+	uint32_t s[4];
+	uint32_t x[16];
+
+	memcpy(s, state, sizeof(s));
+	for (; nblocks != 0; nblocks--, data += 64) {
+		memcpy(x, data, sizeof(x));
+		md5_rounds(s, x);
+	}
+	memcpy(state, s, sizeof(s));
+
+	/*
+	 * Zero out x and s.
+	 */
+	memset(x, 0, sizeof(x));
+	memset(s, 0, sizeof(s));
+}
+
+static void
+md5_transform_ilp(uint32_t state[4], const uint8_t *data, size_t nblocks)
+{
+	uint32_t s[4];
+	uint32_t x[16];
+
+	memcpy(s, state, sizeof(s));
+	for (; nblocks != 0; nblocks--, data += 64) {
+		md5_decode(x, data);
+		md5_rounds_ilp(s, x);
+	}
+	memcpy(state, s, sizeof(s));
+
+	/*
+	 * Zero out x and s.
+	 */
+	memset(x, 0, sizeof(x));
+	memset(s, 0, sizeof(s));
+}
+
+static int
+md5_has_any(void)
+{
+
+	return (1);
+}
+
+static int
+md5_has_le(void)
+{
+	const uint32_t one = 1;
+
+	return (*(const uint8_t *)&one == 1);
+}
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+/*
+ * Same as ilp but lets the compiler use andn and rorx, which saves a
+ * move per step since neither overwrites its source.
+ */
+__attribute__((target("bmi,bmi2"))) static void
+md5_transform_bmi(uint32_t state[4], const uint8_t *data, size_t nblocks)
+{
+	uint32_t s[4];
+	uint32_t x[16];
+
+	memcpy(s, state, sizeof(s));
+	for (; nblocks != 0; nblocks--, data += 64) {
+		md5_decode(x, data);
+		md5_rounds_ilp(s, x);
+	}
+	memcpy(state, s, sizeof(s));
+
+	/*
+	 * Zero out x and s.
 	 */
 	memset(x, 0, sizeof(x));
+	memset(s, 0, sizeof(s));
+}
+
+static int
+md5_has_bmi(void)
+{
+
+	return (__builtin_cpu_supports("bmi") && __builtin_cpu_supports("bmi2"));
+}
+#endif
+
+struct md5_kernel {
+	const char *name;
+	void (*transform)(uint32_t [4], const uint8_t *, size_t);
+	int (*supported)(void);
+};
+
+/*
+ * In order of preference.
+ */
+static const struct md5_kernel md5_kernels[] = {
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+	{ "bmi", md5_transform_bmi, md5_has_bmi },
+#endif
+	{ "ilp", md5_transform_ilp, md5_has_any },
+	{ "le", md5_transform_le, md5_has_le },
+	{ "generic", md5_transform_generic, md5_has_any },
+	{ NULL, NULL, NULL }
+};
+
+/*
+ * The selected kernel, or NULL until the first call resolves it. It is
+ * published with a release store and read with an acquire load, so any
+ * thread may be the first to hash; racing first calls all store the
+ * same kernel.
+ */
+static const struct md5_kernel *md5_kernel;
+
+static const struct md5_kernel *
+md5_kernel_lookup(const char *name)
+{
+	const struct md5_kernel *k;
+
+	for (k = md5_kernels; k->name != NULL; k++) {
+		if (strcmp(k->name, name) == 0)
+			return (k->supported() ? k : NULL);
+	}
+	return (NULL);
+}
+
+/*
+ * Use the kernel named by $MD5_TRANSFORM if set and supported,
+ * otherwise the first supported one.
+ */
+static const struct md5_kernel *
+md5_kernel_resolve(void)
+{
+	const struct md5_kernel *k;
+	const char *env;
+
+	k = NULL;
+	if ((env = getenv("MD5_TRANSFORM")) != NULL)
+		k = md5_kernel_lookup(env);
+	if (k == NULL) {
+		for (k = md5_kernels; !k->supported(); k++)
+			;
+	}
+	MD5_STORE(&md5_kernel, k);
+	return (k);
+}
+
+static MD5_INLINE const struct md5_kernel *
+md5_kernel_current(void)
+{
+	const struct md5_kernel *k;
+
+	if ((k = MD5_LOAD(&md5_kernel)) == NULL)
+		k = md5_kernel_resolve();
+	return (k);
+}
+
+static MD5_INLINE void
+md5_transform_fn(uint32_t state[4], const uint8_t *data, size_t nblocks)
+{
+
+	md5_kernel_current()->transform(state, data, nblocks);
+}
+
+void
+md5_transform(uint32_t state[4], const uint8_t block[64])
+{
+
+	md5_transform_fn(state, block, 1);
+}
+
+/*
+ * Same as calling md5_transform on each of the nblocks 64-byte blocks at
+ * data, without reloading the state or clearing scratch space in
+ * between.
+ */
+void
+md5_transform_blocks(uint32_t state[4], const uint8_t *data, size_t nblocks)
+{
+
+	md5_transform_fn(state, data, nblocks);
+}
+
+/*
+ * Force a kernel by name. Returns -1 if it is unknown or the CPU does
+ * not support it.
+ */
+int
+md5_transform_select(const char *name)
+{
+	const struct md5_kernel *k;
+
+	if ((k = md5_kernel_lookup(name)) == NULL)
+		return (-1);
+	MD5_STORE(&md5_kernel, k);
+	return (0);
+}
+
+const char *
+md5_transform_name(void)
+{
+
+	return (md5_kernel_current()->name);
 }
 
 void
@@ -252,7 +616,8 @@ md5_update(struct md5_ctx *ctx, const void *inputptr, size_t inputlen)
 	const uint8_t *input;
 	size_t partlen;
 	size_t index;
-	uint32_t i;
+	size_t nblocks;
+	size_t i;
 
 	input = inputptr;
 
@@ -263,25 +628,106 @@ md5_update(struct md5_ctx *ctx, const void *inputptr, size_t inputlen)
 	 * ctx->count[0] += (inputlen * 8);
 	 * If ctx->count[0] overflows increment ctx->count[1].
 	 */
-	if ((ctx->count[0] += ((uint32_t)inputlen << 3)) < (uint32_t)inputlen)
+	if ((ctx->count[0] += ((uint32_t)inputlen << 3)) <
+	    ((uint32_t)inputlen << 3))
 		ctx->count[1]++;
-	ctx->count[1] += ((uint32_t)inputlen >> 29);
+	ctx->count[1] += (uint32_t)((uint64_t)inputlen >> 29);
 
 	partlen = 64 - index;
 	i = 0;
 
 	if (inputlen >= partlen) {
 		memcpy(&ctx->buffer[index], input, partlen);
-		md5_transform(ctx->state, ctx->buffer);
+		md5_transform_fn(ctx->state, ctx->buffer, 1);
 
-		for (i = partlen; i + 63 < inputlen; i += 64)
-			md5_transform(ctx->state, &input[i]);
+		i = partlen;
+		nblocks = (inputlen - i) / 64;
+		md5_transform_fn(ctx->state, &input[i], nblocks);
+		i += nblocks * 64;
 		index = 0;
 	}
 
 	memcpy(&ctx->buffer[index], &input[i], inputlen - i);
 }
 
+/*
+ * Same as md5_update over each of the iovcnt buffers of iov in turn. A
+ * block that straddles buffers is assembled in ctx->buffer, whole blocks
+ * are transformed where they lie.
+ */
+void
+md5_updatev(struct md5_ctx *ctx, const struct iovec *iov, int iovcnt)
+{
+	const uint8_t *input;
+	uint64_t total;
+	size_t inputlen;
+	size_t partlen;
+	size_t index;
+	size_t nblocks;
+	int i;
+
+	total = 0;
+	for (i = 0; i < iovcnt; i++)
+		total += iov[i].iov_len;
+
+	/* index = (ctx->count[0] / 8) % 64; */
+	index = (size_t)((ctx->count[0] >> 3) & 0x3f);
+
+	if ((ctx->count[0] += ((uint32_t)total << 3)) < ((uint32_t)total << 3))
+		ctx->count[1]++;
+	ctx->count[1] += (uint32_t)(total >> 29);
+
+	for (i = 0; i < iovcnt; i++) {
+		input = iov[i].iov_base;
+		inputlen = iov[i].iov_len;
+
+		if (index != 0) {
+			partlen = 64 - index;
+			if (inputlen < partlen) {
+				memcpy(&ctx->buffer[index], input, inputlen);
+				index += inputlen;
+				continue;
+			}
+			memcpy(&ctx->buffer[index], input, partlen);
+			md5_transform_fn(ctx->state, ctx->buffer, 1);
+			input += partlen;
+			inputlen -= partlen;
+			index = 0;
+		}
+
+		nblocks = inputlen / 64;
+		if (nblocks != 0) {
+			md5_transform_fn(ctx->state, input, nblocks);
+			input += nblocks * 64;
+			inputlen -= nblocks * 64;
+		}
+		memcpy(ctx->buffer, input, inputlen);
+		index = inputlen;
+	}
+}
+
+static void
+md5_encode(uint8_t digest[16], const uint32_t state[4])
+{
+
+	digest[ 0] = (state[0]) & 0xff;
+	digest[ 1] = (state[0] >> 8) & 0xff;
+	digest[ 2] = (state[0] >> 16) & 0xff;
+	digest[ 3] = (state[0] >> 24)& 0xff;
+	digest[ 4] = (state[1]) & 0xff;
+	digest[ 5] = (state[1] >> 8) & 0xff;
+	digest[ 6] = (state[1] >> 16) & 0xff;
+	digest[ 7] = (state[1] >> 24)& 0xff;
+	digest[ 8] = (state[2]) & 0xff;
+	digest[ 9] = (state[2] >> 8) & 0xff;
+	digest[10] = (state[2] >> 16) & 0xff;
+	digest[11] = (state[2] >> 24)& 0xff;
+	digest[12] = (state[3]) & 0xff;
+	digest[13] = (state[3] >> 8) & 0xff;
+	digest[14] = (state[3] >> 16) & 0xff;
+	digest[15] = (state[3] >> 24)& 0xff;
+}
+
 void
 md5_final(uint8_t digest[16], struct md5_ctx *ctx)
 {
@@ -306,24 +752,8 @@ md5_final(uint8_t digest[16], struct md5_ctx *ctx)
 	md5_update(ctx, md5_padding, (padlen - 8));
 	md5_update(ctx, bits, 8);
 
-	if (digest != NULL) {
-		digest[ 0] = (ctx->state[0]) & 0xff;
-		digest[ 1] = (ctx->state[0] >> 8) & 0xff;
-		digest[ 2] = (ctx->state[0] >> 16) & 0xff;
-		digest[ 3] = (ctx->state[0] >> 24)& 0xff;
-		digest[ 4] = (ctx->state[1]) & 0xff;
-		digest[ 5] = (ctx->state[1] >> 8) & 0xff;
-		digest[ 6] = (ctx->state[1] >> 16) & 0xff;
-		digest[ 7] = (ctx->state[1] >> 24)& 0xff;
-		digest[ 8] = (ctx->state[2]) & 0xff;
-		digest[ 9] = (ctx->state[2] >> 8) & 0xff;
-		digest[10] = (ctx->state[2] >> 16) & 0xff;
-		digest[11] = (ctx->state[2] >> 24)& 0xff;
-		digest[12] = (ctx->state[3]) & 0xff;
-		digest[13] = (ctx->state[3] >> 8) & 0xff;
-		digest[14] = (ctx->state[3] >> 16) & 0xff;
-		digest[15] = (ctx->state[3] >> 24)& 0xff;
-	}
+	if (digest != NULL)
+		md5_encode(digest, ctx->state);
 
 	/*
 	 * Zero out context.
@@ -331,3 +761,229 @@ md5_final(uint8_t digest[16], struct md5_ctx *ctx)
 	memset(ctx, 0, sizeof(*ctx));
 }
 
+/*
+ * Copy src to dst, so a message prefix hashed once can be finished with
+ * many suffixes. Only the bytes buffered in src are copied.
+ */
+void
+md5_ctx_copy(struct md5_ctx *dst, const struct md5_ctx *src)
+{
+
+	memcpy(dst->state, src->state, sizeof(dst->state));
+	dst->count[0] = src->count[0];
+	dst->count[1] = src->count[1];
+	memcpy(dst->buffer, src->buffer, (src->count[0] >> 3) & 0x3f);
+}
+
+/*
+ * Same as md5_init, md5_update and md5_final on a whole message, but
+ * full blocks are compressed straight from data and only the padded
+ * final one or two blocks are built on the stack.
+ */
+void
+md5_digest(uint8_t digest[16], const void *data, size_t len)
+{
+	const uint8_t *input;
+	uint32_t state[4];
+	uint8_t block[128];
+	uint64_t bits;
+	size_t nblocks;
+	size_t rem;
+	int i;
+
+	input = data;
+	state[0] = 0x67452301;
+	state[1] = 0xefcdab89;
+	state[2] = 0x98badcfe;
+	state[3] = 0x10325476;
+
+	nblocks = len / 64;
+	md5_transform_fn(state, input, nblocks);
+	input += nblocks * 64;
+
+	/* Pad to 56 mod 64 and append the length in bits. */
+	rem = len % 64;
+	nblocks = (rem < 56) ? 1 : 2;
+	memcpy(block, input, rem);
+	block[rem] = 0x80;
+	memset(&block[rem + 1], 0, nblocks * 64 - 8 - (rem + 1));
+	bits = (uint64_t)len << 3;
+	for (i = 0; i < 8; i++)
+		block[nblocks * 64 - 8 + i] = (bits >> (8 * i)) & 0xff;
+	md5_transform_fn(state, block, nblocks);
+
+	md5_encode(digest, state);
+
+	/*
+	 * Zero out state and block.
+	 */
+	memset(state, 0, sizeof(state));
+	memset(block, 0, sizeof(block));
+}
+
+/*
+ * Messages of up to 55 bytes fit in one padded block. With len known at
+ * compile time every word after the message, the 0x80 byte and the
+ * length word are constants and get folded into the round additions.
+ */
+static MD5_INLINE void
+md5_short(uint8_t digest[16], const uint8_t *msg, size_t len)
+{
+	uint32_t state[4];
+	uint32_t x[16];
+	size_t i;
+
+	memset(x, 0, sizeof(x));
+	for (i = 0; i < len / 4; i++) {
+		x[i] = (uint32_t)msg[4 * i] |
+		    ((uint32_t)msg[4 * i + 1] << 8) |
+		    ((uint32_t)msg[4 * i + 2] << 16) |
+		    ((uint32_t)msg[4 * i + 3] << 24);
+	}
+	switch (len % 4) {
+	case 3:
+		x[i] |= (uint32_t)msg[4 * i + 2] << 16;
+		/* FALLTHROUGH */
+	case 2:
+		x[i] |= (uint32_t)msg[4 * i + 1] << 8;
+		/* FALLTHROUGH */
+	case 1:
+		x[i] |= (uint32_t)msg[4 * i];
+		break;
+	}
+	x[len / 4] |= (uint32_t)0x80 << (8 * (len % 4));
+	x[14] = (uint32_t)len << 3;
+
+	state[0] = 0x67452301;
+	state[1] = 0xefcdab89;
+	state[2] = 0x98badcfe;
+	state[3] = 0x10325476;
+	md5_rounds_ilp(state, x);
+	md5_encode(digest, state);
+
+	/*
+	 * Zero out x.
+	 */
+	memset(x, 0, sizeof(x));
+}
+
+#define MD5_SHORT(n) \
+static void \
+md5_short_##n(uint8_t digest[16], const uint8_t *msg) \
+{ \
+	md5_short(digest, msg, n); \
+}
+
+MD5_SHORT(0)  MD5_SHORT(1)  MD5_SHORT(2)  MD5_SHORT(3)
+MD5_SHORT(4)  MD5_SHORT(5)  MD5_SHORT(6)  MD5_SHORT(7)
+MD5_SHORT(8)  MD5_SHORT(9)  MD5_SHORT(10) MD5_SHORT(11)
+MD5_SHORT(12) MD5_SHORT(13) MD5_SHORT(14) MD5_SHORT(15)
+MD5_SHORT(16) MD5_SHORT(17) MD5_SHORT(18) MD5_SHORT(19)
+MD5_SHORT(20) MD5_SHORT(21) MD5_SHORT(22) MD5_SHORT(23)
+MD5_SHORT(24) MD5_SHORT(25) MD5_SHORT(26) MD5_SHORT(27)
+MD5_SHORT(28) MD5_SHORT(29) MD5_SHORT(30) MD5_SHORT(31)
+MD5_SHORT(32) MD5_SHORT(33) MD5_SHORT(34) MD5_SHORT(35)
+MD5_SHORT(36) MD5_SHORT(37) MD5_SHORT(38) MD5_SHORT(39)
+MD5_SHORT(40) MD5_SHORT(41) MD5_SHORT(42) MD5_SHORT(43)
+MD5_SHORT(44) MD5_SHORT(45) MD5_SHORT(46) MD5_SHORT(47)
+MD5_SHORT(48) MD5_SHORT(49) MD5_SHORT(50) MD5_SHORT(51)
+MD5_SHORT(52) MD5_SHORT(53) MD5_SHORT(54) MD5_SHORT(55)
+
+static void (*const md5_short_fn[56])(uint8_t [16], const uint8_t *) = {
+	md5_short_0,  md5_short_1,  md5_short_2,  md5_short_3,
+	md5_short_4,  md5_short_5,  md5_short_6,  md5_short_7,
+	md5_short_8,  md5_short_9,  md5_short_10, md5_short_11,
+	md5_short_12, md5_short_13, md5_short_14, md5_short_15,
+	md5_short_16, md5_short_17, md5_short_18, md5_short_19,
+	md5_short_20, md5_short_21, md5_short_22, md5_short_23,
+	md5_short_24, md5_short_25, md5_short_26, md5_short_27,
+	md5_short_28, md5_short_29, md5_short_30, md5_short_31,
+	md5_short_32, md5_short_33, md5_short_34, md5_short_35,
+	md5_short_36, md5_short_37, md5_short_38, md5_short_39,
+	md5_short_40, md5_short_41, md5_short_42, md5_short_43,
+	md5_short_44, md5_short_45, md5_short_46, md5_short_47,
+	md5_short_48, md5_short_49, md5_short_50, md5_short_51,
+	md5_short_52, md5_short_53, md5_short_54, md5_short_55
+};
+
+/*
+ * Same as md5_digest. Messages of up to 55 bytes use a kernel built for
+ * their exact length, longer ones go to md5_digest.
+ */
+void
+md5_digest_short(uint8_t digest[16], const void *data, size_t len)
+{
+
+	if (len < 56)
+		md5_short_fn[len](digest, data);
+	else
+		md5_digest(digest, data, len);
+}
+
+/*
+ * Serialize a context. The layout does not depend on the host:
+ *
+ *   0   "md5c"     magic
+ *   4   1          version
+ *   5   0, 0, 0    reserved
+ *   8   state[4]   little-endian 32-bit words
+ *   24  count      little-endian 64-bit number of bits hashed
+ *   32  buffer     the count / 8 % 64 bytes not yet compressed, then zeros
+ */
+void
+md5_export(uint8_t out[MD5_EXPORT_SIZE], const struct md5_ctx *ctx)
+{
+	uint64_t count;
+	size_t used;
+	int i;
+
+	memset(out, 0, MD5_EXPORT_SIZE);
+	memcpy(out, "md5c", 4);
+	out[4] = MD5_EXPORT_VERSION;
+	for (i = 0; i < 16; i++)
+		out[8 + i] = (ctx->state[i / 4] >> (8 * (i % 4))) & 0xff;
+	count = ((uint64_t)ctx->count[1] << 32) | ctx->count[0];
+	for (i = 0; i < 8; i++)
+		out[24 + i] = (count >> (8 * i)) & 0xff;
+	used = (count >> 3) & 0x3f;
+	memcpy(out + 32, ctx->buffer, used);
+}
+
+/*
+ * Restore a context saved by md5_export. Returns -1 if in is not an
+ * exported md5 context of a version we know.
+ */
+int
+md5_import(struct md5_ctx *ctx, const uint8_t in[MD5_EXPORT_SIZE])
+{
+	uint64_t count;
+	size_t used;
+	int i;
+
+	if (memcmp(in, "md5c", 4) != 0 || in[4] != MD5_EXPORT_VERSION ||
+	    in[5] != 0 || in[6] != 0 || in[7] != 0)
+		return (-1);
+	count = 0;
+	for (i = 0; i < 8; i++)
+		count |= (uint64_t)in[24 + i] << (8 * i);
+	if ((count & 7) != 0)
+		return (-1);
+	used = (count >> 3) & 0x3f;
+	for (i = 32 + used; i < MD5_EXPORT_SIZE; i++) {
+		if (in[i] != 0)
+			return (-1);
+	}
+
+	for (i = 0; i < 4; i++) {
+		ctx->state[i] = (uint32_t)in[8 + 4 * i] |
+		    (uint32_t)in[9 + 4 * i] << 8 |
+		    (uint32_t)in[10 + 4 * i] << 16 |
+		    (uint32_t)in[11 + 4 * i] << 24;
+	}
+	ctx->count[0] = count & 0xffffffff;
+	ctx->count[1] = count >> 32;
+	memset(ctx->buffer, 0, sizeof(ctx->buffer));
+	memcpy(ctx->buffer, in + 32, used);
+
+	return (0);
+}
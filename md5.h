@@ -29,6 +29,11 @@
 #include <stdint.h>
 #include <stddef.h>
 
+#define MD5_EXPORT_SIZE 96
+#define MD5_EXPORT_VERSION 1
+
+struct iovec;
+
 struct md5_ctx {
 	uint32_t state[4]; /* 4 32-bit state words */
 	uint32_t count[2]; /* Number of bits mod 2^64 */
@@ -37,8 +42,17 @@ struct md5_ctx {
 
 void md5_init(struct md5_ctx *);
 void md5_transform(uint32_t [4], const uint8_t [64]);
+void md5_transform_blocks(uint32_t [4], const uint8_t *, size_t);
+int md5_transform_select(const char *);
+const char *md5_transform_name(void);
 void md5_update(struct md5_ctx *, const void *, size_t);
+void md5_updatev(struct md5_ctx *, const struct iovec *, int);
 void md5_final(uint8_t [16], struct md5_ctx *);
+void md5_ctx_copy(struct md5_ctx *, const struct md5_ctx *);
+void md5_digest(uint8_t [16], const void *, size_t);
+void md5_digest_short(uint8_t [16], const void *, size_t);
+void md5_export(uint8_t [MD5_EXPORT_SIZE], const struct md5_ctx *);
+int md5_import(struct md5_ctx *, const uint8_t [MD5_EXPORT_SIZE]);
 
 #endif /* CRYPTO_MD5_H */
 
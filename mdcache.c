@@ -0,0 +1,469 @@
+/*-
+ * Copyright (c) 2023, Collin Funk
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHORS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * A cache of file digests kept in a file that is mapped into every
+ * process using it. An entry is keyed by device and inode and holds the
+ * size, modification and change times the file had when it was hashed,
+ * so a file whose stat() still agrees is not read again.
+ *
+ * The file is a header followed by a table of 64 byte entries, in the
+ * host's byte order. A file may be kept in any of MDCACHE_WAYS entries
+ * picked by its device and inode; when they are all taken by other files
+ * one of them is replaced. Each entry carries a sequence number that is
+ * odd while it is being written, so readers never take a lock: they read
+ * the number, the entry and the number again, and treat an entry that
+ * changed under them as a miss. Writers are serialized by a mutex within
+ * a process and by a lock on the file between processes.
+ *
+ * A file changed less than cache->settle ago is hashed but not stored,
+ * since a second change within the same clock tick would leave its times
+ * as they were.
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <sys/types.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "mdcache.h"
+#include "mdfile.h"
+
+#define MDCACHE_VERSION 1
+#define MDCACHE_HEADER 64
+#define MDCACHE_ORDER 0x01020304
+
+struct mdcache_header {
+	char magic[4];
+	uint32_t version;
+	uint32_t algo;
+	uint32_t order; /* MDCACHE_ORDER as written by this host */
+	uint64_t nslots;
+	uint8_t unused[40];
+};
+
+static uint64_t
+mdcache_mix(uint64_t dev, uint64_t ino)
+{
+	uint64_t h;
+
+	h = dev * 0x9e3779b97f4a7c15ULL ^ ino;
+	h ^= h >> 30;
+	h *= 0xbf58476d1ce4e5b9ULL;
+	h ^= h >> 27;
+	h *= 0x94d049bb133111ebULL;
+	h ^= h >> 31;
+	return (h);
+}
+
+/*
+ * Take or drop the write lock on the whole file, type being F_WRLCK or
+ * F_UNLCK.
+ */
+static int
+mdcache_lock(int fd, int type)
+{
+	struct flock fl;
+
+	memset(&fl, 0, sizeof(fl));
+	fl.l_type = type;
+	fl.l_whence = SEEK_SET;
+	while (fcntl(fd, F_SETLKW, &fl) != 0) {
+		if (errno != EINTR)
+			return (-1);
+	}
+	return (0);
+}
+
+static int64_t
+mdcache_ns(const struct timespec *ts)
+{
+
+	return ((int64_t)ts->tv_sec * 1000000000 + ts->tv_nsec);
+}
+
+static struct mdcache_entry *
+mdcache_bucket(const struct mdcache *cache, const struct stat *st)
+{
+	uint64_t h;
+
+	h = mdcache_mix(st->st_dev, st->st_ino);
+	return (&cache->slot[(h & (cache->nslots / MDCACHE_WAYS - 1)) *
+	    MDCACHE_WAYS]);
+}
+
+/*
+ * Map the table of an open cache file. Fails with EINVAL if the file is
+ * empty, damaged or kept for another algorithm or byte order.
+ */
+static int
+mdcache_map(struct mdcache *cache, int fd)
+{
+	struct mdcache_header hdr;
+	struct stat st;
+	void *map;
+	int prot;
+
+	if (fstat(fd, &st) != 0)
+		return (-1);
+	if (pread(fd, &hdr, sizeof(hdr), 0) != sizeof(hdr) ||
+	    memcmp(hdr.magic, "MDHC", 4) != 0 ||
+	    hdr.version != MDCACHE_VERSION || hdr.algo != (uint32_t)cache->algo ||
+	    hdr.order != MDCACHE_ORDER || hdr.nslots < MDCACHE_WAYS ||
+	    (hdr.nslots & (hdr.nslots - 1)) != 0 ||
+	    hdr.nslots > (SIZE_MAX - MDCACHE_HEADER) /
+	    sizeof(struct mdcache_entry) ||
+	    (uint64_t)st.st_size != MDCACHE_HEADER +
+	    hdr.nslots * sizeof(struct mdcache_entry)) {
+		errno = EINVAL;
+		return (-1);
+	}
+
+	prot = PROT_READ | (cache->readonly ? 0 : PROT_WRITE);
+	if ((map = mmap(NULL, st.st_size, prot, MAP_SHARED, fd, 0)) ==
+	    MAP_FAILED)
+		return (-1);
+	cache->map = map;
+	cache->maplen = st.st_size;
+	cache->slot = (struct mdcache_entry *)((uint8_t *)map +
+	    MDCACHE_HEADER);
+	cache->nslots = hdr.nslots;
+
+	return (0);
+}
+
+/*
+ * Write an empty table next to path and rename it into place. Processes
+ * that still have the old file mapped keep using it until they reopen.
+ */
+static int
+mdcache_create(const char *path, int algo, uint64_t nslots)
+{
+	struct mdcache_header hdr;
+	char *tmp;
+	int error;
+	int fd;
+
+	if ((tmp = malloc(strlen(path) + 32)) == NULL)
+		return (-1);
+	sprintf(tmp, "%s.%ld.tmp", path, (long)getpid());
+	if ((fd = open(tmp, O_RDWR | O_CREAT | O_TRUNC, 0644)) < 0) {
+		free(tmp);
+		return (-1);
+	}
+
+	memset(&hdr, 0, sizeof(hdr));
+	memcpy(hdr.magic, "MDHC", 4);
+	hdr.version = MDCACHE_VERSION;
+	hdr.algo = algo;
+	hdr.order = MDCACHE_ORDER;
+	hdr.nslots = nslots;
+	error = 0;
+	if (ftruncate(fd, MDCACHE_HEADER +
+	    nslots * sizeof(struct mdcache_entry)) != 0 ||
+	    pwrite(fd, &hdr, sizeof(hdr), 0) != sizeof(hdr) ||
+	    rename(tmp, path) != 0)
+		error = errno != 0 ? errno : EIO;
+	if (error != 0) {
+		close(fd);
+		unlink(tmp);
+		free(tmp);
+		errno = error;
+		return (-1);
+	}
+	free(tmp);
+
+	return (fd);
+}
+
+/*
+ * Open the cache at path, creating it with room for nslots entries (0
+ * for MDCACHE_SLOTS) if it is missing, damaged or kept for the other
+ * algorithm. A cache that cannot be written is used for lookups only, or
+ * left empty if it cannot be used at all.
+ */
+int
+mdcache_open(struct mdcache *cache, const char *path, int algo,
+    uint64_t nslots)
+{
+	uint64_t n;
+	int error;
+	int fd;
+	int nfd;
+
+	memset(cache, 0, sizeof(*cache));
+	cache->fd = -1;
+	cache->algo = algo;
+	cache->settle = MDCACHE_SETTLE;
+	if (nslots == 0)
+		nslots = MDCACHE_SLOTS;
+	for (n = MDCACHE_WAYS; n < nslots && n < ((uint64_t)1 << 40); n *= 2)
+		;
+	nslots = n;
+
+	if ((fd = open(path, O_RDWR | O_CREAT, 0644)) < 0) {
+		if (errno != EACCES && errno != EROFS)
+			return (-1);
+		if ((fd = open(path, O_RDONLY)) < 0)
+			return (-1);
+		cache->readonly = 1;
+	}
+	if (cache->readonly) {
+		if (mdcache_map(cache, fd) != 0 && errno != EINVAL)
+			goto fail;
+		cache->fd = fd;
+		pthread_mutex_init(&cache->lock, NULL);
+		return (0);
+	}
+
+	if (mdcache_lock(fd, F_WRLCK) != 0)
+		goto fail;
+	if (mdcache_map(cache, fd) != 0) {
+		if (errno != EINVAL ||
+		    (nfd = mdcache_create(path, algo, nslots)) < 0)
+			goto fail;
+		close(fd);
+		fd = nfd;
+		if (mdcache_map(cache, fd) != 0)
+			goto fail;
+	}
+	mdcache_lock(fd, F_UNLCK);
+	cache->fd = fd;
+	pthread_mutex_init(&cache->lock, NULL);
+
+	return (0);
+
+fail:
+	error = errno;
+	close(fd);
+	errno = error;
+	return (-1);
+}
+
+int
+mdcache_close(struct mdcache *cache)
+{
+	int ret;
+
+	ret = 0;
+	if (cache->map != NULL)
+		munmap(cache->map, cache->maplen);
+	if (cache->fd >= 0 && close(cache->fd) != 0)
+		ret = -1;
+	if (cache->fd >= 0)
+		pthread_mutex_destroy(&cache->lock);
+	cache->map = NULL;
+	cache->slot = NULL;
+	cache->fd = -1;
+
+	return (ret);
+}
+
+/*
+ * Look up a file by what stat() gave for it. Returns 1 and sets digest
+ * if the cache holds the file as it is now, 0 otherwise. Safe to call
+ * from any number of threads while others insert.
+ */
+int
+mdcache_lookup(struct mdcache *cache, uint8_t digest[16],
+    const struct stat *st)
+{
+	struct mdcache_entry *e;
+	uint64_t d[2];
+	uint64_t seq;
+	int match;
+	int w;
+
+	if (cache->slot != NULL && S_ISREG(st->st_mode)) {
+		e = mdcache_bucket(cache, st);
+		for (w = 0; w < MDCACHE_WAYS; w++, e++) {
+			seq = __atomic_load_n(&e->seq, __ATOMIC_ACQUIRE);
+			if (seq == 0 || (seq & 1) != 0)
+				continue;
+			match = __atomic_load_n(&e->dev, __ATOMIC_RELAXED) ==
+			    (uint64_t)st->st_dev &&
+			    __atomic_load_n(&e->ino, __ATOMIC_RELAXED) ==
+			    (uint64_t)st->st_ino &&
+			    __atomic_load_n(&e->size, __ATOMIC_RELAXED) ==
+			    (uint64_t)st->st_size &&
+			    __atomic_load_n(&e->mtime, __ATOMIC_RELAXED) ==
+			    mdcache_ns(&st->st_mtim) &&
+			    __atomic_load_n(&e->ctime, __ATOMIC_RELAXED) ==
+			    mdcache_ns(&st->st_ctim);
+			d[0] = __atomic_load_n(&e->digest[0], __ATOMIC_RELAXED);
+			d[1] = __atomic_load_n(&e->digest[1], __ATOMIC_RELAXED);
+			__atomic_thread_fence(__ATOMIC_ACQUIRE);
+			if (__atomic_load_n(&e->seq, __ATOMIC_RELAXED) != seq)
+				continue;
+			if (match) {
+				memcpy(digest, d, 16);
+				__atomic_fetch_add(&cache->hits, 1,
+				    __ATOMIC_RELAXED);
+				return (1);
+			}
+		}
+	}
+	__atomic_fetch_add(&cache->misses, 1, __ATOMIC_RELAXED);
+
+	return (0);
+}
+
+/*
+ * Store the digest of a file as stat() gave it, over the file's old entry
+ * if it has one, else an unused one, else one of the others.
+ */
+int
+mdcache_insert(struct mdcache *cache, const uint8_t digest[16],
+    const struct stat *st)
+{
+	struct mdcache_entry *bucket;
+	struct mdcache_entry *e;
+	uint64_t d[2];
+	uint64_t seq;
+	int w;
+
+	if (cache->slot == NULL || cache->readonly || !S_ISREG(st->st_mode))
+		return (0);
+
+	pthread_mutex_lock(&cache->lock);
+	if (mdcache_lock(cache->fd, F_WRLCK) != 0) {
+		pthread_mutex_unlock(&cache->lock);
+		return (-1);
+	}
+	bucket = mdcache_bucket(cache, st);
+	e = NULL;
+	for (w = 0; w < MDCACHE_WAYS; w++) {
+		if (bucket[w].dev == (uint64_t)st->st_dev &&
+		    bucket[w].ino == (uint64_t)st->st_ino) {
+			e = &bucket[w];
+			break;
+		}
+		if (e == NULL && bucket[w].seq == 0)
+			e = &bucket[w];
+	}
+	if (e == NULL)
+		e = &bucket[(cache->stored ^ st->st_ino) % MDCACHE_WAYS];
+
+	memcpy(d, digest, 16);
+	seq = e->seq;
+	__atomic_store_n(&e->seq, seq + 1, __ATOMIC_RELAXED);
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+	__atomic_store_n(&e->dev, st->st_dev, __ATOMIC_RELAXED);
+	__atomic_store_n(&e->ino, st->st_ino, __ATOMIC_RELAXED);
+	__atomic_store_n(&e->size, st->st_size, __ATOMIC_RELAXED);
+	__atomic_store_n(&e->mtime, mdcache_ns(&st->st_mtim),
+	    __ATOMIC_RELAXED);
+	__atomic_store_n(&e->ctime, mdcache_ns(&st->st_ctim),
+	    __ATOMIC_RELAXED);
+	__atomic_store_n(&e->digest[0], d[0], __ATOMIC_RELAXED);
+	__atomic_store_n(&e->digest[1], d[1], __ATOMIC_RELAXED);
+	__atomic_store_n(&e->seq, seq + 2, __ATOMIC_RELEASE);
+	cache->stored++;
+
+	mdcache_lock(cache->fd, F_UNLCK);
+	pthread_mutex_unlock(&cache->lock);
+
+	return (0);
+}
+
+static int
+mdcache_same(const struct stat *a, const struct stat *b)
+{
+
+	return (a->st_dev == b->st_dev && a->st_ino == b->st_ino &&
+	    a->st_size == b->st_size &&
+	    mdcache_ns(&a->st_mtim) == mdcache_ns(&b->st_mtim) &&
+	    mdcache_ns(&a->st_ctim) == mdcache_ns(&b->st_ctim));
+}
+
+/*
+ * Store the digest just taken of fd, unless fd changed since before was
+ * taken by fstat() or had changed too recently when reading it started.
+ */
+int
+mdcache_store_fd(struct mdcache *cache, const uint8_t digest[16], int fd,
+    const struct stat *before, const struct timespec *start)
+{
+	struct stat after;
+
+	if (fstat(fd, &after) != 0)
+		return (-1);
+	if (!mdcache_same(before, &after) || mdcache_ns(&after.st_ctim) +
+	    cache->settle > mdcache_ns(start))
+		return (0);
+	return (mdcache_insert(cache, digest, &after));
+}
+
+/*
+ * Hash the file at path with the cache's algorithm, costing one stat()
+ * if the cache holds it unchanged. Otherwise the file is read and the
+ * digest stored. hit, if not NULL, tells which happened.
+ */
+int
+mdcache_hash_path(struct mdcache *cache, uint8_t digest[16],
+    const char *path, const struct mdfile_opts *opts, int *hit)
+{
+	struct stat before;
+	struct timespec start;
+	int error;
+	int fd;
+
+	if (hit != NULL)
+		*hit = 0;
+	if (stat(path, &before) != 0)
+		return (-1);
+	if (mdcache_lookup(cache, digest, &before)) {
+		if (hit != NULL)
+			*hit = 1;
+		return (0);
+	}
+
+	clock_gettime(CLOCK_REALTIME, &start);
+	if ((fd = open(path, O_RDONLY)) < 0)
+		return (-1);
+	if (fstat(fd, &before) != 0 ||
+	    mdfile_hash_fd(digest, cache->algo, fd, opts) != 0) {
+		error = errno;
+		close(fd);
+		errno = error;
+		return (-1);
+	}
+	(void)mdcache_store_fd(cache, digest, fd, &before, &start);
+	close(fd);
+
+	return (0);
+}
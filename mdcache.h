@@ -0,0 +1,77 @@
+/*-
+ * Copyright (c) 2023, Collin Funk
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHORS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#ifndef CRYPTO_MDCACHE_H
+#define CRYPTO_MDCACHE_H
+
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#include <pthread.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <time.h>
+
+#include "mdfile.h"
+
+#define MDCACHE_SLOTS (64 * 1024) /* Default number of entries */
+#define MDCACHE_WAYS 8 /* Entries a file may be kept in */
+#define MDCACHE_SETTLE 1000000000 /* Nanoseconds a change must be old */
+
+struct mdcache_entry {
+	uint64_t seq; /* Odd while being written, 0 if never used */
+	uint64_t dev;
+	uint64_t ino;
+	uint64_t size;
+	int64_t mtime; /* Nanoseconds */
+	int64_t ctime;
+	uint64_t digest[2];
+};
+
+struct mdcache {
+	int fd;
+	int algo; /* MDFILE_MD5 or MDFILE_MD4 */
+	int readonly; /* Lookups only */
+	int64_t settle; /* Files changed this recently are not stored */
+	void *map;
+	size_t maplen;
+	struct mdcache_entry *slot;
+	uint64_t nslots;
+	pthread_mutex_t lock; /* Serializes writers within the process */
+	uint64_t hits;
+	uint64_t misses;
+	uint64_t stored;
+};
+
+int mdcache_open(struct mdcache *, const char *, int, uint64_t);
+int mdcache_close(struct mdcache *);
+int mdcache_lookup(struct mdcache *, uint8_t [16], const struct stat *);
+int mdcache_insert(struct mdcache *, const uint8_t [16], const struct stat *);
+int mdcache_store_fd(struct mdcache *, const uint8_t [16], int,
+    const struct stat *, const struct timespec *);
+int mdcache_hash_path(struct mdcache *, uint8_t [16], const char *,
+    const struct mdfile_opts *, int *);
+
+#endif /* CRYPTO_MDCACHE_H */
@@ -0,0 +1,281 @@
+/*-
+ * Copyright (c) 2023, Collin Funk
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHORS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * Check files against a manifest written by md5sum, md4sum or mdsum, or
+ * in the BSD "MD5 (name) = digest" form. The files are hashed by the
+ * mdfiles pool, largest first, and each result is handed on as soon as
+ * it is known rather than in manifest order, so a failure deep in a long
+ * manifest shows at once. With failfast the pool starts no more files
+ * after the first failure.
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <sys/types.h>
+
+#include <errno.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "mdcheck.h"
+#include "mdfile.h"
+#include "mdfiles.h"
+
+struct mdcheck_run {
+	const struct mdcheck_list *list;
+	int failfast;
+	int stop; /* Set on the first failure with failfast */
+	mdcheck_fn *fn;
+	void *arg;
+	struct mdcheck_stats *stats;
+};
+
+static int
+mdcheck_hex(uint8_t digest[16], const char *p)
+{
+	int hi;
+	int lo;
+	int i;
+
+	for (i = 0; i < 16; i++) {
+		if ((hi = mdfile_hexdigit(p[2 * i])) < 0 ||
+		    (lo = mdfile_hexdigit(p[2 * i + 1])) < 0)
+			return (-1);
+		digest[i] = hi << 4 | lo;
+	}
+	return (0);
+}
+
+/*
+ * Undo the escaping of a name on a line that starts with a backslash.
+ */
+static int
+mdcheck_unescape(char *name)
+{
+	char *p;
+	char *q;
+
+	for (p = q = name; *p != '\0'; p++) {
+		if (*p != '\\') {
+			*q++ = *p;
+			continue;
+		}
+		if (*++p == '\\')
+			*q++ = '\\';
+		else if (*p == 'n')
+			*q++ = '\n';
+		else
+			return (-1);
+	}
+	*q = '\0';
+	return (0);
+}
+
+/*
+ * Split one line, without its newline, into digest and name. The name
+ * points into the line. Returns -1 if the line is not understood.
+ */
+static int
+mdcheck_line(uint8_t digest[16], char **name, char *line, size_t len,
+    int algo)
+{
+	char *end;
+	int escaped;
+
+	if (len > 0 && line[len - 1] == '\r')
+		line[--len] = '\0';
+	escaped = line[0] == '\\';
+	if (escaped) {
+		line++;
+		len--;
+	}
+
+	if (strncmp(line, algo == MDFILE_MD4 ? "MD4 (" : "MD5 (", 5) == 0) {
+		/* MD5 (name) = digest */
+		if (len < 5 + 1 + 4 + 32)
+			return (-1);
+		end = line + len - 32 - 4;
+		if (memcmp(end, ") = ", 4) != 0 ||
+		    mdcheck_hex(digest, end + 4) != 0)
+			return (-1);
+		*end = '\0';
+		*name = line + 5;
+	} else {
+		/* digest, space, space or asterisk, name */
+		if (len < 32 + 2 + 1 || mdcheck_hex(digest, line) != 0 ||
+		    line[32] != ' ' || (line[33] != ' ' && line[33] != '*'))
+			return (-1);
+		*name = line + 34;
+	}
+	if (**name == '\0' || (escaped && mdcheck_unescape(*name) != 0))
+		return (-1);
+
+	return (0);
+}
+
+/*
+ * Add the entries of a manifest to list. Blank lines and lines starting
+ * with '#' are skipped and others not understood are counted. Returns -1
+ * with errno set if the manifest cannot be read or memory runs out.
+ */
+int
+mdcheck_parse(struct mdcheck_list *list, FILE *fp, int algo)
+{
+	struct mdcheck_entry *entries;
+	struct mdcheck_entry *e;
+	uint8_t digest[16];
+	size_t lineno;
+	size_t cap;
+	ssize_t len;
+	char *line;
+	char *name;
+	int ret;
+
+	line = NULL;
+	cap = 0;
+	lineno = 0;
+	ret = 0;
+	while ((len = getline(&line, &cap, fp)) >= 0) {
+		lineno++;
+		if (len > 0 && line[len - 1] == '\n')
+			line[--len] = '\0';
+		if (len == 0 || line[0] == '#')
+			continue;
+		if ((size_t)len != strlen(line) ||
+		    mdcheck_line(digest, &name, line, len, algo) != 0) {
+			list->invalid++;
+			continue;
+		}
+
+		if (list->n == list->cap) {
+			list->cap = list->cap ? list->cap * 2 : 256;
+			if ((entries = realloc(list->entries,
+			    list->cap * sizeof(*entries))) == NULL) {
+				ret = -1;
+				break;
+			}
+			list->entries = entries;
+		}
+		e = &list->entries[list->n];
+		if ((e->path = strdup(name)) == NULL) {
+			ret = -1;
+			break;
+		}
+		e->line = lineno;
+		memcpy(e->digest, digest, 16);
+		list->n++;
+	}
+	if (ret == 0 && ferror(fp))
+		ret = -1;
+	free(line);
+
+	return (ret);
+}
+
+void
+mdcheck_list_free(struct mdcheck_list *list)
+{
+	size_t i;
+
+	for (i = 0; i < list->n; i++)
+		free(list->entries[i].path);
+	free(list->entries);
+	memset(list, 0, sizeof(*list));
+}
+
+static void
+mdcheck_result(const struct mdfiles_result *r, void *arg)
+{
+	struct mdcheck_result res;
+	struct mdcheck_run *run;
+
+	run = arg;
+	res.entry = &run->list->entries[r->index];
+	res.error = r->error;
+	res.match = r->error == 0 &&
+	    memcmp(r->digest, res.entry->digest, 16) == 0;
+	if (res.match)
+		run->stats->matched++;
+	else if (res.error == 0)
+		run->stats->mismatched++;
+	else
+		run->stats->unreadable++;
+	if (!res.match && run->failfast)
+		__atomic_store_n(&run->stop, 1, __ATOMIC_RELAXED);
+
+	run->fn(&res, run->arg);
+}
+
+/*
+ * Check every file of list, handing each result to fn as it comes. fn is
+ * never run by two threads at once. Returns the number of files that did
+ * not match or could not be read, or -1 if the pool could not be set up.
+ * stats may be NULL.
+ */
+int
+mdcheck_verify(const struct mdcheck_list *list,
+    const struct mdfiles_opts *opts, int failfast, mdcheck_fn *fn,
+    void *arg, struct mdcheck_stats *stats)
+{
+	struct mdcheck_stats dummy;
+	struct mdfiles_opts o;
+	struct mdcheck_run run;
+	const char **paths;
+	size_t i;
+	int ret;
+
+	if (stats == NULL)
+		stats = &dummy;
+	memset(stats, 0, sizeof(*stats));
+	if (opts != NULL)
+		o = *opts;
+	else
+		mdfiles_opts_init(&o);
+	o.ordered = 0;
+	o.stop = &run.stop;
+
+	if ((paths = calloc(list->n + 1, sizeof(*paths))) == NULL)
+		return (-1);
+	for (i = 0; i < list->n; i++)
+		paths[i] = list->entries[i].path;
+	run.list = list;
+	run.failfast = failfast;
+	run.stop = 0;
+	run.fn = fn;
+	run.arg = arg;
+	run.stats = stats;
+	ret = mdfiles_hash(paths, list->n, &o, mdcheck_result, &run);
+	free(paths);
+	if (ret < 0)
+		return (-1);
+
+	stats->skipped = list->n - stats->matched - stats->mismatched -
+	    stats->unreadable;
+	return (stats->mismatched + stats->unreadable);
+}
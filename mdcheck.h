@@ -0,0 +1,68 @@
+/*-
+ * Copyright (c) 2023, Collin Funk
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHORS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#ifndef CRYPTO_MDCHECK_H
+#define CRYPTO_MDCHECK_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdio.h>
+
+#include "mdfiles.h"
+
+struct mdcheck_entry {
+	char *path;
+	size_t line; /* Line of the manifest, from 1 */
+	uint8_t digest[16]; /* Digest the manifest gives */
+};
+
+struct mdcheck_list {
+	struct mdcheck_entry *entries;
+	size_t n;
+	size_t cap;
+	size_t invalid; /* Lines that were not understood */
+};
+
+struct mdcheck_result {
+	const struct mdcheck_entry *entry;
+	int error; /* errno if the file could not be read, else 0 */
+	int match; /* Set if the file has the digest given */
+};
+
+typedef void mdcheck_fn(const struct mdcheck_result *, void *);
+
+struct mdcheck_stats {
+	size_t matched;
+	size_t mismatched;
+	size_t unreadable;
+	size_t skipped; /* Not checked after a failure with failfast */
+};
+
+int mdcheck_parse(struct mdcheck_list *, FILE *, int);
+void mdcheck_list_free(struct mdcheck_list *);
+int mdcheck_verify(const struct mdcheck_list *, const struct mdfiles_opts *,
+    int, mdcheck_fn *, void *, struct mdcheck_stats *);
+
+#endif /* CRYPTO_MDCHECK_H */
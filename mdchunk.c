@@ -0,0 +1,612 @@
+/*-
+ * Copyright (c) 2023, Collin Funk
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHORS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * Content-defined chunking in the style of FastCDC. A gear hash, shifted
+ * one bit and added to a random word per byte, is rolled over each chunk
+ * from its minimum length, and the chunk ends at the first byte where the
+ * top bits of the hash are all zero. More bits are tested before the
+ * average length than after it, which narrows the spread of lengths.
+ * Boundaries depend only on the bytes since the previous one, so an edit
+ * moves the chunks around it and no others.
+ *
+ * A stream is read in large buffers. While the chunks of one buffer are
+ * hashed by the multi-buffer engine on a pool of threads, the next
+ * buffer is read and cut.
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "md4-mb.h"
+#include "md5-mb.h"
+#include "mdchunk.h"
+#include "mdfile.h"
+
+#define MDCHUNK_BUFSIZE (8 * 1024 * 1024)
+#define MDCHUNK_BATCH (4 * MD5_MB_MAX_LANES)
+#define MDCHUNK_MAX_THREADS 256
+
+struct mdchunk_buf {
+	uint8_t *data;
+	uint64_t base; /* Offset of data[0] in the stream */
+	size_t len; /* Bytes read into data */
+	size_t used; /* Bytes in whole chunks, the rest is carried over */
+	struct mdchunk *chunks;
+	size_t nchunks;
+	size_t next; /* Next chunk to hand to a thread */
+	size_t done; /* Chunks hashed */
+};
+
+struct mdchunk_pool {
+	pthread_mutex_t lock;
+	pthread_cond_t work; /* A buffer was posted or the pool is closing */
+	pthread_cond_t done; /* The posted buffer is hashed */
+	struct mdchunk_buf *cur; /* Buffer being hashed, or NULL */
+	int algo;
+	int quit;
+};
+
+/*
+ * Random words from splitmix64 seeded with 0. Chunk boundaries depend on
+ * them, so they must never change.
+ */
+static const uint64_t mdchunk_gear[256] = {
+	0xe220a8397b1dcdafULL, 0x6e789e6aa1b965f4ULL, 0x06c45d188009454fULL,
+	0xf88bb8a8724c81ecULL, 0x1b39896a51a8749bULL, 0x53cb9f0c747ea2eaULL,
+	0x2c829abe1f4532e1ULL, 0xc584133ac916ab3cULL, 0x3ee5789041c98ac3ULL,
+	0xf3b8488c368cb0a6ULL, 0x657eecdd3cb13d09ULL, 0xc2d326e0055bdef6ULL,
+	0x8621a03fe0bbdb7bULL, 0x8e1f7555983aa92fULL, 0xb54e0f1600cc4d19ULL,
+	0x84bb3f97971d80abULL, 0x7d29825c75521255ULL, 0xc3cf17102b7f7f86ULL,
+	0x3466e9a083914f64ULL, 0xd81a8d2b5a4485acULL, 0xdb01602b100b9ed7ULL,
+	0xa9038a921825f10dULL, 0xedf5f1d90dca2f6aULL, 0x54496ad67bd2634cULL,
+	0xdd7c01d4f5407269ULL, 0x935e82f1db4c4f7bULL, 0x69b82ebc92233300ULL,
+	0x40d29eb57de1d510ULL, 0xa2f09dabb45c6316ULL, 0xee521d7a0f4d3872ULL,
+	0xf16952ee72f3454fULL, 0x377d35dea8e40225ULL, 0x0c7de8064963bab0ULL,
+	0x05582d37111ac529ULL, 0xd254741f599dc6f7ULL, 0x69630f7593d108c3ULL,
+	0x417ef96181daa383ULL, 0x3c3c41a3b43343a1ULL, 0x6e19905dcbe531dfULL,
+	0x4fa9fa7324851729ULL, 0x84eb4454a792922aULL, 0x134f7096918175ceULL,
+	0x07dc930b302278a8ULL, 0x12c015a97019e937ULL, 0xcc06c31652ebf438ULL,
+	0xecee65630a691e37ULL, 0x3e84ecb1763e79adULL, 0x690ed476743aae49ULL,
+	0x774615d7b1a1f2e1ULL, 0x22b353f04f4f52daULL, 0xe3ddd86ba71a5eb1ULL,
+	0xdf268adeb6513356ULL, 0x2098eb73d4367d77ULL, 0x03d6845323ce3c71ULL,
+	0xc952c5620043c714ULL, 0x9b196bca844f1705ULL, 0x30260345dd9e0ec1ULL,
+	0xcf448a5882bb9698ULL, 0xf4a578dccbc87656ULL, 0xbfdeaed9a17b3c8fULL,
+	0xed79402d1d5c5d7bULL, 0x55f070ab1cbbf170ULL, 0x3e00a34929a88f1dULL,
+	0xe255b237b8bb18fbULL, 0x2a7b67af6c6ad50eULL, 0x466d5e7f3e46f143ULL,
+	0x42375cb399a4fc72ULL, 0x8c8a1f148a8bb259ULL, 0x32fcab5daed5bdfcULL,
+	0x9e60398c8d8553c0ULL, 0xee89cceb8c4064c0ULL, 0xdb0215941d86a66fULL,
+	0x5ccde78203c367a8ULL, 0xf1bcbc6a1ec11786ULL, 0xef054fceee954551ULL,
+	0xdf82012d0555c6dfULL, 0x292566ff72403c08ULL, 0xc4dd302a1bfa1137ULL,
+	0xd85f219db5c554e1ULL, 0x6a27ff807441bcd2ULL, 0x96a573e9b48216e8ULL,
+	0x46a9fdac40bf0048ULL, 0x3dd12464a0ee15b4ULL, 0x451e521296a7eea1ULL,
+	0x56e4398a98f8a0fdULL, 0x7b7dc2160e3335a7ULL, 0xc679ee0bebcb1ccaULL,
+	0x928d6f2d7453424eULL, 0x1b38994205234c6dULL, 0x8086d193a6f2b568ULL,
+	0x21c6e26639ac2c65ULL, 0xd9dccac414d23c6fULL, 0x91cd642057e00235ULL,
+	0x77fc607dc6589373ULL, 0x05b8abe26dd3aee7ULL, 0x12f6436ac376cc66ULL,
+	0x64952424897b2307ULL, 0xee8c2baf6343e5c3ULL, 0xdc4c613d9eba2304ULL,
+	0x3505b7796bd1a506ULL, 0x8176daf800a05f50ULL, 0x8bd8ff7a0385cdbcULL,
+	0x1a764a3cd78101daULL, 0xbe4d15bf6ca266acULL, 0xa85e1f38bb2dc749ULL,
+	0x56759a968493cd8cULL, 0xf3a9bce7336bd182ULL, 0x365b15013741519bULL,
+	0x1f7a44a6b109ac94ULL, 0x3521d628813cb177ULL, 0x6a77afab0f7c9370ULL,
+	0x179642d8cde95015ULL, 0x5ef102a8fb354461ULL, 0xf51c504764ed82f2ULL,
+	0xc58427f041ce6808ULL, 0xfad8fc45c9643c37ULL, 0xcf8682f9a70fa9c0ULL,
+	0x7e1b3b75a4005729ULL, 0x992dd867927b52d8ULL, 0x7fbd5db142f6791fULL,
+	0x370595aacab4adaeULL, 0xb1392dbdc5ab61d6ULL, 0x9fea7dfc79d452d9ULL,
+	0x40b12b120085641cULL, 0xa192afe3157c85d0ULL, 0xc847729f4e08f3a3ULL,
+	0x6f1384a306c41fc2ULL, 0x12d05c4045a39c19ULL, 0x9899202fd20f0841ULL,
+	0xe9c7191857e774b8ULL, 0x4eead809af5b0cc3ULL, 0xe809acafa23864a4ULL,
+	0x4da1edaba1d0f7bdULL, 0x846eb9673349f8e4ULL, 0x87bae55b86039fe8ULL,
+	0x7f367b8bd953eff2ULL, 0x3884700f650d04e1ULL, 0xbfe4b2ab46980cadULL,
+	0xc5fc89075299106cULL, 0x37b2fa361adea7cdULL, 0x7d75d813f04895b4ULL,
+	0x702f5b393f62c0e0ULL, 0x0a3fc775f4ecf37fULL, 0xe4b23787a352437fULL,
+	0xf83fa245c34d6363ULL, 0xb99bcf040786cf50ULL, 0x38b6ea0a0e6c9d8aULL,
+	0x093fdc76776e37e1ULL, 0x1a75e6f76ba7eee8ULL, 0x442cdcfee9660c62ULL,
+	0x22d58d35116b5e0bULL, 0x87d4a5180f6a3645ULL, 0x589fb216bd82131bULL,
+	0x91d031cad319aec0ULL, 0xabecf76a553d320bULL, 0xb8686cb347612dcfULL,
+	0xfcab66337c0a77f5ULL, 0xac318214381ec437ULL, 0x6eb7f0fca24494aeULL,
+	0xcf42861dcdc895a9ULL, 0x4abad7a1586d7a91ULL, 0xc21b318dc2f49745ULL,
+	0xd49474dc2acbd1f0ULL, 0xb1d4873747c1c8e1ULL, 0x5434dc8c7d015bf6ULL,
+	0xe1c486287511b6a9ULL, 0xa8616df62e89a193ULL, 0x31ce6319498d8347ULL,
+	0xafd0b486123d6faaULL, 0xe6495f5d102301ebULL, 0x0dc51ced17a43c52ULL,
+	0x8bcbcde81355ef2dULL, 0x2412af73fdee7cfcULL, 0xc8d589e486e29eedULL,
+	0x23390e8664517f89ULL, 0x251ade58e8a6849dULL, 0xf8555dbd2e8f9cb0ULL,
+	0xcb417c3eef54f7c3ULL, 0x8028f8e1aac3a919ULL, 0x10e31052acf748a0ULL,
+	0x2d886c073b1e1b78ULL, 0x972974d90df9faeeULL, 0xbc1b7b38796893baULL,
+	0x1958ed432070e652ULL, 0xca5f297197a12dccULL, 0xe025a27375704f28ULL,
+	0x418010a570a924fbULL, 0x9828e2941bfc419cULL, 0x4fbacd2f52b85c1fULL,
+	0x33dd5b756211cc67ULL, 0x23c8dfdd1db57ff0ULL, 0x32f81801a1a8e901ULL,
+	0x26884eac5ada36daULL, 0xcaa82f9bb42e37d4ULL, 0x19fb1a7491d6a7d1ULL,
+	0x5aa0243aa357f38eULL, 0xb31d917809e447f0ULL, 0x3f9c197225215be0ULL,
+	0xdc3c315a1e33c095ULL, 0x3dd399ad533e80acULL, 0x566f32cce8301d95ULL,
+	0xc880188083d9ba21ULL, 0xb9cc357f3b0e7d2eULL, 0x0237d2123a8a8d6cULL,
+	0xbf636e9aa7cbf6bdULL, 0xd7bd4284c4e2a6a7ULL, 0xda2ebb47d50577a9ULL,
+	0x90ba1c11b539087dULL, 0x44993d31552b4f57ULL, 0x32c2d6f80a8a8898ULL,
+	0x450583ed7fb54b19ULL, 0xec2b0b09e50ef3efULL, 0xd918a0b6e2efd65cULL,
+	0xe37a868d9785f572ULL, 0x7d1a6118f2b0f37aULL, 0x9e2e3cc13b343439ULL,
+	0xefd82c11212e37e8ULL, 0xaf89c05cd4fc75edULL, 0x55bc16bb9697108eULL,
+	0x6c4701fa5db69beeULL, 0x9237338441daf445ULL, 0x248cf0831e81a5fcULL,
+	0xacc13557e77de273ULL, 0x520970c25e06513aULL, 0x657329cb02987cabULL,
+	0xa9b0b3366a4e55a8ULL, 0xc4d06ca2f39acdd4ULL, 0x5dce37d68170cde1ULL,
+	0x5f1e44e77e1854c9ULL, 0x6883d452d55df899ULL, 0x05c5bd62f1067032ULL,
+	0xe680b683ce60fab0ULL, 0x5dc9da3f286d18b1ULL, 0x94b4bf3ab85ed6d8ULL,
+	0xce65f449e3acc5a3ULL, 0x34b0209642cea639ULL, 0xc14c3c771d904827ULL,
+	0x6addcee2bd9cdee5ULL, 0xe24eed137ffbb613ULL, 0x75dd58ef79963d1bULL,
+	0xfdb83ecf6cc24920ULL, 0x7a1d0057c57169fbULL, 0x339200f4feb62d07ULL,
+	0xd33f4d4ac88469f4ULL, 0x8226f234e68dfee4ULL, 0x320def4f2a105536ULL,
+	0x7786f3b13aefc159ULL, 0xb28225ac9df63ee2ULL, 0x781b9d0376cc6044ULL,
+	0x05bd0115226c6ab6ULL, 0xd302230207bdfdabULL, 0xdb898abd8e0d2933ULL,
+	0x9e79a397ba00b9ccULL, 0x89df84a5f0003ee8ULL, 0x011f04f2a75fb9beULL,
+	0x5a5832bb47bcf19eULL
+};
+
+void
+mdchunk_opts_init(struct mdchunk_opts *opts)
+{
+
+	opts->algo = MDFILE_MD5;
+	opts->min = MDCHUNK_MIN;
+	opts->avg = MDCHUNK_AVG;
+	opts->max = MDCHUNK_MAX;
+	opts->nthreads = 0;
+}
+
+static int
+mdchunk_valid(const struct mdchunk_opts *opts)
+{
+
+	return (opts->min >= 64 && opts->avg >= 256 &&
+	    (opts->avg & (opts->avg - 1)) == 0 && opts->min <= opts->avg &&
+	    opts->avg <= opts->max && opts->max <= MDCHUNK_BUFSIZE / 2);
+}
+
+/*
+ * Roll byte i + k into the hash and end the chunk after it on a match.
+ * Four of these to a loop keep the loop overhead off the one cycle
+ * chain through fp.
+ */
+#define MDCHUNK_ROLL(k) do { \
+	fp = (fp << 1) + mdchunk_gear[p[i + (k)]]; \
+	if ((fp & mask) == 0) \
+		return (i + (k) + 1); \
+} while (0)
+
+/*
+ * Returns the length of the chunk that starts at data: up to the first
+ * boundary, or max bytes if there is none before then, or all len bytes
+ * if there is none in them and len is less than max.
+ */
+size_t
+mdchunk_cut(const struct mdchunk_opts *opts, const void *data, size_t len)
+{
+	const uint8_t *p;
+	uint64_t mask;
+	uint64_t fp;
+	size_t normal;
+	size_t end;
+	size_t i;
+	int bits;
+
+	if (len <= opts->min)
+		return (len);
+	end = len < opts->max ? len : opts->max;
+	normal = opts->avg < end ? opts->avg : end;
+	for (bits = 0; ((size_t)1 << bits) < opts->avg; bits++)
+		;
+
+	p = data;
+	fp = 0;
+	i = opts->min;
+	mask = ~(uint64_t)0 << (64 - bits - 2);
+	for (; i + 4 <= normal; i += 4) {
+		MDCHUNK_ROLL(0);
+		MDCHUNK_ROLL(1);
+		MDCHUNK_ROLL(2);
+		MDCHUNK_ROLL(3);
+	}
+	for (; i < normal; i++)
+		MDCHUNK_ROLL(0);
+	mask = ~(uint64_t)0 << (64 - bits + 2);
+	for (; i + 4 <= end; i += 4) {
+		MDCHUNK_ROLL(0);
+		MDCHUNK_ROLL(1);
+		MDCHUNK_ROLL(2);
+		MDCHUNK_ROLL(3);
+	}
+	for (; i < end; i++)
+		MDCHUNK_ROLL(0);
+	return (end);
+}
+
+/*
+ * Cut the buffer into chunks, leaving an unfinished one at the end
+ * unless the stream has ended. A boundary on the last byte read is left
+ * for the next round too, which finds it again.
+ */
+static void
+mdchunk_split(const struct mdchunk_opts *opts, struct mdchunk_buf *b,
+    int eof)
+{
+	size_t avail;
+	size_t len;
+	size_t pos;
+	size_t n;
+
+	n = 0;
+	for (pos = 0; pos < b->len; pos += len) {
+		avail = b->len - pos;
+		len = mdchunk_cut(opts, b->data + pos, avail);
+		if (len == avail && avail < opts->max && !eof)
+			break;
+		b->chunks[n].offset = b->base + pos;
+		b->chunks[n].len = len;
+		n++;
+	}
+	b->nchunks = n;
+	b->used = pos;
+}
+
+/*
+ * Hash n chunks of the buffer from first.
+ */
+static void
+mdchunk_hash(int algo, struct mdchunk_buf *b, size_t first, size_t n)
+{
+	struct md5_mb_job jobs5[MDCHUNK_BATCH];
+	struct md4_mb_job jobs4[MDCHUNK_BATCH];
+	struct mdchunk *c;
+	size_t i;
+	size_t m;
+
+	c = &b->chunks[first];
+	for (; n != 0; n -= m, c += m) {
+		m = n < MDCHUNK_BATCH ? n : MDCHUNK_BATCH;
+		for (i = 0; i < m; i++) {
+			jobs5[i].data = jobs4[i].data =
+			    b->data + (c[i].offset - b->base);
+			jobs5[i].len = jobs4[i].len = c[i].len;
+		}
+		if (algo == MDFILE_MD4) {
+			md4_mb_digest(jobs4, m);
+			for (i = 0; i < m; i++)
+				memcpy(c[i].digest, jobs4[i].digest, 16);
+		} else {
+			md5_mb_digest(jobs5, m);
+			for (i = 0; i < m; i++)
+				memcpy(c[i].digest, jobs5[i].digest, 16);
+		}
+	}
+}
+
+static void *
+mdchunk_worker(void *arg)
+{
+	struct mdchunk_pool *pool;
+	struct mdchunk_buf *b;
+	size_t first;
+	size_t n;
+
+	pool = arg;
+	pthread_mutex_lock(&pool->lock);
+	for (;;) {
+		while (!pool->quit && (pool->cur == NULL ||
+		    pool->cur->next == pool->cur->nchunks))
+			pthread_cond_wait(&pool->work, &pool->lock);
+		if (pool->quit)
+			break;
+		b = pool->cur;
+		first = b->next;
+		n = b->nchunks - first < MDCHUNK_BATCH ?
+		    b->nchunks - first : MDCHUNK_BATCH;
+		b->next += n;
+		pthread_mutex_unlock(&pool->lock);
+
+		mdchunk_hash(pool->algo, b, first, n);
+
+		pthread_mutex_lock(&pool->lock);
+		b->done += n;
+		if (b->done == b->nchunks)
+			pthread_cond_signal(&pool->done);
+	}
+	pthread_mutex_unlock(&pool->lock);
+
+	return (NULL);
+}
+
+/*
+ * Start hashing the chunks of a buffer, on the pool if there is one and
+ * here if not.
+ */
+static void
+mdchunk_start(struct mdchunk_pool *pool, int nthreads, struct mdchunk_buf *b)
+{
+
+	if (nthreads == 0) {
+		mdchunk_hash(pool->algo, b, 0, b->nchunks);
+		return;
+	}
+	pthread_mutex_lock(&pool->lock);
+	b->next = b->done = 0;
+	pool->cur = b;
+	pthread_cond_broadcast(&pool->work);
+	pthread_mutex_unlock(&pool->lock);
+}
+
+static void
+mdchunk_finish(struct mdchunk_pool *pool, int nthreads)
+{
+
+	if (nthreads == 0)
+		return;
+	pthread_mutex_lock(&pool->lock);
+	while (pool->cur->done != pool->cur->nchunks)
+		pthread_cond_wait(&pool->done, &pool->lock);
+	pool->cur = NULL;
+	pthread_mutex_unlock(&pool->lock);
+}
+
+/*
+ * Read into the buffer until it holds size bytes or the stream ends.
+ */
+static int
+mdchunk_fill(int fd, struct mdchunk_buf *b, size_t size, int *eof)
+{
+	ssize_t n;
+
+	while (b->len < size) {
+		n = read(fd, b->data + b->len, size - b->len);
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n < 0)
+			return (-1);
+		if (n == 0) {
+			*eof = 1;
+			break;
+		}
+		b->len += n;
+	}
+
+	return (0);
+}
+
+/*
+ * Cut what is read from fd into chunks and pass them to fn in order with
+ * their digests. Returns 0, or -1 with errno set.
+ */
+int
+mdchunk_fd(int fd, const struct mdchunk_opts *opts, mdchunk_fn *fn,
+    void *arg)
+{
+	pthread_t threads[MDCHUNK_MAX_THREADS];
+	struct mdchunk_buf bufs[2];
+	struct mdchunk_pool pool;
+	struct mdchunk_buf *cur;
+	struct mdchunk_buf *nxt;
+	size_t maxchunks;
+	size_t tail;
+	int nthreads;
+	int error;
+	int more;
+	int eof;
+	int i;
+
+	if (!mdchunk_valid(opts)) {
+		errno = EINVAL;
+		return (-1);
+	}
+
+	error = 0;
+	maxchunks = MDCHUNK_BUFSIZE / opts->min + 1;
+	memset(bufs, 0, sizeof(bufs));
+	for (i = 0; i < 2; i++) {
+		if ((bufs[i].data = malloc(MDCHUNK_BUFSIZE)) == NULL ||
+		    (bufs[i].chunks = calloc(maxchunks,
+		    sizeof(struct mdchunk))) == NULL)
+			error = ENOMEM;
+	}
+	if (error != 0)
+		goto out;
+
+	/* One thread hashes in between reads, more run beside them. */
+	nthreads = opts->nthreads;
+	if (nthreads <= 0)
+		nthreads = sysconf(_SC_NPROCESSORS_ONLN);
+	if (nthreads > MDCHUNK_MAX_THREADS)
+		nthreads = MDCHUNK_MAX_THREADS;
+	if (nthreads <= 1)
+		nthreads = 0;
+	memset(&pool, 0, sizeof(pool));
+	pool.algo = opts->algo;
+	pthread_mutex_init(&pool.lock, NULL);
+	pthread_cond_init(&pool.work, NULL);
+	pthread_cond_init(&pool.done, NULL);
+	for (i = 0; i < nthreads; i++) {
+		if (pthread_create(&threads[i], NULL, mdchunk_worker,
+		    &pool) != 0)
+			break;
+	}
+	nthreads = i;
+
+	cur = &bufs[0];
+	nxt = &bufs[1];
+	eof = 0;
+	if (mdchunk_fill(fd, cur, MDCHUNK_BUFSIZE, &eof) != 0)
+		error = errno;
+	else
+		mdchunk_split(opts, cur, eof);
+	while (error == 0) {
+		mdchunk_start(&pool, nthreads, cur);
+
+		/* Carry the unfinished chunk over and read on. */
+		more = !eof;
+		if (more) {
+			tail = cur->len - cur->used;
+			memcpy(nxt->data, cur->data + cur->used, tail);
+			nxt->base = cur->base + cur->used;
+			nxt->len = tail;
+			if (mdchunk_fill(fd, nxt, MDCHUNK_BUFSIZE, &eof) != 0)
+				error = errno;
+			else
+				mdchunk_split(opts, nxt, eof);
+		}
+
+		mdchunk_finish(&pool, nthreads);
+		if (error == 0 && cur->nchunks != 0 &&
+		    fn(cur->chunks, cur->nchunks, arg) != 0)
+			error = errno;
+		if (!more)
+			break;
+		cur = nxt;
+		nxt = cur == &bufs[0] ? &bufs[1] : &bufs[0];
+	}
+
+	pthread_mutex_lock(&pool.lock);
+	pool.quit = 1;
+	pthread_cond_broadcast(&pool.work);
+	pthread_mutex_unlock(&pool.lock);
+	for (i = 0; i < nthreads; i++)
+		pthread_join(threads[i], NULL);
+	pthread_cond_destroy(&pool.done);
+	pthread_cond_destroy(&pool.work);
+	pthread_mutex_destroy(&pool.lock);
+
+out:
+	for (i = 0; i < 2; i++) {
+		free(bufs[i].data);
+		free(bufs[i].chunks);
+	}
+	if (error != 0) {
+		errno = error;
+		return (-1);
+	}
+
+	return (0);
+}
+
+int
+mdchunk_index_init(struct mdchunk_index *idx, size_t hint)
+{
+	size_t n;
+
+	memset(idx, 0, sizeof(*idx));
+	for (n = 64; n / 2 < hint; n *= 2)
+		;
+	if ((idx->slots = calloc(n, sizeof(struct mdchunk_slot))) == NULL)
+		return (-1);
+	idx->mask = n - 1;
+
+	return (0);
+}
+
+/*
+ * Digests are uniform already, so their first word is the hash.
+ */
+static size_t
+mdchunk_index_home(const struct mdchunk_index *idx, const uint8_t digest[16])
+{
+	uint64_t h;
+
+	memcpy(&h, digest, sizeof(h));
+	return ((size_t)h & idx->mask);
+}
+
+static int
+mdchunk_index_grow(struct mdchunk_index *idx)
+{
+	struct mdchunk_slot *old;
+	struct mdchunk_slot *s;
+	size_t oldn;
+	size_t i;
+	size_t j;
+
+	old = idx->slots;
+	oldn = idx->mask + 1;
+	if ((idx->slots = calloc(2 * oldn, sizeof(struct mdchunk_slot))) ==
+	    NULL) {
+		idx->slots = old;
+		return (-1);
+	}
+	idx->mask = 2 * oldn - 1;
+	for (i = 0; i < oldn; i++) {
+		s = &old[i];
+		if (s->len == 0)
+			continue;
+		for (j = mdchunk_index_home(idx, s->digest);
+		    idx->slots[j].len != 0; j = (j + 1) & idx->mask)
+			;
+		idx->slots[j] = *s;
+	}
+	free(old);
+
+	return (0);
+}
+
+/*
+ * Count a chunk of len bytes, which must not be 0. Returns 1 if its
+ * digest is new, 0 if it was seen before, or -1 if out of memory.
+ */
+int
+mdchunk_index_add(struct mdchunk_index *idx, const uint8_t digest[16],
+    uint64_t len)
+{
+	struct mdchunk_slot *s;
+	size_t i;
+
+	/* Linear probing stays short below three quarters full. */
+	if ((idx->used + 1) * 4 > (idx->mask + 1) * 3 &&
+	    mdchunk_index_grow(idx) != 0)
+		return (-1);
+
+	idx->chunks++;
+	idx->bytes += len;
+	for (i = mdchunk_index_home(idx, digest);; i = (i + 1) & idx->mask) {
+		s = &idx->slots[i];
+		if (s->len == 0)
+			break;
+		if (memcmp(s->digest, digest, 16) == 0)
+			return (0);
+	}
+	memcpy(s->digest, digest, 16);
+	s->len = len;
+	idx->used++;
+	idx->unique += len;
+
+	return (1);
+}
+
+void
+mdchunk_index_free(struct mdchunk_index *idx)
+{
+
+	free(idx->slots);
+	memset(idx, 0, sizeof(*idx));
+}
@@ -0,0 +1,77 @@
+/*-
+ * Copyright (c) 2023, Collin Funk
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHORS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#ifndef CRYPTO_MDCHUNK_H
+#define CRYPTO_MDCHUNK_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+#define MDCHUNK_MIN (2 * 1024)
+#define MDCHUNK_AVG (8 * 1024)
+#define MDCHUNK_MAX (64 * 1024)
+
+struct mdchunk_opts {
+	int algo; /* MDFILE_MD5 or MDFILE_MD4 */
+	size_t min; /* Never cut before this many bytes, at least 64 */
+	size_t avg; /* Typical chunk size, a power of 2 from 256 */
+	size_t max; /* Always cut here, at least avg */
+	int nthreads; /* Threads hashing chunks, 0 for one per online CPU */
+};
+
+struct mdchunk {
+	uint64_t offset; /* Position in the stream */
+	size_t len;
+	uint8_t digest[16];
+};
+
+/*
+ * Called with the chunks of a stream in order, a batch at a time. Returns
+ * 0, or -1 with errno set to stop.
+ */
+typedef int mdchunk_fn(const struct mdchunk *, size_t, void *);
+
+struct mdchunk_slot {
+	uint8_t digest[16];
+	uint64_t len; /* Chunk length, 0 if the slot is free */
+};
+
+struct mdchunk_index {
+	struct mdchunk_slot *slots;
+	size_t mask; /* Number of slots less 1 */
+	size_t used; /* Distinct chunks */
+	uint64_t chunks; /* Chunks added */
+	uint64_t bytes; /* Bytes in them */
+	uint64_t unique; /* Bytes in the distinct ones */
+};
+
+void mdchunk_opts_init(struct mdchunk_opts *);
+size_t mdchunk_cut(const struct mdchunk_opts *, const void *, size_t);
+int mdchunk_fd(int, const struct mdchunk_opts *, mdchunk_fn *, void *);
+int mdchunk_index_init(struct mdchunk_index *, size_t);
+int mdchunk_index_add(struct mdchunk_index *, const uint8_t [16], uint64_t);
+void mdchunk_index_free(struct mdchunk_index *);
+
+#endif /* CRYPTO_MDCHUNK_H */
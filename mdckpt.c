@@ -0,0 +1,381 @@
+/*-
+ * Copyright (c) 2023, Collin Funk
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHORS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * Checkpoints of md5 and md4 contexts part way through a file, so a file
+ * that only ever grows is hashed again from where it was last seen
+ * instead of from the start. A checkpoint is trusted only while the file
+ * has the same device and inode, is at least as long, and the bytes just
+ * before the checkpoint still hash the same; otherwise an earlier one is
+ * tried. Only the tail is compared, so a rewrite further back than
+ * MDCKPT_GUARD bytes from every checkpoint is not noticed; this is meant
+ * for logs and other files that are only appended to. Stores hold the
+ * contexts in the export format so they move between hosts.
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "md4.h"
+#include "md5.h"
+#include "mdckpt.h"
+#include "mdfile.h"
+
+#define MDCKPT_VERSION 1
+#define MDCKPT_HEADER 32
+#define MDCKPT_RECORD (8 + 16 + MD5_EXPORT_SIZE)
+#define MDCKPT_BUFSIZE (1024 * 1024)
+
+static void
+mdckpt_put64(uint8_t *p, uint64_t v)
+{
+	int i;
+
+	for (i = 0; i < 8; i++)
+		p[i] = (v >> (8 * i)) & 0xff;
+}
+
+static uint64_t
+mdckpt_get64(const uint8_t *p)
+{
+	uint64_t v;
+	int i;
+
+	v = 0;
+	for (i = 0; i < 8; i++)
+		v |= (uint64_t)p[i] << (8 * i);
+	return (v);
+}
+
+void
+mdckpt_init(struct mdckpt_store *store, int algo)
+{
+
+	memset(store, 0, sizeof(*store));
+	store->algo = algo;
+}
+
+/*
+ * Read a store. A missing file gives an empty store, as does one kept for
+ * the other algorithm. Returns -1 with errno set if the file cannot be
+ * read or is damaged.
+ */
+int
+mdckpt_load(struct mdckpt_store *store, const char *path, int algo)
+{
+	uint8_t buf[MDCKPT_HEADER + MDCKPT_MAX * MDCKPT_RECORD + 1];
+	const uint8_t *p;
+	uint64_t prev;
+	ssize_t len;
+	size_t i;
+	int fd;
+
+	mdckpt_init(store, algo);
+	if ((fd = open(path, O_RDONLY)) < 0)
+		return (errno == ENOENT ? 0 : -1);
+	len = mdfile_read(fd, buf, sizeof(buf));
+	close(fd);
+	if (len < 0)
+		return (-1);
+
+	if (len < MDCKPT_HEADER || memcmp(buf, "MDCK", 4) != 0 ||
+	    buf[4] != MDCKPT_VERSION)
+		goto bad;
+	if (buf[5] != algo)
+		return (0);
+	store->dev = mdckpt_get64(buf + 8);
+	store->ino = mdckpt_get64(buf + 16);
+	store->n = mdckpt_get64(buf + 24);
+	if (store->n > MDCKPT_MAX ||
+	    (size_t)len != MDCKPT_HEADER + store->n * MDCKPT_RECORD)
+		goto bad;
+
+	prev = 0;
+	for (i = 0; i < store->n; i++) {
+		p = buf + MDCKPT_HEADER + i * MDCKPT_RECORD;
+		store->ckpt[i].offset = mdckpt_get64(p);
+		memcpy(store->ckpt[i].guard, p + 8, 16);
+		memcpy(store->ckpt[i].ctx, p + 24, MD5_EXPORT_SIZE);
+		if (i != 0 && store->ckpt[i].offset <= prev)
+			goto bad;
+		prev = store->ckpt[i].offset;
+	}
+
+	return (0);
+
+bad:
+	mdckpt_init(store, algo);
+	errno = EINVAL;
+	return (-1);
+}
+
+/*
+ * Write a store through a temporary file renamed into place, so a crash
+ * leaves either the old store or the new one.
+ */
+int
+mdckpt_save(const struct mdckpt_store *store, const char *path)
+{
+	uint8_t buf[MDCKPT_HEADER + MDCKPT_MAX * MDCKPT_RECORD];
+	uint8_t *p;
+	size_t len;
+	size_t i;
+	char *tmp;
+	int error;
+	int fd;
+
+	memset(buf, 0, MDCKPT_HEADER);
+	memcpy(buf, "MDCK", 4);
+	buf[4] = MDCKPT_VERSION;
+	buf[5] = store->algo;
+	mdckpt_put64(buf + 8, store->dev);
+	mdckpt_put64(buf + 16, store->ino);
+	mdckpt_put64(buf + 24, store->n);
+	for (i = 0; i < store->n; i++) {
+		p = buf + MDCKPT_HEADER + i * MDCKPT_RECORD;
+		mdckpt_put64(p, store->ckpt[i].offset);
+		memcpy(p + 8, store->ckpt[i].guard, 16);
+		memcpy(p + 24, store->ckpt[i].ctx, MD5_EXPORT_SIZE);
+	}
+	len = MDCKPT_HEADER + store->n * MDCKPT_RECORD;
+
+	if ((tmp = malloc(strlen(path) + 5)) == NULL)
+		return (-1);
+	sprintf(tmp, "%s.tmp", path);
+	if ((fd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC, 0644)) < 0) {
+		free(tmp);
+		return (-1);
+	}
+	error = 0;
+	if (write(fd, buf, len) != (ssize_t)len || fsync(fd) != 0)
+		error = errno != 0 ? errno : EIO;
+	if (close(fd) != 0 && error == 0)
+		error = errno;
+	if (error == 0 && rename(tmp, path) != 0)
+		error = errno;
+	if (error != 0) {
+		unlink(tmp);
+		free(tmp);
+		errno = error;
+		return (-1);
+	}
+	free(tmp);
+
+	return (0);
+}
+
+/*
+ * MD5 of the MDCKPT_GUARD bytes, or as many as there are, before off.
+ */
+static int
+mdckpt_guard(uint8_t guard[16], int fd, uint64_t off)
+{
+	uint8_t buf[MDCKPT_GUARD];
+	size_t len;
+	ssize_t n;
+	size_t got;
+
+	len = off < MDCKPT_GUARD ? off : MDCKPT_GUARD;
+	for (got = 0; got < len; got += n) {
+		n = pread(fd, buf + got, len - got, off - len + got);
+		if (n < 0 && errno == EINTR) {
+			n = 0;
+			continue;
+		}
+		if (n <= 0)
+			return (-1);
+	}
+	md5_digest(guard, buf, len);
+
+	return (0);
+}
+
+static void
+mdckpt_export(uint8_t out[MD5_EXPORT_SIZE], const struct mdfile_ctx *ctx)
+{
+
+	if (ctx->algo == MDFILE_MD4)
+		md4_export(out, &ctx->u.md4);
+	else
+		md5_export(out, &ctx->u.md5);
+}
+
+/*
+ * Import a stored context, refusing one that has not hashed exactly off
+ * bytes.
+ */
+static int
+mdckpt_import(struct mdfile_ctx *ctx, int algo,
+    const uint8_t in[MD5_EXPORT_SIZE], uint64_t off)
+{
+	const uint32_t *count;
+
+	ctx->algo = algo;
+	if (algo == MDFILE_MD4) {
+		if (md4_import(&ctx->u.md4, in) != 0)
+			return (-1);
+		count = ctx->u.md4.count;
+	} else {
+		if (md5_import(&ctx->u.md5, in) != 0)
+			return (-1);
+		count = ctx->u.md5.count;
+	}
+	if ((((uint64_t)count[1] << 32) | count[0]) != off << 3)
+		return (-1);
+
+	return (0);
+}
+
+/*
+ * Add a checkpoint at off, dropping the oldest if the store is full. The
+ * store is left as it was if the guard cannot be read.
+ */
+static int
+mdckpt_push(struct mdckpt_store *store, int fd, uint64_t off,
+    const struct mdfile_ctx *ctx)
+{
+	struct mdckpt *ck;
+	uint8_t guard[16];
+
+	if (store->n != 0 && store->ckpt[store->n - 1].offset >= off)
+		return (0);
+	if (mdckpt_guard(guard, fd, off) != 0)
+		return (-1);
+	if (store->n == MDCKPT_MAX) {
+		memmove(&store->ckpt[0], &store->ckpt[1],
+		    (MDCKPT_MAX - 1) * sizeof(store->ckpt[0]));
+		store->n--;
+	}
+	ck = &store->ckpt[store->n];
+	ck->offset = off;
+	memcpy(ck->guard, guard, sizeof(ck->guard));
+	mdckpt_export(ck->ctx, ctx);
+	store->n++;
+
+	return (0);
+}
+
+/*
+ * Hash the whole of fd, starting from the latest checkpoint in store that
+ * still holds, adding a checkpoint every interval bytes and one at the
+ * end. *resumed is set to the offset hashing started from. Returns 0, or
+ * -1 with errno set.
+ */
+int
+mdckpt_hash_fd(uint8_t digest[16], int fd, struct mdckpt_store *store,
+    uint64_t interval, uint64_t *resumed)
+{
+	struct mdfile_ctx ctx;
+	struct mdfile_ctx tmp;
+	uint8_t guard[16];
+	struct stat st;
+	uint64_t next;
+	uint64_t size;
+	uint64_t off;
+	uint8_t *buf;
+	size_t len;
+	ssize_t n;
+
+	if (interval == 0) {
+		errno = EINVAL;
+		return (-1);
+	}
+	if (fstat(fd, &st) != 0)
+		return (-1);
+	if (!S_ISREG(st.st_mode)) {
+		errno = ESPIPE;
+		return (-1);
+	}
+	size = st.st_size;
+	if (store->dev != (uint64_t)st.st_dev ||
+	    store->ino != (uint64_t)st.st_ino) {
+		store->n = 0;
+		store->dev = st.st_dev;
+		store->ino = st.st_ino;
+	}
+
+	/* The newest checkpoint whose tail is unchanged. */
+	mdfile_init(&ctx, store->algo);
+	off = 0;
+	while (store->n != 0) {
+		if (store->ckpt[store->n - 1].offset <= size &&
+		    mdckpt_guard(guard, fd,
+		    store->ckpt[store->n - 1].offset) == 0 &&
+		    memcmp(guard, store->ckpt[store->n - 1].guard, 16) == 0 &&
+		    mdckpt_import(&ctx, store->algo,
+		    store->ckpt[store->n - 1].ctx,
+		    store->ckpt[store->n - 1].offset) == 0) {
+			off = store->ckpt[store->n - 1].offset;
+			break;
+		}
+		store->n--;
+	}
+	if (store->n == 0)
+		mdfile_init(&ctx, store->algo);
+	*resumed = off;
+
+	if ((buf = malloc(MDCKPT_BUFSIZE)) == NULL)
+		return (-1);
+	next = (off / interval + 1) * interval;
+	for (;;) {
+		len = MDCKPT_BUFSIZE;
+		if (next - off < len)
+			len = next - off;
+		n = pread(fd, buf, len, off);
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n <= 0)
+			break;
+		mdfile_update(&ctx, buf, n);
+		off += n;
+		if (off == next) {
+			if (mdckpt_push(store, fd, off, &ctx) != 0) {
+				n = -1;
+				break;
+			}
+			next += interval;
+		}
+	}
+	free(buf);
+	if (n < 0 || mdckpt_push(store, fd, off, &ctx) != 0)
+		return (-1);
+
+	tmp = ctx;
+	mdfile_final(digest, &tmp);
+	memset(&ctx, 0, sizeof(ctx));
+
+	return (0);
+}
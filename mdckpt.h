@@ -0,0 +1,58 @@
+/*-
+ * Copyright (c) 2023, Collin Funk
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHORS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#ifndef CRYPTO_MDCKPT_H
+#define CRYPTO_MDCKPT_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include "md5.h"
+
+#define MDCKPT_MAX 8 /* Checkpoints kept per file */
+#define MDCKPT_INTERVAL (64 * 1024 * 1024)
+#define MDCKPT_GUARD 4096 /* Bytes before a checkpoint that must match */
+
+struct mdckpt {
+	uint64_t offset; /* Bytes hashed into ctx */
+	uint8_t guard[16]; /* MD5 of the MDCKPT_GUARD bytes before offset */
+	uint8_t ctx[MD5_EXPORT_SIZE]; /* Exported md5_ctx or md4_ctx */
+};
+
+struct mdckpt_store {
+	int algo; /* MDFILE_MD5 or MDFILE_MD4 */
+	uint64_t dev; /* Identity of the file the checkpoints are for */
+	uint64_t ino;
+	size_t n;
+	struct mdckpt ckpt[MDCKPT_MAX]; /* By increasing offset */
+};
+
+void mdckpt_init(struct mdckpt_store *, int);
+int mdckpt_load(struct mdckpt_store *, const char *, int);
+int mdckpt_save(const struct mdckpt_store *, const char *);
+int mdckpt_hash_fd(uint8_t [16], int, struct mdckpt_store *, uint64_t,
+    uint64_t *);
+
+#endif /* CRYPTO_MDCKPT_H */
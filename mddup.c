@@ -0,0 +1,780 @@
+/*-
+ * Copyright (c) 2023, Collin Funk
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHORS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * Find duplicate files while reading as little as possible. Files are
+ * first grouped by size and only sizes shared by two or more go on.
+ * Those have their first and last opts->edge bytes hashed, which splits
+ * most groups of unrelated files, and only files still matching another
+ * are hashed in full. Each pass runs on a pool of threads, largest files
+ * first. Names for the same device and inode count as one file, since
+ * they share their storage already.
+ *
+ * With a cache, the hashes are kept by device, inode, size and
+ * modification time, so a file unchanged since an earlier run is not
+ * read again. Entries for files not seen in this run are kept, so trees
+ * scanned separately can share a cache.
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "mddup.h"
+#include "mdfile.h"
+
+#define MDDUP_VERSION 1
+#define MDDUP_HEADER 32
+#define MDDUP_RECORD 72
+#define MDDUP_STAT_CHUNK 64 /* Files stat'ed per turn */
+#define MDDUP_MAX_THREADS 256
+
+#define MDDUP_PASS_SIZE 0
+#define MDDUP_PASS_EDGE 1
+#define MDDUP_PASS_DIGEST 2
+
+struct mddup_rec {
+	uint64_t dev;
+	uint64_t ino;
+	uint64_t size;
+	int64_t mtime;
+	int known;
+	int fresh; /* From this run rather than the file */
+	uint8_t edge[16];
+	uint8_t digest[16];
+};
+
+struct mddup_cache {
+	struct mddup_rec *rec; /* By device and inode */
+	size_t n;
+};
+
+struct mddup_pool;
+
+typedef void mddup_work_fn(struct mddup_pool *, struct mddup_file *,
+    uint8_t *);
+
+struct mddup_pool {
+	const struct mddup_opts *opts;
+	const struct mddup_cache *cache;
+	struct mdfile_opts file;
+	int nthreads;
+	mddup_work_fn *fn;
+	struct mddup_file **work;
+	size_t n;
+	size_t chunk; /* Files taken per turn */
+	pthread_mutex_t lock; /* Guards next and bytes */
+	size_t next;
+	uint64_t bytes;
+};
+
+void
+mddup_opts_init(struct mddup_opts *opts)
+{
+
+	opts->algo = MDFILE_MD5;
+	opts->nthreads = 0;
+	opts->edge = MDDUP_EDGE;
+	opts->minsize = 1;
+	opts->cache = NULL;
+	opts->error = NULL;
+}
+
+static void
+mddup_put64(uint8_t *p, uint64_t v)
+{
+	int i;
+
+	for (i = 0; i < 8; i++)
+		p[i] = (v >> (8 * i)) & 0xff;
+}
+
+static uint64_t
+mddup_get64(const uint8_t *p)
+{
+	uint64_t v;
+	int i;
+
+	v = 0;
+	for (i = 0; i < 8; i++)
+		v |= (uint64_t)p[i] << (8 * i);
+	return (v);
+}
+
+static int
+mddup_reccmp(const void *a, const void *b)
+{
+	const struct mddup_rec *ra;
+	const struct mddup_rec *rb;
+
+	ra = a;
+	rb = b;
+	if (ra->dev != rb->dev)
+		return (ra->dev < rb->dev ? -1 : 1);
+	if (ra->ino != rb->ino)
+		return (ra->ino < rb->ino ? -1 : 1);
+	if (ra->fresh != rb->fresh)
+		return (rb->fresh - ra->fresh);
+	return (rb->known - ra->known);
+}
+
+/*
+ * Read a cache. A missing file, one kept for another algorithm or edge
+ * size, and a damaged one all give an empty cache, which is written
+ * over at the end of the run.
+ */
+static int
+mddup_cache_load(struct mddup_cache *cache, const struct mddup_opts *opts)
+{
+	struct mddup_rec *r;
+	struct stat st;
+	uint8_t *buf;
+	const uint8_t *p;
+	ssize_t len;
+	size_t n;
+	size_t i;
+	int fd;
+
+	cache->rec = NULL;
+	cache->n = 0;
+	if ((fd = open(opts->cache, O_RDONLY)) < 0)
+		return (errno == ENOENT ? 0 : -1);
+	if (fstat(fd, &st) != 0 || (buf = malloc(st.st_size + 1)) == NULL) {
+		close(fd);
+		return (-1);
+	}
+	len = mdfile_read(fd, buf, st.st_size + 1);
+	close(fd);
+
+	if (len < MDDUP_HEADER || memcmp(buf, "MDDC", 4) != 0 ||
+	    buf[4] != MDDUP_VERSION || buf[5] != opts->algo ||
+	    mddup_get64(buf + 8) != opts->edge)
+		goto out;
+	n = mddup_get64(buf + 16);
+	if (n > (size_t)(len - MDDUP_HEADER) / MDDUP_RECORD ||
+	    (size_t)len != MDDUP_HEADER + n * MDDUP_RECORD)
+		goto out;
+	if (n == 0 || (cache->rec = calloc(n, sizeof(*r))) == NULL)
+		goto out;
+
+	for (i = 0; i < n; i++) {
+		p = buf + MDDUP_HEADER + i * MDDUP_RECORD;
+		r = &cache->rec[i];
+		r->dev = mddup_get64(p);
+		r->ino = mddup_get64(p + 8);
+		r->size = mddup_get64(p + 16);
+		r->mtime = mddup_get64(p + 24);
+		r->known = p[32] & (MDDUP_EDGE_SET | MDDUP_DIGEST_SET);
+		memcpy(r->edge, p + 40, 16);
+		memcpy(r->digest, p + 56, 16);
+	}
+	cache->n = n;
+	qsort(cache->rec, n, sizeof(*cache->rec), mddup_reccmp);
+
+out:
+	free(buf);
+	return (0);
+}
+
+/*
+ * Merge what this run learnt into the cache and write it through a
+ * temporary file renamed into place.
+ */
+static int
+mddup_cache_save(const struct mddup_cache *cache,
+    const struct mddup_file *files, size_t nfiles,
+    const struct mddup_opts *opts)
+{
+	struct mddup_rec *rec;
+	struct mddup_rec *r;
+	uint8_t *buf;
+	uint8_t *p;
+	size_t len;
+	size_t n;
+	size_t m;
+	size_t i;
+	char *tmp;
+	int error;
+	int fd;
+
+	if ((rec = calloc(cache->n + nfiles + 1, sizeof(*rec))) == NULL)
+		return (-1);
+	if (cache->n != 0)
+		memcpy(rec, cache->rec, cache->n * sizeof(*rec));
+	n = cache->n;
+	for (i = 0; i < nfiles; i++) {
+		if (files[i].error != 0 || files[i].known == 0)
+			continue;
+		r = &rec[n++];
+		r->dev = files[i].dev;
+		r->ino = files[i].ino;
+		r->size = files[i].size;
+		r->mtime = files[i].mtime;
+		r->known = files[i].known;
+		r->fresh = 1;
+		memcpy(r->edge, files[i].edge, 16);
+		memcpy(r->digest, files[i].digest, 16);
+	}
+	qsort(rec, n, sizeof(*rec), mddup_reccmp);
+
+	/* Keep the best entry for each file, those of this run first. */
+	m = 0;
+	for (i = 0; i < n; i++) {
+		if (m != 0 && rec[m - 1].dev == rec[i].dev &&
+		    rec[m - 1].ino == rec[i].ino)
+			continue;
+		rec[m++] = rec[i];
+	}
+
+	len = MDDUP_HEADER + m * MDDUP_RECORD;
+	if ((buf = calloc(1, len)) == NULL) {
+		free(rec);
+		return (-1);
+	}
+	memcpy(buf, "MDDC", 4);
+	buf[4] = MDDUP_VERSION;
+	buf[5] = opts->algo;
+	mddup_put64(buf + 8, opts->edge);
+	mddup_put64(buf + 16, m);
+	for (i = 0; i < m; i++) {
+		p = buf + MDDUP_HEADER + i * MDDUP_RECORD;
+		mddup_put64(p, rec[i].dev);
+		mddup_put64(p + 8, rec[i].ino);
+		mddup_put64(p + 16, rec[i].size);
+		mddup_put64(p + 24, rec[i].mtime);
+		p[32] = rec[i].known;
+		memcpy(p + 40, rec[i].edge, 16);
+		memcpy(p + 56, rec[i].digest, 16);
+	}
+	free(rec);
+
+	if ((tmp = malloc(strlen(opts->cache) + 5)) == NULL) {
+		free(buf);
+		return (-1);
+	}
+	sprintf(tmp, "%s.tmp", opts->cache);
+	error = 0;
+	if ((fd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC, 0644)) < 0)
+		error = errno;
+	else {
+		if (write(fd, buf, len) != (ssize_t)len || fsync(fd) != 0)
+			error = errno != 0 ? errno : EIO;
+		if (close(fd) != 0 && error == 0)
+			error = errno;
+		if (error == 0 && rename(tmp, opts->cache) != 0)
+			error = errno;
+		if (error != 0)
+			unlink(tmp);
+	}
+	free(tmp);
+	free(buf);
+	if (error != 0) {
+		errno = error;
+		return (-1);
+	}
+
+	return (0);
+}
+
+static const struct mddup_rec *
+mddup_cache_find(const struct mddup_cache *cache, const struct mddup_file *f)
+{
+	const struct mddup_rec *r;
+	size_t lo;
+	size_t hi;
+	size_t mid;
+
+	lo = 0;
+	hi = cache->n;
+	while (lo < hi) {
+		mid = lo + (hi - lo) / 2;
+		r = &cache->rec[mid];
+		if (r->dev < f->dev || (r->dev == f->dev && r->ino < f->ino))
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	if (lo == cache->n)
+		return (NULL);
+	r = &cache->rec[lo];
+	if (r->dev != f->dev || r->ino != f->ino || r->size != f->size ||
+	    r->mtime != f->mtime)
+		return (NULL);
+	return (r);
+}
+
+static void *
+mddup_worker(void *arg)
+{
+	struct mddup_pool *pool;
+	uint8_t *buf;
+	size_t first;
+	size_t i;
+
+	pool = arg;
+	buf = malloc(MDFILE_BUFSIZE);
+	for (;;) {
+		pthread_mutex_lock(&pool->lock);
+		first = pool->next;
+		pool->next += pool->chunk;
+		pthread_mutex_unlock(&pool->lock);
+		if (first >= pool->n)
+			break;
+
+		for (i = first; i < first + pool->chunk && i < pool->n; i++) {
+			if (buf == NULL)
+				pool->work[i]->error = ENOMEM;
+			else
+				pool->fn(pool, pool->work[i], buf);
+		}
+	}
+	free(buf);
+
+	return (NULL);
+}
+
+/*
+ * Run fn over n files on the calling thread and up to nthreads - 1
+ * others. If a thread cannot be started its share is left to the others.
+ */
+static void
+mddup_run(struct mddup_pool *pool, mddup_work_fn *fn,
+    struct mddup_file **work, size_t n, size_t chunk)
+{
+	pthread_t threads[MDDUP_MAX_THREADS];
+	int started[MDDUP_MAX_THREADS];
+	int nthreads;
+	int i;
+
+	pool->fn = fn;
+	pool->work = work;
+	pool->n = n;
+	pool->chunk = chunk;
+	pool->next = 0;
+	nthreads = pool->nthreads;
+	if ((size_t)nthreads > (n + chunk - 1) / chunk)
+		nthreads = (n + chunk - 1) / chunk;
+
+	for (i = 1; i < nthreads; i++) {
+		started[i] = pthread_create(&threads[i], NULL, mddup_worker,
+		    pool) == 0;
+	}
+	mddup_worker(pool);
+	for (i = 1; i < nthreads; i++) {
+		if (started[i])
+			pthread_join(threads[i], NULL);
+	}
+}
+
+static void
+mddup_stat(struct mddup_pool *pool, struct mddup_file *f, uint8_t *buf)
+{
+	const struct mddup_rec *r;
+	struct stat st;
+
+	(void)buf;
+	if (stat(f->path, &st) != 0) {
+		f->error = errno;
+		return;
+	}
+	if (!S_ISREG(st.st_mode)) {
+		f->error = S_ISDIR(st.st_mode) ? EISDIR : EINVAL;
+		return;
+	}
+	f->size = st.st_size;
+	f->dev = st.st_dev;
+	f->ino = st.st_ino;
+	f->mtime = (int64_t)st.st_mtim.tv_sec * 1000000000 +
+	    st.st_mtim.tv_nsec;
+
+	if ((r = mddup_cache_find(pool->cache, f)) != NULL) {
+		f->known = r->known;
+		memcpy(f->edge, r->edge, 16);
+		memcpy(f->digest, r->digest, 16);
+	}
+}
+
+/*
+ * Hash len bytes of fd from off into ctx. A file that has become shorter
+ * than it was when listed fails with EIO.
+ */
+static int
+mddup_hash_range(struct mdfile_ctx *ctx, int fd, uint8_t *buf,
+    uint64_t off, uint64_t len)
+{
+	size_t want;
+	ssize_t n;
+
+	while (len > 0) {
+		want = len < MDFILE_BUFSIZE ? len : MDFILE_BUFSIZE;
+		if ((n = pread(fd, buf, want, off)) < 0) {
+			if (errno == EINTR)
+				continue;
+			return (-1);
+		}
+		if (n == 0) {
+			errno = EIO;
+			return (-1);
+		}
+		mdfile_update(ctx, buf, n);
+		off += n;
+		len -= n;
+	}
+
+	return (0);
+}
+
+/*
+ * Hash both ends of a file. A file no longer than both ends together is
+ * read whole, so its edge hash is also its digest.
+ */
+static void
+mddup_edge(struct mddup_pool *pool, struct mddup_file *f, uint8_t *buf)
+{
+	struct mdfile_ctx ctx;
+	uint64_t edge;
+	int fd;
+	int ok;
+
+	edge = pool->opts->edge;
+	if ((fd = open(f->path, O_RDONLY)) < 0) {
+		f->error = errno;
+		return;
+	}
+	mdfile_init(&ctx, pool->opts->algo);
+	if (f->size <= 2 * edge)
+		ok = mddup_hash_range(&ctx, fd, buf, 0, f->size) == 0;
+	else {
+		ok = mddup_hash_range(&ctx, fd, buf, 0, edge) == 0 &&
+		    mddup_hash_range(&ctx, fd, buf, f->size - edge,
+		    edge) == 0;
+	}
+	if (!ok)
+		f->error = errno;
+	close(fd);
+	mdfile_final(f->edge, &ctx);
+	if (!ok)
+		return;
+
+	f->known |= MDDUP_EDGE_SET;
+	if (f->size <= 2 * edge) {
+		memcpy(f->digest, f->edge, 16);
+		f->known |= MDDUP_DIGEST_SET;
+	}
+	pthread_mutex_lock(&pool->lock);
+	pool->bytes += f->size <= 2 * edge ? f->size : 2 * edge;
+	pthread_mutex_unlock(&pool->lock);
+}
+
+static void
+mddup_full(struct mddup_pool *pool, struct mddup_file *f, uint8_t *buf)
+{
+	struct stat st;
+	int fd;
+
+	(void)buf;
+	if ((fd = open(f->path, O_RDONLY)) < 0) {
+		f->error = errno;
+		return;
+	}
+	if (mdfile_hash_fd(f->digest, pool->opts->algo, fd,
+	    &pool->file) != 0)
+		f->error = errno;
+	else if (fstat(fd, &st) != 0 || (uint64_t)st.st_size != f->size)
+		f->error = EIO;
+	else
+		f->known |= MDDUP_DIGEST_SET;
+	close(fd);
+
+	pthread_mutex_lock(&pool->lock);
+	pool->bytes += f->size;
+	pthread_mutex_unlock(&pool->lock);
+}
+
+static int
+mddup_keycmp(const struct mddup_file *a, const struct mddup_file *b,
+    int pass)
+{
+
+	if (a->size != b->size)
+		return (a->size < b->size ? 1 : -1);
+	if (pass == MDDUP_PASS_EDGE)
+		return (memcmp(a->edge, b->edge, 16));
+	if (pass == MDDUP_PASS_DIGEST)
+		return (memcmp(a->digest, b->digest, 16));
+	return (0);
+}
+
+static int
+mddup_indexcmp(const struct mddup_file *a, const struct mddup_file *b)
+{
+
+	return (a->index < b->index ? -1 : a->index > b->index);
+}
+
+static int
+mddup_sizecmp(const void *a, const void *b)
+{
+	const struct mddup_file *fa;
+	const struct mddup_file *fb;
+	int c;
+
+	fa = *(struct mddup_file *const *)a;
+	fb = *(struct mddup_file *const *)b;
+	if ((c = mddup_keycmp(fa, fb, MDDUP_PASS_SIZE)) != 0)
+		return (c);
+	return (mddup_indexcmp(fa, fb));
+}
+
+static int
+mddup_edgecmp(const void *a, const void *b)
+{
+	const struct mddup_file *fa;
+	const struct mddup_file *fb;
+	int c;
+
+	fa = *(struct mddup_file *const *)a;
+	fb = *(struct mddup_file *const *)b;
+	if ((c = mddup_keycmp(fa, fb, MDDUP_PASS_EDGE)) != 0)
+		return (c);
+	return (mddup_indexcmp(fa, fb));
+}
+
+static int
+mddup_digestcmp(const void *a, const void *b)
+{
+	const struct mddup_file *fa;
+	const struct mddup_file *fb;
+	int c;
+
+	fa = *(struct mddup_file *const *)a;
+	fb = *(struct mddup_file *const *)b;
+	if ((c = mddup_keycmp(fa, fb, MDDUP_PASS_DIGEST)) != 0)
+		return (c);
+	return (mddup_indexcmp(fa, fb));
+}
+
+static int
+mddup_inocmp(const void *a, const void *b)
+{
+	const struct mddup_file *fa;
+	const struct mddup_file *fb;
+
+	fa = *(struct mddup_file *const *)a;
+	fb = *(struct mddup_file *const *)b;
+	if (fa->dev != fb->dev)
+		return (fa->dev < fb->dev ? -1 : 1);
+	if (fa->ino != fb->ino)
+		return (fa->ino < fb->ino ? -1 : 1);
+	return (mddup_indexcmp(fa, fb));
+}
+
+/*
+ * Drop the files that failed, sort the rest by the key of a pass and
+ * keep those matching at least one other. Groups stay largest first.
+ */
+static size_t
+mddup_prune(struct mddup_file **work, size_t n, int pass)
+{
+	static int (*const cmp[])(const void *, const void *) = {
+		mddup_sizecmp, mddup_edgecmp, mddup_digestcmp
+	};
+	size_t m;
+	size_t i;
+	size_t j;
+
+	m = 0;
+	for (i = 0; i < n; i++) {
+		if (work[i]->error == 0)
+			work[m++] = work[i];
+	}
+	qsort(work, m, sizeof(*work), cmp[pass]);
+
+	n = 0;
+	for (i = 0; i < m; i = j) {
+		for (j = i + 1; j < m &&
+		    mddup_keycmp(work[i], work[j], pass) == 0; j++)
+			;
+		if (j - i >= 2) {
+			memmove(&work[n], &work[i], (j - i) * sizeof(*work));
+			n += j - i;
+		}
+	}
+
+	return (n);
+}
+
+/*
+ * Find the duplicates among n files and hand each set to fn, largest
+ * files first and each set in input order. Files that could not be read
+ * are then handed to opts->error, if set, in input order. Returns the
+ * number of files that could not be read, or -1 if the pool could not be
+ * set up or the cache could not be read or written. stats may be NULL.
+ */
+int
+mddup_find(const char *const paths[], size_t n,
+    const struct mddup_opts *opts, mddup_fn *fn, void *arg,
+    struct mddup_stats *stats)
+{
+	struct mddup_opts defaults;
+	struct mddup_stats dummy;
+	struct mddup_cache cache;
+	struct mddup_pool pool;
+	struct mddup_file *files;
+	struct mddup_file **work;
+	struct mddup_file **todo;
+	size_t ntodo;
+	size_t m;
+	size_t i;
+	size_t j;
+	int ret;
+
+	if (opts == NULL) {
+		mddup_opts_init(&defaults);
+		opts = &defaults;
+	}
+	if (stats == NULL)
+		stats = &dummy;
+	memset(stats, 0, sizeof(*stats));
+	stats->files = n;
+	memset(&cache, 0, sizeof(cache));
+	if (opts->cache != NULL && mddup_cache_load(&cache, opts) != 0)
+		return (-1);
+
+	files = calloc(n + 1, sizeof(*files));
+	work = calloc(n + 1, sizeof(*work));
+	todo = calloc(n + 1, sizeof(*todo));
+	if (files == NULL || work == NULL || todo == NULL) {
+		free(files);
+		free(work);
+		free(todo);
+		free(cache.rec);
+		errno = ENOMEM;
+		return (-1);
+	}
+
+	memset(&pool, 0, sizeof(pool));
+	pool.opts = opts;
+	pool.cache = &cache;
+	mdfile_opts_init(&pool.file);
+	pool.nthreads = opts->nthreads;
+	if (pool.nthreads <= 0)
+		pool.nthreads = sysconf(_SC_NPROCESSORS_ONLN);
+	if (pool.nthreads <= 0)
+		pool.nthreads = 1;
+	if (pool.nthreads > MDDUP_MAX_THREADS)
+		pool.nthreads = MDDUP_MAX_THREADS;
+	pthread_mutex_init(&pool.lock, NULL);
+
+	for (i = 0; i < n; i++) {
+		files[i].path = paths[i];
+		files[i].index = i;
+		work[i] = &files[i];
+	}
+	mddup_run(&pool, mddup_stat, work, n, MDDUP_STAT_CHUNK);
+
+	/* Keep the first name of each file that can be a duplicate. */
+	qsort(work, n, sizeof(*work), mddup_inocmp);
+	m = 0;
+	for (i = 0; i < n; i++) {
+		if (work[i]->error != 0)
+			continue;
+		if (m != 0 && work[m - 1]->dev == work[i]->dev &&
+		    work[m - 1]->ino == work[i]->ino) {
+			work[i]->error = EEXIST;
+			stats->links++;
+		} else if (work[i]->size >= opts->minsize)
+			work[m++] = work[i];
+	}
+	m = mddup_prune(work, m, MDDUP_PASS_SIZE);
+
+	/* Both ends of every file sharing its size with another. */
+	ntodo = 0;
+	for (i = 0; i < m; i++) {
+		if (work[i]->known & MDDUP_EDGE_SET)
+			stats->cached++;
+		else
+			todo[ntodo++] = work[i];
+	}
+	mddup_run(&pool, mddup_edge, todo, ntodo, 1);
+	stats->edged = ntodo;
+	m = mddup_prune(work, m, MDDUP_PASS_EDGE);
+
+	/* The whole of every file whose ends match another's. */
+	ntodo = 0;
+	for (i = 0; i < m; i++) {
+		if (work[i]->size <= 2 * opts->edge)
+			continue;
+		if (work[i]->known & MDDUP_DIGEST_SET)
+			stats->cached++;
+		else
+			todo[ntodo++] = work[i];
+	}
+	mddup_run(&pool, mddup_full, todo, ntodo, 1);
+	stats->hashed = ntodo;
+	m = mddup_prune(work, m, MDDUP_PASS_DIGEST);
+
+	for (i = 0; i < m; i = j) {
+		for (j = i + 1; j < m && mddup_keycmp(work[i], work[j],
+		    MDDUP_PASS_DIGEST) == 0; j++)
+			;
+		stats->sets++;
+		stats->dups += j - i - 1;
+		stats->wasted += (j - i - 1) * work[i]->size;
+		fn(&work[i], j - i, arg);
+	}
+	stats->bytes = pool.bytes;
+	pthread_mutex_destroy(&pool.lock);
+
+	for (i = 0; i < n; i++) {
+		if (files[i].error == 0 || files[i].error == EEXIST)
+			continue;
+		stats->failed++;
+		if (opts->error != NULL)
+			opts->error(&files[i], arg);
+	}
+	ret = stats->failed;
+	if (opts->cache != NULL &&
+	    mddup_cache_save(&cache, files, n, opts) != 0)
+		ret = -1;
+
+	free(cache.rec);
+	free(todo);
+	free(work);
+	free(files);
+
+	return (ret);
+}
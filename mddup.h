@@ -0,0 +1,81 @@
+/*-
+ * Copyright (c) 2023, Collin Funk
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHORS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#ifndef CRYPTO_MDDUP_H
+#define CRYPTO_MDDUP_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include "mdfile.h"
+
+#define MDDUP_EDGE 4096 /* Bytes hashed at each end of a file at first */
+
+#define MDDUP_EDGE_SET 1
+#define MDDUP_DIGEST_SET 2
+
+struct mddup_file {
+	const char *path;
+	size_t index; /* Position in the input list */
+	uint64_t size;
+	uint64_t dev; /* Identity and age, the key of the cache */
+	uint64_t ino;
+	int64_t mtime; /* Modification time in nanoseconds */
+	int error; /* errno of a failure, 0 if all is well */
+	int known; /* MDDUP_EDGE_SET and MDDUP_DIGEST_SET */
+	uint8_t edge[16]; /* Hash of the first and last bytes */
+	uint8_t digest[16]; /* Hash of the whole file */
+};
+
+typedef void mddup_fn(struct mddup_file *const [], size_t, void *);
+typedef void mddup_error_fn(const struct mddup_file *, void *);
+
+struct mddup_opts {
+	int algo; /* MDFILE_MD5 or MDFILE_MD4 */
+	int nthreads; /* Worker threads, 0 for one per online CPU */
+	size_t edge; /* Bytes hashed at each end in the first pass */
+	uint64_t minsize; /* Smaller files are never duplicates */
+	const char *cache; /* File of earlier hashes, or NULL */
+	mddup_error_fn *error; /* Told of files that could not be read */
+};
+
+struct mddup_stats {
+	size_t files; /* Files given */
+	size_t links; /* Dropped as another name for an earlier file */
+	size_t failed; /* Could not be read */
+	size_t edged; /* Ends read */
+	size_t hashed; /* Read in full */
+	size_t cached; /* Reads saved by the cache */
+	size_t sets; /* Sets of duplicates reported */
+	size_t dups; /* Files in them beyond the first of each */
+	uint64_t bytes; /* Bytes read */
+	uint64_t wasted; /* Bytes taken by those extra copies */
+};
+
+void mddup_opts_init(struct mddup_opts *);
+int mddup_find(const char *const [], size_t, const struct mddup_opts *,
+    mddup_fn *, void *, struct mddup_stats *);
+
+#endif /* CRYPTO_MDDUP_H */
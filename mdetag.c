@@ -0,0 +1,463 @@
+/*-
+ * Copyright (c) 2023, Collin Funk
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHORS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * S3 style multipart ETags. An object uploaded in parts gets the MD5 of
+ * the concatenated MD5s of its parts followed by "-" and the number of
+ * parts; one uploaded in a single piece gets its plain MD5. Parts of a
+ * seekable file are hashed on several threads with pread. A pipe has to
+ * be read in order, so its parts are hashed one after the other in the
+ * same single pass.
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#include <ctype.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "md5.h"
+#include "mdetag.h"
+#include "mdfile.h"
+
+#define MDETAG_BUFSIZE (1024 * 1024)
+#define MDETAG_MAX_THREADS 256
+#define MDETAG_MAX_GUESSES 3 /* Part sizes tried by mdetag_check */
+
+struct mdetag_job {
+	pthread_mutex_t lock;
+	int fd;
+	off_t base; /* Offset of the object in fd */
+	uint64_t size;
+	uint64_t partsize;
+	size_t nparts;
+	size_t next; /* Next part to hash */
+	uint8_t (*digests)[16];
+	int error; /* errno of the first failure */
+};
+
+void
+mdetag_opts_init(struct mdetag_opts *opts)
+{
+
+	opts->partsize = MDETAG_PARTSIZE;
+	opts->threshold = MDETAG_PARTSIZE;
+	opts->nthreads = 0;
+}
+
+static void
+mdetag_hex(char *s, const uint8_t digest[16])
+{
+	static const char hex[] = "0123456789abcdef";
+	int i;
+
+	for (i = 0; i < 16; i++) {
+		s[2 * i] = hex[digest[i] >> 4];
+		s[2 * i + 1] = hex[digest[i] & 0xf];
+	}
+	s[32] = '\0';
+}
+
+/*
+ * Format the ETag of an object uploaded as nparts parts.
+ */
+void
+mdetag_combine(char etag[MDETAG_MAX], const uint8_t (*digests)[16],
+    size_t nparts)
+{
+	uint8_t digest[16];
+
+	md5_digest(digest, digests, nparts * 16);
+	mdetag_hex(etag, digest);
+	snprintf(etag + 32, MDETAG_MAX - 32, "-%zu", nparts);
+}
+
+static void *
+mdetag_worker(void *arg)
+{
+	struct mdetag_job *job;
+	struct md5_ctx ctx;
+	uint64_t off;
+	uint64_t end;
+	uint8_t *buf;
+	size_t part;
+	ssize_t n;
+	int error;
+
+	job = arg;
+	if ((buf = malloc(MDETAG_BUFSIZE)) == NULL) {
+		pthread_mutex_lock(&job->lock);
+		job->error = ENOMEM;
+		pthread_mutex_unlock(&job->lock);
+		return (NULL);
+	}
+
+	error = 0;
+	for (;;) {
+		pthread_mutex_lock(&job->lock);
+		if (error != 0 && job->error == 0)
+			job->error = error;
+		part = job->next++;
+		error = job->error;
+		pthread_mutex_unlock(&job->lock);
+		if (part >= job->nparts || error != 0)
+			break;
+
+		md5_init(&ctx);
+		off = part * job->partsize;
+		end = off + job->partsize < job->size ? off + job->partsize :
+		    job->size;
+		for (; off < end; off += n) {
+			n = pread(job->fd, buf, end - off < MDETAG_BUFSIZE ?
+			    end - off : MDETAG_BUFSIZE, job->base + off);
+			if (n < 0 && errno == EINTR) {
+				n = 0;
+				continue;
+			}
+			if (n <= 0) {
+				/* The file shrank underneath us. */
+				error = n < 0 ? errno : EIO;
+				break;
+			}
+			md5_update(&ctx, buf, n);
+		}
+		md5_final(job->digests[part], &ctx);
+	}
+
+	free(buf);
+	return (NULL);
+}
+
+/*
+ * Hash the parts of size bytes at base in fd on nthreads threads.
+ */
+static int
+mdetag_parts(char etag[MDETAG_MAX], int fd, off_t base, uint64_t size,
+    uint64_t partsize, int nthreads)
+{
+	pthread_t threads[MDETAG_MAX_THREADS];
+	int started[MDETAG_MAX_THREADS];
+	struct mdetag_job job;
+	int i;
+
+	memset(&job, 0, sizeof(job));
+	job.fd = fd;
+	job.base = base;
+	job.size = size;
+	job.partsize = partsize;
+	job.nparts = size == 0 ? 1 : (size - 1) / partsize + 1;
+	if ((job.digests = calloc(job.nparts, 16)) == NULL)
+		return (-1);
+	pthread_mutex_init(&job.lock, NULL);
+
+	if (nthreads <= 0)
+		nthreads = sysconf(_SC_NPROCESSORS_ONLN);
+	if (nthreads <= 0)
+		nthreads = 1;
+	if (nthreads > MDETAG_MAX_THREADS)
+		nthreads = MDETAG_MAX_THREADS;
+	if ((size_t)nthreads > job.nparts)
+		nthreads = job.nparts;
+	for (i = 1; i < nthreads; i++) {
+		started[i] = pthread_create(&threads[i], NULL, mdetag_worker,
+		    &job) == 0;
+	}
+	mdetag_worker(&job);
+	for (i = 1; i < nthreads; i++) {
+		if (started[i])
+			pthread_join(threads[i], NULL);
+	}
+	pthread_mutex_destroy(&job.lock);
+
+	if (job.error == 0)
+		mdetag_combine(etag, (const uint8_t (*)[16])job.digests,
+		    job.nparts);
+	free(job.digests);
+	if (job.error != 0) {
+		errno = job.error;
+		return (-1);
+	}
+
+	return (0);
+}
+
+/*
+ * Finish the part in ctx and append its digest to the array.
+ */
+static int
+mdetag_push(uint8_t (**digests)[16], size_t *nparts, size_t *cap,
+    struct md5_ctx *ctx)
+{
+	uint8_t (*tmp)[16];
+
+	if (*nparts == *cap) {
+		*cap = *cap ? *cap * 2 : 64;
+		if ((tmp = realloc(*digests, *cap * 16)) == NULL)
+			return (-1);
+		*digests = tmp;
+	}
+	md5_final((*digests)[(*nparts)++], ctx);
+	md5_init(ctx);
+
+	return (0);
+}
+
+/*
+ * Read fd to the end, finishing a part every partsize bytes.
+ */
+static int
+mdetag_stream(char etag[MDETAG_MAX], int fd, const struct mdetag_opts *opts)
+{
+	uint8_t (*digests)[16];
+	struct md5_ctx whole;
+	struct md5_ctx part;
+	uint8_t digest[16];
+	uint64_t total;
+	size_t inpart;
+	size_t nparts;
+	size_t cap;
+	size_t len;
+	uint8_t *buf;
+	uint8_t *p;
+	ssize_t n;
+
+	if ((buf = malloc(MDETAG_BUFSIZE)) == NULL)
+		return (-1);
+	digests = NULL;
+	cap = nparts = 0;
+	inpart = 0;
+	total = 0;
+	md5_init(&whole);
+	md5_init(&part);
+
+	while ((n = mdfile_read(fd, buf, MDETAG_BUFSIZE)) > 0) {
+		/* Only needed while the object may be under the threshold. */
+		if (total < opts->threshold)
+			md5_update(&whole, buf, n);
+		total += n;
+		for (p = buf; n > 0; p += len, n -= len) {
+			len = opts->partsize - inpart < (size_t)n ?
+			    opts->partsize - inpart : (size_t)n;
+			md5_update(&part, p, len);
+			inpart += len;
+			if (inpart == opts->partsize) {
+				if (mdetag_push(&digests, &nparts, &cap,
+				    &part) != 0) {
+					n = -1;
+					break;
+				}
+				inpart = 0;
+			}
+		}
+		if (n < 0)
+			break;
+	}
+	free(buf);
+
+	if (n == 0 && total < opts->threshold) {
+		md5_final(digest, &whole);
+		mdetag_hex(etag, digest);
+	} else if (n == 0) {
+		if ((inpart != 0 || nparts == 0) &&
+		    mdetag_push(&digests, &nparts, &cap, &part) != 0)
+			n = -1;
+		else
+			mdetag_combine(etag, (const uint8_t (*)[16])digests,
+			    nparts);
+	}
+	free(digests);
+
+	return (n < 0 ? -1 : 0);
+}
+
+/*
+ * The ETag of everything left to read on fd. Returns 0, or -1 with errno
+ * set.
+ */
+int
+mdetag_fd(char etag[MDETAG_MAX], int fd, const struct mdetag_opts *opts)
+{
+	struct mdetag_opts defaults;
+	uint8_t digest[16];
+	struct stat st;
+	uint64_t size;
+	off_t base;
+
+	if (opts == NULL) {
+		mdetag_opts_init(&defaults);
+		opts = &defaults;
+	}
+	if (opts->partsize == 0) {
+		errno = EINVAL;
+		return (-1);
+	}
+	if (fstat(fd, &st) != 0)
+		return (-1);
+	if (!S_ISREG(st.st_mode) || (base = lseek(fd, 0, SEEK_CUR)) < 0)
+		return (mdetag_stream(etag, fd, opts));
+	size = st.st_size > base ? st.st_size - base : 0;
+
+	if (size < opts->threshold) {
+		if (mdfile_hash_fd(digest, MDFILE_MD5, fd, NULL) != 0)
+			return (-1);
+		mdetag_hex(etag, digest);
+		return (0);
+	}
+	return (mdetag_parts(etag, fd, base, size, opts->partsize,
+	    opts->nthreads));
+}
+
+int
+mdetag_path(char etag[MDETAG_MAX], const char *path,
+    const struct mdetag_opts *opts)
+{
+	int error;
+	int fd;
+	int ret;
+
+	if ((fd = open(path, O_RDONLY)) < 0)
+		return (-1);
+	ret = mdetag_fd(etag, fd, opts);
+	error = errno;
+	close(fd);
+	errno = error;
+
+	return (ret);
+}
+
+/*
+ * Compare fd with an ETag as returned by S3, quoted or not. For a
+ * multipart ETag the part size is not known, but the part count limits
+ * it to a range. Each guess costs a pass over the file, so only the
+ * likely ones are tried: the smallest whole number of MiB in range, as
+ * upload tools use, the smallest power of two MiB in range, and the
+ * smallest size in range. Returns 0 and sets *partsize (0 for a single
+ * piece upload) on a match, 1 if nothing matches, or -1 with errno set.
+ */
+int
+mdetag_check(int fd, const char *expected, int nthreads, size_t *partsize)
+{
+	char want[MDETAG_MAX];
+	char etag[MDETAG_MAX];
+	uint64_t nparts;
+	uint64_t size;
+	uint64_t lo;
+	uint64_t hi;
+	uint64_t p;
+	uint64_t guess[MDETAG_MAX_GUESSES];
+	struct stat st;
+	uint8_t digest[16];
+	size_t nguess;
+	size_t len;
+	char *end;
+	off_t base;
+	size_t i;
+
+	/* Lower case, without quotes. */
+	len = strlen(expected);
+	if (len >= 2 && expected[0] == '"' && expected[len - 1] == '"') {
+		expected++;
+		len -= 2;
+	}
+	if (len < 32 || len >= MDETAG_MAX) {
+		errno = EINVAL;
+		return (-1);
+	}
+	for (i = 0; i < len; i++)
+		want[i] = tolower((unsigned char)expected[i]);
+	want[len] = '\0';
+	for (i = 0; i < 32; i++) {
+		if (!isxdigit((unsigned char)want[i])) {
+			errno = EINVAL;
+			return (-1);
+		}
+	}
+
+	if (len == 32) {
+		if (mdfile_hash_fd(digest, MDFILE_MD5, fd, NULL) != 0)
+			return (-1);
+		mdetag_hex(etag, digest);
+		*partsize = 0;
+		return (strcmp(etag, want) != 0);
+	}
+
+	errno = 0;
+	nparts = strtoull(want + 33, &end, 10);
+	if (want[32] != '-' || *end != '\0' || errno != 0 || nparts == 0) {
+		errno = EINVAL;
+		return (-1);
+	}
+	if (fstat(fd, &st) != 0)
+		return (-1);
+	if (!S_ISREG(st.st_mode) || (base = lseek(fd, 0, SEEK_CUR)) < 0) {
+		/* Each guess needs another pass over the data. */
+		errno = ESPIPE;
+		return (-1);
+	}
+	size = st.st_size > base ? st.st_size - base : 0;
+
+	/* Part sizes p with (nparts - 1) * p < size <= nparts * p. */
+	if (nparts > 1 && size < nparts)
+		return (1);
+	lo = nparts == 1 ? (size ? size : 1) : (size - 1) / nparts + 1;
+	hi = nparts == 1 ? lo : (size - 1) / (nparts - 1);
+	if (hi > SIZE_MAX)
+		hi = SIZE_MAX;
+	if (lo > hi)
+		return (1);
+
+	/* Most likely first, each tried once. */
+	nguess = 0;
+	p = (lo + (1 << 20) - 1) >> 20 << 20;
+	if (p <= hi)
+		guess[nguess++] = p;
+	for (p = 1 << 20; p < lo; p <<= 1)
+		;
+	if (p <= hi && (nguess == 0 || p != guess[0]))
+		guess[nguess++] = p;
+	if (lo % (1 << 20) != 0)
+		guess[nguess++] = lo;
+
+	for (i = 0; i < nguess; i++) {
+		if (mdetag_parts(etag, fd, base, size, guess[i], nthreads) != 0)
+			return (-1);
+		if (strcmp(etag, want) == 0) {
+			*partsize = guess[i];
+			return (0);
+		}
+	}
+
+	return (1);
+}
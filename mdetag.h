@@ -0,0 +1,47 @@
+/*-
+ * Copyright (c) 2023, Collin Funk
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHORS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#ifndef CRYPTO_MDETAG_H
+#define CRYPTO_MDETAG_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+#define MDETAG_PARTSIZE (8 * 1024 * 1024)
+#define MDETAG_MAX 64 /* Room for "<32 hex digits>-<parts>" and a NUL */
+
+struct mdetag_opts {
+	size_t partsize; /* Bytes per part, the last part may be shorter */
+	size_t threshold; /* Smaller objects are uploaded in one piece */
+	int nthreads; /* Threads hashing parts, 0 for one per online CPU */
+};
+
+void mdetag_opts_init(struct mdetag_opts *);
+void mdetag_combine(char [MDETAG_MAX], const uint8_t (*)[16], size_t);
+int mdetag_fd(char [MDETAG_MAX], int, const struct mdetag_opts *);
+int mdetag_path(char [MDETAG_MAX], const char *, const struct mdetag_opts *);
+int mdetag_check(int, const char *, int, size_t *);
+
+#endif /* CRYPTO_MDETAG_H */
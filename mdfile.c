@@ -0,0 +1,467 @@
+/*-
+ * Copyright (c) 2023, Collin Funk
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHORS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * Hash whole files with md5 or md4. A file is either mapped a window at
+ * a time with sequential advice, read ahead by a second thread into two
+ * buffers so reading overlaps hashing, or read in a plain loop.
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <sys/types.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "md4.h"
+#include "md5.h"
+#include "mdfile.h"
+
+struct mdfile_pipe {
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+	int fd;
+	size_t bufsize;
+	uint8_t *buf[2];
+	size_t len[2]; /* Bytes in buf[i], 0 at end of file */
+	int full[2]; /* buf[i] is waiting to be hashed */
+	int error; /* errno of a failed read */
+};
+
+int
+mdfile_algo(const char *name)
+{
+
+	if (strcmp(name, "md5") == 0)
+		return (MDFILE_MD5);
+	if (strcmp(name, "md4") == 0)
+		return (MDFILE_MD4);
+	return (-1);
+}
+
+const char *
+mdfile_algo_name(int algo)
+{
+
+	return (algo == MDFILE_MD4 ? "md4" : "md5");
+}
+
+/*
+ * Read a byte count with an optional k, m or g suffix for KiB, MiB or GiB
+ * into *size. Returns 0, or -1 if arg is not one or it exceeds max.
+ */
+int
+mdfile_size(uint64_t *size, const char *arg, uint64_t max)
+{
+	unsigned long long n;
+	char *end;
+	int shift;
+
+	errno = 0;
+	n = strtoull(arg, &end, 0);
+	shift = 0;
+	switch (*end) {
+	case 'k':
+	case 'K':
+		shift = 10;
+		break;
+	case 'm':
+	case 'M':
+		shift = 20;
+		break;
+	case 'g':
+	case 'G':
+		shift = 30;
+		break;
+	}
+	if (shift != 0)
+		end++;
+	if (errno != 0 || end == arg || *end != '\0' || n > (max >> shift))
+		return (-1);
+	*size = (uint64_t)n << shift;
+
+	return (0);
+}
+
+int
+mdfile_method(const char *name)
+{
+
+	if (strcmp(name, "auto") == 0)
+		return (MDFILE_AUTO);
+	if (strcmp(name, "mmap") == 0)
+		return (MDFILE_MMAP);
+	if (strcmp(name, "thread") == 0)
+		return (MDFILE_THREAD);
+	if (strcmp(name, "read") == 0)
+		return (MDFILE_READ);
+	return (-1);
+}
+
+void
+mdfile_init(struct mdfile_ctx *ctx, int algo)
+{
+
+	ctx->algo = algo;
+	if (algo == MDFILE_MD4)
+		md4_init(&ctx->u.md4);
+	else
+		md5_init(&ctx->u.md5);
+}
+
+void
+mdfile_update(struct mdfile_ctx *ctx, const void *data, size_t len)
+{
+
+	if (ctx->algo == MDFILE_MD4)
+		md4_update(&ctx->u.md4, data, len);
+	else
+		md5_update(&ctx->u.md5, data, len);
+}
+
+void
+mdfile_final(uint8_t digest[16], struct mdfile_ctx *ctx)
+{
+
+	if (ctx->algo == MDFILE_MD4)
+		md4_final(digest, &ctx->u.md4);
+	else
+		md5_final(digest, &ctx->u.md5);
+}
+
+void
+mdfile_copy(struct mdfile_ctx *dst, const struct mdfile_ctx *src)
+{
+
+	dst->algo = src->algo;
+	if (src->algo == MDFILE_MD4)
+		md4_ctx_copy(&dst->u.md4, &src->u.md4);
+	else
+		md5_ctx_copy(&dst->u.md5, &src->u.md5);
+}
+
+void
+mdfile_opts_init(struct mdfile_opts *opts)
+{
+
+	opts->method = MDFILE_AUTO;
+	opts->bufsize = MDFILE_BUFSIZE;
+	opts->mapsize = MDFILE_MAPSIZE;
+}
+
+/*
+ * The value of a hex digit in either case, or -1 if c is not one.
+ */
+int
+mdfile_hexdigit(int c)
+{
+
+	if (c >= '0' && c <= '9')
+		return (c - '0');
+	if (c >= 'a' && c <= 'f')
+		return (c - 'a' + 10);
+	if (c >= 'A' && c <= 'F')
+		return (c - 'A' + 10);
+	return (-1);
+}
+
+/*
+ * Read until buf is full or the file ends. Returns the number of bytes
+ * read or -1 with errno set.
+ */
+ssize_t
+mdfile_read(int fd, void *buf, size_t size)
+{
+	uint8_t *p;
+	ssize_t n;
+	size_t len;
+
+	p = buf;
+	for (len = 0; len < size; len += n) {
+		n = read(fd, p + len, size - len);
+		if (n == 0)
+			break;
+		if (n < 0) {
+			if (errno == EINTR) {
+				n = 0;
+				continue;
+			}
+			return (-1);
+		}
+	}
+
+	return (len);
+}
+
+static void *
+mdfile_alloc(size_t size)
+{
+	void *p;
+
+	if (posix_memalign(&p, 4096, size) != 0)
+		return (NULL);
+	return (p);
+}
+
+static int
+mdfile_hash_read(struct mdfile_ctx *ctx, int fd, size_t bufsize)
+{
+	uint8_t *buf;
+	ssize_t n;
+
+	if ((buf = mdfile_alloc(bufsize)) == NULL)
+		return (-1);
+	(void)posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+
+	while ((n = mdfile_read(fd, buf, bufsize)) > 0)
+		mdfile_update(ctx, buf, n);
+
+	free(buf);
+	return (n < 0 ? -1 : 0);
+}
+
+/*
+ * Map the file mapsize bytes at a time. Each window is unmapped once it
+ * is hashed so the pages can be dropped behind the reader. As with any
+ * mapping, a file truncated underneath us raises SIGBUS.
+ */
+static int
+mdfile_hash_mmap(struct mdfile_ctx *ctx, int fd, off_t size, size_t mapsize)
+{
+	long pagesize;
+	size_t len;
+	off_t off;
+	void *p;
+
+	pagesize = sysconf(_SC_PAGESIZE);
+	mapsize = (mapsize + pagesize - 1) / pagesize * pagesize;
+
+	for (off = 0; off < size; off += len) {
+		len = size - off < (off_t)mapsize ? (size_t)(size - off) :
+		    mapsize;
+		p = mmap(NULL, len, PROT_READ, MAP_SHARED, fd, off);
+		if (p == MAP_FAILED)
+			return (-1);
+		(void)posix_madvise(p, len, POSIX_MADV_SEQUENTIAL);
+		mdfile_update(ctx, p, len);
+		munmap(p, len);
+	}
+
+	return (0);
+}
+
+static void *
+mdfile_reader(void *arg)
+{
+	struct mdfile_pipe *rd;
+	ssize_t n;
+	int i;
+
+	rd = arg;
+	for (i = 0;; i ^= 1) {
+		pthread_mutex_lock(&rd->lock);
+		while (rd->full[i])
+			pthread_cond_wait(&rd->cond, &rd->lock);
+		pthread_mutex_unlock(&rd->lock);
+
+		n = mdfile_read(rd->fd, rd->buf[i], rd->bufsize);
+
+		pthread_mutex_lock(&rd->lock);
+		if (n < 0) {
+			rd->error = errno;
+			n = 0;
+		}
+		rd->len[i] = n;
+		rd->full[i] = 1;
+		pthread_cond_broadcast(&rd->cond);
+		pthread_mutex_unlock(&rd->lock);
+		if (n == 0)
+			break;
+	}
+
+	return (NULL);
+}
+
+/*
+ * Hash one buffer while the reader thread fills the other.
+ */
+static int
+mdfile_hash_thread(struct mdfile_ctx *ctx, int fd, size_t bufsize)
+{
+	struct mdfile_pipe rd;
+	pthread_t thread;
+	size_t len;
+	int error;
+	int i;
+
+	memset(&rd, 0, sizeof(rd));
+	rd.fd = fd;
+	rd.bufsize = bufsize;
+	rd.buf[0] = mdfile_alloc(bufsize);
+	rd.buf[1] = mdfile_alloc(bufsize);
+	if (rd.buf[0] == NULL || rd.buf[1] == NULL) {
+		free(rd.buf[0]);
+		free(rd.buf[1]);
+		return (-1);
+	}
+	(void)posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+	pthread_mutex_init(&rd.lock, NULL);
+	pthread_cond_init(&rd.cond, NULL);
+
+	if ((error = pthread_create(&thread, NULL, mdfile_reader,
+	    &rd)) != 0) {
+		/* No thread to spare, read in this one instead. */
+		pthread_cond_destroy(&rd.cond);
+		pthread_mutex_destroy(&rd.lock);
+		free(rd.buf[0]);
+		free(rd.buf[1]);
+		return (mdfile_hash_read(ctx, fd, bufsize));
+	}
+
+	for (i = 0;; i ^= 1) {
+		pthread_mutex_lock(&rd.lock);
+		while (!rd.full[i])
+			pthread_cond_wait(&rd.cond, &rd.lock);
+		len = rd.len[i];
+		error = rd.error;
+		pthread_mutex_unlock(&rd.lock);
+		if (len == 0)
+			break;
+
+		mdfile_update(ctx, rd.buf[i], len);
+
+		pthread_mutex_lock(&rd.lock);
+		rd.full[i] = 0;
+		pthread_cond_broadcast(&rd.cond);
+		pthread_mutex_unlock(&rd.lock);
+	}
+
+	pthread_join(thread, NULL);
+	pthread_cond_destroy(&rd.cond);
+	pthread_mutex_destroy(&rd.lock);
+	free(rd.buf[0]);
+	free(rd.buf[1]);
+
+	if (error != 0) {
+		errno = error;
+		return (-1);
+	}
+	return (0);
+}
+
+/*
+ * Hash everything left to read on fd. Returns 0, or -1 with errno set.
+ */
+int
+mdfile_hash_fd(uint8_t digest[16], int algo, int fd,
+    const struct mdfile_opts *opts)
+{
+	struct mdfile_opts defaults;
+	struct mdfile_ctx ctx;
+	struct stat st;
+	int method;
+	int ret;
+
+	if (opts == NULL) {
+		mdfile_opts_init(&defaults);
+		opts = &defaults;
+	}
+	if (opts->bufsize == 0 || opts->mapsize == 0) {
+		errno = EINVAL;
+		return (-1);
+	}
+	if (fstat(fd, &st) != 0)
+		return (-1);
+
+	/*
+	 * Small files are not worth a mapping or a thread. Anything that
+	 * cannot be mapped is read ahead.
+	 */
+	method = opts->method;
+	if (method == MDFILE_AUTO) {
+		if (!S_ISREG(st.st_mode))
+			method = MDFILE_THREAD;
+		else if (st.st_size < (off_t)opts->bufsize)
+			method = MDFILE_READ;
+		else
+			method = MDFILE_MMAP;
+	}
+	if (method == MDFILE_MMAP) {
+		if (!S_ISREG(st.st_mode) || lseek(fd, 0, SEEK_CUR) != 0)
+			method = MDFILE_THREAD;
+	}
+
+	mdfile_init(&ctx, algo);
+	ret = -1;
+	switch (method) {
+	case MDFILE_MMAP:
+		ret = mdfile_hash_mmap(&ctx, fd, st.st_size, opts->mapsize);
+		if (ret != 0 && errno != EIO) {
+			/* Some file systems cannot be mapped. */
+			mdfile_init(&ctx, algo);
+			ret = mdfile_hash_thread(&ctx, fd, opts->bufsize);
+		}
+		break;
+	case MDFILE_THREAD:
+		ret = mdfile_hash_thread(&ctx, fd, opts->bufsize);
+		break;
+	case MDFILE_READ:
+		ret = mdfile_hash_read(&ctx, fd, opts->bufsize);
+		break;
+	default:
+		errno = EINVAL;
+		break;
+	}
+	mdfile_final(digest, &ctx);
+
+	return (ret);
+}
+
+int
+mdfile_hash_path(uint8_t digest[16], int algo, const char *path,
+    const struct mdfile_opts *opts)
+{
+	int error;
+	int fd;
+	int ret;
+
+	if ((fd = open(path, O_RDONLY)) < 0)
+		return (-1);
+	ret = mdfile_hash_fd(digest, algo, fd, opts);
+	error = errno;
+	close(fd);
+	errno = error;
+
+	return (ret);
+}
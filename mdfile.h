@@ -0,0 +1,77 @@
+/*-
+ * Copyright (c) 2023, Collin Funk
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHORS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#ifndef CRYPTO_MDFILE_H
+#define CRYPTO_MDFILE_H
+
+#include <sys/types.h>
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include "md4.h"
+#include "md5.h"
+
+#define MDFILE_MD5 0
+#define MDFILE_MD4 1
+
+#define MDFILE_AUTO 0 /* Pick one of the below from the file type and size */
+#define MDFILE_MMAP 1 /* Map windows of the file with sequential advice */
+#define MDFILE_THREAD 2 /* Read ahead into two buffers from a second thread */
+#define MDFILE_READ 3 /* Plain read loop into one buffer */
+
+#define MDFILE_BUFSIZE (256 * 1024)
+#define MDFILE_MAPSIZE (64 * 1024 * 1024)
+
+struct mdfile_ctx {
+	int algo; /* MDFILE_MD5 or MDFILE_MD4 */
+	union {
+		struct md5_ctx md5;
+		struct md4_ctx md4;
+	} u;
+};
+
+struct mdfile_opts {
+	int method; /* One of MDFILE_AUTO, MDFILE_MMAP, ... */
+	size_t bufsize; /* Size of each read buffer */
+	size_t mapsize; /* Size of each mapped window */
+};
+
+int mdfile_algo(const char *);
+const char *mdfile_algo_name(int);
+int mdfile_size(uint64_t *, const char *, uint64_t);
+int mdfile_method(const char *);
+void mdfile_init(struct mdfile_ctx *, int);
+void mdfile_update(struct mdfile_ctx *, const void *, size_t);
+void mdfile_final(uint8_t [16], struct mdfile_ctx *);
+void mdfile_copy(struct mdfile_ctx *, const struct mdfile_ctx *);
+void mdfile_opts_init(struct mdfile_opts *);
+int mdfile_hexdigit(int);
+ssize_t mdfile_read(int, void *, size_t);
+int mdfile_hash_fd(uint8_t [16], int, int, const struct mdfile_opts *);
+int mdfile_hash_path(uint8_t [16], int, const char *,
+    const struct mdfile_opts *);
+
+#endif /* CRYPTO_MDFILE_H */
@@ -0,0 +1,607 @@
+/*-
+ * Copyright (c) 2023, Collin Funk
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHORS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * Hash many files at once. Files are stat'ed, sorted by size and cut
+ * into tasks: a large file is a task of its own and runs of small files
+ * are batched up to opts->batch bytes so scheduling costs little per
+ * file. Tasks are dealt round robin, largest first, to one deque per
+ * thread. A thread takes tasks from the front of its own deque and,
+ * once that is empty, steals from the back of the others.
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "mdcache.h"
+#include "mdfile.h"
+#include "mdfiles.h"
+
+#define MDFILES_BATCH_FILES 64 /* Most small files in one task */
+#define MDFILES_STAT_CHUNK 256 /* Files stat'ed per turn */
+#define MDFILES_MAX_THREADS 256
+
+struct mdfiles_task {
+	size_t first; /* First entry in order[] */
+	size_t count; /* Number of entries */
+};
+
+struct mdfiles_deque {
+	pthread_mutex_t lock;
+	size_t *tasks; /* Indices into pool->tasks */
+	size_t head; /* Next task for the owner */
+	size_t tail; /* One past the next task for a thief */
+};
+
+struct mdfiles_pool {
+	const struct mdfiles_opts *opts;
+	const char *const *paths;
+	size_t n;
+	int nthreads;
+	struct mdfiles_result *results;
+	size_t *order; /* Indices of results by decreasing size */
+	struct mdfiles_task *tasks;
+	struct mdfiles_deque *deques;
+	pthread_mutex_t lock; /* Guards everything below */
+	size_t next_stat; /* First file not yet stat'ed */
+	uint8_t *done; /* Finished but not yet reported in order */
+	size_t next; /* Next file to report in order */
+	int nfailed;
+	mdfiles_fn *fn;
+	void *arg;
+};
+
+struct mdfiles_worker {
+	struct mdfiles_pool *pool;
+	int id;
+};
+
+struct mdfiles_key {
+	uint64_t size;
+	size_t index;
+};
+
+void
+mdfiles_opts_init(struct mdfiles_opts *opts)
+{
+
+	opts->algo = MDFILE_MD5;
+	opts->nthreads = 0;
+	opts->ordered = 1;
+	opts->batch = MDFILES_BATCH;
+	mdfile_opts_init(&opts->file);
+	opts->cache = NULL;
+	opts->stop = NULL;
+}
+
+static int
+mdfiles_push(struct mdfiles_list *list, const char *path, uint64_t size)
+{
+	uint64_t *sizes;
+	char **paths;
+	size_t cap;
+
+	if (list->n == list->cap) {
+		cap = list->cap ? list->cap * 2 : 64;
+		if ((paths = realloc(list->paths,
+		    cap * sizeof(*paths))) == NULL)
+			return (-1);
+		list->paths = paths;
+		if ((sizes = realloc(list->sizes,
+		    cap * sizeof(*sizes))) == NULL)
+			return (-1);
+		list->sizes = sizes;
+		list->cap = cap;
+	}
+	if ((list->paths[list->n] = strdup(path)) == NULL)
+		return (-1);
+	list->sizes[list->n++] = size;
+
+	return (0);
+}
+
+static int
+mdfiles_namecmp(const void *a, const void *b)
+{
+
+	return (strcmp(*(char *const *)a, *(char *const *)b));
+}
+
+/*
+ * Add the regular files under dir in name order. Symbolic links to files
+ * are followed, links to directories are not. A directory that cannot
+ * be read is added as is so hashing it reports why.
+ */
+static int
+mdfiles_walk(struct mdfiles_list *list, const char *dir)
+{
+	struct dirent *de;
+	struct stat st;
+	char **names;
+	char **tmp;
+	char *path;
+	size_t cap;
+	size_t len;
+	size_t n;
+	size_t i;
+	DIR *d;
+	int ret;
+
+	if ((d = opendir(dir)) == NULL)
+		return (mdfiles_push(list, dir, 0));
+
+	names = NULL;
+	cap = n = 0;
+	ret = 0;
+	while ((de = readdir(d)) != NULL) {
+		if (strcmp(de->d_name, ".") == 0 ||
+		    strcmp(de->d_name, "..") == 0)
+			continue;
+		if (n == cap) {
+			cap = cap ? cap * 2 : 32;
+			if ((tmp = realloc(names, cap * sizeof(*names))) ==
+			    NULL) {
+				ret = -1;
+				break;
+			}
+			names = tmp;
+		}
+		if ((names[n] = strdup(de->d_name)) == NULL) {
+			ret = -1;
+			break;
+		}
+		n++;
+	}
+	closedir(d);
+	if (n != 0)
+		qsort(names, n, sizeof(*names), mdfiles_namecmp);
+
+	len = strlen(dir);
+	while (len > 1 && dir[len - 1] == '/')
+		len--;
+	for (i = 0; i < n && ret == 0; i++) {
+		if ((path = malloc(len + strlen(names[i]) + 2)) == NULL) {
+			ret = -1;
+			break;
+		}
+		memcpy(path, dir, len);
+		path[len] = '/';
+		strcpy(path + len + 1, names[i]);
+
+		if (lstat(path, &st) == 0) {
+			if (S_ISDIR(st.st_mode))
+				ret = mdfiles_walk(list, path);
+			else if (S_ISLNK(st.st_mode) && stat(path, &st) == 0 &&
+			    S_ISREG(st.st_mode))
+				ret = mdfiles_push(list, path, st.st_size);
+			else if (S_ISREG(st.st_mode))
+				ret = mdfiles_push(list, path, st.st_size);
+		}
+		free(path);
+	}
+
+	for (i = 0; i < n; i++)
+		free(names[i]);
+	free(names);
+
+	return (ret);
+}
+
+/*
+ * Add path to the list, or every regular file below it if it is a
+ * directory. "-" stands for standard input. Returns -1 if out of memory.
+ */
+int
+mdfiles_list_add(struct mdfiles_list *list, const char *path)
+{
+	struct stat st;
+
+	if (strcmp(path, "-") != 0 && stat(path, &st) == 0) {
+		if (S_ISDIR(st.st_mode))
+			return (mdfiles_walk(list, path));
+		if (S_ISREG(st.st_mode))
+			return (mdfiles_push(list, path, st.st_size));
+	}
+
+	return (mdfiles_push(list, path, 0));
+}
+
+void
+mdfiles_list_free(struct mdfiles_list *list)
+{
+	size_t i;
+
+	for (i = 0; i < list->n; i++)
+		free(list->paths[i]);
+	free(list->paths);
+	free(list->sizes);
+	memset(list, 0, sizeof(*list));
+}
+
+static int
+mdfiles_keycmp(const void *a, const void *b)
+{
+	const struct mdfiles_key *ka;
+	const struct mdfiles_key *kb;
+
+	ka = a;
+	kb = b;
+	if (ka->size != kb->size)
+		return (ka->size < kb->size ? 1 : -1);
+	return (ka->index < kb->index ? -1 : ka->index > kb->index);
+}
+
+/*
+ * Run fn on the calling thread and nthreads - 1 others. If a thread
+ * cannot be started its share is left to the others.
+ */
+static void
+mdfiles_spawn(struct mdfiles_pool *pool, void *(*fn)(void *))
+{
+	struct mdfiles_worker workers[MDFILES_MAX_THREADS];
+	pthread_t threads[MDFILES_MAX_THREADS];
+	int started[MDFILES_MAX_THREADS];
+	int i;
+
+	for (i = 0; i < pool->nthreads; i++) {
+		workers[i].pool = pool;
+		workers[i].id = i;
+		started[i] = i != 0 &&
+		    pthread_create(&threads[i], NULL, fn, &workers[i]) == 0;
+	}
+	fn(&workers[0]);
+	for (i = 1; i < pool->nthreads; i++) {
+		if (started[i])
+			pthread_join(threads[i], NULL);
+	}
+}
+
+static void *
+mdfiles_stat_worker(void *arg)
+{
+	struct mdfiles_worker *w;
+	struct mdfiles_pool *pool;
+	struct stat st;
+	size_t first;
+	size_t i;
+	int ok;
+
+	w = arg;
+	pool = w->pool;
+	for (;;) {
+		pthread_mutex_lock(&pool->lock);
+		first = pool->next_stat;
+		pool->next_stat += MDFILES_STAT_CHUNK;
+		pthread_mutex_unlock(&pool->lock);
+		if (first >= pool->n)
+			break;
+
+		for (i = first; i < first + MDFILES_STAT_CHUNK &&
+		    i < pool->n; i++) {
+			if (strcmp(pool->paths[i], "-") == 0)
+				ok = fstat(STDIN_FILENO, &st) == 0;
+			else
+				ok = stat(pool->paths[i], &st) == 0;
+			if (ok && S_ISREG(st.st_mode))
+				pool->results[i].size = st.st_size;
+		}
+	}
+
+	return (NULL);
+}
+
+/*
+ * Take the next task from our own deque, or steal the last task of
+ * another. Returns 0 when every deque is empty.
+ */
+static int
+mdfiles_pop(struct mdfiles_pool *pool, int id, size_t *task)
+{
+	struct mdfiles_deque *dq;
+	int found;
+	int i;
+
+	found = 0;
+	dq = &pool->deques[id];
+	pthread_mutex_lock(&dq->lock);
+	if (dq->head < dq->tail) {
+		*task = dq->tasks[dq->head++];
+		found = 1;
+	}
+	pthread_mutex_unlock(&dq->lock);
+
+	for (i = 1; i < pool->nthreads && !found; i++) {
+		dq = &pool->deques[(id + i) % pool->nthreads];
+		pthread_mutex_lock(&dq->lock);
+		if (dq->head < dq->tail) {
+			*task = dq->tasks[--dq->tail];
+			found = 1;
+		}
+		pthread_mutex_unlock(&dq->lock);
+	}
+
+	return (found);
+}
+
+static void
+mdfiles_hash_one(struct mdfiles_pool *pool, struct mdfiles_result *r,
+    uint8_t *buf)
+{
+	const struct mdfiles_opts *opts;
+	struct mdfile_ctx ctx;
+	struct mdcache *cache;
+	struct timespec start;
+	struct stat st;
+	ssize_t n;
+	int fd;
+
+	/* An unchanged file in the cache costs only the stat(). */
+	opts = pool->opts;
+	cache = opts->cache;
+	if (strcmp(r->path, "-") == 0 || cache == NULL ||
+	    cache->algo != opts->algo)
+		cache = NULL;
+	else if (stat(r->path, &st) == 0 &&
+	    mdcache_lookup(cache, r->digest, &st)) {
+		r->cached = 1;
+		return;
+	} else
+		clock_gettime(CLOCK_REALTIME, &start);
+
+	if (strcmp(r->path, "-") == 0)
+		fd = STDIN_FILENO;
+	else if ((fd = open(r->path, O_RDONLY)) < 0) {
+		r->error = errno;
+		return;
+	}
+	if (cache != NULL && fstat(fd, &st) != 0)
+		cache = NULL;
+
+	/* Small files go through our own buffer instead of a new one. */
+	if (r->size < opts->file.bufsize) {
+		mdfile_init(&ctx, opts->algo);
+		while ((n = mdfile_read(fd, buf, opts->file.bufsize)) > 0)
+			mdfile_update(&ctx, buf, n);
+		if (n < 0)
+			r->error = errno;
+		mdfile_final(r->digest, &ctx);
+	} else if (mdfile_hash_fd(r->digest, opts->algo, fd,
+	    &opts->file) != 0)
+		r->error = errno;
+	if (cache != NULL && r->error == 0)
+		(void)mdcache_store_fd(cache, r->digest, fd, &st, &start);
+
+	if (fd != STDIN_FILENO)
+		close(fd);
+}
+
+/*
+ * Report a finished file. In order mode results wait until every file
+ * before them has been reported. fn is never run by two threads at once.
+ */
+static void
+mdfiles_report(struct mdfiles_pool *pool, size_t index)
+{
+
+	pthread_mutex_lock(&pool->lock);
+	if (pool->results[index].error != 0)
+		pool->nfailed++;
+	if (pool->opts->ordered) {
+		pool->done[index] = 1;
+		while (pool->next < pool->n && pool->done[pool->next])
+			pool->fn(&pool->results[pool->next++], pool->arg);
+	} else
+		pool->fn(&pool->results[index], pool->arg);
+	pthread_mutex_unlock(&pool->lock);
+}
+
+static void *
+mdfiles_hash_worker(void *arg)
+{
+	struct mdfiles_worker *w;
+	struct mdfiles_pool *pool;
+	struct mdfiles_task *t;
+	struct mdfiles_result *r;
+	uint8_t *buf;
+	size_t task;
+	size_t i;
+
+	w = arg;
+	pool = w->pool;
+	buf = malloc(pool->opts->file.bufsize);
+	while (mdfiles_pop(pool, w->id, &task)) {
+		t = &pool->tasks[task];
+		for (i = t->first; i < t->first + t->count; i++) {
+			if (pool->opts->stop != NULL &&
+			    __atomic_load_n(pool->opts->stop, __ATOMIC_RELAXED))
+				break;
+			r = &pool->results[pool->order[i]];
+			if (buf == NULL)
+				r->error = ENOMEM;
+			else
+				mdfiles_hash_one(pool, r, buf);
+			mdfiles_report(pool, pool->order[i]);
+		}
+	}
+	free(buf);
+
+	return (NULL);
+}
+
+static int
+mdfiles_run(const char *const paths[], const uint64_t sizes[], size_t n,
+    const struct mdfiles_opts *opts, mdfiles_fn *fn, void *arg)
+{
+	struct mdfiles_opts defaults;
+	struct mdfiles_pool pool;
+	struct mdfiles_key *keys;
+	uint64_t bytes;
+	size_t ntasks;
+	size_t i;
+	int ret;
+	int d;
+
+	if (opts == NULL) {
+		mdfiles_opts_init(&defaults);
+		opts = &defaults;
+	}
+	if (n == 0)
+		return (0);
+
+	memset(&pool, 0, sizeof(pool));
+	pool.opts = opts;
+	pool.paths = paths;
+	pool.n = n;
+	pool.fn = fn;
+	pool.arg = arg;
+	pool.nthreads = opts->nthreads;
+	if (pool.nthreads <= 0)
+		pool.nthreads = sysconf(_SC_NPROCESSORS_ONLN);
+	if (pool.nthreads <= 0)
+		pool.nthreads = 1;
+	if (pool.nthreads > MDFILES_MAX_THREADS)
+		pool.nthreads = MDFILES_MAX_THREADS;
+	if ((size_t)pool.nthreads > n)
+		pool.nthreads = n;
+
+	ret = -1;
+	pool.results = calloc(n, sizeof(*pool.results));
+	pool.order = calloc(n, sizeof(*pool.order));
+	pool.tasks = calloc(n, sizeof(*pool.tasks));
+	pool.done = calloc(n, 1);
+	pool.deques = calloc(pool.nthreads, sizeof(*pool.deques));
+	keys = calloc(n, sizeof(*keys));
+	if (pool.results == NULL || pool.order == NULL ||
+	    pool.tasks == NULL || pool.done == NULL || pool.deques == NULL ||
+	    keys == NULL)
+		goto out;
+	for (d = 0; d < pool.nthreads; d++) {
+		pool.deques[d].tasks = calloc(n / pool.nthreads + 1,
+		    sizeof(size_t));
+		if (pool.deques[d].tasks == NULL)
+			goto out;
+	}
+	pthread_mutex_init(&pool.lock, NULL);
+
+	for (i = 0; i < n; i++) {
+		pool.results[i].path = paths[i];
+		pool.results[i].index = i;
+		if (sizes != NULL)
+			pool.results[i].size = sizes[i];
+	}
+	if (sizes == NULL)
+		mdfiles_spawn(&pool, mdfiles_stat_worker);
+
+	/* Largest first, then cut into tasks. */
+	for (i = 0; i < n; i++) {
+		keys[i].size = pool.results[i].size;
+		keys[i].index = i;
+	}
+	qsort(keys, n, sizeof(*keys), mdfiles_keycmp);
+	for (i = 0; i < n; i++)
+		pool.order[i] = keys[i].index;
+
+	ntasks = 0;
+	for (i = 0; i < n;) {
+		pool.tasks[ntasks].first = i;
+		bytes = keys[i++].size;
+		while (i < n && i - pool.tasks[ntasks].first <
+		    MDFILES_BATCH_FILES && bytes + keys[i].size <= opts->batch)
+			bytes += keys[i++].size;
+		pool.tasks[ntasks].count = i - pool.tasks[ntasks].first;
+		ntasks++;
+	}
+
+	/* Deal the tasks out so every deque starts with a large one. */
+	for (i = 0; i < ntasks; i++) {
+		d = i % pool.nthreads;
+		pool.deques[d].tasks[pool.deques[d].tail++] = i;
+	}
+	for (d = 0; d < pool.nthreads; d++)
+		pthread_mutex_init(&pool.deques[d].lock, NULL);
+
+	mdfiles_spawn(&pool, mdfiles_hash_worker);
+
+	for (d = 0; d < pool.nthreads; d++)
+		pthread_mutex_destroy(&pool.deques[d].lock);
+	pthread_mutex_destroy(&pool.lock);
+	ret = pool.nfailed;
+
+out:
+	if (pool.deques != NULL) {
+		for (d = 0; d < pool.nthreads; d++)
+			free(pool.deques[d].tasks);
+	}
+	free(pool.deques);
+	free(pool.done);
+	free(pool.tasks);
+	free(pool.order);
+	free(pool.results);
+	free(keys);
+	if (ret < 0)
+		errno = ENOMEM;
+
+	return (ret);
+}
+
+/*
+ * Hash n files and hand each result to fn. Returns the number of files
+ * that could not be hashed, or -1 if the pool could not be set up. Once
+ * *opts->stop is set, files not yet started are neither hashed nor
+ * reported.
+ */
+int
+mdfiles_hash(const char *const paths[], size_t n,
+    const struct mdfiles_opts *opts, mdfiles_fn *fn, void *arg)
+{
+
+	return (mdfiles_run(paths, NULL, n, opts, fn, arg));
+}
+
+/*
+ * The same for a list built by mdfiles_list_add, using the sizes seen
+ * while walking instead of calling stat again.
+ */
+int
+mdfiles_hash_list(const struct mdfiles_list *list,
+    const struct mdfiles_opts *opts, mdfiles_fn *fn, void *arg)
+{
+
+	return (mdfiles_run((const char *const *)list->paths, list->sizes,
+	    list->n, opts, fn, arg));
+}
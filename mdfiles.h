@@ -0,0 +1,74 @@
+/*-
+ * Copyright (c) 2023, Collin Funk
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHORS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#ifndef CRYPTO_MDFILES_H
+#define CRYPTO_MDFILES_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include "mdfile.h"
+
+#define MDFILES_BATCH (1024 * 1024)
+
+struct mdcache;
+
+struct mdfiles_result {
+	const char *path; /* Path as given, "-" for standard input */
+	size_t index; /* Position in the input list */
+	uint64_t size; /* Size when listed, 0 if not a regular file */
+	int error; /* errno of a failure, 0 on success */
+	int cached; /* Digest taken from opts->cache */
+	uint8_t digest[16]; /* Message digest, set when error is 0 */
+};
+
+typedef void mdfiles_fn(const struct mdfiles_result *, void *);
+
+struct mdfiles_opts {
+	int algo; /* MDFILE_MD5 or MDFILE_MD4 */
+	int nthreads; /* Worker threads, 0 for one per online CPU */
+	int ordered; /* Report in input order instead of as completed */
+	size_t batch; /* Bytes of small files handed out as one task */
+	struct mdfile_opts file; /* How each file is read */
+	struct mdcache *cache; /* Digests of unchanged files, or NULL */
+	int *stop; /* Files not yet started are skipped once set, or NULL */
+};
+
+struct mdfiles_list {
+	char **paths;
+	uint64_t *sizes; /* Sizes seen while walking */
+	size_t n;
+	size_t cap;
+};
+
+void mdfiles_opts_init(struct mdfiles_opts *);
+int mdfiles_list_add(struct mdfiles_list *, const char *);
+void mdfiles_list_free(struct mdfiles_list *);
+int mdfiles_hash(const char *const [], size_t, const struct mdfiles_opts *,
+    mdfiles_fn *, void *);
+int mdfiles_hash_list(const struct mdfiles_list *,
+    const struct mdfiles_opts *, mdfiles_fn *, void *);
+
+#endif /* CRYPTO_MDFILES_H */
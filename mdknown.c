@@ -0,0 +1,644 @@
+/*-
+ * Copyright (c) 2023, Collin Funk
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHORS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * Sets of known digests, such as reference lists of files that can be
+ * left out of a review, in a prebuilt file that is mapped rather than
+ * read. The file holds, in the host's byte order:
+ *
+ *   a 64 byte header;
+ *   a blocked Bloom filter of 64 byte blocks, where a digest sets one
+ *   bit in each of the eight words of one block;
+ *   a bucket index giving where the digests whose leading bits are b
+ *   start, for 2^bucketbits buckets of four to eight digests each;
+ *   the distinct digests in sorted order, 16 bytes each.
+ *
+ * Most files looked up are unknown and are turned away by the one cache
+ * line of their Bloom block. The rest cost a line of the index and about
+ * one line of digests. Batches of lookups prefetch each of these a stage
+ * ahead. Digests are uniform already, so the filter takes its bits and
+ * block straight from them rather than hashing again.
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <sys/types.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "mdfile.h"
+#include "mdfiles.h"
+#include "mdknown.h"
+
+#define MDKNOWN_VERSION 1
+#define MDKNOWN_HEADER 64
+#define MDKNOWN_ORDER 0x01020304
+#define MDKNOWN_BATCH 64
+#define MDKNOWN_SMALL 16 /* Buckets up to this size are insertion sorted */
+
+#ifdef __GNUC__
+#define MDKNOWN_PREFETCH(p) __builtin_prefetch(p)
+#else
+#define MDKNOWN_PREFETCH(p)
+#endif
+
+struct mdknown_header {
+	char magic[4];
+	uint32_t version;
+	uint32_t algo;
+	uint32_t order; /* MDKNOWN_ORDER as written by this host */
+	uint64_t count; /* Distinct digests */
+	uint64_t nblocks; /* Bloom filter blocks, a power of 2 */
+	uint32_t bucketbits;
+	uint8_t unused[28];
+};
+
+struct mdknown_run {
+	const struct mdknown *known;
+	mdknown_fn *fn;
+	void *arg;
+	struct mdknown_stats *stats;
+	struct mdfiles_result results[MDKNOWN_BATCH];
+	uint8_t digests[MDKNOWN_BATCH][16];
+	size_t n;
+};
+
+static uint64_t
+mdknown_le64(const uint8_t *p)
+{
+	uint64_t v;
+	int i;
+
+	v = 0;
+	for (i = 7; i >= 0; i--)
+		v = v << 8 | p[i];
+	return (v);
+}
+
+static uint64_t
+mdknown_bucket(const uint8_t digest[16], int bucketbits)
+{
+	uint32_t lead;
+
+	if (bucketbits == 0)
+		return (0);
+	lead = (uint32_t)digest[0] << 24 | (uint32_t)digest[1] << 16 |
+	    (uint32_t)digest[2] << 8 | digest[3];
+	return (lead >> (32 - bucketbits));
+}
+
+static void
+mdknown_layout(uint64_t nblocks, int bucketbits, uint64_t count,
+    uint64_t *index, uint64_t *digests, uint64_t *size)
+{
+
+	*index = MDKNOWN_HEADER + nblocks * 64;
+	*digests = (*index + (((uint64_t)1 << bucketbits) + 1) * 8 + 63) &
+	    ~(uint64_t)63;
+	*size = *digests + count * 16;
+}
+
+/*
+ * Find the first run of exactly 32 hex digits in a line, so lists in the
+ * format of md5sum, bare digests and CSV files that also carry longer
+ * hashes all work.
+ */
+static int
+mdknown_line(uint8_t digest[16], const char *line)
+{
+	const char *p;
+	const char *q;
+	int i;
+
+	for (p = line; *p != '\0'; p = q) {
+		for (q = p; mdfile_hexdigit(*q) >= 0; q++)
+			;
+		if (q - p == 32) {
+			for (i = 0; i < 16; i++)
+				digest[i] = mdfile_hexdigit(p[2 * i]) << 4 |
+				    mdfile_hexdigit(p[2 * i + 1]);
+			return (0);
+		}
+		if (q == p)
+			q++;
+	}
+	return (-1);
+}
+
+/*
+ * Add the digests of a list to list. Lines that have none are counted
+ * in list->invalid.
+ */
+int
+mdknown_parse(struct mdknown_list *list, FILE *fp)
+{
+	uint8_t (*digests)[16];
+	size_t cap;
+	ssize_t len;
+	char *line;
+	int ret;
+
+	line = NULL;
+	cap = 0;
+	ret = 0;
+	while ((len = getline(&line, &cap, fp)) >= 0) {
+		if (len > 0 && line[len - 1] == '\n')
+			line[--len] = '\0';
+		if (len == 0 || line[0] == '#')
+			continue;
+		if (list->n == list->cap) {
+			list->cap = list->cap ? list->cap * 2 : 1024;
+			if ((digests = realloc(list->digests,
+			    list->cap * 16)) == NULL) {
+				ret = -1;
+				break;
+			}
+			list->digests = digests;
+		}
+		if (mdknown_line(list->digests[list->n], line) != 0)
+			list->invalid++;
+		else
+			list->n++;
+	}
+	if (ret == 0 && ferror(fp))
+		ret = -1;
+	free(line);
+
+	return (ret);
+}
+
+void
+mdknown_list_free(struct mdknown_list *list)
+{
+
+	free(list->digests);
+	memset(list, 0, sizeof(*list));
+}
+
+static int
+mdknown_cmp(const void *a, const void *b)
+{
+
+	return (memcmp(a, b, 16));
+}
+
+static void
+mdknown_sort(uint8_t (*d)[16], size_t n)
+{
+	uint8_t t[16];
+	size_t i;
+	size_t j;
+
+	if (n > MDKNOWN_SMALL) {
+		qsort(d, n, 16, mdknown_cmp);
+		return;
+	}
+	for (i = 1; i < n; i++) {
+		memcpy(t, d[i], 16);
+		for (j = i; j > 0 && memcmp(d[j - 1], t, 16) > 0; j--)
+			memcpy(d[j], d[j - 1], 16);
+		memcpy(d[j], t, 16);
+	}
+}
+
+static void
+mdknown_bloom_add(uint64_t *bloom, uint64_t bmask, const uint8_t digest[16])
+{
+	uint64_t *block;
+	uint64_t h;
+	int w;
+
+	block = &bloom[(mdknown_le64(digest + 8) & bmask) * 8];
+	h = mdknown_le64(digest);
+	for (w = 0; w < 8; w++)
+		block[w] |= (uint64_t)1 << ((h >> (6 * w)) & 63);
+}
+
+/*
+ * Build a database of the digests in list, with bits of Bloom filter per
+ * digest (0 for MDKNOWN_BITS). It is written next to path and renamed
+ * into place, so processes with the old one open keep using it.
+ */
+int
+mdknown_write(const char *path, int algo, const struct mdknown_list *list,
+    unsigned bits)
+{
+	struct mdknown_header hdr;
+	uint8_t (*digests)[16];
+	uint64_t *index;
+	uint64_t nbuckets;
+	uint64_t nblocks;
+	uint64_t offindex;
+	uint64_t offdigests;
+	uint64_t size;
+	uint64_t lo;
+	uint64_t hi;
+	uint64_t b;
+	uint64_t i;
+	uint64_t o;
+	uint8_t *map;
+	char *tmp;
+	int bucketbits;
+	int error;
+	int fd;
+
+	if (bits == 0)
+		bits = MDKNOWN_BITS;
+	for (nblocks = 1; nblocks * 512 < (uint64_t)list->n * bits;
+	    nblocks *= 2)
+		;
+	for (bucketbits = 0; bucketbits < 32 &&
+	    ((uint64_t)8 << bucketbits) <= list->n; bucketbits++)
+		;
+	nbuckets = (uint64_t)1 << bucketbits;
+	mdknown_layout(nblocks, bucketbits, list->n, &offindex, &offdigests,
+	    &size);
+	if (size > SIZE_MAX) {
+		errno = EFBIG;
+		return (-1);
+	}
+
+	if ((tmp = malloc(strlen(path) + 32)) == NULL)
+		return (-1);
+	sprintf(tmp, "%s.%ld.tmp", path, (long)getpid());
+	if ((fd = open(tmp, O_RDWR | O_CREAT | O_TRUNC, 0644)) < 0) {
+		free(tmp);
+		return (-1);
+	}
+	map = MAP_FAILED;
+	if (ftruncate(fd, size) != 0 || (map = mmap(NULL, size,
+	    PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0)) == MAP_FAILED)
+		goto fail;
+	index = (uint64_t *)(map + offindex);
+	digests = (uint8_t (*)[16])(map + offdigests);
+
+	/* Count each bucket, then scatter the digests into place. */
+	for (i = 0; i < list->n; i++)
+		index[mdknown_bucket(list->digests[i], bucketbits) + 1]++;
+	for (b = 0; b < nbuckets; b++)
+		index[b + 1] += index[b];
+	for (i = 0; i < list->n; i++)
+		memcpy(digests[index[mdknown_bucket(list->digests[i],
+		    bucketbits)]++], list->digests[i], 16);
+	for (b = nbuckets; b > 0; b--)
+		index[b] = index[b - 1];
+	index[0] = 0;
+
+	/* Sort each bucket and drop repeats, moving the rest down. */
+	o = 0;
+	for (b = 0; b < nbuckets; b++) {
+		lo = index[b];
+		hi = index[b + 1];
+		index[b] = o;
+		mdknown_sort(&digests[lo], hi - lo);
+		for (i = lo; i < hi; i++) {
+			if (o != index[b] && memcmp(digests[o - 1],
+			    digests[i], 16) == 0)
+				continue;
+			if (o != i)
+				memcpy(digests[o], digests[i], 16);
+			o++;
+		}
+	}
+	index[nbuckets] = o;
+
+	for (i = 0; i < o; i++)
+		mdknown_bloom_add((uint64_t *)(map + MDKNOWN_HEADER),
+		    nblocks - 1, digests[i]);
+
+	memset(&hdr, 0, sizeof(hdr));
+	memcpy(hdr.magic, "MDKN", 4);
+	hdr.version = MDKNOWN_VERSION;
+	hdr.algo = algo;
+	hdr.order = MDKNOWN_ORDER;
+	hdr.count = o;
+	hdr.nblocks = nblocks;
+	hdr.bucketbits = bucketbits;
+	memcpy(map, &hdr, sizeof(hdr));
+	if (munmap(map, size) != 0) {
+		map = MAP_FAILED;
+		goto fail;
+	}
+	map = MAP_FAILED;
+	if (ftruncate(fd, offdigests + o * 16) != 0 || close(fd) != 0) {
+		fd = -1;
+		goto fail;
+	}
+	fd = -1;
+	if (rename(tmp, path) != 0)
+		goto fail;
+	free(tmp);
+
+	return (0);
+
+fail:
+	error = errno != 0 ? errno : EIO;
+	if (map != MAP_FAILED)
+		munmap(map, size);
+	if (fd >= 0)
+		close(fd);
+	unlink(tmp);
+	free(tmp);
+	errno = error;
+	return (-1);
+}
+
+/*
+ * Every bucket must lie within the digests: the index starts at 0, never
+ * goes down, and ends at count.
+ */
+static int
+mdknown_index_ok(const uint64_t *index, int bucketbits, uint64_t count)
+{
+	uint64_t nbuckets;
+	uint64_t b;
+
+	nbuckets = (uint64_t)1 << bucketbits;
+	if (index[0] != 0 || index[nbuckets] != count)
+		return (0);
+	for (b = 0; b < nbuckets; b++) {
+		if (index[b] > index[b + 1])
+			return (0);
+	}
+	return (1);
+}
+
+/*
+ * Map the database at path. Fails with EINVAL if it is damaged or was
+ * written on a host of the other byte order.
+ */
+int
+mdknown_open(struct mdknown *known, const char *path)
+{
+	struct mdknown_header hdr;
+	struct stat st;
+	uint64_t offindex;
+	uint64_t offdigests;
+	uint64_t size;
+	void *map;
+	int error;
+	int fd;
+
+	memset(known, 0, sizeof(*known));
+	if ((fd = open(path, O_RDONLY)) < 0)
+		return (-1);
+	if (fstat(fd, &st) != 0) {
+		error = errno;
+		close(fd);
+		errno = error;
+		return (-1);
+	}
+	if (pread(fd, &hdr, sizeof(hdr), 0) != sizeof(hdr) ||
+	    memcmp(hdr.magic, "MDKN", 4) != 0 ||
+	    hdr.version != MDKNOWN_VERSION ||
+	    (hdr.algo != MDFILE_MD5 && hdr.algo != MDFILE_MD4) ||
+	    hdr.order != MDKNOWN_ORDER || hdr.bucketbits > 32 ||
+	    hdr.nblocks == 0 || (hdr.nblocks & (hdr.nblocks - 1)) != 0 ||
+	    hdr.nblocks > ((uint64_t)1 << 48) ||
+	    hdr.count > ((uint64_t)1 << 56)) {
+		close(fd);
+		errno = EINVAL;
+		return (-1);
+	}
+	mdknown_layout(hdr.nblocks, hdr.bucketbits, hdr.count, &offindex,
+	    &offdigests, &size);
+	if ((uint64_t)st.st_size != size || size > SIZE_MAX) {
+		close(fd);
+		errno = EINVAL;
+		return (-1);
+	}
+
+	map = mmap(NULL, size, PROT_READ, MAP_SHARED, fd, 0);
+	error = errno;
+	close(fd);
+	if (map == MAP_FAILED) {
+		errno = error;
+		return (-1);
+	}
+	posix_madvise(map, size, POSIX_MADV_RANDOM);
+
+	known->algo = hdr.algo;
+	known->map = map;
+	known->maplen = size;
+	known->bloom = (const uint64_t *)((uint8_t *)map + MDKNOWN_HEADER);
+	known->bmask = hdr.nblocks - 1;
+	known->index = (const uint64_t *)((uint8_t *)map + offindex);
+	known->bucketbits = hdr.bucketbits;
+	known->digests = (const uint8_t (*)[16])((uint8_t *)map + offdigests);
+	known->count = hdr.count;
+	if (!mdknown_index_ok(known->index, hdr.bucketbits, hdr.count)) {
+		mdknown_close(known);
+		errno = EINVAL;
+		return (-1);
+	}
+
+	return (0);
+}
+
+void
+mdknown_close(struct mdknown *known)
+{
+
+	if (known->map != NULL)
+		munmap(known->map, known->maplen);
+	memset(known, 0, sizeof(*known));
+}
+
+static const uint64_t *
+mdknown_block(const struct mdknown *known, const uint8_t digest[16])
+{
+
+	return (&known->bloom[(mdknown_le64(digest + 8) & known->bmask) * 8]);
+}
+
+/*
+ * Test the eight bits of a digest in its block without branching.
+ */
+static int
+mdknown_bloom(const uint64_t *block, const uint8_t digest[16])
+{
+	uint64_t hit;
+	uint64_t h;
+	int w;
+
+	h = mdknown_le64(digest);
+	hit = 1;
+	for (w = 0; w < 8; w++)
+		hit &= block[w] >> ((h >> (6 * w)) & 63);
+	return (hit & 1);
+}
+
+static int
+mdknown_scan(const struct mdknown *known, uint64_t lo, uint64_t hi,
+    const uint8_t digest[16])
+{
+	int c;
+
+	for (; lo < hi; lo++) {
+		if ((c = memcmp(known->digests[lo], digest, 16)) >= 0)
+			return (c == 0);
+	}
+	return (0);
+}
+
+/*
+ * Returns 1 if digest is in the database and 0 if not.
+ */
+int
+mdknown_lookup(const struct mdknown *known, const uint8_t digest[16])
+{
+	uint64_t b;
+
+	if (!mdknown_bloom(mdknown_block(known, digest), digest))
+		return (0);
+	b = mdknown_bucket(digest, known->bucketbits);
+	return (mdknown_scan(known, known->index[b], known->index[b + 1],
+	    digest));
+}
+
+/*
+ * Look up n digests, setting hit[i] to 1 or 0. Each stage prefetches
+ * what the next one reads for the whole group before it is needed.
+ */
+void
+mdknown_lookup_batch(const struct mdknown *known, int hit[],
+    const uint8_t (*digest)[16], size_t n)
+{
+	uint64_t bucket[MDKNOWN_BATCH];
+	size_t i;
+	size_t j;
+	size_t m;
+
+	for (i = 0; i < n; i += m) {
+		m = n - i < MDKNOWN_BATCH ? n - i : MDKNOWN_BATCH;
+		for (j = 0; j < m; j++)
+			MDKNOWN_PREFETCH(mdknown_block(known, digest[i + j]));
+		for (j = 0; j < m; j++) {
+			hit[i + j] = mdknown_bloom(mdknown_block(known,
+			    digest[i + j]), digest[i + j]);
+			if (hit[i + j]) {
+				bucket[j] = mdknown_bucket(digest[i + j],
+				    known->bucketbits);
+				MDKNOWN_PREFETCH(&known->index[bucket[j]]);
+			}
+		}
+		for (j = 0; j < m; j++) {
+			if (hit[i + j])
+				MDKNOWN_PREFETCH(
+				    known->digests[known->index[bucket[j]]]);
+		}
+		for (j = 0; j < m; j++) {
+			if (hit[i + j])
+				hit[i + j] = mdknown_scan(known,
+				    known->index[bucket[j]],
+				    known->index[bucket[j] + 1], digest[i + j]);
+		}
+	}
+}
+
+static void
+mdknown_flush(struct mdknown_run *run)
+{
+	int hit[MDKNOWN_BATCH];
+	size_t i;
+
+	mdknown_lookup_batch(run->known, hit,
+	    (const uint8_t (*)[16])run->digests, run->n);
+	for (i = 0; i < run->n; i++) {
+		if (hit[i])
+			run->stats->known++;
+		else
+			run->stats->unknown++;
+		run->fn(&run->results[i], hit[i], run->arg);
+	}
+	run->n = 0;
+}
+
+static void
+mdknown_result(const struct mdfiles_result *r, void *arg)
+{
+	struct mdknown_run *run;
+
+	run = arg;
+	if (r->error != 0) {
+		run->stats->unreadable++;
+		run->fn(r, 0, run->arg);
+		return;
+	}
+	run->results[run->n] = *r;
+	memcpy(run->digests[run->n], r->digest, 16);
+	if (++run->n == MDKNOWN_BATCH)
+		mdknown_flush(run);
+}
+
+/*
+ * Hash n files on the mdfiles pool and look their digests up as they
+ * come in, a batch at a time. fn is told of each file in the order they
+ * finish, with 1 if it is known; files that could not be read have
+ * error set and are never known.
+ */
+int
+mdknown_check(const struct mdknown *known, const char *const paths[],
+    size_t n, const struct mdfiles_opts *opts, mdknown_fn *fn, void *arg,
+    struct mdknown_stats *stats)
+{
+	struct mdknown_stats dummy;
+	struct mdfiles_opts o;
+	struct mdknown_run *run;
+	int ret;
+
+	if (stats == NULL)
+		stats = &dummy;
+	memset(stats, 0, sizeof(*stats));
+	if (opts != NULL)
+		o = *opts;
+	else
+		mdfiles_opts_init(&o);
+	o.algo = known->algo;
+	o.ordered = 0;
+
+	if ((run = malloc(sizeof(*run))) == NULL)
+		return (-1);
+	run->known = known;
+	run->fn = fn;
+	run->arg = arg;
+	run->stats = stats;
+	run->n = 0;
+	ret = mdfiles_hash(paths, n, &o, mdknown_result, run);
+	if (run->n != 0)
+		mdknown_flush(run);
+	free(run);
+
+	return (ret < 0 ? -1 : 0);
+}
@@ -0,0 +1,76 @@
+/*-
+ * Copyright (c) 2023, Collin Funk
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHORS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#ifndef CRYPTO_MDKNOWN_H
+#define CRYPTO_MDKNOWN_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdio.h>
+
+#include "mdfiles.h"
+
+#define MDKNOWN_BITS 16 /* Bloom filter bits per digest */
+
+struct mdknown {
+	int algo; /* MDFILE_MD5 or MDFILE_MD4 */
+	void *map;
+	size_t maplen;
+	const uint64_t *bloom; /* Blocks of 8 words */
+	uint64_t bmask; /* Blocks less 1 */
+	const uint64_t *index; /* First digest of each bucket, and count */
+	int bucketbits; /* Leading digest bits picking a bucket */
+	const uint8_t (*digests)[16]; /* Sorted */
+	uint64_t count;
+};
+
+struct mdknown_list {
+	uint8_t (*digests)[16];
+	size_t n;
+	size_t cap;
+	size_t invalid; /* Lines without a digest */
+};
+
+struct mdknown_stats {
+	size_t known;
+	size_t unknown;
+	size_t unreadable;
+};
+
+typedef void mdknown_fn(const struct mdfiles_result *, int, void *);
+
+int mdknown_parse(struct mdknown_list *, FILE *);
+void mdknown_list_free(struct mdknown_list *);
+int mdknown_write(const char *, int, const struct mdknown_list *, unsigned);
+int mdknown_open(struct mdknown *, const char *);
+void mdknown_close(struct mdknown *);
+int mdknown_lookup(const struct mdknown *, const uint8_t [16]);
+void mdknown_lookup_batch(const struct mdknown *, int [],
+    const uint8_t (*)[16], size_t);
+int mdknown_check(const struct mdknown *, const char *const [], size_t,
+    const struct mdfiles_opts *, mdknown_fn *, void *,
+    struct mdknown_stats *);
+
+#endif /* CRYPTO_MDKNOWN_H */
@@ -0,0 +1,119 @@
+/*-
+ * Copyright (c) 2023, Collin Funk
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHORS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * Cache of contexts that have hashed a common message prefix, such as a
+ * salt or a fixed header, so messages starting with it only pay for
+ * their own suffix. Prefixes are matched by content, the least recently
+ * found one giving way to a new one. A cache must not be shared between
+ * threads.
+ */
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "mdfile.h"
+#include "mdprefix.h"
+
+void
+mdprefix_init(struct mdprefix_cache *cache, int algo)
+{
+
+	memset(cache, 0, sizeof(*cache));
+	cache->algo = algo;
+}
+
+void
+mdprefix_free(struct mdprefix_cache *cache)
+{
+	int i;
+
+	for (i = 0; i < MDPREFIX_SLOTS; i++)
+		free(cache->slot[i].prefix);
+
+	/*
+	 * Zero out cache.
+	 */
+	memset(cache, 0, sizeof(*cache));
+}
+
+/*
+ * Set ctx to the context after hashing the len bytes at prefix, from the
+ * cache if the prefix is there and otherwise hashing it and adding it.
+ * If no memory can be had for the copy the prefix is hashed but not
+ * kept.
+ */
+void
+mdprefix_start(struct mdprefix_cache *cache, struct mdfile_ctx *ctx,
+    const void *prefix, size_t len)
+{
+	struct mdprefix_slot *slot;
+	struct mdprefix_slot *lru;
+	uint8_t *copy;
+	int i;
+
+	cache->tick++;
+	lru = &cache->slot[0];
+	for (i = 0; i < MDPREFIX_SLOTS; i++) {
+		slot = &cache->slot[i];
+		if (slot->prefix != NULL && slot->len == len &&
+		    memcmp(slot->prefix, prefix, len) == 0) {
+			slot->used = cache->tick;
+			cache->hits++;
+			mdfile_copy(ctx, &slot->ctx);
+			return;
+		}
+		if (slot->used < lru->used)
+			lru = slot;
+	}
+
+	mdfile_init(ctx, cache->algo);
+	mdfile_update(ctx, prefix, len);
+	if ((copy = malloc(len != 0 ? len : 1)) == NULL)
+		return;
+	memcpy(copy, prefix, len);
+	free(lru->prefix);
+	lru->prefix = copy;
+	lru->len = len;
+	lru->used = cache->tick;
+	mdfile_copy(&lru->ctx, ctx);
+}
+
+/*
+ * Digest of the message made of the plen bytes at prefix followed by the
+ * len bytes at data.
+ */
+void
+mdprefix_digest(struct mdprefix_cache *cache, uint8_t digest[16],
+    const void *prefix, size_t plen, const void *data, size_t len)
+{
+	struct mdfile_ctx ctx;
+
+	mdprefix_start(cache, &ctx, prefix, plen);
+	mdfile_update(&ctx, data, len);
+	mdfile_final(digest, &ctx);
+}
@@ -0,0 +1,57 @@
+/*-
+ * Copyright (c) 2023, Collin Funk
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHORS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#ifndef CRYPTO_MDPREFIX_H
+#define CRYPTO_MDPREFIX_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include "mdfile.h"
+
+#define MDPREFIX_SLOTS 16
+
+struct mdprefix_slot {
+	uint8_t *prefix; /* Copy of the prefix, NULL if the slot is free */
+	size_t len; /* Length of the prefix */
+	uint64_t used; /* Tick of the last lookup that found it */
+	struct mdfile_ctx ctx; /* Context after hashing the prefix */
+};
+
+struct mdprefix_cache {
+	int algo; /* MDFILE_MD5 or MDFILE_MD4 */
+	uint64_t tick; /* Lookups so far */
+	uint64_t hits; /* Lookups that found their prefix */
+	struct mdprefix_slot slot[MDPREFIX_SLOTS];
+};
+
+void mdprefix_init(struct mdprefix_cache *, int);
+void mdprefix_free(struct mdprefix_cache *);
+void mdprefix_start(struct mdprefix_cache *, struct mdfile_ctx *,
+    const void *, size_t);
+void mdprefix_digest(struct mdprefix_cache *, uint8_t [16], const void *,
+    size_t, const void *, size_t);
+
+#endif /* CRYPTO_MDPREFIX_H */
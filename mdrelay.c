@@ -0,0 +1,298 @@
+/*-
+ * Copyright (c) 2023, Collin Funk
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHORS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * Forward a stream from one descriptor to another and hash it on the
+ * way. The copy loop reads into a buffer, hashes it and writes it out,
+ * so every byte crosses into user space and back. On Linux the splice
+ * loop instead moves the input into a pipe, duplicates the pipe's pages
+ * into a second pipe with tee, and splices the first pipe to the output.
+ * Only the duplicate is read, once, for hashing.
+ */
+
+#define _GNU_SOURCE
+
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#if defined(__linux__) && defined(SPLICE_F_MOVE)
+#define HAVE_SPLICE
+#endif
+
+#include "mdfile.h"
+#include "mdrelay.h"
+
+void
+mdrelay_opts_init(struct mdrelay_opts *opts)
+{
+
+	opts->algo = MDFILE_MD5;
+	opts->method = MDRELAY_AUTO;
+	opts->bufsize = MDRELAY_BUFSIZE;
+}
+
+int
+mdrelay_method(const char *name)
+{
+
+	if (strcmp(name, "auto") == 0)
+		return (MDRELAY_AUTO);
+	if (strcmp(name, "splice") == 0)
+		return (MDRELAY_SPLICE);
+	if (strcmp(name, "copy") == 0)
+		return (MDRELAY_COPY);
+	return (-1);
+}
+
+static int
+mdrelay_write(int fd, const uint8_t *buf, size_t len)
+{
+	ssize_t n;
+
+	for (; len != 0; buf += n, len -= n) {
+		if ((n = write(fd, buf, len)) < 0) {
+			if (errno == EINTR) {
+				n = 0;
+				continue;
+			}
+			return (-1);
+		}
+	}
+
+	return (0);
+}
+
+static int
+mdrelay_copy(struct mdfile_ctx *ctx, int in, int out, uint8_t *buf,
+    size_t bufsize, uint64_t *total)
+{
+	ssize_t n;
+
+	for (;;) {
+		if ((n = read(in, buf, bufsize)) < 0) {
+			if (errno == EINTR)
+				continue;
+			return (-1);
+		}
+		if (n == 0)
+			return (0);
+		mdfile_update(ctx, buf, n);
+		if (mdrelay_write(out, buf, n) != 0)
+			return (-1);
+		*total += n;
+	}
+}
+
+#ifdef HAVE_SPLICE
+/*
+ * Splice can read from pipes, sockets and files, and write to the same
+ * unless the file is opened for appending.
+ */
+static int
+mdrelay_can_splice(int in, int out)
+{
+	struct stat st;
+	int flags;
+
+	if (fstat(in, &st) != 0 || !(S_ISFIFO(st.st_mode) ||
+	    S_ISSOCK(st.st_mode) || S_ISREG(st.st_mode)))
+		return (0);
+	if (fstat(out, &st) != 0 || !(S_ISFIFO(st.st_mode) ||
+	    S_ISSOCK(st.st_mode) || S_ISREG(st.st_mode)))
+		return (0);
+	if ((flags = fcntl(out, F_GETFL)) < 0 || (flags & O_APPEND) != 0)
+		return (0);
+
+	return (1);
+}
+
+/*
+ * Move len bytes from the pipe at in to out.
+ */
+static int
+mdrelay_drain(int in, int out, size_t len)
+{
+	ssize_t n;
+
+	for (; len != 0; len -= n) {
+		if ((n = splice(in, NULL, out, NULL, len, SPLICE_F_MOVE |
+		    SPLICE_F_MORE)) <= 0) {
+			if (n < 0 && errno == EINTR) {
+				n = 0;
+				continue;
+			}
+			if (n == 0)
+				errno = EPIPE;
+			return (-1);
+		}
+	}
+
+	return (0);
+}
+
+/*
+ * Returns 1 if the first splice from in was refused before anything
+ * moved, so the caller can copy instead.
+ */
+static int
+mdrelay_splice(struct mdfile_ctx *ctx, int in, int out, uint8_t *buf,
+    size_t bufsize, int fallback, uint64_t *total)
+{
+	ssize_t n;
+	ssize_t m;
+	int fwd[2];
+	int dup[2];
+	int ret;
+
+	if (pipe2(fwd, O_CLOEXEC) != 0)
+		return (-1);
+	if (pipe2(dup, O_CLOEXEC) != 0) {
+		close(fwd[0]);
+		close(fwd[1]);
+		return (-1);
+	}
+
+	/*
+	 * The copy read back for hashing must fit in the second pipe,
+	 * so neither pipe may hold more than buf.
+	 */
+	fcntl(fwd[1], F_SETPIPE_SZ, (int)bufsize);
+	fcntl(dup[1], F_SETPIPE_SZ, (int)bufsize);
+	if ((n = fcntl(fwd[1], F_GETPIPE_SZ)) > 0 && (size_t)n < bufsize)
+		bufsize = n;
+	if ((n = fcntl(dup[1], F_GETPIPE_SZ)) > 0 && (size_t)n < bufsize)
+		bufsize = n;
+
+	ret = 0;
+	for (;;) {
+		n = splice(in, NULL, fwd[1], NULL, bufsize, SPLICE_F_MOVE |
+		    SPLICE_F_MORE);
+		if (n < 0) {
+			if (errno == EINTR)
+				continue;
+			if (fallback && *total == 0 && errno == EINVAL)
+				ret = 1;
+			else
+				ret = -1;
+			break;
+		}
+		if (n == 0)
+			break;
+
+		/*
+		 * tee always starts at the head of fwd, so forward what it
+		 * duplicated before asking for more.
+		 */
+		while (n != 0) {
+			if ((m = tee(fwd[0], dup[1], n, 0)) <= 0) {
+				if (m < 0 && errno == EINTR)
+					continue;
+				if (m == 0)
+					errno = EIO;
+				ret = -1;
+				goto out;
+			}
+			if (mdrelay_drain(fwd[0], out, m) != 0 ||
+			    mdfile_read(dup[0], buf, m) != m) {
+				ret = -1;
+				goto out;
+			}
+			mdfile_update(ctx, buf, m);
+			*total += m;
+			n -= m;
+		}
+	}
+
+out:
+	close(fwd[0]);
+	close(fwd[1]);
+	close(dup[0]);
+	close(dup[1]);
+
+	return (ret);
+}
+#endif
+
+/*
+ * Forward everything from in to out until in ends, and set digest to
+ * the hash of it. The number of bytes forwarded is stored in total, if
+ * given, even on failure. Returns 0, or -1 with errno set.
+ */
+int
+mdrelay(uint8_t digest[16], int in, int out, const struct mdrelay_opts *opts,
+    uint64_t *total)
+{
+	struct mdrelay_opts o;
+	struct mdfile_ctx ctx;
+	uint64_t dummy;
+	uint8_t *buf;
+	int ret;
+
+	if (total == NULL)
+		total = &dummy;
+	*total = 0;
+	if (opts != NULL)
+		o = *opts;
+	else
+		mdrelay_opts_init(&o);
+	if (o.bufsize == 0)
+		o.bufsize = MDRELAY_BUFSIZE;
+
+#ifdef HAVE_SPLICE
+	if (o.method == MDRELAY_AUTO && !mdrelay_can_splice(in, out))
+		o.method = MDRELAY_COPY;
+#else
+	if (o.method == MDRELAY_SPLICE) {
+		errno = ENOSYS;
+		return (-1);
+	}
+	o.method = MDRELAY_COPY;
+#endif
+
+	if ((buf = malloc(o.bufsize)) == NULL)
+		return (-1);
+	mdfile_init(&ctx, o.algo);
+
+	ret = 1;
+#ifdef HAVE_SPLICE
+	if (o.method != MDRELAY_COPY)
+		ret = mdrelay_splice(&ctx, in, out, buf, o.bufsize,
+		    o.method == MDRELAY_AUTO, total);
+#endif
+	if (ret == 1)
+		ret = mdrelay_copy(&ctx, in, out, buf, o.bufsize, total);
+	mdfile_final(digest, &ctx);
+	free(buf);
+
+	return (ret);
+}
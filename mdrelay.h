@@ -0,0 +1,49 @@
+/*-
+ * Copyright (c) 2023, Collin Funk
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHORS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#ifndef CRYPTO_MDRELAY_H
+#define CRYPTO_MDRELAY_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+#define MDRELAY_AUTO 0 /* Splice if both ends allow it, else copy */
+#define MDRELAY_SPLICE 1 /* Move pages through pipes, read only a tee */
+#define MDRELAY_COPY 2 /* Plain read and write loop through one buffer */
+
+#define MDRELAY_BUFSIZE (256 * 1024)
+
+struct mdrelay_opts {
+	int algo; /* MDFILE_MD5 or MDFILE_MD4 */
+	int method; /* One of MDRELAY_AUTO, MDRELAY_SPLICE, MDRELAY_COPY */
+	size_t bufsize; /* Bytes moved per round, and the pipe size */
+};
+
+void mdrelay_opts_init(struct mdrelay_opts *);
+int mdrelay_method(const char *);
+int mdrelay(uint8_t [16], int, int, const struct mdrelay_opts *,
+    uint64_t *);
+
+#endif /* CRYPTO_MDRELAY_H */
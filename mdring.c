@@ -0,0 +1,528 @@
+/*-
+ * Copyright (c) 2023, Collin Funk
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHORS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * Ketama consistent hashing as in libketama. A server of weight w gets
+ * 40 * w MD5 digests of "name-0", "name-1", ..., and each digest gives
+ * four 32-bit little-endian points on the ring. A key goes to the server
+ * of the first point at or after the first word of its MD5, wrapping
+ * past the last point to the first. With equal weights the ring is that
+ * of libketama. Weights scale a server's points directly rather than by
+ * its share of the total, so adding or removing one server leaves every
+ * other server's points where they were.
+ *
+ * Points are hashed 64 at a time by the multi-buffer engine. The sorted
+ * points are also kept in Eytzinger order, the layout of a binary heap,
+ * so a lookup walks down from the root touching one cache line per four
+ * levels near the top and branching only on the loop.
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <errno.h>
+#include <limits.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "md5.h"
+#include "md5-mb.h"
+#include "mdring.h"
+
+#define MDRING_BATCH (4 * MD5_MB_MAX_LANES)
+
+#ifdef __GNUC__
+#define MDRING_PREFETCH(p) __builtin_prefetch(p)
+#else
+#define MDRING_PREFETCH(p)
+#endif
+
+void
+mdring_init(struct mdring *r)
+{
+
+	memset(r, 0, sizeof(*r));
+}
+
+void
+mdring_free(struct mdring *r)
+{
+	size_t i;
+
+	for (i = 0; i < r->nservers; i++)
+		free(r->servers[i].name);
+	free(r->servers);
+	free(r->points);
+	free(r->eyt);
+	free(r->eyt_server);
+	memset(r, 0, sizeof(*r));
+}
+
+static uint32_t
+mdring_word(const uint8_t *p)
+{
+
+	return ((uint32_t)p[3] << 24 | (uint32_t)p[2] << 16 |
+	    (uint32_t)p[1] << 8 | p[0]);
+}
+
+static int
+mdring_cmp_point(const void *a, const void *b)
+{
+	const struct mdring_point *pa;
+	const struct mdring_point *pb;
+
+	pa = a;
+	pb = b;
+	if (pa->point != pb->point)
+		return (pa->point < pb->point ? -1 : 1);
+	return ((pa->server > pb->server) - (pa->server < pb->server));
+}
+
+static int
+mdring_cmp_name(const void *a, const void *b)
+{
+
+	return (strcmp(*(const char *const *)a, *(const char *const *)b));
+}
+
+/*
+ * Sort n points by value with four byte-wide counting passes through
+ * aux. Each pass is stable, so points of equal value stay in the order
+ * given, which is that of their servers.
+ */
+static void
+mdring_sort(struct mdring_point *p, struct mdring_point *aux, size_t n)
+{
+	struct mdring_point *from;
+	struct mdring_point *to;
+	struct mdring_point *t;
+	size_t count[256];
+	size_t sum;
+	size_t c;
+	size_t i;
+	int shift;
+
+	from = p;
+	to = aux;
+	for (shift = 0; shift < 32; shift += 8) {
+		memset(count, 0, sizeof(count));
+		for (i = 0; i < n; i++)
+			count[(from[i].point >> shift) & 0xff]++;
+		for (i = sum = 0; i < 256; i++) {
+			c = count[i];
+			count[i] = sum;
+			sum += c;
+		}
+		for (i = 0; i < n; i++)
+			to[count[(from[i].point >> shift) & 0xff]++] = from[i];
+		t = from;
+		from = to;
+		to = t;
+	}
+}
+
+/*
+ * Write "name-i" at p and return its length.
+ */
+static size_t
+mdring_label(char *p, const char *name, size_t len, unsigned i)
+{
+	char digits[16];
+	size_t n;
+
+	memcpy(p, name, len);
+	p[len++] = '-';
+	n = 0;
+	do {
+		digits[n++] = '0' + i % 10;
+		i /= 10;
+	} while (i != 0);
+	while (n != 0)
+		p[len++] = digits[--n];
+
+	return (len);
+}
+
+/*
+ * Hash the n labels in jobs and append their points to *out.
+ */
+static void
+mdring_emit(struct mdring_point **out, struct md5_mb_job *jobs,
+    const uint32_t *owner, size_t n)
+{
+	size_t i;
+	int h;
+
+	md5_mb_digest(jobs, n);
+	for (i = 0; i < n; i++) {
+		for (h = 0; h < 4; h++) {
+			(*out)->point = mdring_word(&jobs[i].digest[4 * h]);
+			(*out)->server = owner[i];
+			(*out)++;
+		}
+	}
+}
+
+/*
+ * Lay the sorted points out in Eytzinger order: the in-order walk of the
+ * implicit tree rooted at k visits them in sorted order.
+ */
+static size_t
+mdring_eytzinger(struct mdring *r, size_t i, size_t k)
+{
+
+	if (k <= r->npoints) {
+		i = mdring_eytzinger(r, i, 2 * k);
+		r->eyt[k] = r->points[i].point;
+		r->eyt_server[k] = r->points[i].server;
+		i = mdring_eytzinger(r, i + 1, 2 * k + 1);
+	}
+	return (i);
+}
+
+/*
+ * Refuse names already on the ring or given twice.
+ */
+static int
+mdring_unique(const struct mdring *r, const char *const names[], size_t n)
+{
+	const char **all;
+	size_t total;
+	size_t i;
+	int ret;
+
+	if ((all = malloc((r->nservers + n) * sizeof(*all))) == NULL)
+		return (-1);
+	total = 0;
+	for (i = 0; i < r->nservers; i++) {
+		if (r->servers[i].name != NULL)
+			all[total++] = r->servers[i].name;
+	}
+	for (i = 0; i < n; i++)
+		all[total++] = names[i];
+	qsort(all, total, sizeof(*all), mdring_cmp_name);
+
+	ret = 0;
+	for (i = 1; i < total; i++) {
+		if (strcmp(all[i - 1], all[i]) == 0) {
+			errno = EEXIST;
+			ret = -1;
+			break;
+		}
+	}
+	free(all);
+
+	return (ret);
+}
+
+static int
+mdring_reserve(struct mdring *r, size_t nservers, size_t npoints)
+{
+	struct mdring_server *servers;
+	struct mdring_point *points;
+	uint32_t *eyt;
+
+	if (nservers > r->scap) {
+		if ((servers = realloc(r->servers,
+		    nservers * sizeof(*servers))) == NULL)
+			return (-1);
+		r->servers = servers;
+		r->scap = nservers;
+	}
+	if (npoints > r->pcap) {
+		if ((points = realloc(r->points,
+		    npoints * sizeof(*points))) == NULL)
+			return (-1);
+		r->points = points;
+		if ((eyt = realloc(r->eyt, (npoints + 1) * sizeof(*eyt))) ==
+		    NULL)
+			return (-1);
+		r->eyt = eyt;
+		if ((eyt = realloc(r->eyt_server,
+		    (npoints + 1) * sizeof(*eyt))) == NULL)
+			return (-1);
+		r->eyt_server = eyt;
+		r->pcap = npoints;
+	}
+
+	return (0);
+}
+
+/*
+ * Add n servers, with weight[i] times the standard number of points or
+ * the standard number if weight is NULL. Their points are hashed, sorted
+ * and merged into the ring; nothing else is rehashed. Returns 0, or -1
+ * with errno set and the ring unchanged.
+ */
+int
+mdring_add_many(struct mdring *r, const char *const names[],
+    const unsigned weight[], size_t n)
+{
+	struct md5_mb_job jobs[MDRING_BATCH];
+	uint32_t owner[MDRING_BATCH];
+	struct mdring_point *tmp;
+	struct mdring_point *out;
+	uint32_t *slot;
+	char **dups;
+	char *scratch;
+	size_t stride;
+	size_t nfree;
+	size_t nnew;
+	size_t len;
+	size_t i;
+	size_t j;
+	size_t o;
+	size_t m;
+	unsigned w;
+	unsigned k;
+
+	nnew = 0;
+	stride = 0;
+	for (i = 0; i < n; i++) {
+		w = weight != NULL ? weight[i] : 1;
+		if (names[i] == NULL || names[i][0] == '\0' || w == 0 ||
+		    w > MDRING_MAXWEIGHT) {
+			errno = EINVAL;
+			return (-1);
+		}
+		nnew += (size_t)4 * MDRING_HASHES * w;
+		len = strlen(names[i]);
+		if (len + 12 > stride)
+			stride = len + 12;
+	}
+	if (n == 0)
+		return (0);
+	if (mdring_unique(r, names, n) != 0)
+		return (-1);
+
+	nfree = 0;
+	for (i = 0; i < r->nservers; i++)
+		nfree += r->servers[i].name == NULL;
+	if (r->nservers + (n > nfree ? n - nfree : 0) > INT_MAX) {
+		errno = ENOSPC;
+		return (-1);
+	}
+	tmp = NULL;
+	slot = NULL;
+	dups = NULL;
+	scratch = NULL;
+	if (mdring_reserve(r, r->nservers + (n > nfree ? n - nfree : 0),
+	    r->npoints + nnew) != 0 ||
+	    (tmp = malloc(2 * nnew * sizeof(*tmp))) == NULL ||
+	    (slot = malloc(n * sizeof(*slot))) == NULL ||
+	    (dups = calloc(n, sizeof(*dups))) == NULL ||
+	    (scratch = malloc(MDRING_BATCH * stride)) == NULL)
+		goto fail;
+	for (i = 0; i < n; i++) {
+		if ((dups[i] = strdup(names[i])) == NULL)
+			goto fail;
+	}
+
+	/*
+	 * Nothing can fail from here on. Take free slots first, in
+	 * increasing order, so the points come out ordered by server.
+	 */
+	for (i = j = 0; i < n; i++) {
+		while (j < r->nservers && r->servers[j].name != NULL)
+			j++;
+		if (j == r->nservers)
+			r->nservers++;
+		slot[i] = j;
+		r->servers[j].name = dups[i];
+		r->servers[j].weight = weight != NULL ? weight[i] : 1;
+	}
+
+	out = tmp;
+	m = 0;
+	for (i = 0; i < n; i++) {
+		len = strlen(names[i]);
+		w = r->servers[slot[i]].weight;
+		for (k = 0; k < MDRING_HASHES * w; k++) {
+			jobs[m].data = &scratch[m * stride];
+			jobs[m].len = mdring_label(&scratch[m * stride],
+			    names[i], len, k);
+			owner[m] = slot[i];
+			if (++m == MDRING_BATCH) {
+				mdring_emit(&out, jobs, owner, m);
+				m = 0;
+			}
+		}
+	}
+	mdring_emit(&out, jobs, owner, m);
+	mdring_sort(tmp, tmp + nnew, nnew);
+
+	/* Merge from the top down, into the room past the old points. */
+	i = r->npoints;
+	j = nnew;
+	for (o = i + j; j != 0;) {
+		if (i != 0 && mdring_cmp_point(&r->points[i - 1],
+		    &tmp[j - 1]) > 0)
+			r->points[--o] = r->points[--i];
+		else
+			r->points[--o] = tmp[--j];
+	}
+	r->npoints += nnew;
+	mdring_eytzinger(r, 0, 1);
+
+	free(scratch);
+	free(dups);
+	free(slot);
+	free(tmp);
+	return (0);
+
+fail:
+	for (i = 0; dups != NULL && i < n; i++)
+		free(dups[i]);
+	free(scratch);
+	free(dups);
+	free(slot);
+	free(tmp);
+	errno = ENOMEM;
+	return (-1);
+}
+
+int
+mdring_add(struct mdring *r, const char *name, unsigned weight)
+{
+
+	return (mdring_add_many(r, &name, &weight, 1));
+}
+
+/*
+ * Take a server and its points off the ring. The points of the others
+ * stay as they are. Returns 0, or -1 with errno set to ENOENT.
+ */
+int
+mdring_remove(struct mdring *r, const char *name)
+{
+	size_t s;
+	size_t i;
+	size_t o;
+
+	for (s = 0; s < r->nservers; s++) {
+		if (r->servers[s].name != NULL &&
+		    strcmp(r->servers[s].name, name) == 0)
+			break;
+	}
+	if (s == r->nservers) {
+		errno = ENOENT;
+		return (-1);
+	}
+
+	for (i = o = 0; i < r->npoints; i++) {
+		if (r->points[i].server != s)
+			r->points[o++] = r->points[i];
+	}
+	r->npoints = o;
+	free(r->servers[s].name);
+	r->servers[s].name = NULL;
+	r->servers[s].weight = 0;
+	mdring_eytzinger(r, 0, 1);
+
+	return (0);
+}
+
+uint32_t
+mdring_hash(const void *key, size_t len)
+{
+	uint8_t digest[16];
+
+	md5_digest(digest, key, len);
+	return (mdring_word(digest));
+}
+
+/*
+ * Returns the server owning hash h, or -1 if the ring is empty.
+ */
+int
+mdring_find(const struct mdring *r, uint32_t h)
+{
+	size_t k;
+
+	if (r->npoints == 0)
+		return (-1);
+
+	/*
+	 * Go right past points below h and left otherwise. The last left
+	 * turn is at the first point at or after h: drop the right turns
+	 * after it and that turn. No left turn at all means h is past
+	 * every point and wraps around to the first.
+	 */
+	k = 1;
+	while (k <= r->npoints) {
+		MDRING_PREFETCH(&r->eyt[16 * k]);
+		k = 2 * k + (r->eyt[k] < h);
+	}
+#ifdef __GNUC__
+	k >>= __builtin_ctzll(~(unsigned long long)k) + 1;
+#else
+	while (k & 1)
+		k >>= 1;
+	k >>= 1;
+#endif
+	if (k == 0)
+		return (r->points[0].server);
+
+	return (r->eyt_server[k]);
+}
+
+const char *
+mdring_lookup(const struct mdring *r, const void *key, size_t len)
+{
+	int s;
+
+	if ((s = mdring_find(r, mdring_hash(key, len))) < 0)
+		return (NULL);
+	return (r->servers[s].name);
+}
+
+/*
+ * Look up n keys, their digests taken side by side.
+ */
+void
+mdring_lookup_batch(const struct mdring *r, const char *server[],
+    const void *const key[], const size_t len[], size_t n)
+{
+	struct md5_mb_job jobs[MDRING_BATCH];
+	size_t i;
+	size_t j;
+	size_t m;
+	int s;
+
+	for (i = 0; i < n; i += m) {
+		m = n - i < MDRING_BATCH ? n - i : MDRING_BATCH;
+		for (j = 0; j < m; j++) {
+			jobs[j].data = key[i + j];
+			jobs[j].len = len[i + j];
+		}
+		md5_mb_digest(jobs, m);
+		for (j = 0; j < m; j++) {
+			s = mdring_find(r, mdring_word(jobs[j].digest));
+			server[i + j] = s < 0 ? NULL : r->servers[s].name;
+		}
+	}
+}
@@ -0,0 +1,68 @@
+/*-
+ * Copyright (c) 2023, Collin Funk
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHORS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#ifndef CRYPTO_MDRING_H
+#define CRYPTO_MDRING_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+#define MDRING_HASHES 40 /* Digests per unit of weight, 4 points each */
+#define MDRING_MAXWEIGHT 1024
+
+struct mdring_point {
+	uint32_t point;
+	uint32_t server; /* Index into servers */
+};
+
+struct mdring_server {
+	char *name; /* NULL if the slot is free */
+	unsigned weight;
+};
+
+struct mdring {
+	struct mdring_server *servers;
+	size_t nservers; /* Slots, free or not */
+	size_t scap; /* Slots allocated */
+	struct mdring_point *points; /* Sorted by point, then server */
+	size_t npoints;
+	size_t pcap; /* Points allocated */
+	uint32_t *eyt; /* Points in Eytzinger order from index 1 */
+	uint32_t *eyt_server; /* Server of each of those */
+};
+
+void mdring_init(struct mdring *);
+void mdring_free(struct mdring *);
+int mdring_add(struct mdring *, const char *, unsigned);
+int mdring_add_many(struct mdring *, const char *const [], const unsigned [],
+    size_t);
+int mdring_remove(struct mdring *, const char *);
+uint32_t mdring_hash(const void *, size_t);
+int mdring_find(const struct mdring *, uint32_t);
+const char *mdring_lookup(const struct mdring *, const void *, size_t);
+void mdring_lookup_batch(const struct mdring *, const char *[],
+    const void *const [], const size_t [], size_t);
+
+#endif /* CRYPTO_MDRING_H */
@@ -0,0 +1,516 @@
+/*-
+ * Copyright (c) 2023, Collin Funk
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHORS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * md5sum and md4sum compatible file hasher. Run as md4sum, or with
+ * -a md4, it hashes with md4 and with md5 otherwise.
+ *
+ * With -j or -r the files are hashed by a pool of threads, -r descending
+ * into directories. With -u they are instead read through io_uring from
+ * one thread, -D files at a time. Lines come out in argument order unless
+ * -U is given.
+ *
+ * With -K each file's hashing state is checkpointed into dir every -I
+ * bytes and at the end, so a file that has only been appended to since
+ * the last run is hashed from where that run stopped.
+ *
+ * With -C digests are kept in a cache file by device, inode, size and
+ * times, so a file unchanged since it was last hashed is not read.
+ *
+ * With -c the files are instead manifests to check files against, on a
+ * pool of threads. Results come out as they are known, failures first
+ * as a rule since small files are left to the end. -q leaves out the
+ * files that match and -x stops at the first failure.
+ *
+ * usage: mdsum [-brtuU] [-a md5|md4] [-j threads] [-D depth]
+ *            [-m auto|mmap|thread|read] [-B bufsize] [-M mapsize]
+ *            [-K dir] [-I interval] [-C cache] [file ...]
+ *        mdsum -c [-qx] [-a md5|md4] [-j threads] [-C cache]
+ *            [manifest ...]
+ */
+
+#define _XOPEN_SOURCE 700
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "md5.h"
+#include "mdcache.h"
+#include "mdcheck.h"
+#include "mdckpt.h"
+#include "mdfile.h"
+#include "mdfiles.h"
+#include "mduring.h"
+
+static const char *progname = "mdsum";
+static const char *ckptdir;
+static uint64_t ckptinterval = MDCKPT_INTERVAL;
+static int binary;
+static int quiet;
+static int status;
+
+static void
+usage(void)
+{
+
+	fprintf(stderr, "usage: %s [-brtuU] [-a md5|md4] [-j threads] "
+	    "[-D depth]\n"
+	    "           [-m auto|mmap|thread|read] [-B bufsize] [-M mapsize]\n"
+	    "           [-K dir] [-I interval] [-C cache] [file ...]\n"
+	    "       %s -c [-qx] [-a md5|md4] [-j threads] [-C cache] "
+	    "[manifest ...]\n", progname, progname);
+	exit(1);
+}
+
+static void
+print_name(const char *name, int escape)
+{
+	const char *p;
+
+	for (p = name; *p != '\0'; p++) {
+		if (escape && *p == '\\')
+			fputs("\\\\", stdout);
+		else if (escape && *p == '\n')
+			fputs("\\n", stdout);
+		else
+			putchar(*p);
+	}
+}
+
+/*
+ * Print one line in the md5sum format. Names holding a backslash or a
+ * newline are escaped and the line is marked with a leading backslash.
+ */
+static void
+print_digest(const uint8_t digest[16], const char *name, int binary)
+{
+	int escape;
+	int i;
+
+	escape = strpbrk(name, "\\\n") != NULL;
+	if (escape)
+		putchar('\\');
+	for (i = 0; i < 16; i++)
+		printf("%02x", digest[i]);
+	putchar(' ');
+	putchar(binary ? '*' : ' ');
+	print_name(name, escape);
+	putchar('\n');
+}
+
+static void
+print_result(const struct mdfiles_result *r, void *arg)
+{
+
+	(void)arg;
+	if (r->error != 0) {
+		fprintf(stderr, "%s: %s: %s\n", progname, r->path,
+		    strerror(r->error));
+		status = 1;
+	} else
+		print_digest(r->digest, r->path, binary);
+}
+
+/*
+ * Hash name resuming from its checkpoint store in ckptdir, which is named
+ * by the MD5 of the file's absolute path.
+ */
+static int
+hash_checkpointed(uint8_t digest[16], int algo, const char *name)
+{
+	struct mdckpt_store store;
+	uint8_t key[16];
+	uint64_t resumed;
+	char *store_path;
+	char *real;
+	int error;
+	int fd;
+	int i;
+	int n;
+
+	if ((real = realpath(name, NULL)) == NULL)
+		return (-1);
+	md5_digest(key, real, strlen(real));
+	free(real);
+	if ((store_path = malloc(strlen(ckptdir) + 34)) == NULL)
+		return (-1);
+	n = sprintf(store_path, "%s/", ckptdir);
+	for (i = 0; i < 16; i++)
+		n += sprintf(store_path + n, "%02x", key[i]);
+
+	/* A damaged store only costs hashing from the start. */
+	if (mdckpt_load(&store, store_path, algo) != 0)
+		mdckpt_init(&store, algo);
+	if ((fd = open(name, O_RDONLY)) < 0) {
+		free(store_path);
+		return (-1);
+	}
+	if (mdckpt_hash_fd(digest, fd, &store, ckptinterval, &resumed) != 0) {
+		error = errno;
+		close(fd);
+		free(store_path);
+		errno = error;
+		return (-1);
+	}
+	close(fd);
+	if (mdckpt_save(&store, store_path) != 0)
+		fprintf(stderr, "%s: %s: %s\n", progname, store_path,
+		    strerror(errno));
+	free(store_path);
+
+	return (0);
+}
+
+static void
+hash_serial(char **files, int nfiles, const struct mdfiles_opts *opts)
+{
+	uint8_t digest[16];
+	const char *name;
+	int i;
+
+	for (i = 0; i < nfiles || (i == 0 && nfiles == 0); i++) {
+		name = nfiles == 0 ? "-" : files[i];
+		if (strcmp(name, "-") == 0) {
+			if (mdfile_hash_fd(digest, opts->algo, STDIN_FILENO,
+			    &opts->file) != 0) {
+				fprintf(stderr, "%s: -: %s\n", progname,
+				    strerror(errno));
+				status = 1;
+				continue;
+			}
+		} else if (ckptdir != NULL ? hash_checkpointed(digest,
+		    opts->algo, name) != 0 : opts->cache != NULL ?
+		    mdcache_hash_path(opts->cache, digest, name, &opts->file,
+		    NULL) != 0 : mdfile_hash_path(digest, opts->algo, name,
+		    &opts->file) != 0) {
+			fprintf(stderr, "%s: %s: %s\n", progname, name,
+			    strerror(errno));
+			status = 1;
+			continue;
+		}
+		print_digest(digest, name, binary);
+	}
+}
+
+/*
+ * Hash the files on a pool of threads, or through io_uring if uring is
+ * given, walking directories if recurse is set.
+ */
+static void
+hash_parallel(char **files, int nfiles, const struct mdfiles_opts *opts,
+    const struct mduring_opts *uring, int recurse)
+{
+	static const char *stdin_name[] = { "-" };
+	struct mdfiles_list list;
+	int ret;
+	int i;
+
+	if (nfiles == 0) {
+		files = (char **)stdin_name;
+		nfiles = 1;
+	}
+	if (!recurse) {
+		if (uring != NULL)
+			ret = mduring_hash((const char *const *)files, nfiles,
+			    uring, print_result, NULL);
+		else
+			ret = mdfiles_hash((const char *const *)files, nfiles,
+			    opts, print_result, NULL);
+	} else {
+		memset(&list, 0, sizeof(list));
+		ret = 0;
+		for (i = 0; i < nfiles; i++) {
+			if (mdfiles_list_add(&list, files[i]) != 0) {
+				ret = -1;
+				break;
+			}
+		}
+		if (ret == 0 && uring != NULL)
+			ret = mduring_hash((const char *const *)list.paths,
+			    list.n, uring, print_result, NULL);
+		else if (ret == 0)
+			ret = mdfiles_hash_list(&list, opts, print_result,
+			    NULL);
+		mdfiles_list_free(&list);
+	}
+	if (ret < 0) {
+		fprintf(stderr, "%s: %s\n", progname, strerror(errno));
+		status = 1;
+	}
+}
+
+static void
+print_check(const struct mdcheck_result *r, void *arg)
+{
+	const char *name;
+	int escape;
+
+	(void)arg;
+	if (r->match && quiet)
+		return;
+	name = r->entry->path;
+	if (r->error != 0)
+		fprintf(stderr, "%s: %s: %s\n", progname, name,
+		    strerror(r->error));
+	escape = strpbrk(name, "\\\n") != NULL;
+	if (escape)
+		putchar('\\');
+	print_name(name, escape);
+	if (r->match)
+		fputs(": OK\n", stdout);
+	else {
+		fputs(r->error != 0 ? ": FAILED open or read\n" :
+		    ": FAILED\n", stdout);
+		fflush(stdout);
+	}
+}
+
+static void
+plural(size_t n, const char *one, const char *many)
+{
+
+	fputs(n == 1 ? one : many, stderr);
+}
+
+/*
+ * Check the files listed in the manifests, all in one pool.
+ */
+static void
+check_manifests(char **files, int nfiles, const struct mdfiles_opts *opts,
+    int failfast)
+{
+	struct mdcheck_stats stats;
+	struct mdcheck_list list;
+	const char *name;
+	FILE *fp;
+	int i;
+
+	memset(&list, 0, sizeof(list));
+	for (i = 0; i < nfiles || (i == 0 && nfiles == 0); i++) {
+		name = nfiles == 0 ? "-" : files[i];
+		if (strcmp(name, "-") == 0)
+			fp = stdin;
+		else if ((fp = fopen(name, "r")) == NULL) {
+			fprintf(stderr, "%s: %s: %s\n", progname, name,
+			    strerror(errno));
+			status = 1;
+			continue;
+		}
+		if (mdcheck_parse(&list, fp, opts->algo) != 0) {
+			fprintf(stderr, "%s: %s: %s\n", progname, name,
+			    strerror(errno));
+			status = 1;
+		}
+		if (fp != stdin)
+			fclose(fp);
+	}
+	if (list.n == 0) {
+		fprintf(stderr, "%s: no properly formatted checksum lines "
+		    "found\n", progname);
+		status = 1;
+		mdcheck_list_free(&list);
+		return;
+	}
+
+	if (mdcheck_verify(&list, opts, failfast, print_check, NULL,
+	    &stats) != 0)
+		status = 1;
+	fflush(stdout);
+	if (list.invalid != 0) {
+		fprintf(stderr, "%s: WARNING: %zu ", progname, list.invalid);
+		plural(list.invalid, "line is", "lines are");
+		fputs(" improperly formatted\n", stderr);
+	}
+	if (stats.unreadable != 0) {
+		fprintf(stderr, "%s: WARNING: %zu listed ", progname,
+		    stats.unreadable);
+		plural(stats.unreadable, "file", "files");
+		fputs(" could not be read\n", stderr);
+	}
+	if (stats.mismatched != 0) {
+		fprintf(stderr, "%s: WARNING: %zu computed ", progname,
+		    stats.mismatched);
+		plural(stats.mismatched, "checksum", "checksums");
+		fputs(" did NOT match\n", stderr);
+	}
+	if (stats.skipped != 0) {
+		fprintf(stderr, "%s: %zu ", progname, stats.skipped);
+		plural(stats.skipped, "file", "files");
+		fputs(" not checked\n", stderr);
+	}
+	mdcheck_list_free(&list);
+}
+
+static size_t
+parse_size(const char *arg)
+{
+	uint64_t n;
+
+	if (mdfile_size(&n, arg, SIZE_MAX / 2) != 0 || n == 0)
+		usage();
+	return (n);
+}
+
+int
+main(int argc, char **argv)
+{
+	struct mduring_opts uring;
+	struct mdfiles_opts opts;
+	struct mdcache cache;
+	const char *cachepath;
+	const char *p;
+	char *end;
+	int parallel;
+	int failfast;
+	int check;
+	int recurse;
+	int use_uring;
+	int ch;
+
+	if ((p = strrchr(argv[0], '/')) != NULL)
+		progname = p + 1;
+	else
+		progname = argv[0];
+	mdfiles_opts_init(&opts);
+	if (strcmp(progname, "md4sum") == 0)
+		opts.algo = MDFILE_MD4;
+	mduring_opts_init(&uring);
+	parallel = 0;
+	recurse = 0;
+	use_uring = 0;
+	cachepath = NULL;
+	check = 0;
+	failfast = 0;
+
+	while ((ch = getopt(argc, argv, "a:bB:cC:D:I:j:K:m:M:qrtuUx")) != -1) {
+		switch (ch) {
+		case 'a':
+			if ((opts.algo = mdfile_algo(optarg)) < 0)
+				usage();
+			break;
+		case 'b':
+			binary = 1;
+			break;
+		case 'B':
+			opts.file.bufsize = parse_size(optarg);
+			uring.bufsize = opts.file.bufsize;
+			break;
+		case 'c':
+			check = 1;
+			break;
+		case 'C':
+			cachepath = optarg;
+			break;
+		case 'D':
+			uring.depth = strtol(optarg, &end, 10);
+			if (*end != '\0' || uring.depth <= 0)
+				usage();
+			break;
+		case 'I':
+			if ((ckptinterval = parse_size(optarg)) == 0)
+				usage();
+			break;
+		case 'j':
+			opts.nthreads = strtol(optarg, &end, 10);
+			if (*end != '\0' || opts.nthreads < 0)
+				usage();
+			parallel = 1;
+			break;
+		case 'K':
+			ckptdir = optarg;
+			break;
+		case 'm':
+			if ((opts.file.method = mdfile_method(optarg)) < 0)
+				usage();
+			break;
+		case 'M':
+			opts.file.mapsize = parse_size(optarg);
+			break;
+		case 'q':
+			quiet = 1;
+			break;
+		case 'r':
+			recurse = 1;
+			parallel = 1;
+			break;
+		case 't':
+			binary = 0;
+			break;
+		case 'u':
+			use_uring = 1;
+			parallel = 1;
+			break;
+		case 'U':
+			opts.ordered = 0;
+			break;
+		case 'x':
+			failfast = 1;
+			break;
+		default:
+			usage();
+		}
+	}
+	argc -= optind;
+	argv += optind;
+
+	uring.algo = opts.algo;
+	uring.ordered = opts.ordered;
+	if (ckptdir != NULL && (parallel || cachepath != NULL))
+		usage();
+	if (cachepath != NULL && use_uring)
+		usage();
+	if (check && (ckptdir != NULL || use_uring || recurse))
+		usage();
+	if (!check && (quiet || failfast))
+		usage();
+	if (cachepath != NULL) {
+		if (mdcache_open(&cache, cachepath, opts.algo, 0) != 0) {
+			fprintf(stderr, "%s: %s: %s\n", progname, cachepath,
+			    strerror(errno));
+			return (1);
+		}
+		opts.cache = &cache;
+	}
+	if (check)
+		check_manifests(argv, argc, &opts, failfast);
+	else if (parallel)
+		hash_parallel(argv, argc, &opts, use_uring ? &uring : NULL,
+		    recurse);
+	else
+		hash_serial(argv, argc, &opts);
+	if (opts.cache != NULL)
+		mdcache_close(opts.cache);
+
+	if (fflush(stdout) != 0 || ferror(stdout)) {
+		fprintf(stderr, "%s: stdout: %s\n", progname, strerror(errno));
+		status = 1;
+	}
+	return (status);
+}
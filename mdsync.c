@@ -0,0 +1,961 @@
+/*-
+ * Copyright (c) 2023, Collin Funk
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHORS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * The rsync algorithm. A signature holds a rolling checksum and a strong
+ * MD4 or MD5 hash of every block of the basis file. A delta is made by
+ * sliding a block sized window over the new file a byte at a time: where
+ * the rolling checksum of the window is found in the signature and the
+ * strong hashes agree, the block is copied from the basis, and bytes
+ * that match nothing are sent as literals. Patching replays the delta
+ * against the basis and checks the result against a hash of the whole
+ * new file carried at the end of the delta.
+ *
+ * The rolling checksum is rsync's: a is the sum of the bytes and b the
+ * sum of a over the window, so both are updated in constant time as the
+ * window moves. The formats are not rsync's wire protocol.
+ *
+ * Signature, all numbers little-endian:
+ *
+ *   0   "MDSS"       magic
+ *   4   1            version
+ *   5   algo         MDFILE_MD5 or MDFILE_MD4
+ *   6   0, 0         reserved
+ *   8   blocksize    32 bits
+ *   12  0            reserved, 32 bits
+ *   16  size         64-bit length of the basis
+ *   24  blocks       per block a 32-bit rolling checksum and 16 bytes of
+ *                    strong hash
+ *
+ * Delta:
+ *
+ *   0   "MDSD"       magic
+ *   4   1            version
+ *   5   algo         hash of the whole new file in the 'E' op
+ *   6   0, 0         reserved
+ *   8   blocksize    32 bits
+ *   12  0            reserved, 32 bits
+ *   16  size         64-bit length of the basis
+ *   24  ops          'C' block count: copy count blocks from block
+ *                    'L' len bytes: len literal bytes, at most
+ *                        MDSYNC_LITERAL
+ *                    'E' size digest: end, with the length and hash of
+ *                        the new file
+ *
+ * with block, count and size 64 bits and len 32 bits.
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#include <errno.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "md4.h"
+#include "md4-mb.h"
+#include "md5.h"
+#include "md5-mb.h"
+#include "mdfile.h"
+#include "mdsync.h"
+
+#define MDSYNC_VERSION 1
+#define MDSYNC_HEADER 24
+#define MDSYNC_RECORD 20
+#define MDSYNC_BATCH 256 /* Blocks hashed by the multi-buffer engine at once */
+#define MDSYNC_BUFSIZE (1024 * 1024)
+
+static void
+mdsync_put32(uint8_t *p, uint32_t v)
+{
+
+	p[0] = v & 0xff;
+	p[1] = (v >> 8) & 0xff;
+	p[2] = (v >> 16) & 0xff;
+	p[3] = (v >> 24) & 0xff;
+}
+
+static void
+mdsync_put64(uint8_t *p, uint64_t v)
+{
+
+	mdsync_put32(p, v & 0xffffffff);
+	mdsync_put32(p + 4, v >> 32);
+}
+
+static uint32_t
+mdsync_get32(const uint8_t *p)
+{
+
+	return ((uint32_t)p[0] | ((uint32_t)p[1] << 8) |
+	    ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24));
+}
+
+static uint64_t
+mdsync_get64(const uint8_t *p)
+{
+
+	return ((uint64_t)mdsync_get32(p) |
+	    ((uint64_t)mdsync_get32(p + 4) << 32));
+}
+
+static void
+mdsync_header(uint8_t hdr[MDSYNC_HEADER], const char *magic, int algo,
+    uint32_t blocksize, uint64_t size)
+{
+
+	memset(hdr, 0, MDSYNC_HEADER);
+	memcpy(hdr, magic, 4);
+	hdr[4] = MDSYNC_VERSION;
+	hdr[5] = algo;
+	mdsync_put32(hdr + 8, blocksize);
+	mdsync_put64(hdr + 16, size);
+}
+
+static int
+mdsync_parse_header(const uint8_t hdr[MDSYNC_HEADER], const char *magic,
+    int *algo, uint32_t *blocksize, uint64_t *size)
+{
+
+	if (memcmp(hdr, magic, 4) != 0 || hdr[4] != MDSYNC_VERSION ||
+	    (hdr[5] != MDFILE_MD5 && hdr[5] != MDFILE_MD4) ||
+	    hdr[6] != 0 || hdr[7] != 0 || mdsync_get32(hdr + 12) != 0)
+		return (-1);
+	*algo = hdr[5];
+	*blocksize = mdsync_get32(hdr + 8);
+	*size = mdsync_get64(hdr + 16);
+	if (*blocksize < MDSYNC_MINBLOCK || *blocksize > MDSYNC_MAXBLOCK)
+		return (-1);
+	return (0);
+}
+
+/*
+ * Block size rsync picks for a basis of size bytes: 700 up to 490000
+ * bytes, then the square root rounded down to a multiple of 8, up to
+ * MDSYNC_MAXBLOCK.
+ */
+uint32_t
+mdsync_blocksize(uint64_t size)
+{
+	uint64_t r;
+
+	if (size <= 700 * 700)
+		return (700);
+	for (r = 700; (r + 1) * (r + 1) <= size && r < MDSYNC_MAXBLOCK; r++)
+		;
+	r &= ~(uint64_t)7;
+	return (r < MDSYNC_MAXBLOCK ? r : MDSYNC_MAXBLOCK);
+}
+
+/*
+ * Rolling checksum of len bytes.
+ */
+uint32_t
+mdsync_weak(const void *data, size_t len)
+{
+	const uint8_t *p;
+	uint32_t a;
+	uint32_t b;
+	size_t i;
+
+	p = data;
+	a = b = 0;
+	for (i = 0; i < len; i++) {
+		a += p[i];
+		b += a;
+	}
+	return ((a & 0xffff) | (b << 16));
+}
+
+static void
+mdsync_strong(uint8_t digest[16], int algo, const void *data, size_t len)
+{
+
+	if (algo == MDFILE_MD4)
+		md4_digest(digest, data, len);
+	else
+		md5_digest(digest, data, len);
+}
+
+int
+mdsync_sig_init(struct mdsync_sig *sig, int algo, uint32_t blocksize)
+{
+
+	memset(sig, 0, sizeof(*sig));
+	if (blocksize < MDSYNC_MINBLOCK || blocksize > MDSYNC_MAXBLOCK ||
+	    (algo != MDFILE_MD5 && algo != MDFILE_MD4)) {
+		errno = EINVAL;
+		return (-1);
+	}
+	sig->algo = algo;
+	sig->blocksize = blocksize;
+	if ((sig->partial = malloc(blocksize)) == NULL)
+		return (-1);
+	return (0);
+}
+
+static int
+mdsync_sig_grow(struct mdsync_sig *sig, size_t n)
+{
+	uint8_t (*strong)[16];
+	uint32_t *weak;
+	size_t cap;
+
+	if (sig->nblocks + n <= sig->cap)
+		return (0);
+	if (sig->nblocks + n >= UINT32_MAX) {
+		errno = EFBIG;
+		return (-1);
+	}
+	cap = sig->cap != 0 ? sig->cap : 1024;
+	while (cap < sig->nblocks + n)
+		cap *= 2;
+	if ((weak = realloc(sig->weak, cap * sizeof(*weak))) == NULL)
+		return (-1);
+	sig->weak = weak;
+	if ((strong = realloc(sig->strong, cap * sizeof(*strong))) == NULL)
+		return (-1);
+	sig->strong = strong;
+	sig->cap = cap;
+	return (0);
+}
+
+/*
+ * Add n full blocks at data, the strong hashes side by side.
+ */
+static void
+mdsync_sig_blocks(struct mdsync_sig *sig, const uint8_t *data, size_t n)
+{
+	struct md5_mb_job jobs5[MDSYNC_BATCH];
+	struct md4_mb_job jobs4[MDSYNC_BATCH];
+	size_t bs;
+	size_t i;
+	size_t m;
+
+	bs = sig->blocksize;
+	for (; n != 0; n -= m, data += m * bs) {
+		m = n < MDSYNC_BATCH ? n : MDSYNC_BATCH;
+		for (i = 0; i < m; i++) {
+			sig->weak[sig->nblocks + i] =
+			    mdsync_weak(data + i * bs, bs);
+			jobs5[i].data = jobs4[i].data = data + i * bs;
+			jobs5[i].len = jobs4[i].len = bs;
+		}
+		if (sig->algo == MDFILE_MD4) {
+			md4_mb_digest(jobs4, m);
+			for (i = 0; i < m; i++)
+				memcpy(sig->strong[sig->nblocks + i],
+				    jobs4[i].digest, 16);
+		} else {
+			md5_mb_digest(jobs5, m);
+			for (i = 0; i < m; i++)
+				memcpy(sig->strong[sig->nblocks + i],
+				    jobs5[i].digest, 16);
+		}
+		sig->nblocks += m;
+	}
+}
+
+int
+mdsync_sig_update(struct mdsync_sig *sig, const void *data, size_t len)
+{
+	const uint8_t *input;
+	size_t bs;
+	size_t n;
+
+	input = data;
+	bs = sig->blocksize;
+	sig->size += len;
+	if (mdsync_sig_grow(sig, (sig->npartial + len) / bs) != 0)
+		return (-1);
+
+	if (sig->npartial != 0) {
+		n = bs - sig->npartial < len ? bs - sig->npartial : len;
+		memcpy(sig->partial + sig->npartial, input, n);
+		sig->npartial += n;
+		input += n;
+		len -= n;
+		if (sig->npartial < bs)
+			return (0);
+		mdsync_sig_blocks(sig, sig->partial, 1);
+		sig->npartial = 0;
+	}
+
+	mdsync_sig_blocks(sig, input, len / bs);
+	input += len / bs * bs;
+	memcpy(sig->partial, input, len % bs);
+	sig->npartial = len % bs;
+	return (0);
+}
+
+/*
+ * Chain the blocks into buckets by rolling checksum, each bucket in
+ * block order.
+ */
+static int
+mdsync_sig_index(struct mdsync_sig *sig)
+{
+	size_t nbuckets;
+	size_t i;
+	uint32_t h;
+	int bits;
+
+	for (bits = 4, nbuckets = 16; nbuckets < 2 * sig->nblocks &&
+	    bits < 31; bits++)
+		nbuckets *= 2;
+	sig->shift = 32 - bits;
+	if ((sig->head = calloc(nbuckets, sizeof(*sig->head))) == NULL ||
+	    (sig->next = calloc(sig->nblocks + 1, sizeof(*sig->next))) ==
+	    NULL)
+		return (-1);
+	for (i = sig->nblocks; i-- > 0;) {
+		h = (sig->weak[i] * 0x9e3779b1) >> sig->shift;
+		sig->next[i] = sig->head[h];
+		sig->head[h] = i + 1;
+	}
+	return (0);
+}
+
+int
+mdsync_sig_final(struct mdsync_sig *sig)
+{
+	size_t i;
+
+	if (sig->npartial != 0) {
+		if (mdsync_sig_grow(sig, 1) != 0)
+			return (-1);
+		i = sig->nblocks++;
+		sig->weak[i] = mdsync_weak(sig->partial, sig->npartial);
+		mdsync_strong(sig->strong[i], sig->algo, sig->partial,
+		    sig->npartial);
+		sig->npartial = 0;
+	}
+	free(sig->partial);
+	sig->partial = NULL;
+	return (mdsync_sig_index(sig));
+}
+
+/*
+ * Signature of the file open on fd with blocks of blocksize bytes, or
+ * the size mdsync_blocksize picks if blocksize is 0.
+ */
+int
+mdsync_sig_fd(struct mdsync_sig *sig, int algo, uint32_t blocksize, int fd)
+{
+	struct stat st;
+	uint8_t *buf;
+	ssize_t n;
+	int error;
+
+	if (blocksize == 0) {
+		if (fstat(fd, &st) != 0)
+			return (-1);
+		blocksize = mdsync_blocksize(S_ISREG(st.st_mode) ?
+		    (uint64_t)st.st_size : 0);
+	}
+	if (mdsync_sig_init(sig, algo, blocksize) != 0)
+		return (-1);
+	if ((buf = malloc(MDSYNC_BUFSIZE)) == NULL)
+		goto fail;
+	while ((n = mdfile_read(fd, buf, MDSYNC_BUFSIZE)) > 0) {
+		if (mdsync_sig_update(sig, buf, n) != 0)
+			break;
+	}
+	if (n != 0 || mdsync_sig_final(sig) != 0)
+		goto fail;
+	free(buf);
+	return (0);
+
+fail:
+	error = errno;
+	free(buf);
+	mdsync_sig_free(sig);
+	errno = error;
+	return (-1);
+}
+
+int
+mdsync_sig_write(const struct mdsync_sig *sig, mdsync_write_fn *fn,
+    void *arg)
+{
+	uint8_t buf[MDSYNC_HEADER + 256 * MDSYNC_RECORD];
+	uint8_t *p;
+	size_t i;
+
+	mdsync_header(buf, "MDSS", sig->algo, sig->blocksize, sig->size);
+	if (fn(buf, MDSYNC_HEADER, arg) != 0)
+		return (-1);
+	for (i = 0, p = buf; i < sig->nblocks; i++) {
+		mdsync_put32(p, sig->weak[i]);
+		memcpy(p + 4, sig->strong[i], 16);
+		p += MDSYNC_RECORD;
+		if (p == buf + 256 * MDSYNC_RECORD || i + 1 == sig->nblocks) {
+			if (fn(buf, p - buf, arg) != 0)
+				return (-1);
+			p = buf;
+		}
+	}
+	return (0);
+}
+
+/*
+ * Read a signature written by mdsync_sig_write. Returns -1 with errno
+ * set to EINVAL if it is malformed.
+ */
+int
+mdsync_sig_read(struct mdsync_sig *sig, int fd)
+{
+	uint8_t hdr[MDSYNC_HEADER];
+	uint8_t rec[MDSYNC_RECORD];
+	uint64_t nblocks;
+	uint64_t size;
+	uint32_t bs;
+	ssize_t n;
+	size_t i;
+	int algo;
+	int error;
+
+	memset(sig, 0, sizeof(*sig));
+	if ((n = mdfile_read(fd, hdr, sizeof(hdr))) < 0)
+		return (-1);
+	if (n != sizeof(hdr) ||
+	    mdsync_parse_header(hdr, "MDSS", &algo, &bs, &size) != 0) {
+		errno = EINVAL;
+		return (-1);
+	}
+	nblocks = size / bs + (size % bs != 0);
+	if (mdsync_sig_init(sig, algo, bs) != 0)
+		return (-1);
+	free(sig->partial);
+	sig->partial = NULL;
+	if (nblocks >= UINT32_MAX || mdsync_sig_grow(sig, nblocks) != 0)
+		goto fail;
+
+	for (i = 0; i < nblocks; i++) {
+		if ((n = mdfile_read(fd, rec, sizeof(rec))) < 0)
+			goto fail;
+		if (n != sizeof(rec)) {
+			errno = EINVAL;
+			goto fail;
+		}
+		sig->weak[i] = mdsync_get32(rec);
+		memcpy(sig->strong[i], rec + 4, 16);
+	}
+	sig->nblocks = nblocks;
+	sig->size = size;
+	if ((n = mdfile_read(fd, rec, 1)) != 0) {
+		if (n > 0)
+			errno = EINVAL;
+		goto fail;
+	}
+	if (mdsync_sig_index(sig) != 0)
+		goto fail;
+	return (0);
+
+fail:
+	error = errno;
+	mdsync_sig_free(sig);
+	errno = error;
+	return (-1);
+}
+
+void
+mdsync_sig_free(struct mdsync_sig *sig)
+{
+
+	free(sig->weak);
+	free(sig->strong);
+	free(sig->head);
+	free(sig->next);
+	free(sig->partial);
+	memset(sig, 0, sizeof(*sig));
+}
+
+static size_t
+mdsync_blocklen(const struct mdsync_sig *sig, size_t i)
+{
+
+	if (i + 1 == sig->nblocks && sig->size % sig->blocksize != 0)
+		return (sig->size % sig->blocksize);
+	return (sig->blocksize);
+}
+
+/*
+ * Find a block of the signature holding the len bytes at p, whose
+ * rolling checksum is weak. The block after the last one copied is
+ * tried first, as runs of unchanged blocks are the common case. Returns
+ * the block or -1.
+ */
+static int64_t
+mdsync_match(const struct mdsync_delta *d, uint32_t weak, const uint8_t *p,
+    size_t len)
+{
+	const struct mdsync_sig *sig;
+	uint8_t strong[16];
+	uint32_t k;
+	size_t i;
+	int have;
+
+	sig = d->sig;
+	have = 0;
+	if (d->ncopy != 0) {
+		i = d->copy + d->ncopy;
+		if (i < sig->nblocks && sig->weak[i] == weak &&
+		    mdsync_blocklen(sig, i) == len) {
+			mdsync_strong(strong, sig->algo, p, len);
+			have = 1;
+			if (memcmp(strong, sig->strong[i], 16) == 0)
+				return (i);
+		}
+	}
+
+	for (k = sig->head[(weak * 0x9e3779b1) >> sig->shift]; k != 0;
+	    k = sig->next[k - 1]) {
+		i = k - 1;
+		if (sig->weak[i] != weak || mdsync_blocklen(sig, i) != len)
+			continue;
+		if (!have) {
+			mdsync_strong(strong, sig->algo, p, len);
+			have = 1;
+		}
+		if (memcmp(strong, sig->strong[i], 16) == 0)
+			return (i);
+	}
+	return (-1);
+}
+
+static int
+mdsync_flush_copy(struct mdsync_delta *d)
+{
+	uint8_t op[17];
+
+	if (d->ncopy == 0)
+		return (0);
+	op[0] = 'C';
+	mdsync_put64(op + 1, d->copy);
+	mdsync_put64(op + 9, d->ncopy);
+	d->ncopy = 0;
+	return (d->fn(op, sizeof(op), d->arg));
+}
+
+/*
+ * Send the bytes between start and pos as literals.
+ */
+static int
+mdsync_flush_literal(struct mdsync_delta *d)
+{
+	uint8_t op[5];
+	size_t n;
+
+	if (d->pos != d->start && mdsync_flush_copy(d) != 0)
+		return (-1);
+	for (; d->start < d->pos; d->start += n) {
+		n = d->pos - d->start;
+		if (n > MDSYNC_LITERAL)
+			n = MDSYNC_LITERAL;
+		op[0] = 'L';
+		mdsync_put32(op + 1, n);
+		if (d->fn(op, sizeof(op), d->arg) != 0 ||
+		    d->fn(d->buf + d->start, n, d->arg) != 0)
+			return (-1);
+		d->literal += n;
+	}
+	return (0);
+}
+
+static int
+mdsync_add_copy(struct mdsync_delta *d, uint64_t block)
+{
+
+	d->matched++;
+	if (d->ncopy != 0 && d->copy + d->ncopy == block) {
+		d->ncopy++;
+		return (0);
+	}
+	if (mdsync_flush_copy(d) != 0)
+		return (-1);
+	d->copy = block;
+	d->ncopy = 1;
+	return (0);
+}
+
+int
+mdsync_delta_init(struct mdsync_delta *d, const struct mdsync_sig *sig,
+    mdsync_write_fn *fn, void *arg)
+{
+	uint8_t hdr[MDSYNC_HEADER];
+
+	memset(d, 0, sizeof(*d));
+	d->sig = sig;
+	d->fn = fn;
+	d->arg = arg;
+	mdfile_init(&d->whole, sig->algo);
+	d->cap = MDSYNC_LITERAL + 2 * (size_t)sig->blocksize;
+	if ((d->buf = malloc(d->cap)) == NULL)
+		return (-1);
+	mdsync_header(hdr, "MDSD", sig->algo, sig->blocksize, sig->size);
+	if (fn(hdr, sizeof(hdr), arg) != 0) {
+		free(d->buf);
+		d->buf = NULL;
+		return (-1);
+	}
+	return (0);
+}
+
+/*
+ * Slide the window over the buffered data as far as it goes, stopping
+ * with less than a block after pos or a block that matched nothing and
+ * needs another byte to move on.
+ */
+static int
+mdsync_scan(struct mdsync_delta *d)
+{
+	const uint8_t *p;
+	uint32_t bs;
+	uint32_t out;
+	uint32_t in;
+	int64_t j;
+	size_t i;
+
+	bs = d->sig->blocksize;
+	while (d->end - d->pos >= bs) {
+		p = d->buf + d->pos;
+		if (!d->summed) {
+			d->a = d->b = 0;
+			for (i = 0; i < bs; i++) {
+				d->a += p[i];
+				d->b += d->a;
+			}
+			d->summed = 1;
+			d->checked = 0;
+		}
+		if (!d->checked) {
+			j = mdsync_match(d, (d->a & 0xffff) | (d->b << 16), p,
+			    bs);
+			if (j >= 0) {
+				if (mdsync_flush_literal(d) != 0 ||
+				    mdsync_add_copy(d, j) != 0)
+					return (-1);
+				d->pos += bs;
+				d->start = d->pos;
+				d->summed = 0;
+				continue;
+			}
+			d->checked = 1;
+		}
+		if (d->end - d->pos == bs)
+			break;
+
+		out = p[0];
+		in = p[bs];
+		d->a += in - out;
+		d->b += d->a - bs * out;
+		d->pos++;
+		d->checked = 0;
+		if (d->pos - d->start >= MDSYNC_LITERAL &&
+		    mdsync_flush_literal(d) != 0)
+			return (-1);
+	}
+	return (0);
+}
+
+int
+mdsync_delta_update(struct mdsync_delta *d, const void *data, size_t len)
+{
+	const uint8_t *input;
+	size_t n;
+
+	if (d->buf == NULL) {
+		errno = EINVAL;
+		return (-1);
+	}
+	input = data;
+	mdfile_update(&d->whole, data, len);
+	d->size += len;
+	while (len != 0) {
+		/* Keep the pending literals and the window, drop the rest. */
+		if (d->end == d->cap) {
+			memmove(d->buf, d->buf + d->start, d->end - d->start);
+			d->pos -= d->start;
+			d->end -= d->start;
+			d->start = 0;
+		}
+		n = d->cap - d->end < len ? d->cap - d->end : len;
+		memcpy(d->buf + d->end, input, n);
+		d->end += n;
+		input += n;
+		len -= n;
+		if (mdsync_scan(d) != 0) {
+			free(d->buf);
+			d->buf = NULL;
+			return (-1);
+		}
+	}
+	return (0);
+}
+
+/*
+ * Finish the delta. What is left after the window is shorter than a
+ * block and can only match a short last block of the basis.
+ */
+int
+mdsync_delta_final(struct mdsync_delta *d)
+{
+	uint8_t op[25];
+	size_t tail;
+	int64_t j;
+	int ret;
+
+	if (d->buf == NULL) {
+		errno = EINVAL;
+		return (-1);
+	}
+	ret = -1;
+	tail = d->end - d->pos;
+	if (tail != 0 && tail < d->sig->blocksize) {
+		j = mdsync_match(d, mdsync_weak(d->buf + d->pos, tail),
+		    d->buf + d->pos, tail);
+		if (j >= 0) {
+			if (mdsync_flush_literal(d) != 0 ||
+			    mdsync_add_copy(d, j) != 0)
+				goto out;
+			d->start = d->pos = d->end;
+		}
+	}
+	d->pos = d->end;
+	if (mdsync_flush_literal(d) != 0 || mdsync_flush_copy(d) != 0)
+		goto out;
+
+	op[0] = 'E';
+	mdsync_put64(op + 1, d->size);
+	mdfile_final(op + 9, &d->whole);
+	ret = d->fn(op, sizeof(op), d->arg);
+
+out:
+	free(d->buf);
+	d->buf = NULL;
+	return (ret);
+}
+
+/*
+ * Buffered reads of a delta.
+ */
+struct mdsync_reader {
+	int fd;
+	uint8_t *buf;
+	size_t pos;
+	size_t len;
+};
+
+static int
+mdsync_get(struct mdsync_reader *rd, void *out, size_t n)
+{
+	uint8_t *p;
+	ssize_t got;
+	size_t m;
+
+	p = out;
+	while (n != 0) {
+		if (rd->pos == rd->len) {
+			if ((got = mdfile_read(rd->fd, rd->buf,
+			    MDSYNC_BUFSIZE)) < 0)
+				return (-1);
+			if (got == 0) {
+				errno = EINVAL;
+				return (-1);
+			}
+			rd->pos = 0;
+			rd->len = got;
+		}
+		m = rd->len - rd->pos < n ? rd->len - rd->pos : n;
+		memcpy(p, rd->buf + rd->pos, m);
+		rd->pos += m;
+		p += m;
+		n -= m;
+	}
+	return (0);
+}
+
+/*
+ * Copy count blocks from block of the basis to the output.
+ */
+static int
+mdsync_patch_copy(int basis, uint32_t bs, uint64_t size, uint64_t block,
+    uint64_t count, uint8_t *buf, struct mdfile_ctx *ctx, uint64_t *written,
+    mdsync_write_fn *fn, void *arg)
+{
+	uint64_t nblocks;
+	uint64_t off;
+	uint64_t end;
+	size_t len;
+	ssize_t n;
+
+	nblocks = size / bs + (size % bs != 0);
+	if (count == 0 || block >= nblocks || count > nblocks - block) {
+		errno = EINVAL;
+		return (-1);
+	}
+	off = block * bs;
+	end = (block + count) * bs < size ? (block + count) * bs : size;
+	for (; off < end; off += n) {
+		len = end - off < MDSYNC_BUFSIZE ? end - off : MDSYNC_BUFSIZE;
+		n = pread(basis, buf, len, off);
+		if (n < 0 && errno == EINTR) {
+			n = 0;
+			continue;
+		}
+		if (n < 0)
+			return (-1);
+		if (n == 0) {
+			errno = EINVAL;
+			return (-1);
+		}
+		mdfile_update(ctx, buf, n);
+		*written += n;
+		if (fn(buf, n, arg) != 0)
+			return (-1);
+	}
+	return (0);
+}
+
+/*
+ * Rebuild the new file from the basis open on basis and the delta read
+ * from delta, passing it to fn. The basis must be the file the
+ * signature was made from. Returns -1 with errno set to EINVAL for a
+ * malformed delta or one made against a basis of another length, and to
+ * EBADMSG if the result does not hash to what the delta says, in which
+ * case what was written must be thrown away.
+ */
+int
+mdsync_patch(int basis, int delta, mdsync_write_fn *fn, void *arg)
+{
+	struct mdsync_reader rd;
+	struct mdfile_ctx ctx;
+	struct stat st;
+	uint8_t hdr[MDSYNC_HEADER];
+	uint8_t digest[16];
+	uint8_t op[25];
+	uint8_t *buf;
+	uint64_t written;
+	uint64_t size;
+	uint32_t bs;
+	uint32_t n;
+	int algo;
+	int error;
+	int ret;
+
+	memset(&rd, 0, sizeof(rd));
+	rd.fd = delta;
+	if ((rd.buf = malloc(MDSYNC_BUFSIZE)) == NULL)
+		return (-1);
+	if ((buf = malloc(MDSYNC_BUFSIZE)) == NULL) {
+		free(rd.buf);
+		return (-1);
+	}
+	ret = -1;
+	if (mdsync_get(&rd, hdr, sizeof(hdr)) != 0)
+		goto out;
+	if (mdsync_parse_header(hdr, "MDSD", &algo, &bs, &size) != 0 ||
+	    fstat(basis, &st) != 0 ||
+	    (S_ISREG(st.st_mode) && (uint64_t)st.st_size != size)) {
+		errno = EINVAL;
+		goto out;
+	}
+
+	mdfile_init(&ctx, algo);
+	written = 0;
+	for (;;) {
+		if (mdsync_get(&rd, op, 1) != 0)
+			goto out;
+		if (op[0] == 'C') {
+			if (mdsync_get(&rd, op + 1, 16) != 0 ||
+			    mdsync_patch_copy(basis, bs, size,
+			    mdsync_get64(op + 1), mdsync_get64(op + 9), buf,
+			    &ctx, &written, fn, arg) != 0)
+				goto out;
+		} else if (op[0] == 'L') {
+			if (mdsync_get(&rd, op + 1, 4) != 0)
+				goto out;
+			n = mdsync_get32(op + 1);
+			if (n == 0 || n > MDSYNC_LITERAL) {
+				errno = EINVAL;
+				goto out;
+			}
+			if (mdsync_get(&rd, buf, n) != 0 ||
+			    fn(buf, n, arg) != 0)
+				goto out;
+			mdfile_update(&ctx, buf, n);
+			written += n;
+		} else if (op[0] == 'E') {
+			if (mdsync_get(&rd, op + 1, 8) != 0 ||
+			    mdsync_get(&rd, digest, 16) != 0)
+				goto out;
+			break;
+		} else {
+			errno = EINVAL;
+			goto out;
+		}
+	}
+
+	mdfile_final(op + 9, &ctx);
+	if (mdsync_get64(op + 1) != written ||
+	    memcmp(op + 9, digest, 16) != 0) {
+		errno = EBADMSG;
+		goto out;
+	}
+	ret = 0;
+
+out:
+	error = errno;
+	free(rd.buf);
+	free(buf);
+	errno = error;
+	return (ret);
+}
+
+int
+mdsync_write_fd(const void *data, size_t len, void *arg)
+{
+	const uint8_t *p;
+	ssize_t n;
+	int fd;
+
+	fd = *(int *)arg;
+	for (p = data; len != 0; p += n, len -= n) {
+		n = write(fd, p, len);
+		if (n < 0 && errno == EINTR) {
+			n = 0;
+			continue;
+		}
+		if (n < 0)
+			return (-1);
+	}
+	return (0);
+}
@@ -0,0 +1,96 @@
+/*-
+ * Copyright (c) 2023, Collin Funk
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHORS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#ifndef CRYPTO_MDSYNC_H
+#define CRYPTO_MDSYNC_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include "mdfile.h"
+
+#define MDSYNC_MINBLOCK 64
+#define MDSYNC_MAXBLOCK (128 * 1024)
+#define MDSYNC_LITERAL (64 * 1024) /* Longest literal run in a delta */
+
+/*
+ * Called with each piece of a signature, delta or patched file. Returns
+ * 0, or -1 with errno set to stop.
+ */
+typedef int mdsync_write_fn(const void *, size_t, void *);
+
+struct mdsync_sig {
+	int algo; /* Strong hash, MDFILE_MD5 or MDFILE_MD4 */
+	uint32_t blocksize; /* Bytes per block, the last may be shorter */
+	uint64_t size; /* Length of the basis file */
+	size_t nblocks;
+	size_t cap; /* Blocks allocated */
+	uint32_t *weak; /* Rolling checksum of each block */
+	uint8_t (*strong)[16]; /* Strong hash of each block */
+	uint32_t *head; /* First block in each bucket plus 1, or 0 */
+	uint32_t *next; /* Next block in the same bucket plus 1, or 0 */
+	int shift; /* 32 less log2 of the number of buckets */
+	uint8_t *partial; /* Bytes of an unfinished block while building */
+	size_t npartial;
+};
+
+struct mdsync_delta {
+	const struct mdsync_sig *sig;
+	mdsync_write_fn *fn;
+	void *arg;
+	struct mdfile_ctx whole; /* Hash of the new file */
+	uint8_t *buf; /* Window onto the new file */
+	size_t cap;
+	size_t start; /* Start of pending literal bytes in buf */
+	size_t pos; /* Start of the block sized window in buf */
+	size_t end; /* End of the data in buf */
+	uint32_t a; /* Rolling checksum halves of the window */
+	uint32_t b;
+	int summed; /* a and b are those of the window at pos */
+	int checked; /* The window at pos matched no block */
+	uint64_t copy; /* First block of the pending copy */
+	uint64_t ncopy; /* Blocks in the pending copy, or 0 */
+	uint64_t size; /* Bytes of the new file so far */
+	uint64_t literal; /* Literal bytes emitted so far */
+	uint64_t matched; /* Blocks matched so far */
+};
+
+uint32_t mdsync_blocksize(uint64_t);
+uint32_t mdsync_weak(const void *, size_t);
+int mdsync_sig_init(struct mdsync_sig *, int, uint32_t);
+int mdsync_sig_update(struct mdsync_sig *, const void *, size_t);
+int mdsync_sig_final(struct mdsync_sig *);
+int mdsync_sig_fd(struct mdsync_sig *, int, uint32_t, int);
+int mdsync_sig_write(const struct mdsync_sig *, mdsync_write_fn *, void *);
+int mdsync_sig_read(struct mdsync_sig *, int);
+void mdsync_sig_free(struct mdsync_sig *);
+int mdsync_delta_init(struct mdsync_delta *, const struct mdsync_sig *,
+    mdsync_write_fn *, void *);
+int mdsync_delta_update(struct mdsync_delta *, const void *, size_t);
+int mdsync_delta_final(struct mdsync_delta *);
+int mdsync_patch(int, int, mdsync_write_fn *, void *);
+int mdsync_write_fd(const void *, size_t, void *);
+
+#endif /* CRYPTO_MDSYNC_H */
@@ -0,0 +1,623 @@
+/*-
+ * Copyright (c) 2023, Collin Funk
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHORS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * Hash many files from one thread with io_uring. Up to depth files are
+ * in flight, each owning a registered buffer; every open, read and close
+ * is queued as it becomes possible and all of them go to the kernel in
+ * one io_uring_enter per round. The ring is driven through the raw
+ * system calls so there is no liburing dependency. Elsewhere, or on a
+ * kernel without the needed operations, files are read with pread.
+ */
+
+#define _GNU_SOURCE
+
+#include <sys/types.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#if defined(__linux__)
+#include <sys/syscall.h>
+#include <linux/io_uring.h>
+#if defined(__NR_io_uring_setup) && defined(IO_URING_OP_SUPPORTED)
+#define HAVE_IO_URING
+#endif
+#endif
+
+#include "mdfile.h"
+#include "mdfiles.h"
+#include "mduring.h"
+
+struct mduring_report {
+	const struct mduring_opts *opts;
+	struct mdfiles_result *results;
+	uint8_t *done; /* Finished but not yet reported in order */
+	size_t next; /* Next file to report in order */
+	size_t nreported;
+	size_t n;
+	int nfailed;
+	mdfiles_fn *fn;
+	void *arg;
+};
+
+void
+mduring_opts_init(struct mduring_opts *opts)
+{
+
+	opts->algo = MDFILE_MD5;
+	opts->depth = MDURING_DEPTH;
+	opts->bufsize = MDURING_BUFSIZE;
+	opts->ordered = 1;
+	opts->pread = 0;
+}
+
+static void
+mduring_report(struct mduring_report *rep, size_t index)
+{
+
+	if (rep->results[index].error != 0)
+		rep->nfailed++;
+	rep->nreported++;
+	if (rep->opts->ordered) {
+		rep->done[index] = 1;
+		while (rep->next < rep->n && rep->done[rep->next])
+			rep->fn(&rep->results[rep->next++], rep->arg);
+	} else
+		rep->fn(&rep->results[index], rep->arg);
+}
+
+/*
+ * One file at a time with open, pread and close.
+ */
+static int
+mduring_hash_pread(struct mduring_report *rep, uint8_t *buf)
+{
+	struct mdfiles_result *r;
+	struct mdfile_ctx ctx;
+	uint64_t off;
+	ssize_t n;
+	size_t i;
+	int fd;
+
+	for (i = 0; i < rep->n; i++) {
+		r = &rep->results[i];
+		if (strcmp(r->path, "-") == 0)
+			fd = STDIN_FILENO;
+		else if ((fd = open(r->path, O_RDONLY)) < 0) {
+			r->error = errno;
+			mduring_report(rep, i);
+			continue;
+		}
+
+		mdfile_init(&ctx, rep->opts->algo);
+		for (off = 0;; off += n) {
+			if (fd == STDIN_FILENO)
+				n = read(fd, buf, rep->opts->bufsize);
+			else
+				n = pread(fd, buf, rep->opts->bufsize, off);
+			if (n < 0 && errno == EINTR) {
+				n = 0;
+				continue;
+			}
+			if (n <= 0)
+				break;
+			mdfile_update(&ctx, buf, n);
+		}
+		if (n < 0)
+			r->error = errno;
+		mdfile_final(r->digest, &ctx);
+		r->size = off;
+		if (fd != STDIN_FILENO)
+			close(fd);
+		mduring_report(rep, i);
+	}
+
+	return (0);
+}
+
+#ifdef HAVE_IO_URING
+
+#define MDURING_OPEN 0
+#define MDURING_READ 1
+#define MDURING_CLOSE 2
+
+struct mduring_ring {
+	int fd;
+	unsigned *sq_head;
+	unsigned *sq_tail;
+	unsigned *sq_mask;
+	unsigned *sq_array;
+	unsigned *cq_head;
+	unsigned *cq_tail;
+	unsigned *cq_mask;
+	struct io_uring_sqe *sqes;
+	struct io_uring_cqe *cqes;
+	void *sq_ptr;
+	void *cq_ptr;
+	size_t sq_len;
+	size_t cq_len;
+	size_t sqes_len;
+	unsigned tail; /* Our copy of *sq_tail */
+	unsigned queued; /* Entries not yet submitted */
+};
+
+struct mduring_slot {
+	size_t index; /* File being hashed, or SIZE_MAX if free */
+	int state; /* MDURING_OPEN, MDURING_READ or MDURING_CLOSE */
+	int fd;
+	uint64_t off;
+	struct mdfile_ctx ctx;
+};
+
+static int
+mduring_setup(struct mduring_ring *ring, unsigned entries)
+{
+	struct io_uring_params p;
+	long fd;
+
+	memset(ring, 0, sizeof(*ring));
+	memset(&p, 0, sizeof(p));
+	if ((fd = syscall(__NR_io_uring_setup, entries, &p)) < 0)
+		return (-1);
+	ring->fd = fd;
+
+	ring->sq_len = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+	ring->cq_len = p.cq_off.cqes +
+	    p.cq_entries * sizeof(struct io_uring_cqe);
+	if (p.features & IORING_FEAT_SINGLE_MMAP) {
+		if (ring->cq_len > ring->sq_len)
+			ring->sq_len = ring->cq_len;
+		ring->cq_len = 0;
+	}
+	ring->sq_ptr = mmap(NULL, ring->sq_len, PROT_READ | PROT_WRITE,
+	    MAP_SHARED, fd, IORING_OFF_SQ_RING);
+	if (ring->sq_ptr == MAP_FAILED)
+		goto fail;
+	if (ring->cq_len != 0) {
+		ring->cq_ptr = mmap(NULL, ring->cq_len, PROT_READ | PROT_WRITE,
+		    MAP_SHARED, fd, IORING_OFF_CQ_RING);
+		if (ring->cq_ptr == MAP_FAILED)
+			goto fail;
+	} else
+		ring->cq_ptr = ring->sq_ptr;
+	ring->sqes_len = p.sq_entries * sizeof(struct io_uring_sqe);
+	ring->sqes = mmap(NULL, ring->sqes_len, PROT_READ | PROT_WRITE,
+	    MAP_SHARED, fd, IORING_OFF_SQES);
+	if (ring->sqes == MAP_FAILED)
+		goto fail;
+
+	ring->sq_head = (unsigned *)((char *)ring->sq_ptr + p.sq_off.head);
+	ring->sq_tail = (unsigned *)((char *)ring->sq_ptr + p.sq_off.tail);
+	ring->sq_mask = (unsigned *)((char *)ring->sq_ptr +
+	    p.sq_off.ring_mask);
+	ring->sq_array = (unsigned *)((char *)ring->sq_ptr + p.sq_off.array);
+	ring->cq_head = (unsigned *)((char *)ring->cq_ptr + p.cq_off.head);
+	ring->cq_tail = (unsigned *)((char *)ring->cq_ptr + p.cq_off.tail);
+	ring->cq_mask = (unsigned *)((char *)ring->cq_ptr +
+	    p.cq_off.ring_mask);
+	ring->cqes = (struct io_uring_cqe *)((char *)ring->cq_ptr +
+	    p.cq_off.cqes);
+	ring->tail = *ring->sq_tail;
+
+	return (0);
+
+fail:
+	if (ring->sqes != NULL && ring->sqes != MAP_FAILED)
+		munmap(ring->sqes, ring->sqes_len);
+	if (ring->cq_len != 0 && ring->cq_ptr != NULL &&
+	    ring->cq_ptr != MAP_FAILED)
+		munmap(ring->cq_ptr, ring->cq_len);
+	if (ring->sq_ptr != NULL && ring->sq_ptr != MAP_FAILED)
+		munmap(ring->sq_ptr, ring->sq_len);
+	close(fd);
+	return (-1);
+}
+
+static void
+mduring_teardown(struct mduring_ring *ring)
+{
+
+	munmap(ring->sqes, ring->sqes_len);
+	if (ring->cq_len != 0)
+		munmap(ring->cq_ptr, ring->cq_len);
+	munmap(ring->sq_ptr, ring->sq_len);
+	close(ring->fd);
+}
+
+/*
+ * Check that the kernel knows every operation we queue.
+ */
+static int
+mduring_probe(struct mduring_ring *ring, int *fixed)
+{
+	static const int ops[] = { IORING_OP_OPENAT, IORING_OP_READ,
+	    IORING_OP_CLOSE };
+	struct io_uring_probe *probe;
+	size_t size;
+	size_t i;
+	int ok;
+
+	size = sizeof(*probe) + 256 * sizeof(struct io_uring_probe_op);
+	if ((probe = calloc(1, size)) == NULL)
+		return (0);
+	ok = syscall(__NR_io_uring_register, ring->fd, IORING_REGISTER_PROBE,
+	    probe, 256) == 0;
+	for (i = 0; ok && i < sizeof(ops) / sizeof(ops[0]); i++) {
+		ok = ops[i] <= probe->last_op &&
+		    (probe->ops[ops[i]].flags & IO_URING_OP_SUPPORTED);
+	}
+	*fixed = ok && IORING_OP_READ_FIXED <= probe->last_op &&
+	    (probe->ops[IORING_OP_READ_FIXED].flags & IO_URING_OP_SUPPORTED);
+	free(probe);
+
+	return (ok);
+}
+
+static struct io_uring_sqe *
+mduring_sqe(struct mduring_ring *ring, int op, unsigned slot)
+{
+	struct io_uring_sqe *sqe;
+	unsigned idx;
+
+	idx = ring->tail & *ring->sq_mask;
+	sqe = &ring->sqes[idx];
+	memset(sqe, 0, sizeof(*sqe));
+	sqe->opcode = op;
+	sqe->user_data = slot;
+	ring->sq_array[idx] = idx;
+	ring->tail++;
+	ring->queued++;
+
+	return (sqe);
+}
+
+/*
+ * Submit everything queued and wait for at least one completion.
+ */
+static int
+mduring_enter(struct mduring_ring *ring)
+{
+	long ret;
+
+	__atomic_store_n(ring->sq_tail, ring->tail, __ATOMIC_RELEASE);
+	do {
+		ret = syscall(__NR_io_uring_enter, ring->fd, ring->queued, 1,
+		    IORING_ENTER_GETEVENTS, NULL, 0);
+	} while (ret < 0 && errno == EINTR);
+	if (ret < 0)
+		return (-1);
+	ring->queued -= ret;
+
+	return (0);
+}
+
+static void
+mduring_queue_open(struct mduring_ring *ring, struct mduring_slot *s,
+    unsigned slot, const char *path)
+{
+	struct io_uring_sqe *sqe;
+
+	sqe = mduring_sqe(ring, IORING_OP_OPENAT, slot);
+	sqe->fd = AT_FDCWD;
+	sqe->addr = (uintptr_t)path;
+	sqe->open_flags = O_RDONLY;
+	s->state = MDURING_OPEN;
+}
+
+static void
+mduring_queue_read(struct mduring_ring *ring, struct mduring_slot *s,
+    unsigned slot, uint8_t *buf, size_t bufsize, int fixed)
+{
+	struct io_uring_sqe *sqe;
+
+	sqe = mduring_sqe(ring, fixed ? IORING_OP_READ_FIXED :
+	    IORING_OP_READ, slot);
+	sqe->fd = s->fd;
+	sqe->addr = (uintptr_t)buf;
+	sqe->len = bufsize;
+	/* Pipes are read from their current position. */
+	sqe->off = s->fd == STDIN_FILENO ? (uint64_t)-1 : s->off;
+	if (fixed)
+		sqe->buf_index = slot;
+	s->state = MDURING_READ;
+}
+
+static void
+mduring_queue_close(struct mduring_ring *ring, struct mduring_slot *s,
+    unsigned slot)
+{
+	struct io_uring_sqe *sqe;
+
+	sqe = mduring_sqe(ring, IORING_OP_CLOSE, slot);
+	sqe->fd = s->fd;
+	s->state = MDURING_CLOSE;
+}
+
+/*
+ * Give a free slot the next file, or mark it free if there is none.
+ */
+static void
+mduring_start(struct mduring_ring *ring, struct mduring_report *rep,
+    struct mduring_slot *slots, unsigned slot, size_t *next, uint8_t *bufs,
+    int fixed)
+{
+	struct mduring_slot *s;
+	size_t bufsize;
+
+	s = &slots[slot];
+	bufsize = rep->opts->bufsize;
+	if (*next == rep->n) {
+		s->index = SIZE_MAX;
+		return;
+	}
+	s->index = (*next)++;
+	s->off = 0;
+	mdfile_init(&s->ctx, rep->opts->algo);
+	if (strcmp(rep->results[s->index].path, "-") == 0) {
+		s->fd = STDIN_FILENO;
+		mduring_queue_read(ring, s, slot, bufs + slot * bufsize,
+		    bufsize, fixed);
+	} else
+		mduring_queue_open(ring, s, slot,
+		    rep->results[s->index].path);
+}
+
+static int
+mduring_hash_ring(struct mduring_report *rep, uint8_t *bufs)
+{
+	struct mduring_slot *slots;
+	struct mduring_slot *s;
+	struct mdfiles_result *r;
+	struct mduring_ring ring;
+	struct io_uring_cqe *cqe;
+	struct iovec *iov;
+	size_t bufsize;
+	size_t next;
+	unsigned depth;
+	unsigned head;
+	unsigned slot;
+	unsigned busy;
+	unsigned i;
+	int fixed;
+	int res;
+	int ret;
+
+	depth = rep->opts->depth;
+	bufsize = rep->opts->bufsize;
+	if (mduring_setup(&ring, depth) != 0)
+		return (-1);
+	if (!mduring_probe(&ring, &fixed)) {
+		mduring_teardown(&ring);
+		errno = ENOSYS;
+		return (-1);
+	}
+	if ((slots = calloc(depth, sizeof(*slots))) == NULL ||
+	    (iov = calloc(depth, sizeof(*iov))) == NULL) {
+		free(slots);
+		mduring_teardown(&ring);
+		return (-1);
+	}
+
+	/*
+	 * Registered buffers save the kernel mapping them for every read.
+	 * Without them, or if the memlock limit is too low, plain reads
+	 * into the same buffers work too.
+	 */
+	for (i = 0; i < depth; i++) {
+		iov[i].iov_base = bufs + i * bufsize;
+		iov[i].iov_len = bufsize;
+	}
+	if (fixed && syscall(__NR_io_uring_register, ring.fd,
+	    IORING_REGISTER_BUFFERS, iov, depth) != 0)
+		fixed = 0;
+
+	next = 0;
+	busy = 0;
+	for (i = 0; i < depth; i++) {
+		mduring_start(&ring, rep, slots, i, &next, bufs, fixed);
+		if (slots[i].index != SIZE_MAX)
+			busy++;
+	}
+
+	ret = 0;
+	while (busy != 0) {
+		if (mduring_enter(&ring) != 0) {
+			ret = -1;
+			break;
+		}
+		head = *ring.cq_head;
+		while (head != __atomic_load_n(ring.cq_tail, __ATOMIC_ACQUIRE)) {
+			cqe = &ring.cqes[head & *ring.cq_mask];
+			slot = cqe->user_data;
+			res = cqe->res;
+			head++;
+
+			s = &slots[slot];
+			r = &rep->results[s->index];
+			switch (s->state) {
+			case MDURING_OPEN:
+				if (res < 0) {
+					r->error = -res;
+					break;
+				}
+				s->fd = res;
+				mduring_queue_read(&ring, s, slot,
+				    bufs + slot * bufsize, bufsize, fixed);
+				continue;
+			case MDURING_READ:
+				if (res == -EINTR || res == -EAGAIN) {
+					mduring_queue_read(&ring, s, slot,
+					    bufs + slot * bufsize, bufsize,
+					    fixed);
+					continue;
+				}
+				if (res > 0) {
+					mdfile_update(&s->ctx,
+					    bufs + slot * bufsize, res);
+					s->off += res;
+					mduring_queue_read(&ring, s, slot,
+					    bufs + slot * bufsize, bufsize,
+					    fixed);
+					continue;
+				}
+				if (res < 0)
+					r->error = -res;
+				mdfile_final(r->digest, &s->ctx);
+				r->size = s->off;
+				if (s->fd != STDIN_FILENO) {
+					mduring_queue_close(&ring, s, slot);
+					continue;
+				}
+				break;
+			case MDURING_CLOSE:
+				break;
+			}
+
+			/* The file is done and its slot is free. */
+			mduring_report(rep, s->index);
+			busy--;
+			mduring_start(&ring, rep, slots, slot, &next, bufs,
+			    fixed);
+			if (s->index != SIZE_MAX)
+				busy++;
+		}
+		__atomic_store_n(ring.cq_head, head, __ATOMIC_RELEASE);
+	}
+
+	if (ret != 0) {
+		res = errno;
+		for (i = 0; i < depth; i++) {
+			if (slots[i].index != SIZE_MAX &&
+			    slots[i].state == MDURING_READ &&
+			    slots[i].fd != STDIN_FILENO)
+				close(slots[i].fd);
+		}
+		errno = res;
+	}
+	mduring_teardown(&ring);
+	free(iov);
+	free(slots);
+
+	return (ret);
+}
+
+#endif /* HAVE_IO_URING */
+
+/*
+ * Whether mduring_hash can use io_uring here.
+ */
+int
+mduring_available(void)
+{
+#ifdef HAVE_IO_URING
+	struct mduring_ring ring;
+	int fixed;
+	int ok;
+
+	if (mduring_setup(&ring, 1) != 0)
+		return (0);
+	ok = mduring_probe(&ring, &fixed);
+	mduring_teardown(&ring);
+
+	return (ok);
+#else
+
+	return (0);
+#endif
+}
+
+/*
+ * Hash n files and hand each result to fn. Returns the number of files
+ * that could not be hashed, or -1 if nothing could be set up.
+ */
+int
+mduring_hash(const char *const paths[], size_t n,
+    const struct mduring_opts *opts, mdfiles_fn *fn, void *arg)
+{
+	struct mduring_opts defaults;
+	struct mduring_report rep;
+	uint8_t *bufs;
+	size_t i;
+	int ret;
+
+	if (opts == NULL) {
+		mduring_opts_init(&defaults);
+		opts = &defaults;
+	}
+	if (opts->depth <= 0 || opts->depth > 4096 || opts->bufsize == 0 ||
+	    opts->bufsize > UINT32_MAX / opts->depth) {
+		errno = EINVAL;
+		return (-1);
+	}
+	if (n == 0)
+		return (0);
+
+	memset(&rep, 0, sizeof(rep));
+	rep.opts = opts;
+	rep.n = n;
+	rep.fn = fn;
+	rep.arg = arg;
+	rep.results = calloc(n, sizeof(*rep.results));
+	rep.done = calloc(n, 1);
+	if (posix_memalign((void **)&bufs, 4096,
+	    opts->depth * opts->bufsize) != 0)
+		bufs = NULL;
+	ret = -1;
+	if (rep.results == NULL || rep.done == NULL || bufs == NULL) {
+		errno = ENOMEM;
+		goto out;
+	}
+	for (i = 0; i < n; i++) {
+		rep.results[i].path = paths[i];
+		rep.results[i].index = i;
+	}
+
+	ret = -1;
+#ifdef HAVE_IO_URING
+	if (!opts->pread)
+		ret = mduring_hash_ring(&rep, bufs);
+#endif
+	/* Nothing has been reported if the ring could not be set up. */
+	if (ret != 0 && rep.nreported == 0)
+		ret = mduring_hash_pread(&rep, bufs);
+	if (ret == 0)
+		ret = rep.nfailed;
+
+out:
+	free(bufs);
+	free(rep.done);
+	free(rep.results);
+
+	return (ret);
+}
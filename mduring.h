@@ -0,0 +1,50 @@
+/*-
+ * Copyright (c) 2023, Collin Funk
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHORS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#ifndef CRYPTO_MDURING_H
+#define CRYPTO_MDURING_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include "mdfiles.h"
+
+#define MDURING_DEPTH 32
+#define MDURING_BUFSIZE (128 * 1024)
+
+struct mduring_opts {
+	int algo; /* MDFILE_MD5 or MDFILE_MD4 */
+	int depth; /* Files in flight at once */
+	size_t bufsize; /* Read size, one buffer per file in flight */
+	int ordered; /* Report in input order instead of as completed */
+	int pread; /* Use the pread loop even if io_uring works */
+};
+
+void mduring_opts_init(struct mduring_opts *);
+int mduring_available(void);
+int mduring_hash(const char *const [], size_t, const struct mduring_opts *,
+    mdfiles_fn *, void *);
+
+#endif /* CRYPTO_MDURING_H */
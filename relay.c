@@ -0,0 +1,135 @@
+/*-
+ * Copyright (c) 2023, Collin Funk
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHORS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * Copy standard input to standard output, like cat in the middle of a
+ * pipeline, and print the digest of what passed through on standard
+ * error in the format of md5sum, or to a file with -d. Sockets, pipes
+ * and files are spliced rather than copied where the kernel allows.
+ *
+ * usage: mdrelay [-v] [-a md5|md4] [-b bufsize] [-d file]
+ *            [-m auto|splice|copy]
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <errno.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "mdfile.h"
+#include "mdrelay.h"
+
+static void
+usage(void)
+{
+
+	fprintf(stderr, "usage: mdrelay [-v] [-a md5|md4] [-b bufsize] "
+	    "[-d file]\n"
+	    "               [-m auto|splice|copy]\n");
+	exit(1);
+}
+
+static uint64_t
+parse_size(const char *arg)
+{
+	uint64_t n;
+
+	if (mdfile_size(&n, arg, INT32_MAX) != 0 || n == 0)
+		usage();
+	return (n);
+}
+
+int
+main(int argc, char **argv)
+{
+	struct mdrelay_opts opts;
+	const char *dpath;
+	uint8_t digest[16];
+	uint64_t total;
+	FILE *fp;
+	int verbose;
+	int ret;
+	int ch;
+	int i;
+
+	mdrelay_opts_init(&opts);
+	dpath = NULL;
+	verbose = 0;
+	while ((ch = getopt(argc, argv, "a:b:d:m:v")) != -1) {
+		switch (ch) {
+		case 'a':
+			if ((opts.algo = mdfile_algo(optarg)) < 0)
+				usage();
+			break;
+		case 'b':
+			opts.bufsize = parse_size(optarg);
+			break;
+		case 'd':
+			dpath = optarg;
+			break;
+		case 'm':
+			if ((opts.method = mdrelay_method(optarg)) < 0)
+				usage();
+			break;
+		case 'v':
+			verbose = 1;
+			break;
+		default:
+			usage();
+		}
+	}
+	if (optind != argc)
+		usage();
+
+	ret = 0;
+	if (mdrelay(digest, STDIN_FILENO, STDOUT_FILENO, &opts, &total) != 0) {
+		fprintf(stderr, "mdrelay: %s\n", strerror(errno));
+		ret = 1;
+	}
+	if (verbose)
+		fprintf(stderr, "%llu bytes\n", (unsigned long long)total);
+	if (ret != 0)
+		return (ret);
+
+	if (dpath == NULL)
+		fp = stderr;
+	else if ((fp = fopen(dpath, "w")) == NULL) {
+		fprintf(stderr, "mdrelay: %s: %s\n", dpath, strerror(errno));
+		return (1);
+	}
+	for (i = 0; i < 16; i++)
+		fprintf(fp, "%02x", digest[i]);
+	fprintf(fp, "  -\n");
+	if (fp != stderr && fclose(fp) != 0) {
+		fprintf(stderr, "mdrelay: %s: %s\n", dpath, strerror(errno));
+		return (1);
+	}
+
+	return (0);
+}
@@ -0,0 +1,244 @@
+/*-
+ * Copyright (c) 2023, Collin Funk
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHORS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * rdiff style front end to mdsync: make a signature of a basis file, a
+ * delta of a new file against the signature, and rebuild the new file
+ * from the basis and the delta. A missing file or "-" is standard input
+ * or output. A patched file is written next to its final name and
+ * renamed into place once it has been checked, so the basis itself may
+ * be the output.
+ *
+ * usage: mdsync [-a md5|md4] [-b blocksize] signature basis [sigfile]
+ *        mdsync [-v] delta sigfile [newfile [deltafile]]
+ *        mdsync patch basis [deltafile [newfile]]
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "mdfile.h"
+#include "mdsync.h"
+
+static void
+usage(void)
+{
+
+	fprintf(stderr, "usage: mdsync [-a md5|md4] [-b blocksize] "
+	    "signature basis [sigfile]\n"
+	    "       mdsync [-v] delta sigfile [newfile [deltafile]]\n"
+	    "       mdsync patch basis [deltafile [newfile]]\n");
+	exit(1);
+}
+
+static uint32_t
+parse_blocksize(const char *arg)
+{
+	uint64_t n;
+
+	if (mdfile_size(&n, arg, MDSYNC_MAXBLOCK) != 0 ||
+	    n < MDSYNC_MINBLOCK)
+		usage();
+	return (n);
+}
+
+static int
+open_in(const char *name)
+{
+	int fd;
+
+	if (name == NULL || strcmp(name, "-") == 0)
+		return (STDIN_FILENO);
+	if ((fd = open(name, O_RDONLY)) < 0) {
+		fprintf(stderr, "mdsync: %s: %s\n", name, strerror(errno));
+		exit(1);
+	}
+	return (fd);
+}
+
+static int
+open_out(const char *name)
+{
+	int fd;
+
+	if (name == NULL || strcmp(name, "-") == 0)
+		return (STDOUT_FILENO);
+	if ((fd = open(name, O_WRONLY | O_CREAT | O_TRUNC, 0666)) < 0) {
+		fprintf(stderr, "mdsync: %s: %s\n", name, strerror(errno));
+		exit(1);
+	}
+	return (fd);
+}
+
+static void
+fail(const char *what)
+{
+
+	fprintf(stderr, "mdsync: %s: %s\n", what, strerror(errno));
+	exit(1);
+}
+
+static int
+signature(int algo, uint32_t blocksize, const char *basis, const char *out)
+{
+	struct mdsync_sig sig;
+	int fd;
+
+	fd = open_out(out);
+	if (mdsync_sig_fd(&sig, algo, blocksize, open_in(basis)) != 0)
+		fail(basis != NULL ? basis : "-");
+	if (mdsync_sig_write(&sig, mdsync_write_fd, &fd) != 0 ||
+	    close(fd) != 0)
+		fail(out != NULL ? out : "-");
+	mdsync_sig_free(&sig);
+	return (0);
+}
+
+static double
+now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (ts.tv_sec + ts.tv_nsec / 1e9);
+}
+
+static int
+delta(const char *sigfile, const char *newfile, const char *out, int verbose)
+{
+	struct mdsync_sig sig;
+	struct mdsync_delta d;
+	uint8_t *buf;
+	double t0;
+	ssize_t n;
+	int ofd;
+	int fd;
+
+	if (mdsync_sig_read(&sig, open_in(sigfile)) != 0)
+		fail(sigfile);
+	fd = open_in(newfile);
+	ofd = open_out(out);
+	if ((buf = malloc(MDFILE_BUFSIZE)) == NULL)
+		fail("malloc");
+	t0 = now();
+	if (mdsync_delta_init(&d, &sig, mdsync_write_fd, &ofd) != 0)
+		fail(out != NULL ? out : "-");
+	while ((n = mdfile_read(fd, buf, MDFILE_BUFSIZE)) > 0) {
+		if (mdsync_delta_update(&d, buf, n) != 0)
+			fail(out != NULL ? out : "-");
+	}
+	if (n < 0)
+		fail(newfile != NULL ? newfile : "-");
+	if (mdsync_delta_final(&d) != 0 || close(ofd) != 0)
+		fail(out != NULL ? out : "-");
+
+	if (verbose) {
+		fprintf(stderr, "%llu bytes, %llu blocks of %u matched, "
+		    "%llu literal bytes, %.1f MB/s\n",
+		    (unsigned long long)d.size, (unsigned long long)d.matched,
+		    sig.blocksize, (unsigned long long)d.literal,
+		    d.size / (now() - t0) / 1e6);
+	}
+	free(buf);
+	mdsync_sig_free(&sig);
+	return (0);
+}
+
+static int
+patch(const char *basis, const char *deltafile, const char *out)
+{
+	char *tmp;
+	int ofd;
+
+	if (out == NULL || strcmp(out, "-") == 0) {
+		ofd = STDOUT_FILENO;
+		if (mdsync_patch(open_in(basis), open_in(deltafile),
+		    mdsync_write_fd, &ofd) != 0)
+			fail(deltafile != NULL ? deltafile : "-");
+		return (0);
+	}
+
+	if ((tmp = malloc(strlen(out) + 5)) == NULL)
+		fail("malloc");
+	sprintf(tmp, "%s.tmp", out);
+	ofd = open_out(tmp);
+	if (mdsync_patch(open_in(basis), open_in(deltafile), mdsync_write_fd,
+	    &ofd) != 0 || close(ofd) != 0 || rename(tmp, out) != 0) {
+		fprintf(stderr, "mdsync: %s: %s\n", out, strerror(errno));
+		unlink(tmp);
+		exit(1);
+	}
+	free(tmp);
+	return (0);
+}
+
+int
+main(int argc, char **argv)
+{
+	uint32_t blocksize;
+	int verbose;
+	int algo;
+	int ch;
+
+	algo = MDFILE_MD5;
+	blocksize = 0;
+	verbose = 0;
+	while ((ch = getopt(argc, argv, "a:b:v")) != -1) {
+		switch (ch) {
+		case 'a':
+			if ((algo = mdfile_algo(optarg)) < 0)
+				usage();
+			break;
+		case 'b':
+			blocksize = parse_blocksize(optarg);
+			break;
+		case 'v':
+			verbose = 1;
+			break;
+		default:
+			usage();
+		}
+	}
+	argc -= optind;
+	argv += optind;
+
+	if (argc >= 2 && argc <= 3 && strcmp(argv[0], "signature") == 0)
+		return (signature(algo, blocksize, argv[1], argv[2]));
+	if (argc >= 2 && argc <= 4 && strcmp(argv[0], "delta") == 0)
+		return (delta(argv[1], argv[2], argc > 3 ? argv[3] : NULL,
+		    verbose));
+	if (argc >= 2 && argc <= 4 && strcmp(argv[0], "patch") == 0)
+		return (patch(argv[1], argv[2], argc > 3 ? argv[3] : NULL));
+	usage();
+	return (1);
+}
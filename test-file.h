@@ -0,0 +1,84 @@
+/*-
+ * Copyright (c) 2023, Collin Funk
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHORS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+/*
+ * Fixtures shared by the tests of the file layer. Include after defining
+ * _POSIX_C_SOURCE.
+ */
+
+#ifndef CRYPTO_TEST_FILE_H
+#define CRYPTO_TEST_FILE_H
+
+#include <sys/types.h>
+
+#include <fcntl.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <unistd.h>
+
+#include "md4.h"
+#include "md5.h"
+#include "mdfile.h"
+
+/*
+ * The one-shot digest of data with algo, to check the others against.
+ */
+static inline void
+digest_ref(uint8_t digest[16], int algo, const void *data, size_t len)
+{
+
+	if (algo == MDFILE_MD4)
+		md4_digest(digest, data, len);
+	else
+		md5_digest(digest, data, len);
+}
+
+/*
+ * Create or truncate path and write len bytes of data to it. Returns 0,
+ * or -1 after printing why.
+ */
+static inline int
+write_file(const char *path, const uint8_t *data, size_t len)
+{
+	int fd;
+
+	if ((fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0600)) < 0) {
+		perror(path);
+		return (-1);
+	}
+	if (write(fd, data, len) != (ssize_t)len) {
+		perror(path);
+		close(fd);
+		return (-1);
+	}
+	if (close(fd) != 0) {
+		perror(path);
+		return (-1);
+	}
+	return (0);
+}
+
+#endif /* CRYPTO_TEST_FILE_H */
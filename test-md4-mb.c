@@ -0,0 +1,311 @@
+/*-
+ * Copyright (c) 2023, Collin Funk
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHORS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "md4.h"
+#include "md4-mb.h"
+#include "test.h"
+
+#define NJOBS 200
+
+static void
+md4_ref(uint8_t digest[16], const void *data, size_t len)
+{
+	struct md4_ctx ctx;
+
+	md4_init(&ctx);
+	md4_update(&ctx, data, len);
+	md4_final(digest, &ctx);
+}
+
+/*
+ * RFC 1320 vectors, all in flight at once.
+ */
+static int
+test_vectors(void)
+{
+	static const char *msgs[7] = {
+		"",
+		"a",
+		"abc",
+		"message digest",
+		"abcdefghijklmnopqrstuvwxyz",
+		"ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789",
+		"1234567890123456789012345678901234"
+		"5678901234567890123456789012345678901234567890"
+	};
+	static const char *expected[7] = {
+		"\x31\xd6\xcf\xe0\xd1\x6a\xe9\x31\xb7\x3c\x59\xd7\xe0\xc0\x89\xc0",
+		"\xbd\xe5\x2c\xb3\x1d\xe3\x3e\x46\x24\x5e\x05\xfb\xdb\xd6\xfb\x24",
+		"\xa4\x48\x01\x7a\xaf\x21\xd8\x52\x5f\xc1\x0a\xe8\x7a\xa6\x72\x9d",
+		"\xd9\x13\x0a\x81\x64\x54\x9f\xe8\x18\x87\x48\x06\xe1\xc7\x01\x4b",
+		"\xd7\x9e\x1c\x30\x8a\xa5\xbb\xcd\xee\xa8\xed\x63\xdf\x41\x2d\xa9",
+		"\x04\x3f\x85\x82\xf2\x41\xdb\x35\x1c\xe6\x27\xe1\x53\xe7\xf0\xe4",
+		"\xe3\x3b\x4d\xdc\x9c\x38\xf2\x19\x9c\x3e\x7b\x16\x4f\xcc\x05\x36"
+	};
+	struct md4_mb_job jobs[7];
+	int i;
+
+	for (i = 0; i < 7; i++) {
+		jobs[i].data = msgs[i];
+		jobs[i].len = strlen(msgs[i]);
+	}
+	jobs[0].data = NULL; /* An empty job need not point anywhere. */
+	md4_mb_digest(jobs, 7);
+
+	for (i = 0; i < 7; i++) {
+		printf("Digest #%02d: ", i + 1);
+		for (int j = 0; j < 16; ++j)
+			printf("%02x", jobs[i].digest[j]);
+		printf("\n");
+
+		if (memcmp(jobs[i].digest, expected[i], 16) != 0) {
+			fprintf(stderr, "Test %d failed.\n", i + 1);
+			return 1;
+		}
+	}
+
+	return 0;
+}
+
+/*
+ * Random lengths through submit/flush, compared with md4_update.
+ */
+static int
+test_random_jobs(const uint8_t *buf, size_t bufsize)
+{
+	struct md4_mb_mgr mgr;
+	struct md4_mb_job jobs[NJOBS];
+	struct md4_mb_job *job;
+	uint8_t digest[16];
+	size_t seen;
+	size_t i;
+
+	for (i = 0; i < NJOBS; i++) {
+		if (rng() % 8 == 0)
+			jobs[i].len = rng() % bufsize;
+		else
+			jobs[i].len = rng() % 300;
+		jobs[i].data = &buf[rng() % (bufsize - jobs[i].len + 1)];
+		jobs[i].user = &jobs[i];
+	}
+
+	seen = 0;
+	md4_mb_init(&mgr);
+	for (i = 0; i < NJOBS; i++) {
+		if ((job = md4_mb_submit(&mgr, &jobs[i])) != NULL)
+			seen++;
+	}
+	while ((job = md4_mb_flush(&mgr)) != NULL) {
+		if (job->user != job) {
+			fprintf(stderr, "Job cookie clobbered.\n");
+			return 1;
+		}
+		seen++;
+	}
+	if (seen != NJOBS) {
+		fprintf(stderr, "Returned %zu of %d jobs.\n", seen, NJOBS);
+		return 1;
+	}
+
+	for (i = 0; i < NJOBS; i++) {
+		md4_ref(digest, jobs[i].data, jobs[i].len);
+		if (memcmp(digest, jobs[i].digest, 16) != 0) {
+			fprintf(stderr, "Job %zu (%zu bytes) failed.\n", i,
+			    jobs[i].len);
+			return 1;
+		}
+	}
+
+	printf("Random jobs: ok\n");
+	return 0;
+}
+
+/*
+ * Batched context updates in random chunks, compared with md4_update.
+ */
+static int
+test_random_update(const uint8_t *buf, size_t bufsize)
+{
+	struct md4_ctx ctxs[NJOBS];
+	struct md4_ctx refs[NJOBS];
+	struct md4_ctx *ctxp[NJOBS];
+	const void *data[NJOBS];
+	size_t len[NJOBS];
+	uint8_t digest[16];
+	uint8_t expected[16];
+	int round;
+	size_t i;
+
+	for (i = 0; i < NJOBS; i++) {
+		md4_init(&ctxs[i]);
+		md4_init(&refs[i]);
+		ctxp[i] = &ctxs[i];
+	}
+
+	for (round = 0; round < 8; round++) {
+		for (i = 0; i < NJOBS; i++) {
+			len[i] = rng() % ((rng() % 4 == 0) ? 4096 : 100);
+			data[i] = &buf[rng() % (bufsize - len[i] + 1)];
+			md4_update(&refs[i], data[i], len[i]);
+		}
+		md4_mb_update(ctxp, data, len, NJOBS);
+	}
+
+	for (i = 0; i < NJOBS; i++) {
+		md4_final(digest, &ctxs[i]);
+		md4_final(expected, &refs[i]);
+		if (memcmp(digest, expected, 16) != 0) {
+			fprintf(stderr, "Context %zu failed.\n", i);
+			return 1;
+		}
+	}
+
+	printf("Random updates: ok\n");
+	return 0;
+}
+
+/*
+ * Whole blocks from random starting states, compared with md4_transform.
+ */
+static int
+test_random_transform(const uint8_t *buf, size_t bufsize)
+{
+	struct md4_ctx ctxs[NJOBS];
+	struct md4_ctx *ctxp[NJOBS];
+	uint32_t start[NJOBS][4];
+	const void *data[NJOBS];
+	size_t len[NJOBS];
+	const uint8_t *p;
+	size_t i;
+	size_t j;
+	int k;
+
+	for (i = 0; i < NJOBS; i++) {
+		md4_init(&ctxs[i]);
+		for (k = 0; k < 4; k++)
+			start[i][k] = ctxs[i].state[k] = rng();
+		ctxp[i] = &ctxs[i];
+		len[i] = 64 * (rng() % 64);
+		data[i] = &buf[rng() % (bufsize - len[i] + 1)];
+	}
+	md4_mb_update(ctxp, data, len, NJOBS);
+
+	for (i = 0; i < NJOBS; i++) {
+		p = data[i];
+		for (j = 0; j < len[i]; j += 64)
+			md4_transform(start[i], &p[j]);
+		if (memcmp(start[i], ctxs[i].state, sizeof(start[i])) != 0) {
+			fprintf(stderr, "Transform %zu (%zu blocks) failed.\n",
+			    i, len[i] / 64);
+			return 1;
+		}
+	}
+
+	printf("Random transforms: ok\n");
+	return 0;
+}
+
+/*
+ * Batched NT hashes of short and long ASCII, other UTF-8 and malformed
+ * passwords, compared with md4_nthash.
+ */
+static int
+test_random_nthash(void)
+{
+	static char pw[NJOBS][64];
+	const void *pwp[NJOBS];
+	size_t len[NJOBS];
+	uint8_t digests[NJOBS][16];
+	uint8_t expected[16];
+	size_t nbad;
+	size_t i;
+	size_t j;
+
+	nbad = 0;
+	for (i = 0; i < NJOBS; i++) {
+		len[i] = rng() % ((rng() % 4 == 0) ? 60 : 28);
+		for (j = 0; j < len[i]; j++)
+			pw[i][j] = 0x20 + rng() % 95;
+		if (rng() % 8 == 0 && len[i] >= 2) {
+			/* U+00E9, or half of it. */
+			pw[i][0] = 0xc3;
+			pw[i][1] = 0xa9;
+			if (rng() % 2 == 0) {
+				pw[i][1] = 'x';
+				nbad++;
+			}
+		}
+		pwp[i] = pw[i];
+	}
+
+	if (md4_mb_nthash(digests, pwp, len, NJOBS) != nbad) {
+		fprintf(stderr, "Wrong count of bad passwords.\n");
+		return 1;
+	}
+	for (i = 0; i < NJOBS; i++) {
+		if (md4_nthash(expected, pw[i], len[i]) != 0)
+			memset(expected, 0, sizeof(expected));
+		if (memcmp(digests[i], expected, 16) != 0) {
+			fprintf(stderr, "NT hash %zu (%zu bytes) failed.\n", i,
+			    len[i]);
+			return 1;
+		}
+	}
+
+	printf("Random NT hashes: ok\n");
+	return 0;
+}
+
+int
+main(void)
+{
+	uint8_t *buf;
+	size_t bufsize;
+	size_t i;
+
+	bufsize = 1 << 16;
+	if ((buf = malloc(bufsize)) == NULL)
+		exit(1);
+	for (i = 0; i < bufsize; i++)
+		buf[i] = rng() & 0xff;
+
+	if (test_vectors() != 0)
+		exit(1);
+	if (test_random_jobs(buf, bufsize) != 0)
+		exit(1);
+	if (test_random_update(buf, bufsize) != 0)
+		exit(1);
+	if (test_random_transform(buf, bufsize) != 0)
+		exit(1);
+	if (test_random_nthash() != 0)
+		exit(1);
+
+	free(buf);
+	return 0;
+}
@@ -23,6 +23,8 @@
  * SUCH DAMAGE.
  */
 
+#include <sys/uio.h>
+
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -34,11 +36,14 @@ md4_test(const char *message, const char *expected, int number)
 {
 	struct md4_ctx ctx;
 	uint8_t digest[16];
+	uint8_t oneshot[16];
 
 	md4_init(&ctx);
 	md4_update(&ctx, message, strlen(message));
 	md4_final(digest, &ctx);
 
+	md4_digest(oneshot, message, strlen(message));
+
 	printf("Digest #%02d: ", number);
 	for (int i = 0; i < 16; ++i)
 		printf("%02x", digest[i]);
@@ -48,6 +53,344 @@ md4_test(const char *message, const char *expected, int number)
 		fprintf(stderr, "Test %d failed.\n", number);
 		return 1;
 	}
+	if (memcmp(oneshot, expected, 16) != 0) {
+		fprintf(stderr, "Test %d failed for md4_digest.\n", number);
+		return 1;
+	}
+
+	return 0;
+}
+
+/*
+ * One million repetitions of "a" in a single md4_update, so nearly all
+ * of it goes through md4_transform_blocks at once.
+ */
+static int
+md4_test_million(void)
+{
+	static const char expected[16] = "\xbb\xce\x80\xcc\x6b\xb6\x5e\x5c"
+	    "\x67\x45\xe3\x0d\x4e\xec\xa9\xa4";
+	struct md4_ctx ctx;
+	uint8_t digest[16];
+	char *message;
+
+	if ((message = malloc(1000000)) == NULL)
+		return 1;
+	memset(message, 'a', 1000000);
+
+	md4_init(&ctx);
+	md4_update(&ctx, message, 1000000);
+	md4_final(digest, &ctx);
+	free(message);
+
+	if (memcmp(digest, expected, 16) != 0) {
+		fprintf(stderr, "Million test failed.\n");
+		return 1;
+	}
+
+	return 0;
+}
+
+/*
+ * Every kernel the CPU supports must match md4_transform with the
+ * generic kernel, one block at a time or many blocks per call.
+ */
+static int
+md4_test_kernels(void)
+{
+	static const char *names[] = { "generic", "le", "ilp", "bmi" };
+	uint32_t expected[4];
+	uint32_t state[4];
+	uint8_t data[64 * 9];
+	size_t i;
+
+	for (i = 0; i < sizeof(data); i++)
+		data[i] = (i * 131 + 7) & 0xff;
+
+	md4_transform_select("generic");
+	expected[0] = 0x67452301;
+	expected[1] = 0xefcdab89;
+	expected[2] = 0x98badcfe;
+	expected[3] = 0x10325476;
+	for (i = 0; i < 9; i++)
+		md4_transform(expected, &data[i * 64]);
+
+	for (i = 0; i < sizeof(names) / sizeof(names[0]); i++) {
+		if (md4_transform_select(names[i]) != 0)
+			continue;
+		state[0] = 0x67452301;
+		state[1] = 0xefcdab89;
+		state[2] = 0x98badcfe;
+		state[3] = 0x10325476;
+		md4_transform_blocks(state, data, 4);
+		md4_transform(state, &data[4 * 64]);
+		md4_transform_blocks(state, &data[5 * 64], 4);
+		md4_transform_blocks(state, data, 0);
+
+		printf("Kernel %s: ", md4_transform_name());
+		if (memcmp(state, expected, sizeof(state)) != 0) {
+			printf("failed\n");
+			return 1;
+		}
+		printf("ok\n");
+	}
+
+	return 0;
+}
+
+/*
+ * md4_digest against a context for every length that changes how the
+ * final blocks are padded.
+ */
+static int
+md4_test_digest(void)
+{
+	struct md4_ctx ctx;
+	uint8_t data[300];
+	uint8_t digest[16];
+	uint8_t oneshot[16];
+	size_t len;
+
+	for (len = 0; len < sizeof(data); len++)
+		data[len] = (len * 7 + 3) & 0xff;
+
+	for (len = 0; len <= sizeof(data); len++) {
+		md4_init(&ctx);
+		md4_update(&ctx, data, len);
+		md4_final(digest, &ctx);
+		md4_digest(oneshot, data, len);
+		if (memcmp(digest, oneshot, 16) != 0) {
+			fprintf(stderr, "md4_digest failed at %zu bytes.\n",
+			    len);
+			return 1;
+		}
+	}
+
+	return 0;
+}
+
+/*
+ * Export a context at every split point, import it into a fresh one and
+ * finish hashing there. A damaged export must be refused.
+ */
+static int
+md4_test_export(void)
+{
+	struct md4_ctx ctx;
+	uint8_t blob[MD4_EXPORT_SIZE];
+	uint8_t data[200];
+	uint8_t digest[16];
+	uint8_t expected[16];
+	size_t split;
+
+	for (split = 0; split < sizeof(data); split++)
+		data[split] = (split * 13 + 5) & 0xff;
+	md4_digest(expected, data, sizeof(data));
+
+	for (split = 0; split <= sizeof(data); split++) {
+		md4_init(&ctx);
+		md4_update(&ctx, data, split);
+		md4_export(blob, &ctx);
+		memset(&ctx, 0xa5, sizeof(ctx));
+		if (md4_import(&ctx, blob) != 0) {
+			fprintf(stderr, "md4_import refused %zu bytes.\n",
+			    split);
+			return 1;
+		}
+		md4_update(&ctx, data + split, sizeof(data) - split);
+		md4_final(digest, &ctx);
+		if (memcmp(digest, expected, 16) != 0) {
+			fprintf(stderr, "md4_export failed at %zu bytes.\n",
+			    split);
+			return 1;
+		}
+	}
+
+	blob[0] ^= 1;
+	if (md4_import(&ctx, blob) == 0) {
+		fprintf(stderr, "md4_import took a bad magic.\n");
+		return 1;
+	}
+	blob[0] ^= 1;
+	blob[MD4_EXPORT_SIZE - 1] = 1;
+	if (md4_import(&ctx, blob) == 0) {
+		fprintf(stderr, "md4_import took stray buffer bytes.\n");
+		return 1;
+	}
+
+	return 0;
+}
+
+/*
+ * Hash a prefix of every length once, then finish copies of it with two
+ * different suffixes.
+ */
+static int
+md4_test_copy(void)
+{
+	struct md4_ctx prefix;
+	struct md4_ctx ctx;
+	uint8_t data[200];
+	uint8_t digest[16];
+	uint8_t expected[16];
+	size_t split;
+	int i;
+
+	for (split = 0; split < sizeof(data); split++)
+		data[split] = (split * 7 + 3) & 0xff;
+
+	for (split = 0; split <= 150; split++) {
+		md4_init(&prefix);
+		md4_update(&prefix, data, split);
+		for (i = 0; i < 2; i++) {
+			memset(&ctx, 0xa5, sizeof(ctx));
+			md4_ctx_copy(&ctx, &prefix);
+			md4_update(&ctx, data + split, 25 * (i + 1));
+			md4_final(digest, &ctx);
+			md4_digest(expected, data, split + 25 * (i + 1));
+			if (memcmp(digest, expected, 16) != 0) {
+				fprintf(stderr, "md4_ctx_copy failed at %zu "
+				    "bytes.\n", split);
+				return 1;
+			}
+		}
+	}
+
+	return 0;
+}
+
+/*
+ * NT hashes of ASCII and other UTF-8 passwords, compared with md4_digest
+ * of the UTF-16LE form, plus two well known values. Malformed UTF-8 must
+ * be refused.
+ */
+static int
+md4_test_nthash(void)
+{
+	static const struct {
+		const char *utf8;
+		const char *utf16;
+		size_t len16;
+	} v[4] = {
+		{ "\xc3\x9cn\xc3\xaf" "c\xc3\xb6" "d\xc3\xa9",
+		    "\xdc\0n\0\xef\0c\0\xf6\0d\0\xe9\0", 14 },
+		{ "\xf0\x9f\x94\x91key", "\x3d\xd8\x11\xddk\0e\0y\0", 10 },
+		{ "\xe2\x82\xac", "\xac\x20", 2 },
+		/* A surrogate pair across the end of the first block. */
+		{ "aaaaaaaaaaaaaaaaaaaaaaaaaaaaaaa\xf0\x9f\x94\x91",
+		    "a\0a\0a\0a\0a\0a\0a\0a\0a\0a\0a\0a\0a\0a\0a\0a\0"
+		    "a\0a\0a\0a\0a\0a\0a\0a\0a\0a\0a\0a\0a\0a\0a\0"
+		    "\x3d\xd8\x11\xdd", 66 },
+	};
+	static const char *bad[5] = {
+		"\xc0\x80", "\xed\xa0\x80", "\xe2\x82", "\xff", "ok\x80"
+	};
+	uint8_t wide[100];
+	uint8_t digest[16];
+	uint8_t expected[16];
+	char pw[50];
+	size_t len;
+	size_t i;
+
+	md4_nthash(digest, "", 0);
+	if (memcmp(digest, "\x31\xd6\xcf\xe0\xd1\x6a\xe9\x31"
+	    "\xb7\x3c\x59\xd7\xe0\xc0\x89\xc0", 16) != 0) {
+		fprintf(stderr, "NT hash of the empty password failed.\n");
+		return 1;
+	}
+	md4_nthash(digest, "password", 8);
+	if (memcmp(digest, "\x88\x46\xf7\xea\xee\x8f\xb1\x17"
+	    "\xad\x06\xbd\xd8\x30\xb7\x58\x6c", 16) != 0) {
+		fprintf(stderr, "NT hash of \"password\" failed.\n");
+		return 1;
+	}
+
+	for (len = 0; len < sizeof(pw); len++) {
+		for (i = 0; i < len; i++) {
+			pw[i] = 0x20 + (i * 37 + len) % 95;
+			wide[2 * i] = pw[i];
+			wide[2 * i + 1] = 0;
+		}
+		if (md4_nthash(digest, pw, len) != 0) {
+			fprintf(stderr, "NT hash refused %zu characters.\n",
+			    len);
+			return 1;
+		}
+		md4_digest(expected, wide, 2 * len);
+		if (memcmp(digest, expected, 16) != 0) {
+			fprintf(stderr, "NT hash of %zu characters failed.\n",
+			    len);
+			return 1;
+		}
+	}
+
+	for (i = 0; i < 4; i++) {
+		if (md4_nthash(digest, v[i].utf8, strlen(v[i].utf8)) != 0) {
+			fprintf(stderr, "NT hash refused string %zu.\n", i);
+			return 1;
+		}
+		md4_digest(expected, v[i].utf16, v[i].len16);
+		if (memcmp(digest, expected, 16) != 0) {
+			fprintf(stderr, "NT hash of string %zu failed.\n", i);
+			return 1;
+		}
+	}
+
+	for (i = 0; i < 5; i++) {
+		if (md4_nthash(digest, bad[i], strlen(bad[i])) == 0) {
+			fprintf(stderr, "NT hash took bad UTF-8 %zu.\n", i);
+			return 1;
+		}
+	}
+
+	return 0;
+}
+
+/*
+ * Hash data through md4_updatev in fragments of 0 to 130 bytes, after
+ * each possible number of bytes already buffered.
+ */
+static int
+md4_test_updatev(void)
+{
+	struct md4_ctx ctx;
+	struct iovec iov[64];
+	uint8_t data[1000];
+	uint8_t digest[16];
+	uint8_t expected[16];
+	uint32_t seed;
+	size_t off;
+	size_t pre;
+	int n;
+
+	for (off = 0; off < sizeof(data); off++)
+		data[off] = (off * 11 + 7) & 0xff;
+	md4_digest(expected, data, sizeof(data));
+
+	seed = 1;
+	for (pre = 0; pre < 64; pre++) {
+		md4_init(&ctx);
+		md4_update(&ctx, data, pre);
+		off = pre;
+		while (off < sizeof(data)) {
+			for (n = 0; n < 64 && off < sizeof(data); n++) {
+				seed = seed * 1103515245 + 12345;
+				iov[n].iov_base = &data[off];
+				iov[n].iov_len = (seed >> 16) % 131;
+				if (iov[n].iov_len > sizeof(data) - off)
+					iov[n].iov_len = sizeof(data) - off;
+				off += iov[n].iov_len;
+			}
+			md4_updatev(&ctx, iov, n);
+		}
+		md4_updatev(&ctx, iov, 0);
+		md4_final(digest, &ctx);
+		if (memcmp(digest, expected, 16) != 0) {
+			fprintf(stderr, "md4_updatev failed after %zu "
+			    "bytes.\n", pre);
+			return 1;
+		}
+	}
 
 	return 0;
 }
@@ -103,6 +446,20 @@ main(void)
 		exit(1);
 	if (md4_test(test_msg7, expected7, 7) != 0)
 		exit(1);
+	if (md4_test_million() != 0)
+		exit(1);
+	if (md4_test_digest() != 0)
+		exit(1);
+	if (md4_test_kernels() != 0)
+		exit(1);
+	if (md4_test_export() != 0)
+		exit(1);
+	if (md4_test_copy() != 0)
+		exit(1);
+	if (md4_test_updatev() != 0)
+		exit(1);
+	if (md4_test_nthash() != 0)
+		exit(1);
 
 	return 0;
 }
@@ -0,0 +1,197 @@
+/*-
+ * Copyright (c) 2023, Collin Funk
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHORS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "md5.h"
+#include "md5-hmac.h"
+#include "test.h"
+
+#define NMSG 300
+#define NKEY 5
+
+/*
+ * HMAC-MD5 vectors from RFC 2202.
+ */
+static int
+test_vectors(void)
+{
+	static const struct {
+		uint8_t fill; /* Key byte, or 0 for the key below */
+		size_t keylen;
+		const char *key;
+		uint8_t datafill; /* Data byte, or 0 for the data below */
+		size_t datalen;
+		const char *data;
+		const char *tag;
+	} v[7] = {
+		{ 0x0b, 16, NULL, 0, 8, "Hi There",
+		    "\x92\x94\x72\x7a\x36\x38\xbb\x1c"
+		    "\x13\xf4\x8e\xf8\x15\x8b\xfc\x9d" },
+		{ 0, 4, "Jefe", 0, 28, "what do ya want for nothing?",
+		    "\x75\x0c\x78\x3e\x6a\xb0\xb5\x03"
+		    "\xea\xa8\x6e\x31\x0a\x5d\xb7\x38" },
+		{ 0xaa, 16, NULL, 0xdd, 50, NULL,
+		    "\x56\xbe\x34\x52\x1d\x14\x4c\x88"
+		    "\xdb\xb8\xc7\x33\xf0\xe8\xb3\xf6" },
+		{ 0, 25, "\x01\x02\x03\x04\x05\x06\x07\x08\x09\x0a\x0b\x0c"
+		    "\x0d\x0e\x0f\x10\x11\x12\x13\x14\x15\x16\x17\x18\x19",
+		    0xcd, 50, NULL,
+		    "\x69\x7e\xaf\x0a\xca\x3a\x3a\xea"
+		    "\x3a\x75\x16\x47\x46\xff\xaa\x79" },
+		{ 0x0c, 16, NULL, 0, 20, "Test With Truncation",
+		    "\x56\x46\x1e\xf2\x34\x2e\xdc\x00"
+		    "\xf9\xba\xb9\x95\x69\x0e\xfd\x4c" },
+		{ 0xaa, 80, NULL, 0, 54,
+		    "Test Using Larger Than Block-Size Key - Hash Key First",
+		    "\x6b\x1a\xb7\xfe\x4b\xd7\xbf\x8f"
+		    "\x0b\x62\xe6\xce\x61\xb9\xd0\xcd" },
+		{ 0xaa, 80, NULL, 0, 73,
+		    "Test Using Larger Than Block-Size Key and Larger "
+		    "Than One Block-Size Data",
+		    "\x6f\x63\x0f\xad\x67\xcd\xa0\xee"
+		    "\x1f\xb1\xf5\x62\xdb\x3a\xa5\x3e" },
+	};
+	struct md5_hmac_key hk;
+	uint8_t key[80];
+	uint8_t data[80];
+	uint8_t tag[16];
+	int i;
+	int j;
+
+	for (i = 0; i < 7; i++) {
+		if (v[i].key != NULL)
+			memcpy(key, v[i].key, v[i].keylen);
+		else
+			memset(key, v[i].fill, v[i].keylen);
+		if (v[i].data != NULL)
+			memcpy(data, v[i].data, v[i].datalen);
+		else
+			memset(data, v[i].datafill, v[i].datalen);
+
+		md5_hmac_init(&hk, key, v[i].keylen);
+		md5_hmac(tag, &hk, data, v[i].datalen);
+
+		printf("HMAC #%02d: ", i + 1);
+		for (j = 0; j < 16; j++)
+			printf("%02x", tag[j]);
+		printf("\n");
+
+		if (memcmp(tag, v[i].tag, 16) != 0) {
+			fprintf(stderr, "Test %d failed.\n", i + 1);
+			return 1;
+		}
+		if (!md5_hmac_verify(&hk, data, v[i].datalen, tag, 16) ||
+		    !md5_hmac_verify(&hk, data, v[i].datalen, tag, 12)) {
+			fprintf(stderr, "Test %d did not verify.\n", i + 1);
+			return 1;
+		}
+		tag[15] ^= 1;
+		if (md5_hmac_verify(&hk, data, v[i].datalen, tag, 16) ||
+		    md5_hmac_verify(&hk, data, v[i].datalen, tag, 8)) {
+			fprintf(stderr, "Test %d took a bad tag.\n", i + 1);
+			return 1;
+		}
+		md5_hmac_clear(&hk);
+	}
+
+	return 0;
+}
+
+/*
+ * Random messages under a few keys, batched and one at a time.
+ */
+static int
+test_batch(const uint8_t *buf, size_t bufsize)
+{
+	static uint8_t tags[NMSG][16];
+	struct md5_hmac_key keys[NKEY];
+	const struct md5_hmac_key *keyp[NMSG];
+	const void *data[NMSG];
+	size_t len[NMSG];
+	uint8_t tag[16];
+	int ok[NMSG];
+	size_t nok;
+	size_t i;
+
+	for (i = 0; i < NKEY; i++)
+		md5_hmac_init(&keys[i], &buf[i * 100], i * 30);
+	for (i = 0; i < NMSG; i++) {
+		keyp[i] = &keys[rng() % NKEY];
+		len[i] = rng() % ((rng() % 4 == 0) ? 4096 : 200);
+		data[i] = &buf[rng() % (bufsize - len[i] + 1)];
+	}
+
+	md5_hmac_batch(tags, keyp, data, len, NMSG);
+	for (i = 0; i < NMSG; i++) {
+		md5_hmac(tag, keyp[i], data[i], len[i]);
+		if (memcmp(tag, tags[i], 16) != 0) {
+			fprintf(stderr, "Message %zu (%zu bytes) failed.\n", i,
+			    len[i]);
+			return 1;
+		}
+	}
+
+	for (i = 0; i < NMSG; i += 7)
+		tags[i][i % 16] ^= 0x80;
+	nok = md5_hmac_verify_batch(ok, keyp, data, len, tags, NMSG);
+	for (i = 0; i < NMSG; i++) {
+		if (ok[i] != (i % 7 != 0)) {
+			fprintf(stderr, "Verify of message %zu failed.\n", i);
+			return 1;
+		}
+	}
+	if (nok != NMSG - (NMSG + 6) / 7) {
+		fprintf(stderr, "Verified %zu messages.\n", nok);
+		return 1;
+	}
+
+	printf("Batches: ok\n");
+	return 0;
+}
+
+int
+main(void)
+{
+	uint8_t *buf;
+	size_t bufsize;
+	size_t i;
+
+	bufsize = 1 << 16;
+	if ((buf = malloc(bufsize)) == NULL)
+		exit(1);
+	for (i = 0; i < bufsize; i++)
+		buf[i] = rng() & 0xff;
+
+	if (test_vectors() != 0)
+		exit(1);
+	if (test_batch(buf, bufsize) != 0)
+		exit(1);
+
+	free(buf);
+	return 0;
+}
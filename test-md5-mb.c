@@ -0,0 +1,284 @@
+/*-
+ * Copyright (c) 2023, Collin Funk
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHORS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "md5.h"
+#include "md5-mb.h"
+#include "test.h"
+
+#define NJOBS 200
+
+static void
+md5_ref(uint8_t digest[16], const void *data, size_t len)
+{
+	struct md5_ctx ctx;
+
+	md5_init(&ctx);
+	md5_update(&ctx, data, len);
+	md5_final(digest, &ctx);
+}
+
+/*
+ * RFC 1321 vectors, all in flight at once.
+ */
+static int
+test_vectors(void)
+{
+	static const char *msgs[7] = {
+		"",
+		"a",
+		"abc",
+		"message digest",
+		"abcdefghijklmnopqrstuvwxyz",
+		"ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789",
+		"1234567890123456789012345678901234"
+		"5678901234567890123456789012345678901234567890"
+	};
+	static const char *expected[7] = {
+		"\xd4\x1d\x8c\xd9\x8f\x00\xb2\x04\xe9\x80\x09\x98\xec\xf8\x42\x7e",
+		"\x0c\xc1\x75\xb9\xc0\xf1\xb6\xa8\x31\xc3\x99\xe2\x69\x77\x26\x61",
+		"\x90\x01\x50\x98\x3c\xd2\x4f\xb0\xd6\x96\x3f\x7d\x28\xe1\x7f\x72",
+		"\xf9\x6b\x69\x7d\x7c\xb7\x93\x8d\x52\x5a\x2f\x31\xaa\xf1\x61\xd0",
+		"\xc3\xfc\xd3\xd7\x61\x92\xe4\x00\x7d\xfb\x49\x6c\xca\x67\xe1\x3b",
+		"\xd1\x74\xab\x98\xd2\x77\xd9\xf5\xa5\x61\x1c\x2c\x9f\x41\x9d\x9f",
+		"\x57\xed\xf4\xa2\x2b\xe3\xc9\x55\xac\x49\xda\x2e\x21\x07\xb6\x7a"
+	};
+	struct md5_mb_job jobs[7];
+	int i;
+
+	for (i = 0; i < 7; i++) {
+		jobs[i].data = msgs[i];
+		jobs[i].len = strlen(msgs[i]);
+	}
+	jobs[0].data = NULL; /* An empty job need not point anywhere. */
+	md5_mb_digest(jobs, 7);
+
+	for (i = 0; i < 7; i++) {
+		printf("Digest #%02d: ", i + 1);
+		for (int j = 0; j < 16; ++j)
+			printf("%02x", jobs[i].digest[j]);
+		printf("\n");
+
+		if (memcmp(jobs[i].digest, expected[i], 16) != 0) {
+			fprintf(stderr, "Test %d failed.\n", i + 1);
+			return 1;
+		}
+	}
+
+	return 0;
+}
+
+/*
+ * Random lengths through submit/flush, compared with md5_update.
+ */
+static int
+test_random_jobs(const uint8_t *buf, size_t bufsize)
+{
+	struct md5_mb_mgr mgr;
+	struct md5_mb_job jobs[NJOBS];
+	struct md5_mb_job *job;
+	uint8_t digest[16];
+	size_t seen;
+	size_t i;
+
+	for (i = 0; i < NJOBS; i++) {
+		if (rng() % 8 == 0)
+			jobs[i].len = rng() % bufsize;
+		else
+			jobs[i].len = rng() % 300;
+		jobs[i].data = &buf[rng() % (bufsize - jobs[i].len + 1)];
+		jobs[i].user = &jobs[i];
+	}
+
+	seen = 0;
+	md5_mb_init(&mgr);
+	for (i = 0; i < NJOBS; i++) {
+		if ((job = md5_mb_submit(&mgr, &jobs[i])) != NULL)
+			seen++;
+	}
+	while ((job = md5_mb_flush(&mgr)) != NULL) {
+		if (job->user != job) {
+			fprintf(stderr, "Job cookie clobbered.\n");
+			return 1;
+		}
+		seen++;
+	}
+	if (seen != NJOBS) {
+		fprintf(stderr, "Returned %zu of %d jobs.\n", seen, NJOBS);
+		return 1;
+	}
+
+	for (i = 0; i < NJOBS; i++) {
+		md5_ref(digest, jobs[i].data, jobs[i].len);
+		if (memcmp(digest, jobs[i].digest, 16) != 0) {
+			fprintf(stderr, "Job %zu (%zu bytes) failed.\n", i,
+			    jobs[i].len);
+			return 1;
+		}
+	}
+
+	printf("Random jobs: ok\n");
+	return 0;
+}
+
+/*
+ * Batched context updates in random chunks, compared with md5_update.
+ */
+static int
+test_random_update(const uint8_t *buf, size_t bufsize)
+{
+	struct md5_ctx ctxs[NJOBS];
+	struct md5_ctx refs[NJOBS];
+	struct md5_ctx *ctxp[NJOBS];
+	const void *data[NJOBS];
+	size_t len[NJOBS];
+	uint8_t digest[16];
+	uint8_t expected[16];
+	int round;
+	size_t i;
+
+	for (i = 0; i < NJOBS; i++) {
+		md5_init(&ctxs[i]);
+		md5_init(&refs[i]);
+		ctxp[i] = &ctxs[i];
+	}
+
+	for (round = 0; round < 8; round++) {
+		for (i = 0; i < NJOBS; i++) {
+			len[i] = rng() % ((rng() % 4 == 0) ? 4096 : 100);
+			data[i] = &buf[rng() % (bufsize - len[i] + 1)];
+			md5_update(&refs[i], data[i], len[i]);
+		}
+		md5_mb_update(ctxp, data, len, NJOBS);
+	}
+
+	for (i = 0; i < NJOBS; i++) {
+		md5_final(digest, &ctxs[i]);
+		md5_final(expected, &refs[i]);
+		if (memcmp(digest, expected, 16) != 0) {
+			fprintf(stderr, "Context %zu failed.\n", i);
+			return 1;
+		}
+	}
+
+	printf("Random updates: ok\n");
+	return 0;
+}
+
+/*
+ * Batched finals of contexts holding 0 to 63 buffered bytes, compared
+ * with md5_final.
+ */
+static int
+test_random_final(const uint8_t *buf, size_t bufsize)
+{
+	struct md5_ctx ctxs[NJOBS];
+	struct md5_ctx refs[NJOBS];
+	struct md5_ctx *ctxp[NJOBS];
+	uint8_t digests[NJOBS][16];
+	uint8_t expected[16];
+	size_t len;
+	size_t i;
+
+	for (i = 0; i < NJOBS; i++) {
+		len = rng() % ((rng() % 4 == 0) ? 4096 : 200);
+		md5_init(&ctxs[i]);
+		md5_update(&ctxs[i], &buf[rng() % (bufsize - len + 1)], len);
+		refs[i] = ctxs[i];
+		ctxp[i] = &ctxs[i];
+	}
+	md5_mb_final(digests, ctxp, NJOBS);
+
+	for (i = 0; i < NJOBS; i++) {
+		md5_final(expected, &refs[i]);
+		if (memcmp(digests[i], expected, 16) != 0) {
+			fprintf(stderr, "Final %zu failed.\n", i);
+			return 1;
+		}
+	}
+
+	printf("Random finals: ok\n");
+	return 0;
+}
+
+/*
+ * Arrays of equal length keys, short and long, compared with md5_update.
+ */
+static int
+test_short_array(const uint8_t *buf)
+{
+	uint8_t digests[NJOBS][16];
+	uint8_t expected[16];
+	size_t len;
+	size_t n;
+	size_t i;
+
+	for (len = 0; len <= 70; len++) {
+		n = rng() % NJOBS;
+		md5_mb_digest_short(digests, buf, len, n);
+		for (i = 0; i < n; i++) {
+			md5_ref(expected, &buf[i * len], len);
+			if (memcmp(digests[i], expected, 16) != 0) {
+				fprintf(stderr, "Key %zu of %zu bytes failed.\n",
+				    i, len);
+				return 1;
+			}
+		}
+	}
+
+	printf("Short arrays: ok\n");
+	return 0;
+}
+
+int
+main(void)
+{
+	uint8_t *buf;
+	size_t bufsize;
+	size_t i;
+
+	bufsize = 1 << 16;
+	if ((buf = malloc(bufsize)) == NULL)
+		exit(1);
+	for (i = 0; i < bufsize; i++)
+		buf[i] = rng() & 0xff;
+
+	if (test_vectors() != 0)
+		exit(1);
+	if (test_random_jobs(buf, bufsize) != 0)
+		exit(1);
+	if (test_random_update(buf, bufsize) != 0)
+		exit(1);
+	if (test_random_final(buf, bufsize) != 0)
+		exit(1);
+	if (test_short_array(buf) != 0)
+		exit(1);
+
+	free(buf);
+	return 0;
+}
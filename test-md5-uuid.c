@@ -0,0 +1,224 @@
+/*-
+ * Copyright (c) 2023, Collin Funk
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHORS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "md5.h"
+#include "md5-uuid.h"
+#include "test.h"
+
+#define NJOBS 200
+
+/*
+ * Known UUIDs, hashed one at a time and as a batch.
+ */
+static int
+test_vectors(void)
+{
+	static const uint8_t *ns[4] = {
+		md5_uuid_ns_dns, md5_uuid_ns_url, md5_uuid_ns_dns,
+		md5_uuid_ns_oid
+	};
+	static const char *names[4] = {
+		"www.example.com",
+		"http://www.ietf.org/rfc/rfc4122.txt",
+		"python.org",
+		""
+	};
+	static const char *expected[4] = {
+		"5df41881-3aed-3515-88a7-2f4a814cf09e",
+		"9d6b34c7-782b-3369-ba31-472ccb4e61ec",
+		"6fa459ea-ee8a-3ca4-894e-db77e160355e",
+		"596b79dc-00dd-3991-a72f-d3696c38c64f"
+	};
+	struct md5_uuid_ns space;
+	uint8_t uuid[2][16];
+	char str[2][MD5_UUID_STRLEN + 1];
+	const void *name;
+	size_t len;
+	int i;
+
+	for (i = 0; i < 4; i++) {
+		md5_uuid_ns_init(&space, ns[i]);
+		name = names[i];
+		len = strlen(names[i]);
+		md5_uuid3(uuid[0], &space, name, len);
+		md5_uuid3_batch(&uuid[1], &space, &name, &len, 1);
+		md5_uuid_format(str, (const uint8_t (*)[16])uuid, 2);
+		printf("UUID #%02d: %s\n", i + 1, str[0]);
+
+		if (strcmp(str[0], expected[i]) != 0 ||
+		    strcmp(str[1], expected[i]) != 0) {
+			fprintf(stderr, "Test %d failed.\n", i + 1);
+			return 1;
+		}
+	}
+
+	return 0;
+}
+
+/*
+ * Names of random lengths as a batch, compared with md5_uuid3.
+ */
+static int
+test_random_batch(const uint8_t *buf, size_t bufsize)
+{
+	struct md5_uuid_ns space;
+	const void *names[NJOBS];
+	size_t lens[NJOBS];
+	uint8_t uuids[NJOBS][16];
+	uint8_t ns[16];
+	uint8_t expected[16];
+	size_t i;
+
+	for (i = 0; i < 16; i++)
+		ns[i] = rng() & 0xff;
+	md5_uuid_ns_init(&space, ns);
+	for (i = 0; i < NJOBS; i++) {
+		lens[i] = rng() % ((rng() % 4 == 0) ? 1024 : 64);
+		names[i] = &buf[rng() % (bufsize - lens[i] + 1)];
+	}
+	md5_uuid3_batch(uuids, &space, names, lens, NJOBS);
+
+	for (i = 0; i < NJOBS; i++) {
+		md5_uuid3(expected, &space, names[i], lens[i]);
+		if (memcmp(uuids[i], expected, 16) != 0) {
+			fprintf(stderr, "Name %zu (%zu bytes) failed.\n", i,
+			    lens[i]);
+			return 1;
+		}
+		if ((uuids[i][6] & 0xf0) != 0x30 ||
+		    (uuids[i][8] & 0xc0) != 0x80) {
+			fprintf(stderr, "Name %zu has bad version bits.\n", i);
+			return 1;
+		}
+	}
+
+	printf("Random batches: ok\n");
+	return 0;
+}
+
+/*
+ * Random UUIDs formatted, compared with printf, and parsed back.
+ */
+static int
+test_format(void)
+{
+	uint8_t uuids[NJOBS][16];
+	uint8_t back[16];
+	char str[NJOBS][MD5_UUID_STRLEN + 1];
+	char expected[MD5_UUID_STRLEN + 1];
+	const uint8_t *u;
+	size_t i;
+	int j;
+
+	for (i = 0; i < NJOBS; i++) {
+		for (j = 0; j < 16; j++)
+			uuids[i][j] = rng() & 0xff;
+	}
+	md5_uuid_format(str, (const uint8_t (*)[16])uuids, NJOBS);
+
+	for (i = 0; i < NJOBS; i++) {
+		u = uuids[i];
+		snprintf(expected, sizeof(expected), "%02x%02x%02x%02x-"
+		    "%02x%02x-%02x%02x-%02x%02x-%02x%02x%02x%02x%02x%02x",
+		    u[0], u[1], u[2], u[3], u[4], u[5], u[6], u[7], u[8],
+		    u[9], u[10], u[11], u[12], u[13], u[14], u[15]);
+		if (strcmp(str[i], expected) != 0) {
+			fprintf(stderr, "Format %zu gave %s, not %s.\n", i,
+			    str[i], expected);
+			return 1;
+		}
+		if (md5_uuid_parse(back, str[i]) != 0 ||
+		    memcmp(back, u, 16) != 0) {
+			fprintf(stderr, "Parse %zu failed.\n", i);
+			return 1;
+		}
+	}
+
+	printf("Formatting: ok\n");
+	return 0;
+}
+
+/*
+ * Both cases are read and anything but the canonical form is refused.
+ */
+static int
+test_parse(void)
+{
+	static const char *bad[6] = {
+		"",
+		"6ba7b810-9dad-11d1-80b4-00c04fd430c",
+		"6ba7b810-9dad-11d1-80b4-00c04fd430c80",
+		"6ba7b8109dad-11d1-80b4-00c04fd430c8-",
+		"6ba7b810-9dad-11d1-80b4-00c04fd430g8",
+		"{6ba7b810-9dad-11d1-80b4-00c04fd430c8}"
+	};
+	uint8_t uuid[16];
+	int i;
+
+	if (md5_uuid_parse(uuid, "6BA7B810-9DAD-11D1-80B4-00C04FD430C8") != 0 ||
+	    memcmp(uuid, md5_uuid_ns_dns, 16) != 0) {
+		fprintf(stderr, "Uppercase parse failed.\n");
+		return 1;
+	}
+	for (i = 0; i < 6; i++) {
+		if (md5_uuid_parse(uuid, bad[i]) == 0) {
+			fprintf(stderr, "Accepted \"%s\".\n", bad[i]);
+			return 1;
+		}
+	}
+
+	printf("Parsing: ok\n");
+	return 0;
+}
+
+int
+main(void)
+{
+	uint8_t *buf;
+	size_t bufsize;
+	size_t i;
+
+	bufsize = 1 << 16;
+	if ((buf = malloc(bufsize)) == NULL)
+		exit(1);
+	for (i = 0; i < bufsize; i++)
+		buf[i] = rng() & 0xff;
+
+	if (test_vectors() != 0)
+		exit(1);
+	if (test_random_batch(buf, bufsize) != 0)
+		exit(1);
+	if (test_format() != 0)
+		exit(1);
+	if (test_parse() != 0)
+		exit(1);
+
+	free(buf);
+	return 0;
+}
@@ -23,6 +23,8 @@
  * SUCH DAMAGE.
  */
 
+#include <sys/uio.h>
+
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -34,11 +36,14 @@ md5_test(const char *message, const char *expected, int number)
 {
 	struct md5_ctx ctx;
 	uint8_t digest[16];
+	uint8_t oneshot[16];
 
 	md5_init(&ctx);
 	md5_update(&ctx, message, strlen(message));
 	md5_final(digest, &ctx);
 
+	md5_digest(oneshot, message, strlen(message));
+
 	printf("Digest #%02d: ", number);
 	for (int i = 0; i < 16; ++i)
 		printf("%02x", digest[i]);
@@ -48,6 +53,263 @@ md5_test(const char *message, const char *expected, int number)
 		fprintf(stderr, "Test %d failed.\n", number);
 		return 1;
 	}
+	if (memcmp(oneshot, expected, 16) != 0) {
+		fprintf(stderr, "Test %d failed for md5_digest.\n", number);
+		return 1;
+	}
+
+	return 0;
+}
+
+/*
+ * One million repetitions of "a" in a single md5_update, so nearly all
+ * of it goes through md5_transform_blocks at once.
+ */
+static int
+md5_test_million(void)
+{
+	static const char expected[16] = "\x77\x07\xd6\xae\x4e\x02\x7c\x70"
+	    "\xee\xa2\xa9\x35\xc2\x29\x6f\x21";
+	struct md5_ctx ctx;
+	uint8_t digest[16];
+	char *message;
+
+	if ((message = malloc(1000000)) == NULL)
+		return 1;
+	memset(message, 'a', 1000000);
+
+	md5_init(&ctx);
+	md5_update(&ctx, message, 1000000);
+	md5_final(digest, &ctx);
+	free(message);
+
+	if (memcmp(digest, expected, 16) != 0) {
+		fprintf(stderr, "Million test failed.\n");
+		return 1;
+	}
+
+	return 0;
+}
+
+/*
+ * Every kernel the CPU supports must match md5_transform with the
+ * generic kernel, one block at a time or many blocks per call.
+ */
+static int
+md5_test_kernels(void)
+{
+	static const char *names[] = { "generic", "le", "ilp", "bmi" };
+	uint32_t expected[4];
+	uint32_t state[4];
+	uint8_t data[64 * 9];
+	size_t i;
+
+	for (i = 0; i < sizeof(data); i++)
+		data[i] = (i * 131 + 7) & 0xff;
+
+	md5_transform_select("generic");
+	expected[0] = 0x67452301;
+	expected[1] = 0xefcdab89;
+	expected[2] = 0x98badcfe;
+	expected[3] = 0x10325476;
+	for (i = 0; i < 9; i++)
+		md5_transform(expected, &data[i * 64]);
+
+	for (i = 0; i < sizeof(names) / sizeof(names[0]); i++) {
+		if (md5_transform_select(names[i]) != 0)
+			continue;
+		state[0] = 0x67452301;
+		state[1] = 0xefcdab89;
+		state[2] = 0x98badcfe;
+		state[3] = 0x10325476;
+		md5_transform_blocks(state, data, 4);
+		md5_transform(state, &data[4 * 64]);
+		md5_transform_blocks(state, &data[5 * 64], 4);
+		md5_transform_blocks(state, data, 0);
+
+		printf("Kernel %s: ", md5_transform_name());
+		if (memcmp(state, expected, sizeof(state)) != 0) {
+			printf("failed\n");
+			return 1;
+		}
+		printf("ok\n");
+	}
+
+	return 0;
+}
+
+/*
+ * md5_digest against a context for every length that changes how the
+ * final blocks are padded.
+ */
+static int
+md5_test_digest(void)
+{
+	struct md5_ctx ctx;
+	uint8_t data[300];
+	uint8_t digest[16];
+	uint8_t oneshot[16];
+	size_t len;
+
+	for (len = 0; len < sizeof(data); len++)
+		data[len] = (len * 7 + 3) & 0xff;
+
+	for (len = 0; len <= sizeof(data); len++) {
+		md5_init(&ctx);
+		md5_update(&ctx, data, len);
+		md5_final(digest, &ctx);
+		md5_digest(oneshot, data, len);
+		if (memcmp(digest, oneshot, 16) != 0) {
+			fprintf(stderr, "md5_digest failed at %zu bytes.\n",
+			    len);
+			return 1;
+		}
+		md5_digest_short(oneshot, data, len);
+		if (memcmp(digest, oneshot, 16) != 0) {
+			fprintf(stderr, "md5_digest_short failed at %zu "
+			    "bytes.\n", len);
+			return 1;
+		}
+	}
+
+	return 0;
+}
+
+/*
+ * Export a context at every split point, import it into a fresh one and
+ * finish hashing there. A damaged export must be refused.
+ */
+static int
+md5_test_export(void)
+{
+	struct md5_ctx ctx;
+	uint8_t blob[MD5_EXPORT_SIZE];
+	uint8_t data[200];
+	uint8_t digest[16];
+	uint8_t expected[16];
+	size_t split;
+
+	for (split = 0; split < sizeof(data); split++)
+		data[split] = (split * 13 + 5) & 0xff;
+	md5_digest(expected, data, sizeof(data));
+
+	for (split = 0; split <= sizeof(data); split++) {
+		md5_init(&ctx);
+		md5_update(&ctx, data, split);
+		md5_export(blob, &ctx);
+		memset(&ctx, 0xa5, sizeof(ctx));
+		if (md5_import(&ctx, blob) != 0) {
+			fprintf(stderr, "md5_import refused %zu bytes.\n",
+			    split);
+			return 1;
+		}
+		md5_update(&ctx, data + split, sizeof(data) - split);
+		md5_final(digest, &ctx);
+		if (memcmp(digest, expected, 16) != 0) {
+			fprintf(stderr, "md5_export failed at %zu bytes.\n",
+			    split);
+			return 1;
+		}
+	}
+
+	blob[0] ^= 1;
+	if (md5_import(&ctx, blob) == 0) {
+		fprintf(stderr, "md5_import took a bad magic.\n");
+		return 1;
+	}
+	blob[0] ^= 1;
+	blob[MD5_EXPORT_SIZE - 1] = 1;
+	if (md5_import(&ctx, blob) == 0) {
+		fprintf(stderr, "md5_import took stray buffer bytes.\n");
+		return 1;
+	}
+
+	return 0;
+}
+
+/*
+ * Hash a prefix of every length once, then finish copies of it with two
+ * different suffixes.
+ */
+static int
+md5_test_copy(void)
+{
+	struct md5_ctx prefix;
+	struct md5_ctx ctx;
+	uint8_t data[200];
+	uint8_t digest[16];
+	uint8_t expected[16];
+	size_t split;
+	int i;
+
+	for (split = 0; split < sizeof(data); split++)
+		data[split] = (split * 7 + 3) & 0xff;
+
+	for (split = 0; split <= 150; split++) {
+		md5_init(&prefix);
+		md5_update(&prefix, data, split);
+		for (i = 0; i < 2; i++) {
+			memset(&ctx, 0xa5, sizeof(ctx));
+			md5_ctx_copy(&ctx, &prefix);
+			md5_update(&ctx, data + split, 25 * (i + 1));
+			md5_final(digest, &ctx);
+			md5_digest(expected, data, split + 25 * (i + 1));
+			if (memcmp(digest, expected, 16) != 0) {
+				fprintf(stderr, "md5_ctx_copy failed at %zu "
+				    "bytes.\n", split);
+				return 1;
+			}
+		}
+	}
+
+	return 0;
+}
+
+/*
+ * Hash data through md5_updatev in fragments of 0 to 130 bytes, after
+ * each possible number of bytes already buffered.
+ */
+static int
+md5_test_updatev(void)
+{
+	struct md5_ctx ctx;
+	struct iovec iov[64];
+	uint8_t data[1000];
+	uint8_t digest[16];
+	uint8_t expected[16];
+	uint32_t seed;
+	size_t off;
+	size_t pre;
+	int n;
+
+	for (off = 0; off < sizeof(data); off++)
+		data[off] = (off * 11 + 7) & 0xff;
+	md5_digest(expected, data, sizeof(data));
+
+	seed = 1;
+	for (pre = 0; pre < 64; pre++) {
+		md5_init(&ctx);
+		md5_update(&ctx, data, pre);
+		off = pre;
+		while (off < sizeof(data)) {
+			for (n = 0; n < 64 && off < sizeof(data); n++) {
+				seed = seed * 1103515245 + 12345;
+				iov[n].iov_base = &data[off];
+				iov[n].iov_len = (seed >> 16) % 131;
+				if (iov[n].iov_len > sizeof(data) - off)
+					iov[n].iov_len = sizeof(data) - off;
+				off += iov[n].iov_len;
+			}
+			md5_updatev(&ctx, iov, n);
+		}
+		md5_updatev(&ctx, iov, 0);
+		md5_final(digest, &ctx);
+		if (memcmp(digest, expected, 16) != 0) {
+			fprintf(stderr, "md5_updatev failed after %zu "
+			    "bytes.\n", pre);
+			return 1;
+		}
+	}
 
 	return 0;
 }
@@ -103,6 +365,18 @@ main(void)
 		exit(1);
 	if (md5_test(test_msg7, expected7, 7) != 0)
 		exit(1);
+	if (md5_test_million() != 0)
+		exit(1);
+	if (md5_test_digest() != 0)
+		exit(1);
+	if (md5_test_kernels() != 0)
+		exit(1);
+	if (md5_test_export() != 0)
+		exit(1);
+	if (md5_test_copy() != 0)
+		exit(1);
+	if (md5_test_updatev() != 0)
+		exit(1);
 
 	return 0;
 }
@@ -0,0 +1,298 @@
+/*-
+ * Copyright (c) 2023, Collin Funk
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHORS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <sys/stat.h>
+
+#include <pthread.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "md5.h"
+#include "mdcache.h"
+#include "test-file.h"
+#include "test.h"
+
+#define NFILES 20
+#define NREADERS 3
+#define NKEYS 64
+#define NROUNDS 2000
+
+/*
+ * Files are read and stored the first time, taken from the cache the
+ * second, also through another handle, and read again once changed.
+ */
+static int
+test_files(const char *dir, const char *path)
+{
+	struct mdcache cache;
+	struct mdcache other;
+	char names[NFILES][256];
+	uint8_t expected[NFILES][16];
+	uint8_t digest[16];
+	uint8_t buf[5000];
+	struct timespec times[2];
+	size_t len;
+	int round;
+	int hit;
+	int i;
+
+	for (i = 0; i < NFILES; i++) {
+		snprintf(names[i], sizeof(names[i]), "%s/f%02d", dir, i);
+		len = rng() % sizeof(buf);
+		for (size_t j = 0; j < len; j++)
+			buf[j] = rng() & 0xff;
+		if (write_file(names[i], buf, len) != 0)
+			return 1;
+		md5_digest(expected[i], buf, len);
+	}
+
+	if (mdcache_open(&cache, path, MDFILE_MD5, 100) != 0) {
+		perror(path);
+		return 1;
+	}
+	if (cache.nslots != 128) {
+		fprintf(stderr, "Asked for 100 slots, got %llu.\n",
+		    (unsigned long long)cache.nslots);
+		return 1;
+	}
+	cache.settle = 0;
+	for (round = 0; round < 2; round++) {
+		for (i = 0; i < NFILES; i++) {
+			if (mdcache_hash_path(&cache, digest, names[i], NULL,
+			    &hit) != 0 || hit != round ||
+			    memcmp(digest, expected[i], 16) != 0) {
+				fprintf(stderr, "%s failed in round %d.\n",
+				    names[i], round);
+				return 1;
+			}
+		}
+	}
+
+	/* A second handle, as another process would have, sees them. */
+	if (mdcache_open(&other, path, MDFILE_MD5, 0) != 0 ||
+	    other.nslots != 128)
+		return 1;
+	if (mdcache_hash_path(&other, digest, names[0], NULL, &hit) != 0 ||
+	    !hit || memcmp(digest, expected[0], 16) != 0) {
+		fprintf(stderr, "Second handle missed.\n");
+		return 1;
+	}
+
+	/* A change is noticed even with the modification time set back. */
+	for (i = 0; i < (int)sizeof(buf); i++)
+		buf[i] = rng() & 0xff;
+	if (write_file(names[1], buf, 100) != 0)
+		return 1;
+	times[0].tv_sec = times[1].tv_sec = 1000000000;
+	times[0].tv_nsec = times[1].tv_nsec = 0;
+	if (utimensat(AT_FDCWD, names[1], times, 0) != 0)
+		return 1;
+	md5_digest(expected[1], buf, 100);
+	for (round = 0; round < 2; round++) {
+		if (mdcache_hash_path(&other, digest, names[1], NULL,
+		    &hit) != 0 || memcmp(digest, expected[1], 16) != 0) {
+			fprintf(stderr, "Changed file failed.\n");
+			return 1;
+		}
+	}
+
+	/* Recently changed files are not stored. */
+	other.settle = 3600 * 1000000000LL;
+	if (write_file(names[2], buf, 200) != 0)
+		return 1;
+	for (round = 0; round < 2; round++) {
+		if (mdcache_hash_path(&other, digest, names[2], NULL,
+		    &hit) != 0 || hit) {
+			fprintf(stderr, "Recent file stored.\n");
+			return 1;
+		}
+	}
+	mdcache_close(&other);
+	mdcache_close(&cache);
+
+	/* Nor is the cache used for the other algorithm. */
+	if (mdcache_open(&cache, path, MDFILE_MD4, 0) != 0 ||
+	    cache.nslots != MDCACHE_SLOTS)
+		return 1;
+	cache.settle = 0;
+	if (mdcache_hash_path(&cache, digest, names[3], NULL, &hit) != 0 ||
+	    hit) {
+		fprintf(stderr, "MD5 digest used for MD4.\n");
+		return 1;
+	}
+	mdcache_close(&cache);
+
+	for (i = 0; i < NFILES; i++)
+		unlink(names[i]);
+	printf("Files: ok\n");
+	return 0;
+}
+
+struct race {
+	struct mdcache *cache;
+	int stop;
+	int failed;
+	unsigned long hits;
+};
+
+/*
+ * Key k at version v is a file with inode k and size v, whose digest
+ * names both, so a torn entry cannot pass for a whole one.
+ */
+static void
+race_key(struct stat *st, uint8_t digest[16], uint64_t k, uint64_t v)
+{
+
+	memset(st, 0, sizeof(*st));
+	st->st_mode = S_IFREG | 0644;
+	st->st_dev = 1;
+	st->st_ino = k;
+	st->st_size = v;
+	st->st_mtim.tv_sec = v;
+	st->st_ctim.tv_sec = v;
+	memset(digest, 0, 16);
+	memcpy(digest, &k, sizeof(k));
+	memcpy(digest + 8, &v, sizeof(v));
+}
+
+static void *
+race_reader(void *arg)
+{
+	struct race *r;
+	struct stat st;
+	uint8_t expected[16];
+	uint8_t digest[16];
+	uint32_t state;
+	uint64_t k;
+	uint64_t v;
+
+	r = arg;
+	state = 0x12345;
+	while (!__atomic_load_n(&r->stop, __ATOMIC_RELAXED)) {
+		state = state * 1103515245 + 12345;
+		k = (state >> 8) % NKEYS;
+		v = (state >> 20) % 4;
+		race_key(&st, expected, k, v);
+		if (mdcache_lookup(r->cache, digest, &st)) {
+			r->hits++;
+			if (memcmp(digest, expected, 16) != 0)
+				r->failed = 1;
+		}
+	}
+
+	return (NULL);
+}
+
+/*
+ * Readers look up entries while a writer keeps replacing them in a
+ * table too small to hold them all.
+ */
+static int
+test_race(const char *path)
+{
+	struct race races[NREADERS];
+	pthread_t threads[NREADERS];
+	struct mdcache cache;
+	struct stat st;
+	uint8_t digest[16];
+	unsigned long hits;
+	int nthreads;
+	int ret;
+	int i;
+	int n;
+
+	unlink(path);
+	if (mdcache_open(&cache, path, MDFILE_MD5, 16) != 0)
+		return 1;
+	for (i = 0; i < NREADERS; i++) {
+		races[i].cache = &cache;
+		races[i].stop = 0;
+		races[i].failed = 0;
+		races[i].hits = 0;
+		if (pthread_create(&threads[i], NULL, race_reader,
+		    &races[i]) != 0)
+			break;
+	}
+	nthreads = i;
+	ret = nthreads != NREADERS;
+	for (n = 0; ret == 0 && n < NROUNDS; n++) {
+		race_key(&st, digest, rng() % NKEYS, rng() % 4);
+		if (mdcache_insert(&cache, digest, &st) != 0)
+			ret = 1;
+		else if (n % 64 == 0)
+			sched_yield();
+	}
+
+	/* The readers are stopped and joined on failure too. */
+	hits = 0;
+	for (i = 0; i < nthreads; i++) {
+		__atomic_store_n(&races[i].stop, 1, __ATOMIC_RELAXED);
+		pthread_join(threads[i], NULL);
+		hits += races[i].hits;
+		if (races[i].failed) {
+			fprintf(stderr, "Reader %d saw a torn entry.\n", i);
+			ret = 1;
+		}
+	}
+	mdcache_close(&cache);
+	if (ret != 0)
+		return 1;
+
+	/* A damaged file is replaced by an empty table. */
+	if (write_file(path, (const uint8_t *)"MDHC junk", 9) != 0 ||
+	    mdcache_open(&cache, path, MDFILE_MD5, 16) != 0 ||
+	    cache.nslots != 16 || mdcache_lookup(&cache, digest, &st))
+		return 1;
+	mdcache_close(&cache);
+
+	printf("Concurrent readers: ok (%lu hits)\n", hits);
+	return 0;
+}
+
+int
+main(void)
+{
+	char dir[] = "/tmp/test-mdcache.XXXXXX";
+	char path[256];
+	int ret;
+
+	if (mkdtemp(dir) == NULL) {
+		perror("mkdtemp");
+		exit(1);
+	}
+	snprintf(path, sizeof(path), "%s/cache", dir);
+	ret = test_files(dir, path) != 0 || test_race(path) != 0;
+	unlink(path);
+	rmdir(dir);
+
+	if (ret != 0)
+		exit(1);
+	return 0;
+}
@@ -0,0 +1,222 @@
+/*-
+ * Copyright (c) 2023, Collin Funk
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHORS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "md5.h"
+#include "mdcheck.h"
+#include "test-file.h"
+#include "test.h"
+
+#define NFILES 40
+
+static void
+hex(char out[33], const uint8_t digest[16])
+{
+	int i;
+
+	for (i = 0; i < 16; i++)
+		sprintf(out + 2 * i, "%02x", digest[i]);
+}
+
+struct seen {
+	int count[NFILES + 8];
+	size_t results;
+};
+
+static void
+record(const struct mdcheck_result *r, void *arg)
+{
+	struct seen *s;
+
+	s = arg;
+	s->count[r->entry->line - 1]++;
+	s->results++;
+}
+
+/*
+ * Every form of line md5sum, md4sum and BSD md5 write, with a mismatch,
+ * a missing file and lines that are not understood.
+ */
+static int
+test_manifest(const char *dir)
+{
+	struct mdcheck_stats stats;
+	struct mdcheck_list list;
+	struct mdfiles_opts opts;
+	struct seen seen;
+	uint8_t digest[16];
+	uint8_t buf[3000];
+	char path[256];
+	char name[256];
+	char sum[33];
+	size_t len;
+	size_t j;
+	FILE *fp;
+	int i;
+
+	snprintf(path, sizeof(path), "%s/manifest", dir);
+	if ((fp = fopen(path, "w")) == NULL)
+		return 1;
+	for (i = 0; i < 4; i++) {
+		snprintf(name, sizeof(name), i == 3 ? "%s/back\\slash%d" :
+		    "%s/file%d", dir, i);
+		len = rng() % sizeof(buf);
+		for (j = 0; j < len; j++)
+			buf[j] = rng() & 0xff;
+		if (write_file(name, buf, len) != 0)
+			return 1;
+		md5_digest(digest, buf, len);
+		if (i == 2)
+			digest[5] ^= 1;
+		hex(sum, digest);
+		if (i == 0)
+			fprintf(fp, "%s  %s\n", sum, name);
+		else if (i == 1)
+			fprintf(fp, "MD5 (%s) = %s\r\n", name, sum);
+		else if (i == 2)
+			fprintf(fp, "%s *%s\n", sum, name);
+		else {
+			fprintf(fp, "\\%s  ", sum);
+			for (j = 0; name[j] != '\0'; j++) {
+				if (name[j] == '\\')
+					fputc('\\', fp);
+				fputc(name[j], fp);
+			}
+			fputc('\n', fp);
+		}
+	}
+	fprintf(fp, "# comment\n\n");
+	fprintf(fp, "%s  %s/missing\n", sum, dir);
+	fprintf(fp, "%.31s  %s/file0\n", sum, dir);
+	fprintf(fp, "MD4 (%s/file0) = %s\n", dir, sum);
+	fclose(fp);
+
+	memset(&list, 0, sizeof(list));
+	if ((fp = fopen(path, "r")) == NULL ||
+	    mdcheck_parse(&list, fp, MDFILE_MD5) != 0)
+		return 1;
+	fclose(fp);
+	unlink(path);
+	if (list.n != 5 || list.invalid != 2) {
+		fprintf(stderr, "Parsed %zu entries and %zu bad lines.\n",
+		    list.n, list.invalid);
+		return 1;
+	}
+
+	memset(&seen, 0, sizeof(seen));
+	mdfiles_opts_init(&opts);
+	opts.nthreads = 2;
+	if (mdcheck_verify(&list, &opts, 0, record, &seen, &stats) != 2 ||
+	    stats.matched != 3 || stats.mismatched != 1 ||
+	    stats.unreadable != 1 || stats.skipped != 0 ||
+	    seen.results != 5) {
+		fprintf(stderr, "Checked %zu, %zu matched, %zu did not, "
+		    "%zu unread.\n", seen.results, stats.matched,
+		    stats.mismatched, stats.unreadable);
+		return 1;
+	}
+	for (i = 0; i < 4; i++) {
+		snprintf(name, sizeof(name), i == 3 ? "%s/back\\slash%d" :
+		    "%s/file%d", dir, i);
+		unlink(name);
+	}
+	mdcheck_list_free(&list);
+
+	printf("Manifest: ok\n");
+	return 0;
+}
+
+/*
+ * With failfast, a manifest of nothing but failures stops early.
+ */
+static int
+test_failfast(const char *dir)
+{
+	struct mdcheck_stats stats;
+	struct mdcheck_list list;
+	struct mdfiles_opts opts;
+	struct seen seen;
+	size_t i;
+
+	memset(&list, 0, sizeof(list));
+	list.entries = calloc(NFILES, sizeof(*list.entries));
+	if (list.entries == NULL)
+		return 1;
+	for (i = 0; i < NFILES; i++) {
+		if ((list.entries[i].path = malloc(256)) == NULL)
+			return 1;
+		snprintf(list.entries[i].path, 256, "%s/none%zu", dir, i);
+		list.entries[i].line = i + 1;
+		list.n++;
+	}
+
+	memset(&seen, 0, sizeof(seen));
+	mdfiles_opts_init(&opts);
+	opts.nthreads = 1;
+	if (mdcheck_verify(&list, &opts, 1, record, &seen, &stats) != 1 ||
+	    stats.unreadable != 1 || stats.skipped != NFILES - 1 ||
+	    seen.results != 1) {
+		fprintf(stderr, "Failfast checked %zu files.\n",
+		    seen.results);
+		return 1;
+	}
+
+	memset(&seen, 0, sizeof(seen));
+	if (mdcheck_verify(&list, &opts, 0, record, &seen, &stats) !=
+	    NFILES || seen.results != NFILES)
+		return 1;
+	for (i = 0; i < NFILES; i++) {
+		if (seen.count[i] != 1)
+			return 1;
+	}
+	mdcheck_list_free(&list);
+
+	printf("Failfast: ok\n");
+	return 0;
+}
+
+int
+main(void)
+{
+	char dir[] = "/tmp/test-mdcheck.XXXXXX";
+	int ret;
+
+	if (mkdtemp(dir) == NULL) {
+		perror("mkdtemp");
+		exit(1);
+	}
+	ret = test_manifest(dir) != 0 || test_failfast(dir) != 0;
+	rmdir(dir);
+
+	if (ret != 0)
+		exit(1);
+	return 0;
+}
@@ -0,0 +1,337 @@
+/*-
+ * Copyright (c) 2023, Collin Funk
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHORS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "md4.h"
+#include "md5.h"
+#include "mdchunk.h"
+#include "mdfile.h"
+#include "test-file.h"
+#include "test.h"
+
+#define DATASIZE (20 * 1024 * 1024 + 321)
+
+struct collect {
+	struct mdchunk *chunks;
+	size_t n;
+	size_t cap;
+};
+
+static char path[] = "/tmp/test-mdchunk.XXXXXX";
+
+static int
+collect(const struct mdchunk *chunks, size_t n, void *arg)
+{
+	struct collect *c;
+	struct mdchunk *p;
+
+	c = arg;
+	if (c->n + n > c->cap) {
+		c->cap = (c->n + n) * 2;
+		if ((p = realloc(c->chunks, c->cap * sizeof(*p))) == NULL)
+			return (-1);
+		c->chunks = p;
+	}
+	memcpy(c->chunks + c->n, chunks, n * sizeof(*p));
+	c->n += n;
+	return (0);
+}
+
+/*
+ * Chunk len bytes of data through a file.
+ */
+static int
+chunk_data(struct collect *c, const struct mdchunk_opts *opts,
+    const uint8_t *data, size_t len)
+{
+	int ret;
+	int fd;
+
+	if ((fd = open(path, O_RDWR | O_TRUNC)) < 0 ||
+	    write(fd, data, len) != (ssize_t)len ||
+	    lseek(fd, 0, SEEK_SET) != 0) {
+		perror(path);
+		exit(1);
+	}
+	memset(c, 0, sizeof(*c));
+	ret = mdchunk_fd(fd, opts, collect, c);
+	close(fd);
+	return (ret);
+}
+
+/*
+ * Chunks must tile the data within the size limits and carry the digests
+ * of their bytes.
+ */
+static int
+check_chunks(const struct collect *c, const struct mdchunk_opts *opts,
+    const uint8_t *data, size_t len)
+{
+	uint8_t digest[16];
+	uint64_t off;
+	size_t i;
+
+	off = 0;
+	for (i = 0; i < c->n; i++) {
+		if (c->chunks[i].offset != off ||
+		    c->chunks[i].len > opts->max ||
+		    (c->chunks[i].len < opts->min && i != c->n - 1)) {
+			fprintf(stderr, "Chunk %zu at %llu of %zu bytes is "
+			    "out of place.\n", i,
+			    (unsigned long long)c->chunks[i].offset,
+			    c->chunks[i].len);
+			return 1;
+		}
+		digest_ref(digest, opts->algo, data + off, c->chunks[i].len);
+		if (memcmp(digest, c->chunks[i].digest, 16) != 0) {
+			fprintf(stderr, "Chunk %zu has the wrong digest.\n",
+			    i);
+			return 1;
+		}
+		off += c->chunks[i].len;
+	}
+	if (off != len) {
+		fprintf(stderr, "Chunks cover %llu of %zu bytes.\n",
+		    (unsigned long long)off, len);
+		return 1;
+	}
+	return 0;
+}
+
+/*
+ * The same chunks and digests on one thread and on several, across
+ * several buffers.
+ */
+static int
+test_stream(int algo, const uint8_t *data)
+{
+	struct mdchunk_opts opts;
+	struct collect one;
+	struct collect many;
+	size_t avg;
+
+	mdchunk_opts_init(&opts);
+	opts.algo = algo;
+	opts.nthreads = 1;
+	if (chunk_data(&one, &opts, data, DATASIZE) != 0) {
+		perror("mdchunk_fd");
+		return 1;
+	}
+	if (check_chunks(&one, &opts, data, DATASIZE) != 0)
+		return 1;
+	avg = DATASIZE / one.n;
+	if (avg < opts.avg / 2 || avg > opts.avg * 2) {
+		fprintf(stderr, "Average chunk of %zu bytes.\n", avg);
+		return 1;
+	}
+
+	opts.nthreads = 4;
+	if (chunk_data(&many, &opts, data, DATASIZE) != 0) {
+		perror("mdchunk_fd");
+		return 1;
+	}
+	if (many.n != one.n ||
+	    memcmp(many.chunks, one.chunks, one.n * sizeof(*one.chunks)) !=
+	    0) {
+		fprintf(stderr, "Threads changed the chunks.\n");
+		return 1;
+	}
+
+	printf("%s stream: %zu chunks of %zu bytes on average: ok\n",
+	    mdfile_algo_name(algo), one.n, avg);
+	free(one.chunks);
+	free(many.chunks);
+	return 0;
+}
+
+/*
+ * Short streams and other chunk sizes.
+ */
+static int
+test_sizes(const uint8_t *data)
+{
+	static const size_t lens[] = { 0, 1, 63, 2048, 2049, 65536, 200000 };
+	struct mdchunk_opts opts;
+	struct collect c;
+	size_t i;
+
+	mdchunk_opts_init(&opts);
+	for (i = 0; i < sizeof(lens) / sizeof(lens[0]); i++) {
+		if (chunk_data(&c, &opts, data, lens[i]) != 0 ||
+		    check_chunks(&c, &opts, data, lens[i]) != 0) {
+			fprintf(stderr, "Stream of %zu bytes failed.\n",
+			    lens[i]);
+			return 1;
+		}
+		free(c.chunks);
+	}
+
+	opts.min = 64;
+	opts.avg = 256;
+	opts.max = 1024;
+	if (chunk_data(&c, &opts, data, 1 << 20) != 0 ||
+	    check_chunks(&c, &opts, data, 1 << 20) != 0)
+		return 1;
+	free(c.chunks);
+
+	opts.avg = 300;
+	if (chunk_data(&c, &opts, data, 1000) == 0 || errno != EINVAL) {
+		fprintf(stderr, "Accepted an average of 300 bytes.\n");
+		return 1;
+	}
+
+	printf("Sizes: ok\n");
+	return 0;
+}
+
+/*
+ * Bytes inserted and removed move only the chunks around them, so an
+ * edited copy is mostly duplicates of the original.
+ */
+static int
+test_edits(uint8_t *data)
+{
+	struct mdchunk_index idx;
+	struct mdchunk_opts opts;
+	struct collect c;
+	size_t len;
+	size_t off;
+	size_t i;
+	int pass;
+	int ret;
+
+	mdchunk_opts_init(&opts);
+	if (mdchunk_index_init(&idx, 0) != 0)
+		return 1;
+	len = 4 * 1024 * 1024;
+	for (pass = 0; pass < 2; pass++) {
+		if (chunk_data(&c, &opts, data, len) != 0)
+			return 1;
+		for (i = 0; i < c.n; i++) {
+			ret = mdchunk_index_add(&idx, c.chunks[i].digest,
+			    c.chunks[i].len);
+			if (ret < 0 || (pass == 0 && ret != 1)) {
+				fprintf(stderr, "Index add failed.\n");
+				return 1;
+			}
+		}
+		free(c.chunks);
+
+		/* Insert 10 bytes at each of 8 places. */
+		for (i = 0; pass == 0 && i < 8; i++) {
+			off = rng() % len;
+			memmove(data + off + 10, data + off, len - off);
+			memset(data + off, 'x', 10);
+			len += 10;
+		}
+	}
+
+	if (idx.used > idx.chunks / 2 + 32) {
+		fprintf(stderr, "%zu of %llu chunks distinct after edits.\n",
+		    idx.used, (unsigned long long)idx.chunks);
+		return 1;
+	}
+	printf("Edits: %zu of %llu chunks distinct: ok\n", idx.used,
+	    (unsigned long long)idx.chunks);
+	mdchunk_index_free(&idx);
+	return 0;
+}
+
+/*
+ * Many digests, each added twice, through several rounds of growth.
+ */
+static int
+test_index(void)
+{
+	struct mdchunk_index idx;
+	uint8_t digest[16];
+	uint32_t seed;
+	size_t i;
+	int pass;
+	int j;
+
+	if (mdchunk_index_init(&idx, 10) != 0)
+		return 1;
+	seed = rng_state;
+	for (pass = 0; pass < 2; pass++) {
+		rng_state = seed;
+		for (i = 0; i < 100000; i++) {
+			for (j = 0; j < 16; j++)
+				digest[j] = rng();
+			if (mdchunk_index_add(&idx, digest, 100) != !pass) {
+				fprintf(stderr, "Digest %zu on pass %d.\n", i,
+				    pass);
+				return 1;
+			}
+		}
+	}
+	if (idx.used != 100000 || idx.chunks != 200000 ||
+	    idx.bytes != 20000000 || idx.unique != 10000000) {
+		fprintf(stderr, "Index counts are off.\n");
+		return 1;
+	}
+	mdchunk_index_free(&idx);
+
+	printf("Index: ok\n");
+	return 0;
+}
+
+int
+main(void)
+{
+	uint8_t *data;
+	size_t i;
+	int ret;
+	int fd;
+
+	/* Room for the insertions of test_edits. */
+	if ((data = malloc(DATASIZE + 1024)) == NULL)
+		exit(1);
+	for (i = 0; i < DATASIZE; i++)
+		data[i] = rng();
+	if ((fd = mkstemp(path)) < 0) {
+		perror("mkstemp");
+		exit(1);
+	}
+	close(fd);
+
+	ret = test_stream(MDFILE_MD5, data) != 0 ||
+	    test_stream(MDFILE_MD4, data) != 0 ||
+	    test_sizes(data) != 0 ||
+	    test_edits(data) != 0 ||
+	    test_index() != 0;
+
+	unlink(path);
+	free(data);
+	return ret;
+}
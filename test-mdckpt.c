@@ -0,0 +1,237 @@
+/*-
+ * Copyright (c) 2023, Collin Funk
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHORS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "md4.h"
+#include "md5.h"
+#include "mdckpt.h"
+#include "mdfile.h"
+#include "test-file.h"
+#include "test.h"
+
+#define FILESIZE (1024 * 1024)
+#define INTERVAL 100000
+
+/*
+ * Hash fd through the store kept at store_path and compare with a hash
+ * of the len bytes at data. The offset hashing resumed from is returned
+ * in *resumed.
+ */
+static int
+check(int fd, const char *store_path, int algo, const uint8_t *data,
+    size_t len, uint64_t *resumed)
+{
+	struct mdckpt_store store;
+	uint8_t expected[16];
+	uint8_t digest[16];
+
+	if (mdckpt_load(&store, store_path, algo) != 0) {
+		perror("mdckpt_load");
+		return 1;
+	}
+	if (mdckpt_hash_fd(digest, fd, &store, INTERVAL, resumed) != 0) {
+		perror("mdckpt_hash_fd");
+		return 1;
+	}
+	if (mdckpt_save(&store, store_path) != 0) {
+		perror("mdckpt_save");
+		return 1;
+	}
+	digest_ref(expected, algo, data, len);
+	if (memcmp(digest, expected, 16) != 0) {
+		fprintf(stderr, "Digest of %zu bytes from %llu failed.\n", len,
+		    (unsigned long long)*resumed);
+		return 1;
+	}
+	if (store.n == 0 || store.ckpt[store.n - 1].offset != len) {
+		fprintf(stderr, "No checkpoint at the end of %zu bytes.\n",
+		    len);
+		return 1;
+	}
+
+	return 0;
+}
+
+static int
+test_algo(int algo, uint8_t *data, const char *path,
+    const char *store_path)
+{
+	struct mdckpt_store store;
+	uint64_t resumed;
+	int fd;
+
+	unlink(store_path);
+	if ((fd = open(path, O_RDWR | O_CREAT | O_TRUNC, 0600)) < 0) {
+		perror(path);
+		return 1;
+	}
+
+	/* First sight of the file. */
+	if (write(fd, data, FILESIZE) != FILESIZE ||
+	    check(fd, store_path, algo, data, FILESIZE, &resumed) != 0)
+		goto fail;
+	if (resumed != 0) {
+		fprintf(stderr, "Resumed a new file at %llu.\n",
+		    (unsigned long long)resumed);
+		goto fail;
+	}
+
+	/* Appended, picked up at the old end. */
+	if (write(fd, data + FILESIZE, 5000) != 5000 ||
+	    check(fd, store_path, algo, data, FILESIZE + 5000, &resumed) != 0)
+		goto fail;
+	if (resumed != FILESIZE) {
+		fprintf(stderr, "Append resumed at %llu.\n",
+		    (unsigned long long)resumed);
+		goto fail;
+	}
+
+	/* Unchanged, nothing to hash. */
+	if (check(fd, store_path, algo, data, FILESIZE + 5000, &resumed) != 0)
+		goto fail;
+	if (resumed != FILESIZE + 5000) {
+		fprintf(stderr, "Unchanged file resumed at %llu.\n",
+		    (unsigned long long)resumed);
+		goto fail;
+	}
+
+	/* Rewritten just before the end, the checkpoint before is used. */
+	data[FILESIZE + 4000] ^= 1;
+	if (pwrite(fd, data + FILESIZE + 4000, 1, FILESIZE + 4000) != 1 ||
+	    check(fd, store_path, algo, data, FILESIZE + 5000, &resumed) != 0)
+		goto fail;
+	if (resumed != FILESIZE) {
+		fprintf(stderr, "Rewrite resumed at %llu.\n",
+		    (unsigned long long)resumed);
+		goto fail;
+	}
+
+	/* Truncated, only checkpoints inside the file are used. */
+	if (ftruncate(fd, 250000) != 0 ||
+	    check(fd, store_path, algo, data, 250000, &resumed) != 0)
+		goto fail;
+	if (resumed > 250000) {
+		fprintf(stderr, "Truncation resumed at %llu.\n",
+		    (unsigned long long)resumed);
+		goto fail;
+	}
+
+	/*
+	 * A context that does not match its offset, as from a hand-edited
+	 * store, is dropped even though the guard still matches.
+	 */
+	if (mdckpt_load(&store, store_path, algo) != 0 || store.n < 2) {
+		fprintf(stderr, "Store lost its checkpoints.\n");
+		goto fail;
+	}
+	memcpy(store.ckpt[store.n - 1].ctx, store.ckpt[store.n - 2].ctx,
+	    MD5_EXPORT_SIZE);
+	if (mdckpt_save(&store, store_path) != 0 ||
+	    check(fd, store_path, algo, data, 250000, &resumed) != 0)
+		goto fail;
+	if (resumed == 250000) {
+		fprintf(stderr, "Resumed from a mismatched context.\n");
+		goto fail;
+	}
+
+	close(fd);
+	printf("%s checkpoints: ok\n", algo == MDFILE_MD4 ? "MD4" : "MD5");
+	return 0;
+
+fail:
+	close(fd);
+	return 1;
+}
+
+/*
+ * A damaged store is refused.
+ */
+static int
+test_damaged(const char *store_path)
+{
+	struct mdckpt_store store;
+	int fd;
+
+	if ((fd = open(store_path, O_WRONLY)) < 0 ||
+	    pwrite(fd, "X", 1, 0) != 1) {
+		perror(store_path);
+		return 1;
+	}
+	close(fd);
+	if (mdckpt_load(&store, store_path, MDFILE_MD5) == 0) {
+		fprintf(stderr, "Damaged store accepted.\n");
+		return 1;
+	}
+	if (truncate(store_path, 40) != 0) {
+		perror(store_path);
+		return 1;
+	}
+	if (mdckpt_load(&store, store_path, MDFILE_MD5) == 0) {
+		fprintf(stderr, "Short store accepted.\n");
+		return 1;
+	}
+
+	printf("Damaged stores: ok\n");
+	return 0;
+}
+
+int
+main(void)
+{
+	char dir[] = "/tmp/test-mdckpt.XXXXXX";
+	char path[64];
+	char store_path[64];
+	uint8_t *data;
+	size_t i;
+	int ret;
+
+	if ((data = malloc(FILESIZE + 5000)) == NULL)
+		exit(1);
+	for (i = 0; i < FILESIZE + 5000; i++)
+		data[i] = rng() & 0xff;
+	if (mkdtemp(dir) == NULL) {
+		perror("mkdtemp");
+		exit(1);
+	}
+	snprintf(path, sizeof(path), "%s/file", dir);
+	snprintf(store_path, sizeof(store_path), "%s/store", dir);
+
+	ret = test_algo(MDFILE_MD5, data, path, store_path) != 0 ||
+	    test_algo(MDFILE_MD4, data, path, store_path) != 0 ||
+	    test_damaged(store_path) != 0;
+
+	unlink(path);
+	unlink(store_path);
+	rmdir(dir);
+	free(data);
+	return ret;
+}
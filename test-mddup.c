@@ -0,0 +1,272 @@
+/*-
+ * Copyright (c) 2023, Collin Funk
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHORS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <sys/stat.h>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "md5.h"
+#include "mddup.h"
+#include "test-file.h"
+#include "test.h"
+
+#define NFILES 11
+#define EDGE 256
+#define BIG 4000
+#define SMALL 300
+
+struct check {
+	char *paths[NFILES];
+	char sets[8][NFILES + 1]; /* Indices of each set as letters */
+	int nsets;
+	int nerrors;
+};
+
+static void
+record_set(struct mddup_file *const set[], size_t n, void *arg)
+{
+	struct check *c;
+	size_t i;
+
+	c = arg;
+	if (c->nsets == 8)
+		return;
+	for (i = 0; i < n && i < NFILES; i++)
+		c->sets[c->nsets][i] = 'a' + set[i]->index;
+	c->sets[c->nsets++][i] = '\0';
+}
+
+static void
+record_error(const struct mddup_file *f, void *arg)
+{
+	struct check *c;
+
+	c = arg;
+	if (f->index != NFILES - 1 || f->error != ENOENT)
+		fprintf(stderr, "%s failed: %s\n", f->path,
+		    strerror(f->error));
+	c->nerrors++;
+}
+
+static int
+run(struct check *c, const char *cache, int nthreads, const char *sets,
+    const struct mddup_stats *expected)
+{
+	struct mddup_opts opts;
+	struct mddup_stats stats;
+	char got[64];
+	int ret;
+	int i;
+
+	mddup_opts_init(&opts);
+	opts.nthreads = nthreads;
+	opts.edge = EDGE;
+	opts.cache = cache;
+	opts.error = record_error;
+	c->nsets = 0;
+	c->nerrors = 0;
+	ret = mddup_find((const char *const *)c->paths, NFILES, &opts,
+	    record_set, c, &stats);
+
+	got[0] = '\0';
+	for (i = 0; i < c->nsets; i++) {
+		strcat(got, c->sets[i]);
+		strcat(got, " ");
+	}
+	if (ret != 1 || c->nerrors != 1 || strcmp(got, sets) != 0) {
+		fprintf(stderr, "Found \"%s\" instead of \"%s\".\n", got,
+		    sets);
+		return 1;
+	}
+	if (stats.files != expected->files ||
+	    stats.links != expected->links ||
+	    stats.failed != expected->failed ||
+	    stats.edged != expected->edged ||
+	    stats.hashed != expected->hashed ||
+	    stats.cached != expected->cached ||
+	    stats.sets != expected->sets || stats.dups != expected->dups ||
+	    stats.bytes != expected->bytes ||
+	    stats.wasted != expected->wasted) {
+		fprintf(stderr, "Read %zu ends and %zu files, %llu bytes, "
+		    "%zu from cache.\n", stats.edged, stats.hashed,
+		    (unsigned long long)stats.bytes, stats.cached);
+		return 1;
+	}
+
+	return 0;
+}
+
+/*
+ * a and b are the same. c differs from them in the middle only, d at
+ * the start. e is another name for a. f and g are the same but shorter
+ * than both ends, h and i are empty, j has a size of its own and k is
+ * missing.
+ */
+static int
+make_files(struct check *c, const char *dir)
+{
+	uint8_t big[BIG + 1000];
+	uint8_t small[SMALL];
+	size_t i;
+
+	for (i = 0; i < sizeof(big); i++)
+		big[i] = rng() & 0xff;
+	for (i = 0; i < sizeof(small); i++)
+		small[i] = rng() & 0xff;
+	for (i = 0; i < NFILES; i++) {
+		if ((c->paths[i] = malloc(256)) == NULL)
+			return (-1);
+		snprintf(c->paths[i], 256, "%s/%c", dir, (int)('a' + i));
+	}
+
+	if (write_file(c->paths[0], big, BIG) != 0 ||
+	    write_file(c->paths[1], big, BIG) != 0)
+		return (-1);
+	big[BIG / 2] ^= 1;
+	if (write_file(c->paths[2], big, BIG) != 0)
+		return (-1);
+	big[BIG / 2] ^= 1;
+	big[0] ^= 1;
+	if (write_file(c->paths[3], big, BIG) != 0 ||
+	    link(c->paths[0], c->paths[4]) != 0 ||
+	    write_file(c->paths[5], small, SMALL) != 0 ||
+	    write_file(c->paths[6], small, SMALL) != 0 ||
+	    write_file(c->paths[7], small, 0) != 0 ||
+	    write_file(c->paths[8], small, 0) != 0 ||
+	    write_file(c->paths[9], big, sizeof(big)) != 0)
+		return (-1);
+
+	return (0);
+}
+
+/*
+ * Every pass with one thread and with several, then again through a
+ * cache, which should leave nothing to read, then after b changes.
+ */
+static int
+test_find(struct check *c, const char *dir)
+{
+	struct mddup_stats expected;
+	struct timespec times[2];
+	char cache[256];
+	uint8_t buf[BIG];
+	int fd;
+
+	memset(&expected, 0, sizeof(expected));
+	expected.files = NFILES;
+	expected.links = 1;
+	expected.failed = 1;
+	expected.edged = 6;
+	expected.hashed = 3;
+	expected.sets = 2;
+	expected.dups = 2;
+	expected.bytes = 4 * 2 * EDGE + 2 * SMALL + 3 * BIG;
+	expected.wasted = BIG + SMALL;
+	if (run(c, NULL, 1, "ab fg ", &expected) != 0 ||
+	    run(c, NULL, 4, "ab fg ", &expected) != 0)
+		return 1;
+	printf("Passes: ok\n");
+
+	snprintf(cache, sizeof(cache), "%s/cache", dir);
+	if (run(c, cache, 2, "ab fg ", &expected) != 0)
+		return 1;
+	expected.edged = 0;
+	expected.hashed = 0;
+	expected.cached = 9;
+	expected.bytes = 0;
+	if (run(c, cache, 2, "ab fg ", &expected) != 0)
+		return 1;
+
+	/* Change b in the middle and move its time on. */
+	if ((fd = open(c->paths[1], O_RDWR)) < 0 ||
+	    pread(fd, buf, BIG, 0) != BIG)
+		return 1;
+	buf[BIG / 2] ^= 2;
+	if (pwrite(fd, buf, BIG, 0) != BIG)
+		return 1;
+	close(fd);
+	times[0].tv_sec = times[1].tv_sec = 1000000000;
+	times[0].tv_nsec = times[1].tv_nsec = 0;
+	if (utimensat(AT_FDCWD, c->paths[1], times, 0) != 0)
+		return 1;
+	expected.edged = 1;
+	expected.hashed = 1;
+	expected.cached = 7;
+	expected.sets = 1;
+	expected.dups = 1;
+	expected.bytes = 2 * EDGE + BIG;
+	expected.wasted = SMALL;
+	if (run(c, cache, 2, "fg ", &expected) != 0)
+		return 1;
+
+	/* A damaged cache is started afresh. */
+	if ((fd = open(cache, O_WRONLY | O_TRUNC)) < 0 ||
+	    write(fd, "MDDC junk", 9) != 9)
+		return 1;
+	close(fd);
+	expected.edged = 6;
+	expected.hashed = 3;
+	expected.cached = 0;
+	expected.bytes = 4 * 2 * EDGE + 2 * SMALL + 3 * BIG;
+	if (run(c, cache, 1, "fg ", &expected) != 0)
+		return 1;
+	unlink(cache);
+	printf("Cache: ok\n");
+
+	return 0;
+}
+
+int
+main(void)
+{
+	static struct check c;
+	char dir[] = "/tmp/test-mddup.XXXXXX";
+	size_t i;
+	int ret;
+
+	if (mkdtemp(dir) == NULL) {
+		perror("mkdtemp");
+		exit(1);
+	}
+	ret = make_files(&c, dir) != 0 || test_find(&c, dir) != 0;
+
+	for (i = 0; i < NFILES; i++) {
+		if (c.paths[i] != NULL)
+			unlink(c.paths[i]);
+		free(c.paths[i]);
+	}
+	rmdir(dir);
+
+	if (ret != 0)
+		exit(1);
+	return 0;
+}
@@ -0,0 +1,219 @@
+/*-
+ * Copyright (c) 2023, Collin Funk
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHORS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "md5.h"
+#include "mdetag.h"
+#include "test-file.h"
+#include "test.h"
+
+/*
+ * The ETag computed part by part with md5_digest.
+ */
+static void
+etag_ref(char etag[MDETAG_MAX], const uint8_t *data, size_t len,
+    size_t partsize)
+{
+	static uint8_t digests[4096][16];
+	size_t nparts;
+	size_t i;
+
+	nparts = len == 0 ? 1 : (len - 1) / partsize + 1;
+	for (i = 0; i < nparts; i++) {
+		md5_digest(digests[i], data + i * partsize,
+		    len - i * partsize < partsize ? len - i * partsize :
+		    partsize);
+	}
+	mdetag_combine(etag, (const uint8_t (*)[16])digests, nparts);
+}
+
+/*
+ * Files of several sizes and part sizes, on one and several threads.
+ */
+static int
+test_files(const char *path, const uint8_t *buf)
+{
+	static const size_t sizes[] = { 0, 1, 4999, 5000, 5001, 100000 };
+	struct mdetag_opts opts;
+	char expected[MDETAG_MAX];
+	char etag[MDETAG_MAX];
+	size_t i;
+	int t;
+
+	for (i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++) {
+		if (write_file(path, buf, sizes[i]) != 0)
+			return 1;
+		etag_ref(expected, buf, sizes[i], 5000);
+		for (t = 1; t <= 4; t++) {
+			mdetag_opts_init(&opts);
+			opts.partsize = 5000;
+			opts.threshold = 0;
+			opts.nthreads = t;
+			if (mdetag_path(etag, path, &opts) != 0 ||
+			    strcmp(etag, expected) != 0) {
+				fprintf(stderr, "%zu bytes on %d threads: %s, "
+				    "expected %s.\n", sizes[i], t, etag,
+				    expected);
+				return 1;
+			}
+		}
+
+		/* Below the threshold it is the plain MD5. */
+		opts.threshold = sizes[i] + 1;
+		if (mdetag_path(etag, path, &opts) != 0 ||
+		    strlen(etag) != 32) {
+			fprintf(stderr, "Single part %zu bytes failed.\n",
+			    sizes[i]);
+			return 1;
+		}
+	}
+
+	printf("Files: ok\n");
+	return 0;
+}
+
+/*
+ * A pipe is split into parts as it is read.
+ */
+static int
+test_pipe(const uint8_t *buf)
+{
+	struct mdetag_opts opts;
+	char expected[MDETAG_MAX];
+	char etag[MDETAG_MAX];
+	size_t len;
+	int fds[2];
+
+	len = 30000;
+	if (pipe(fds) != 0 || write(fds[1], buf, len) != (ssize_t)len) {
+		perror("pipe");
+		return 1;
+	}
+	close(fds[1]);
+	mdetag_opts_init(&opts);
+	opts.partsize = 7000;
+	opts.threshold = 0;
+	etag_ref(expected, buf, len, 7000);
+	if (mdetag_fd(etag, fds[0], &opts) != 0 ||
+	    strcmp(etag, expected) != 0) {
+		fprintf(stderr, "Pipe: %s, expected %s.\n", etag, expected);
+		return 1;
+	}
+	close(fds[0]);
+
+	printf("Pipe: ok\n");
+	return 0;
+}
+
+/*
+ * The part size is recovered from the ETag and the file size.
+ */
+static int
+test_check(const char *path, const uint8_t *buf, size_t bufsize)
+{
+	char expected[MDETAG_MAX];
+	char quoted[MDETAG_MAX + 2];
+	size_t partsize;
+	size_t len;
+	int fd;
+
+	len = bufsize - 12345;
+	if (write_file(path, buf, len) != 0)
+		return 1;
+	etag_ref(expected, buf, len, 3 << 20);
+	snprintf(quoted, sizeof(quoted), "\"%s\"", expected);
+	if ((fd = open(path, O_RDONLY)) < 0 ||
+	    mdetag_check(fd, quoted, 0, &partsize) != 0 ||
+	    partsize != 3 << 20) {
+		fprintf(stderr, "Part size not found for %s.\n", expected);
+		return 1;
+	}
+
+	/* Two parts of 8 MiB, past the smallest whole MiB that fits. */
+	etag_ref(expected, buf, len, 8 << 20);
+	if (mdetag_check(fd, expected, 0, &partsize) != 0 ||
+	    partsize != 8 << 20) {
+		fprintf(stderr, "Power of two part size not found for %s.\n",
+		    expected);
+		return 1;
+	}
+
+	/* A part size that is not a whole number of MiB. */
+	etag_ref(expected, buf, len, len / 2 + 1);
+	if (mdetag_check(fd, expected, 0, &partsize) != 0 ||
+	    partsize != len / 2 + 1) {
+		fprintf(stderr, "Odd part size not found for %s.\n",
+		    expected);
+		return 1;
+	}
+
+	expected[0] = expected[0] == '0' ? '1' : '0';
+	if (mdetag_check(fd, expected, 0, &partsize) != 1) {
+		fprintf(stderr, "Wrong ETag matched.\n");
+		return 1;
+	}
+	close(fd);
+
+	printf("Check: ok\n");
+	return 0;
+}
+
+int
+main(void)
+{
+	char path[] = "/tmp/test-mdetag.XXXXXX";
+	uint8_t *buf;
+	size_t bufsize;
+	size_t i;
+	int fd;
+	int ret;
+
+	bufsize = 11 << 20;
+	if ((buf = malloc(bufsize)) == NULL)
+		exit(1);
+	for (i = 0; i < bufsize; i++)
+		buf[i] = rng() & 0xff;
+	if ((fd = mkstemp(path)) < 0) {
+		perror("mkstemp");
+		exit(1);
+	}
+	close(fd);
+
+	ret = test_files(path, buf) != 0 || test_pipe(buf) != 0 ||
+	    test_check(path, buf, bufsize) != 0;
+
+	unlink(path);
+	free(buf);
+	if (ret != 0)
+		exit(1);
+	return 0;
+}
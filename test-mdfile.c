@@ -0,0 +1,157 @@
+/*-
+ * Copyright (c) 2023, Collin Funk
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHORS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "md4.h"
+#include "md5.h"
+#include "mdfile.h"
+#include "test-file.h"
+#include "test.h"
+
+/*
+ * Every method and both algorithms over files of awkward sizes, with
+ * buffers and windows small enough to cross many boundaries.
+ */
+static int
+test_files(const uint8_t *buf)
+{
+	static const size_t sizes[] = { 0, 1, 63, 64, 4095, 4096, 100003,
+	    1 << 20 };
+	static const char *methods[] = { "auto", "mmap", "thread", "read" };
+	struct mdfile_opts opts;
+	char path[] = "/tmp/test-mdfile.XXXXXX";
+	uint8_t digest[16];
+	uint8_t expected[16];
+	size_t i;
+	size_t m;
+	int algo;
+	int fd;
+
+	if ((fd = mkstemp(path)) < 0) {
+		perror("mkstemp");
+		return 1;
+	}
+	for (i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++) {
+		if (ftruncate(fd, 0) != 0 || lseek(fd, 0, SEEK_SET) != 0 ||
+		    write(fd, buf, sizes[i]) != (ssize_t)sizes[i]) {
+			perror("write");
+			goto fail;
+		}
+		for (algo = MDFILE_MD5; algo <= MDFILE_MD4; algo++) {
+			digest_ref(expected, algo, buf, sizes[i]);
+			for (m = 0; m < sizeof(methods) / sizeof(methods[0]);
+			    m++) {
+				mdfile_opts_init(&opts);
+				opts.method = mdfile_method(methods[m]);
+				opts.bufsize = 1000 + rng() % 9000;
+				opts.mapsize = 4096 * (1 + rng() % 8);
+				if (mdfile_hash_path(digest, algo, path,
+				    &opts) != 0 ||
+				    memcmp(digest, expected, 16) != 0) {
+					fprintf(stderr, "%s %s of %zu bytes "
+					    "failed.\n", mdfile_algo_name(algo),
+					    methods[m], sizes[i]);
+					goto fail;
+				}
+			}
+		}
+	}
+
+	/* Hashing starts at the current offset, so mapping is skipped. */
+	lseek(fd, 1000, SEEK_SET);
+	md5_digest(expected, buf + 1000, sizes[i - 1] - 1000);
+	if (mdfile_hash_fd(digest, MDFILE_MD5, fd, NULL) != 0 ||
+	    memcmp(digest, expected, 16) != 0) {
+		fprintf(stderr, "Hash from an offset failed.\n");
+		goto fail;
+	}
+
+	close(fd);
+	unlink(path);
+	printf("Files: ok\n");
+	return 0;
+
+fail:
+	close(fd);
+	unlink(path);
+	return 1;
+}
+
+/*
+ * A pipe cannot be mapped or sized, so it must be read ahead.
+ */
+static int
+test_pipe(const uint8_t *buf)
+{
+	uint8_t digest[16];
+	uint8_t expected[16];
+	size_t len;
+	int fds[2];
+
+	len = 12345;
+	if (pipe(fds) != 0 || write(fds[1], buf, len) != (ssize_t)len) {
+		perror("pipe");
+		return 1;
+	}
+	close(fds[1]);
+	md5_digest(expected, buf, len);
+	if (mdfile_hash_fd(digest, MDFILE_MD5, fds[0], NULL) != 0 ||
+	    memcmp(digest, expected, 16) != 0) {
+		fprintf(stderr, "Pipe failed.\n");
+		return 1;
+	}
+	close(fds[0]);
+
+	printf("Pipe: ok\n");
+	return 0;
+}
+
+int
+main(void)
+{
+	uint8_t *buf;
+	size_t bufsize;
+	size_t i;
+
+	bufsize = 1 << 20;
+	if ((buf = malloc(bufsize)) == NULL)
+		exit(1);
+	for (i = 0; i < bufsize; i++)
+		buf[i] = rng() & 0xff;
+
+	if (test_files(buf) != 0)
+		exit(1);
+	if (test_pipe(buf) != 0)
+		exit(1);
+
+	free(buf);
+	return 0;
+}
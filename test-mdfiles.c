@@ -0,0 +1,243 @@
+/*-
+ * Copyright (c) 2023, Collin Funk
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHORS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <sys/stat.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "md5.h"
+#include "mdcache.h"
+#include "mdfiles.h"
+#include "test-file.h"
+#include "test.h"
+
+#define NFILES 300
+
+struct check {
+	char *paths[NFILES + 1];
+	uint8_t expected[NFILES + 1][16];
+	int seen[NFILES + 1];
+	size_t next;
+	int ordered;
+	int failed;
+	size_t cached;
+};
+
+static void
+check_result(const struct mdfiles_result *r, void *arg)
+{
+	struct check *c;
+
+	c = arg;
+	if (c->ordered && r->index != c->next++) {
+		fprintf(stderr, "%s reported out of order.\n", r->path);
+		c->failed = 1;
+	}
+	c->seen[r->index]++;
+	c->cached += r->cached;
+	if (r->index == NFILES) {
+		/* The last path does not exist. */
+		if (r->error == 0) {
+			fprintf(stderr, "Missing file hashed.\n");
+			c->failed = 1;
+		}
+	} else if (r->error != 0 ||
+	    memcmp(r->digest, c->expected[r->index], 16) != 0) {
+		fprintf(stderr, "%s failed.\n", r->path);
+		c->failed = 1;
+	}
+}
+
+/*
+ * A mix of empty, small and large files hashed with different numbers
+ * of threads, in order and as completed.
+ */
+static int
+test_pool(struct check *c)
+{
+	struct mdfiles_opts opts;
+	int nthreads;
+	int ordered;
+	size_t i;
+	int ret;
+
+	for (nthreads = 1; nthreads <= 8; nthreads *= 2) {
+		for (ordered = 0; ordered <= 1; ordered++) {
+			memset(c->seen, 0, sizeof(c->seen));
+			c->next = 0;
+			c->ordered = ordered;
+			mdfiles_opts_init(&opts);
+			opts.nthreads = nthreads;
+			opts.ordered = ordered;
+			opts.batch = 64 * 1024;
+			opts.file.bufsize = 8192;
+			ret = mdfiles_hash((const char *const *)c->paths,
+			    NFILES + 1, &opts, check_result, c);
+			if (ret != 1 || c->failed) {
+				fprintf(stderr, "Pool of %d failed.\n",
+				    nthreads);
+				return 1;
+			}
+			for (i = 0; i <= NFILES; i++) {
+				if (c->seen[i] != 1) {
+					fprintf(stderr, "%s reported %d "
+					    "times.\n", c->paths[i],
+					    c->seen[i]);
+					return 1;
+				}
+			}
+		}
+	}
+
+	printf("Pool: ok\n");
+	return 0;
+}
+
+/*
+ * Through a cache every file is read the first time and none the second.
+ */
+static int
+test_cache(struct check *c, const char *dir)
+{
+	struct mdfiles_opts opts;
+	struct mdcache cache;
+	char path[256];
+	int round;
+
+	snprintf(path, sizeof(path), "%s/cache", dir);
+	if (mdcache_open(&cache, path, MDFILE_MD5, 16 * 1024) != 0) {
+		perror(path);
+		return 1;
+	}
+	cache.settle = 0;
+	for (round = 0; round < 2; round++) {
+		memset(c->seen, 0, sizeof(c->seen));
+		c->cached = 0;
+		c->ordered = 0;
+		mdfiles_opts_init(&opts);
+		opts.nthreads = 4;
+		opts.ordered = 0;
+		opts.cache = &cache;
+		if (mdfiles_hash((const char *const *)c->paths, NFILES + 1,
+		    &opts, check_result, c) != 1 || c->failed ||
+		    c->cached != (round == 0 ? 0 : NFILES)) {
+			fprintf(stderr, "Round %d took %zu from the cache.\n",
+			    round, c->cached);
+			return 1;
+		}
+	}
+	mdcache_close(&cache);
+	unlink(path);
+
+	printf("Cache: ok\n");
+	return 0;
+}
+
+/*
+ * Walking the directory finds every file once, in name order.
+ */
+static int
+test_walk(struct check *c, const char *dir)
+{
+	struct mdfiles_list list;
+	size_t i;
+
+	memset(&list, 0, sizeof(list));
+	if (mdfiles_list_add(&list, dir) != 0 || list.n != NFILES) {
+		fprintf(stderr, "Walk found %zu files.\n", list.n);
+		return 1;
+	}
+	for (i = 0; i < NFILES; i++) {
+		if (strcmp(list.paths[i], c->paths[i]) != 0) {
+			fprintf(stderr, "Walk found %s for %s.\n",
+			    list.paths[i], c->paths[i]);
+			return 1;
+		}
+	}
+	mdfiles_list_free(&list);
+
+	printf("Walk: ok\n");
+	return 0;
+}
+
+int
+main(void)
+{
+	static struct check c;
+	char dir[] = "/tmp/test-mdfiles.XXXXXX";
+	char sub[128];
+	uint8_t *buf;
+	size_t bufsize;
+	size_t len;
+	size_t i;
+	int ret;
+
+	bufsize = 1 << 20;
+	if ((buf = malloc(bufsize)) == NULL)
+		exit(1);
+	for (i = 0; i < bufsize; i++)
+		buf[i] = rng() & 0xff;
+
+	if (mkdtemp(dir) == NULL) {
+		perror("mkdtemp");
+		exit(1);
+	}
+	snprintf(sub, sizeof(sub), "%s/sub", dir);
+	mkdir(sub, 0700);
+	for (i = 0; i <= NFILES; i++) {
+		if ((c.paths[i] = malloc(256)) == NULL)
+			exit(1);
+		snprintf(c.paths[i], 256, "%s/%s%03zu", i < NFILES / 2 ?
+		    dir : sub, i == NFILES ? "missing" : "f", i);
+		if (i == NFILES)
+			break;
+		len = rng() % 16 == 0 ? rng() % bufsize : rng() % 5000;
+		if (i % 50 == 0)
+			len = 0;
+		md5_digest(c.expected[i], buf, len);
+		if (write_file(c.paths[i], buf, len) != 0)
+			exit(1);
+	}
+
+	ret = test_pool(&c) != 0 || test_walk(&c, dir) != 0 ||
+	    test_cache(&c, dir) != 0;
+
+	for (i = 0; i < NFILES; i++)
+		unlink(c.paths[i]);
+	for (i = 0; i <= NFILES; i++)
+		free(c.paths[i]);
+	rmdir(sub);
+	rmdir(dir);
+	free(buf);
+
+	if (ret != 0)
+		exit(1);
+	return 0;
+}
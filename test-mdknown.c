@@ -0,0 +1,371 @@
+/*-
+ * Copyright (c) 2023, Collin Funk
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHORS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "md5.h"
+#include "mdfile.h"
+#include "mdknown.h"
+#include "test-file.h"
+#include "test.h"
+
+#define NDIGESTS 100000
+#define NFILES 40
+
+struct seen {
+	int known[NFILES + 1];
+	int errors;
+	size_t calls;
+};
+
+static void
+random_digest(uint8_t digest[16])
+{
+	int i;
+
+	for (i = 0; i < 16; i++)
+		digest[i] = rng();
+}
+
+static int
+add_digest(struct mdknown_list *list, const uint8_t digest[16])
+{
+	uint8_t (*p)[16];
+
+	if (list->n == list->cap) {
+		list->cap = list->cap ? list->cap * 2 : 1024;
+		if ((p = realloc(list->digests, list->cap * 16)) == NULL)
+			return (-1);
+		list->digests = p;
+	}
+	memcpy(list->digests[list->n++], digest, 16);
+	return (0);
+}
+
+/*
+ * Digests are found in md5sum lines, bare, or after a longer hash.
+ */
+static int
+test_parse(const char *dir)
+{
+	static const char *text =
+	    "# reference set\n"
+	    "d41d8cd98f00b204e9800998ecf8427e  empty\n"
+	    "0CC175B9C0F1B6A831C399E269772661\n"
+	    "\"DA39A3EE5E6B4B0D3255BFEF95601890AFD80709\","
+	    "\"900150983CD24FB0D6963F7D28E17F72\",\"abc\"\n"
+	    "da39a3ee5e6b4b0d3255bfef95601890afd80709\n"
+	    "not a digest\n"
+	    "f96b697d7cb7938d525a2f31aaf161d0x\r\n";
+	static const uint8_t expected[4][16] = {
+		{ 0xd4, 0x1d, 0x8c, 0xd9, 0x8f, 0x00, 0xb2, 0x04,
+		  0xe9, 0x80, 0x09, 0x98, 0xec, 0xf8, 0x42, 0x7e },
+		{ 0x0c, 0xc1, 0x75, 0xb9, 0xc0, 0xf1, 0xb6, 0xa8,
+		  0x31, 0xc3, 0x99, 0xe2, 0x69, 0x77, 0x26, 0x61 },
+		{ 0x90, 0x01, 0x50, 0x98, 0x3c, 0xd2, 0x4f, 0xb0,
+		  0xd6, 0x96, 0x3f, 0x7d, 0x28, 0xe1, 0x7f, 0x72 },
+		{ 0xf9, 0x6b, 0x69, 0x7d, 0x7c, 0xb7, 0x93, 0x8d,
+		  0x52, 0x5a, 0x2f, 0x31, 0xaa, 0xf1, 0x61, 0xd0 }
+	};
+	struct mdknown_list list;
+	char path[64];
+	FILE *fp;
+
+	snprintf(path, sizeof(path), "%s/list", dir);
+	if ((fp = fopen(path, "w")) == NULL || fputs(text, fp) == EOF ||
+	    fclose(fp) != 0) {
+		perror(path);
+		return 1;
+	}
+	memset(&list, 0, sizeof(list));
+	if ((fp = fopen(path, "r")) == NULL || mdknown_parse(&list, fp) != 0) {
+		perror(path);
+		return 1;
+	}
+	fclose(fp);
+	unlink(path);
+
+	if (list.n != 4 || list.invalid != 2 ||
+	    memcmp(list.digests, expected, sizeof(expected)) != 0) {
+		fprintf(stderr, "Parsed %zu digests and %zu bad lines.\n",
+		    list.n, list.invalid);
+		return 1;
+	}
+	mdknown_list_free(&list);
+
+	printf("Parsing: ok\n");
+	return 0;
+}
+
+/*
+ * Every digest written is found, one at a time and in batches, and
+ * others are not.
+ */
+static int
+test_lookup(const char *dir, size_t n)
+{
+	static uint8_t absent[NDIGESTS][16];
+	static int hit[NDIGESTS];
+	struct mdknown_list list;
+	struct mdknown known;
+	char path[64];
+	size_t i;
+
+	memset(&list, 0, sizeof(list));
+	for (i = 0; i < n; i++) {
+		if (list.n == 0 || rng() % 10 != 0)
+			random_digest(absent[0]);
+		else
+			memcpy(absent[0], list.digests[rng() % list.n], 16);
+		if (add_digest(&list, absent[0]) != 0)
+			return 1;
+	}
+	for (i = 0; i < NDIGESTS; i++)
+		random_digest(absent[i]);
+
+	snprintf(path, sizeof(path), "%s/db", dir);
+	if (mdknown_write(path, MDFILE_MD5, &list, 0) != 0 ||
+	    mdknown_open(&known, path) != 0) {
+		perror(path);
+		return 1;
+	}
+	if (known.count > n || (n > 100 && known.count < n * 8 / 10)) {
+		fprintf(stderr, "%llu distinct digests of %zu.\n",
+		    (unsigned long long)known.count, n);
+		return 1;
+	}
+
+	for (i = 0; i < n; i++) {
+		if (!mdknown_lookup(&known, list.digests[i])) {
+			fprintf(stderr, "Digest %zu of %zu is missing.\n", i,
+			    n);
+			return 1;
+		}
+	}
+	mdknown_lookup_batch(&known, hit, (const uint8_t (*)[16])list.digests,
+	    n);
+	for (i = 0; i < n; i++) {
+		if (!hit[i]) {
+			fprintf(stderr, "Batch missed digest %zu of %zu.\n",
+			    i, n);
+			return 1;
+		}
+	}
+	mdknown_lookup_batch(&known, hit, (const uint8_t (*)[16])absent,
+	    NDIGESTS);
+	for (i = 0; i < NDIGESTS; i++) {
+		if (hit[i] || mdknown_lookup(&known, absent[i])) {
+			fprintf(stderr, "Found an absent digest.\n");
+			return 1;
+		}
+	}
+
+	printf("Lookups in %llu digests: ok\n",
+	    (unsigned long long)known.count);
+	mdknown_close(&known);
+	mdknown_list_free(&list);
+	unlink(path);
+	return 0;
+}
+
+/*
+ * A damaged index, a truncated database or a stray file is refused.
+ */
+static int
+test_damaged(const char *dir)
+{
+	struct mdknown_list list;
+	struct mdknown known;
+	uint8_t digest[16];
+	char path[64];
+	uint64_t bad;
+	off_t off;
+	size_t i;
+	int fd;
+
+	memset(&list, 0, sizeof(list));
+	for (i = 0; i < 1000; i++) {
+		random_digest(digest);
+		if (add_digest(&list, digest) != 0)
+			return 1;
+	}
+	snprintf(path, sizeof(path), "%s/db", dir);
+	if (mdknown_write(path, MDFILE_MD5, &list, 0) != 0 ||
+	    mdknown_open(&known, path) != 0) {
+		perror(path);
+		return 1;
+	}
+	off = (const uint8_t *)&known.index[1] - (const uint8_t *)known.map;
+	mdknown_close(&known);
+	bad = (uint64_t)1 << 40;
+	if ((fd = open(path, O_WRONLY)) < 0 ||
+	    pwrite(fd, &bad, sizeof(bad), off) != sizeof(bad) ||
+	    close(fd) != 0) {
+		perror(path);
+		return 1;
+	}
+	if (mdknown_open(&known, path) == 0 || errno != EINVAL) {
+		fprintf(stderr, "Opened a database with a bad index.\n");
+		return 1;
+	}
+	if (truncate(path, 1000) != 0) {
+		perror(path);
+		return 1;
+	}
+	if (mdknown_open(&known, path) == 0 || errno != EINVAL) {
+		fprintf(stderr, "Opened a truncated database.\n");
+		return 1;
+	}
+	if ((fd = open(path, O_WRONLY | O_TRUNC)) < 0 ||
+	    write(fd, list.digests, 1000) != 1000 || close(fd) != 0) {
+		perror(path);
+		return 1;
+	}
+	if (mdknown_open(&known, path) == 0 || errno != EINVAL) {
+		fprintf(stderr, "Opened a stray file.\n");
+		return 1;
+	}
+	mdknown_list_free(&list);
+	unlink(path);
+
+	printf("Damaged: ok\n");
+	return 0;
+}
+
+static void
+note_file(const struct mdfiles_result *r, int known, void *arg)
+{
+	struct seen *seen;
+
+	seen = arg;
+	seen->calls++;
+	if (r->error != 0) {
+		seen->errors++;
+		return;
+	}
+	seen->known[r->index] = known;
+}
+
+/*
+ * Files hashed and looked up, every third one known.
+ */
+static int
+test_check(const char *dir)
+{
+	struct mdknown_stats stats;
+	struct mdknown_list list;
+	struct mdknown known;
+	struct seen seen;
+	const char *paths[NFILES + 1];
+	char names[NFILES + 1][64];
+	uint8_t data[4096];
+	uint8_t digest[16];
+	size_t len;
+	char db[64];
+	int i;
+
+	memset(&list, 0, sizeof(list));
+	for (i = 0; i < NFILES; i++) {
+		snprintf(names[i], sizeof(names[i]), "%s/f%d", dir, i);
+		len = rng() % sizeof(data);
+		for (size_t j = 0; j < len; j++)
+			data[j] = rng();
+		if (write_file(names[i], data, len) != 0)
+			return 1;
+		if (i % 3 == 0) {
+			md5_digest(digest, data, len);
+			if (add_digest(&list, digest) != 0)
+				return 1;
+		}
+		paths[i] = names[i];
+	}
+	snprintf(names[NFILES], sizeof(names[NFILES]), "%s/missing", dir);
+	paths[NFILES] = names[NFILES];
+
+	snprintf(db, sizeof(db), "%s/db", dir);
+	if (mdknown_write(db, MDFILE_MD5, &list, 0) != 0 ||
+	    mdknown_open(&known, db) != 0) {
+		perror(db);
+		return 1;
+	}
+	memset(&seen, 0, sizeof(seen));
+	if (mdknown_check(&known, paths, NFILES + 1, NULL, note_file, &seen,
+	    &stats) != 0) {
+		perror("mdknown_check");
+		return 1;
+	}
+	for (i = 0; i < NFILES; i++) {
+		if (seen.known[i] != (i % 3 == 0)) {
+			fprintf(stderr, "File %d known is %d.\n", i,
+			    seen.known[i]);
+			return 1;
+		}
+		unlink(names[i]);
+	}
+	if (seen.calls != NFILES + 1 || seen.errors != 1 ||
+	    stats.known != (NFILES + 2) / 3 ||
+	    stats.unknown != NFILES - (NFILES + 2) / 3 ||
+	    stats.unreadable != 1) {
+		fprintf(stderr, "Check counts are off.\n");
+		return 1;
+	}
+	mdknown_close(&known);
+	mdknown_list_free(&list);
+	unlink(db);
+
+	printf("Check: ok\n");
+	return 0;
+}
+
+int
+main(void)
+{
+	char dir[] = "/tmp/test-mdknown.XXXXXX";
+	int ret;
+
+	if (mkdtemp(dir) == NULL) {
+		perror("mkdtemp");
+		exit(1);
+	}
+	ret = test_parse(dir) != 0 ||
+	    test_lookup(dir, 0) != 0 ||
+	    test_lookup(dir, 1) != 0 ||
+	    test_lookup(dir, 9) != 0 ||
+	    test_lookup(dir, NDIGESTS) != 0 ||
+	    test_damaged(dir) != 0 ||
+	    test_check(dir) != 0;
+	rmdir(dir);
+
+	if (ret != 0)
+		exit(1);
+	return 0;
+}
@@ -0,0 +1,113 @@
+/*-
+ * Copyright (c) 2023, Collin Funk
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHORS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "md4.h"
+#include "md5.h"
+#include "mdfile.h"
+#include "mdprefix.h"
+#include "test-file.h"
+#include "test.h"
+
+#define NPREFIX (MDPREFIX_SLOTS + 4)
+#define NMSG 2000
+
+/*
+ * Messages made of one of NPREFIX prefixes and a random suffix, compared
+ * with hashing the whole message. There are more prefixes than slots so
+ * some are evicted and hashed again.
+ */
+static int
+test_algo(int algo, const uint8_t *buf, size_t bufsize)
+{
+	struct mdprefix_cache cache;
+	uint8_t expected[16];
+	uint8_t digest[16];
+	uint8_t msg[8192];
+	size_t plen[NPREFIX];
+	size_t off[NPREFIX];
+	size_t len;
+	size_t p;
+	int i;
+
+	for (p = 0; p < NPREFIX; p++) {
+		plen[p] = p < 4 ? p * 64 : rng() % 4097;
+		off[p] = rng() % (bufsize - plen[p]);
+	}
+
+	mdprefix_init(&cache, algo);
+	for (i = 0; i < NMSG; i++) {
+		/* Mostly the first few prefixes, so they stay cached. */
+		p = rng() % 4 != 0 ? rng() % 4 : rng() % NPREFIX;
+		len = rng() % 200;
+		memcpy(msg, buf + off[p], plen[p]);
+		memcpy(msg + plen[p], buf + i, len);
+		mdprefix_digest(&cache, digest, msg, plen[p], msg + plen[p],
+		    len);
+
+		digest_ref(expected, algo, msg, plen[p] + len);
+		if (memcmp(digest, expected, 16) != 0) {
+			fprintf(stderr, "Message %d with prefix %zu failed.\n",
+			    i, p);
+			return 1;
+		}
+	}
+	if (cache.hits < NMSG / 2) {
+		fprintf(stderr, "Only %llu of %d lookups hit.\n",
+		    (unsigned long long)cache.hits, NMSG);
+		return 1;
+	}
+	mdprefix_free(&cache);
+
+	printf("%s prefixes: ok\n", algo == MDFILE_MD4 ? "MD4" : "MD5");
+	return 0;
+}
+
+int
+main(void)
+{
+	uint8_t *buf;
+	size_t bufsize;
+	size_t i;
+
+	bufsize = 1 << 16;
+	if ((buf = malloc(bufsize)) == NULL)
+		exit(1);
+	for (i = 0; i < bufsize; i++)
+		buf[i] = rng() & 0xff;
+
+	if (test_algo(MDFILE_MD5, buf, bufsize) != 0)
+		exit(1);
+	if (test_algo(MDFILE_MD4, buf, bufsize) != 0)
+		exit(1);
+
+	free(buf);
+	return 0;
+}
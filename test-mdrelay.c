@@ -0,0 +1,308 @@
+/*-
+ * Copyright (c) 2023, Collin Funk
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHORS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <sys/types.h>
+#include <sys/socket.h>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "md4.h"
+#include "md5.h"
+#include "mdfile.h"
+#include "mdrelay.h"
+#include "test-file.h"
+#include "test.h"
+
+#define BUFSIZE ((1 << 20) + 7)
+
+struct feed {
+	int fd;
+	const uint8_t *buf;
+	size_t len;
+	uint8_t *out;
+	size_t got;
+};
+
+/*
+ * Write the input in uneven pieces, then end the stream.
+ */
+static void *
+feed_writer(void *arg)
+{
+	struct feed *f;
+	size_t off;
+	ssize_t n;
+
+	f = arg;
+	for (off = 0; off < f->len; off += n) {
+		n = 1 + (off * 7919) % 30011;
+		if ((size_t)n > f->len - off)
+			n = f->len - off;
+		if ((n = write(f->fd, f->buf + off, n)) < 0)
+			break;
+	}
+	shutdown(f->fd, SHUT_WR);
+	return (NULL);
+}
+
+static void *
+feed_reader(void *arg)
+{
+	struct feed *f;
+	ssize_t n;
+
+	f = arg;
+	while ((n = read(f->fd, f->out + f->got, BUFSIZE - f->got)) > 0)
+		f->got += n;
+	return (NULL);
+}
+
+/*
+ * Socket to socket through every method, with pipes smaller and larger
+ * than the writes.
+ */
+static int
+test_sockets(const uint8_t *buf, uint8_t *out)
+{
+	static const size_t sizes[] = { 0, 1, 4095, 100003, BUFSIZE };
+	static const char *methods[] = { "auto", "splice", "copy" };
+	struct mdrelay_opts opts;
+	struct feed wr;
+	struct feed rd;
+	pthread_t wt;
+	pthread_t rt;
+	uint8_t digest[16];
+	uint8_t expected[16];
+	uint64_t total;
+	int in[2];
+	int dst[2];
+	size_t i;
+	size_t m;
+	int algo;
+	int ret;
+
+	for (i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++) {
+		for (algo = MDFILE_MD5; algo <= MDFILE_MD4; algo++) {
+			digest_ref(expected, algo, buf, sizes[i]);
+			for (m = 0; m < sizeof(methods) / sizeof(methods[0]);
+			    m++) {
+				if (socketpair(AF_UNIX, SOCK_STREAM, 0,
+				    in) != 0 ||
+				    socketpair(AF_UNIX, SOCK_STREAM, 0,
+				    dst) != 0) {
+					perror("socketpair");
+					return 1;
+				}
+				wr.fd = in[0];
+				wr.buf = buf;
+				wr.len = sizes[i];
+				rd.fd = dst[1];
+				rd.out = out;
+				rd.got = 0;
+				pthread_create(&wt, NULL, feed_writer, &wr);
+				pthread_create(&rt, NULL, feed_reader, &rd);
+
+				mdrelay_opts_init(&opts);
+				opts.algo = algo;
+				opts.method = mdrelay_method(methods[m]);
+				opts.bufsize = 4096 << (rng() % 6);
+				ret = mdrelay(digest, in[1], dst[0], &opts,
+				    &total);
+				shutdown(dst[0], SHUT_WR);
+				pthread_join(wt, NULL);
+				pthread_join(rt, NULL);
+				close(in[0]);
+				close(in[1]);
+				close(dst[0]);
+				close(dst[1]);
+
+				if (ret != 0 || total != sizes[i] ||
+				    rd.got != sizes[i] ||
+				    memcmp(out, buf, sizes[i]) != 0 ||
+				    memcmp(digest, expected, 16) != 0) {
+					fprintf(stderr, "%s %s of %zu bytes "
+					    "failed.\n", mdfile_algo_name(algo),
+					    methods[m], sizes[i]);
+					return 1;
+				}
+			}
+		}
+	}
+
+	printf("Sockets: ok\n");
+	return 0;
+}
+
+/*
+ * A file relayed to a file, then to a file opened for appending, which
+ * cannot be spliced to and so is copied to unless splice is insisted on.
+ */
+static int
+test_files(const uint8_t *buf, uint8_t *out)
+{
+	static const char *methods[] = { "auto", "copy", "splice" };
+	struct mdrelay_opts opts;
+	char src[] = "/tmp/test-mdrelay.XXXXXX";
+	char dst[] = "/tmp/test-mdrelay.XXXXXX";
+	uint8_t digest[16];
+	uint8_t expected[16];
+	uint64_t total;
+	size_t m;
+	int flags;
+	int in;
+	int fd;
+	int ret;
+
+	if ((in = mkstemp(src)) < 0 || (fd = mkstemp(dst)) < 0) {
+		perror("mkstemp");
+		return 1;
+	}
+	close(fd);
+	if (write(in, buf, BUFSIZE) != BUFSIZE) {
+		perror(src);
+		return 1;
+	}
+	md5_digest(expected, buf, BUFSIZE);
+
+	ret = 1;
+	for (m = 0; m < sizeof(methods) / sizeof(methods[0]); m++) {
+		mdrelay_opts_init(&opts);
+		opts.method = mdrelay_method(methods[m]);
+		flags = O_WRONLY | O_TRUNC | (m == 0 ? 0 : O_APPEND);
+		if (lseek(in, 0, SEEK_SET) != 0 ||
+		    (fd = open(dst, flags)) < 0) {
+			perror(dst);
+			goto out;
+		}
+		if (opts.method == MDRELAY_SPLICE) {
+			if (mdrelay(digest, in, fd, &opts, &total) == 0 ||
+			    total != 0) {
+				fprintf(stderr, "Spliced to an appending "
+				    "file.\n");
+				goto out;
+			}
+			close(fd);
+			continue;
+		}
+		if (mdrelay(digest, in, fd, &opts, &total) != 0 ||
+		    total != BUFSIZE || memcmp(digest, expected, 16) != 0) {
+			fprintf(stderr, "File %s failed.\n", methods[m]);
+			goto out;
+		}
+		close(fd);
+		if ((fd = open(dst, O_RDONLY)) < 0 ||
+		    mdfile_read(fd, out, BUFSIZE) != BUFSIZE ||
+		    memcmp(out, buf, BUFSIZE) != 0) {
+			fprintf(stderr, "File %s copied wrong.\n",
+			    methods[m]);
+			goto out;
+		}
+		close(fd);
+	}
+	ret = 0;
+	printf("Files: ok\n");
+
+out:
+	close(in);
+	unlink(src);
+	unlink(dst);
+	return ret;
+}
+
+/*
+ * A reader that goes away is an error, not a hang.
+ */
+static int
+test_closed(const uint8_t *buf)
+{
+	static const char *methods[] = { "splice", "copy" };
+	struct mdrelay_opts opts;
+	char src[] = "/tmp/test-mdrelay.XXXXXX";
+	uint8_t digest[16];
+	int dst[2];
+	size_t m;
+	int in;
+
+	if ((in = mkstemp(src)) < 0 || write(in, buf, BUFSIZE) != BUFSIZE) {
+		perror(src);
+		return 1;
+	}
+	unlink(src);
+	signal(SIGPIPE, SIG_IGN);
+	for (m = 0; m < sizeof(methods) / sizeof(methods[0]); m++) {
+		if (socketpair(AF_UNIX, SOCK_STREAM, 0, dst) != 0) {
+			perror("socketpair");
+			return 1;
+		}
+		close(dst[1]);
+		mdrelay_opts_init(&opts);
+		opts.method = mdrelay_method(methods[m]);
+		lseek(in, 0, SEEK_SET);
+		if (mdrelay(digest, in, dst[0], &opts, NULL) == 0 ||
+		    errno != EPIPE) {
+			fprintf(stderr, "%s to a closed socket: %s\n",
+			    methods[m], strerror(errno));
+			return 1;
+		}
+		close(dst[0]);
+	}
+	close(in);
+
+	printf("Closed: ok\n");
+	return 0;
+}
+
+int
+main(void)
+{
+	uint8_t *buf;
+	uint8_t *out;
+	size_t i;
+
+	if ((buf = malloc(BUFSIZE)) == NULL || (out = malloc(BUFSIZE)) == NULL)
+		exit(1);
+	for (i = 0; i < BUFSIZE; i++)
+		buf[i] = rng() & 0xff;
+
+	if (test_sockets(buf, out) != 0)
+		exit(1);
+	if (test_files(buf, out) != 0)
+		exit(1);
+	if (test_closed(buf) != 0)
+		exit(1);
+
+	free(buf);
+	free(out);
+	return 0;
+}
@@ -0,0 +1,285 @@
+/*-
+ * Copyright (c) 2023, Collin Funk
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHORS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "mdring.h"
+#include "test.h"
+
+#define NSERVERS 50
+#define NKEYS 2000
+
+static char names[NSERVERS][32];
+static const char *namep[NSERVERS];
+
+/*
+ * Servers for keys on a ring of four, from the libketama algorithm.
+ */
+static int
+test_vectors(void)
+{
+	static const char *servers[4] = {
+		"10.0.1.1:11211", "10.0.1.2:11211", "10.0.1.3:11211",
+		"10.0.1.4:11211"
+	};
+	static const char *keys[8] = {
+		"foo", "bar", "baz", "memcached", "user:1001", "session-42",
+		"", "x"
+	};
+	static const int expected[8] = { 1, 3, 1, 2, 3, 1, 3, 3 };
+	struct mdring r;
+	const char *s;
+	int i;
+
+	mdring_init(&r);
+	if (mdring_add_many(&r, servers, NULL, 4) != 0) {
+		perror("mdring_add_many");
+		return 1;
+	}
+	if (r.npoints != 640 || r.points[0].point != 4398564 ||
+	    r.points[639].point != 4290013132U) {
+		fprintf(stderr, "Ring points are off.\n");
+		return 1;
+	}
+	for (i = 0; i < 8; i++) {
+		s = mdring_lookup(&r, keys[i], strlen(keys[i]));
+		printf("Key #%02d: %s\n", i + 1, s);
+		if (s == NULL || strcmp(s, servers[expected[i]]) != 0) {
+			fprintf(stderr, "Test %d failed.\n", i + 1);
+			return 1;
+		}
+	}
+	mdring_free(&r);
+
+	return 0;
+}
+
+/*
+ * Server of the first point at or after h by a linear scan.
+ */
+static int
+find_ref(const struct mdring *r, uint32_t h)
+{
+	size_t i;
+
+	for (i = 0; i < r->npoints; i++) {
+		if (r->points[i].point >= h)
+			return (r->points[i].server);
+	}
+	return (r->points[0].server);
+}
+
+static int
+check_find(const struct mdring *r)
+{
+	uint32_t h;
+	size_t i;
+
+	for (i = 0; i < 3 * NKEYS; i++) {
+		switch (i % 3) {
+		case 0:
+			h = rng();
+			break;
+		case 1:
+			h = r->points[rng() % r->npoints].point;
+			break;
+		default:
+			h = r->points[rng() % r->npoints].point + 1;
+			break;
+		}
+		if (i < 2)
+			h = i == 0 ? 0 : UINT32_MAX;
+		if (mdring_find(r, h) != find_ref(r, h)) {
+			fprintf(stderr, "Lookup of %08x failed.\n", h);
+			return 1;
+		}
+	}
+	return 0;
+}
+
+/*
+ * Same points, by name, on two rings.
+ */
+static int
+same_ring(const struct mdring *a, const struct mdring *b)
+{
+	size_t i;
+
+	if (a->npoints != b->npoints)
+		return 0;
+	for (i = 0; i < a->npoints; i++) {
+		if (a->points[i].point != b->points[i].point ||
+		    strcmp(a->servers[a->points[i].server].name,
+		    b->servers[b->points[i].server].name) != 0)
+			return 0;
+	}
+	return 1;
+}
+
+/*
+ * Servers added one at a time or removed give the ring built from
+ * scratch, and keys move only off removed servers.
+ */
+static int
+test_incremental(void)
+{
+	const char *after[NKEYS];
+	const char *batch[NKEYS];
+	const void *keys[NKEYS];
+	size_t lens[NKEYS];
+	char keybuf[NKEYS][16];
+	struct mdring a;
+	struct mdring b;
+	size_t moved;
+	int before[NKEYS];
+	int i;
+
+	mdring_init(&a);
+	mdring_init(&b);
+	if (mdring_add_many(&a, namep, NULL, NSERVERS) != 0)
+		return 1;
+	for (i = NSERVERS - 1; i >= 0; i--) {
+		if (mdring_add(&b, namep[i], 1) != 0)
+			return 1;
+	}
+	if (!same_ring(&a, &b) || check_find(&a) != 0) {
+		fprintf(stderr, "Rings built two ways differ.\n");
+		return 1;
+	}
+
+	for (i = 0; i < NKEYS; i++) {
+		lens[i] = snprintf(keybuf[i], sizeof(keybuf[i]), "key:%d",
+		    i * 7919);
+		keys[i] = keybuf[i];
+		/* Names are freed on removal, so keep the numbers. */
+		before[i] = atoi(mdring_lookup(&a, keys[i], lens[i]) + 6);
+	}
+
+	/* Take off every fifth server and put the first back. */
+	for (i = 0; i < NSERVERS; i += 5) {
+		if (mdring_remove(&a, namep[i]) != 0)
+			return 1;
+	}
+	if (mdring_add(&a, namep[0], 1) != 0 || check_find(&a) != 0)
+		return 1;
+	mdring_free(&b);
+	mdring_init(&b);
+	for (i = 0; i < NSERVERS; i++) {
+		if ((i % 5 != 0 || i == 0) && mdring_add(&b, namep[i], 1) != 0)
+			return 1;
+	}
+	if (!same_ring(&a, &b)) {
+		fprintf(stderr, "Ring after removals differs.\n");
+		return 1;
+	}
+
+	moved = 0;
+	mdring_lookup_batch(&a, batch, keys, lens, NKEYS);
+	for (i = 0; i < NKEYS; i++) {
+		after[i] = mdring_lookup(&a, keys[i], lens[i]);
+		if (batch[i] != after[i]) {
+			fprintf(stderr, "Batch lookup of key %d differs.\n",
+			    i);
+			return 1;
+		}
+		if (strcmp(namep[before[i]], after[i]) == 0)
+			continue;
+		moved++;
+		if (before[i] == 0 || before[i] % 5 != 0) {
+			fprintf(stderr, "Key %d moved off %s.\n", i,
+			    namep[before[i]]);
+			return 1;
+		}
+	}
+
+	printf("Incremental: %zu of %d keys moved: ok\n", moved, NKEYS);
+	mdring_free(&a);
+	mdring_free(&b);
+	return 0;
+}
+
+/*
+ * Weights scale the points, and bad input leaves the ring alone.
+ */
+static int
+test_errors(void)
+{
+	static const char *twice[2] = { "a:1", "a:1" };
+	static const unsigned weights[2] = { 3, 1 };
+	struct mdring r;
+	size_t i;
+	size_t n;
+
+	mdring_init(&r);
+	if (mdring_lookup(&r, "k", 1) != NULL || mdring_find(&r, 0) != -1) {
+		fprintf(stderr, "Empty ring gave a server.\n");
+		return 1;
+	}
+	if (mdring_add_many(&r, namep, weights, 2) != 0 ||
+	    r.npoints != 4 * 4 * MDRING_HASHES)
+		return 1;
+	for (i = n = 0; i < r.npoints; i++)
+		n += r.points[i].server == 0;
+	if (n != 3 * 4 * MDRING_HASHES) {
+		fprintf(stderr, "Weight 3 gave %zu points.\n", n);
+		return 1;
+	}
+
+	if (mdring_add(&r, namep[1], 1) == 0 || errno != EEXIST ||
+	    mdring_add_many(&r, twice, NULL, 2) == 0 || errno != EEXIST ||
+	    mdring_add(&r, "b:1", 0) == 0 || errno != EINVAL ||
+	    mdring_remove(&r, "c:1") == 0 || errno != ENOENT ||
+	    r.npoints != 4 * 4 * MDRING_HASHES) {
+		fprintf(stderr, "Bad input was taken.\n");
+		return 1;
+	}
+	mdring_free(&r);
+
+	printf("Errors: ok\n");
+	return 0;
+}
+
+int
+main(void)
+{
+	int i;
+
+	for (i = 0; i < NSERVERS; i++) {
+		snprintf(names[i], sizeof(names[i]), "cache-%d:11211", i);
+		namep[i] = names[i];
+	}
+
+	if (test_vectors() != 0)
+		exit(1);
+	if (test_incremental() != 0)
+		exit(1);
+	if (test_errors() != 0)
+		exit(1);
+
+	return 0;
+}
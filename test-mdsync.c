@@ -0,0 +1,312 @@
+/*-
+ * Copyright (c) 2023, Collin Funk
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHORS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "mdfile.h"
+#include "mdsync.h"
+#include "test.h"
+
+#define BASISSIZE (1024 * 1024 + 123)
+
+struct membuf {
+	uint8_t *p;
+	size_t len;
+	size_t cap;
+};
+
+static char dir[] = "/tmp/test-mdsync.XXXXXX";
+
+static int
+membuf_write(const void *data, size_t len, void *arg)
+{
+	struct membuf *mb;
+	uint8_t *p;
+
+	mb = arg;
+	if (mb->len + len > mb->cap) {
+		mb->cap = (mb->len + len) * 2;
+		if ((p = realloc(mb->p, mb->cap)) == NULL)
+			return (-1);
+		mb->p = p;
+	}
+	memcpy(mb->p + mb->len, data, len);
+	mb->len += len;
+	return (0);
+}
+
+/*
+ * Write len bytes to a file in the test directory and open it for
+ * reading.
+ */
+static int
+file_of(const char *name, const void *data, size_t len)
+{
+	char path[64];
+	int fd;
+
+	snprintf(path, sizeof(path), "%s/%s", dir, name);
+	if ((fd = open(path, O_RDWR | O_CREAT | O_TRUNC, 0600)) < 0 ||
+	    write(fd, data, len) != (ssize_t)len ||
+	    lseek(fd, 0, SEEK_SET) != 0) {
+		perror(path);
+		exit(1);
+	}
+	return (fd);
+}
+
+/*
+ * Feed len bytes to fn in random pieces.
+ */
+#define FEED(fn, obj, data, len) do { \
+	size_t off_; \
+	size_t n_; \
+	for (off_ = 0; off_ < (len); off_ += n_) { \
+		n_ = rng() % 10000 + 1; \
+		if (n_ > (len) - off_) \
+			n_ = (len) - off_; \
+		if (fn((obj), (data) + off_, n_) != 0) { \
+			perror(#fn); \
+			return 1; \
+		} \
+	} \
+} while (0)
+
+/*
+ * Signature of basis, through a file, and a delta of target against it,
+ * also through a file. Patching must give back target, sending at most
+ * maxlit bytes as literals.
+ */
+static int
+check(int algo, uint32_t bs, const uint8_t *basis, size_t blen,
+    const uint8_t *target, size_t tlen, size_t maxlit, struct membuf *delta)
+{
+	struct mdsync_sig sig;
+	struct mdsync_sig sig2;
+	struct mdsync_delta d;
+	struct membuf out;
+	int bfd;
+	int sfd;
+	int dfd;
+
+	memset(&out, 0, sizeof(out));
+	delta->len = 0;
+
+	if (mdsync_sig_init(&sig, algo, bs) != 0)
+		return 1;
+	FEED(mdsync_sig_update, &sig, basis, blen);
+	if (mdsync_sig_final(&sig) != 0 ||
+	    mdsync_sig_write(&sig, membuf_write, &out) != 0)
+		return 1;
+	sfd = file_of("sig", out.p, out.len);
+	if (mdsync_sig_read(&sig2, sfd) != 0) {
+		perror("mdsync_sig_read");
+		return 1;
+	}
+	close(sfd);
+	if (sig2.nblocks != sig.nblocks || sig2.size != sig.size ||
+	    (sig.nblocks != 0 &&
+	    (memcmp(sig2.weak, sig.weak, 4 * sig.nblocks) != 0 ||
+	    memcmp(sig2.strong, sig.strong, 16 * sig.nblocks) != 0))) {
+		fprintf(stderr, "Signature did not read back.\n");
+		return 1;
+	}
+	mdsync_sig_free(&sig);
+
+	if (mdsync_delta_init(&d, &sig2, membuf_write, delta) != 0)
+		return 1;
+	FEED(mdsync_delta_update, &d, target, tlen);
+	if (mdsync_delta_final(&d) != 0)
+		return 1;
+	if (d.literal > maxlit) {
+		fprintf(stderr, "%llu literal bytes with blocks of %u, "
+		    "expected at most %zu.\n", (unsigned long long)d.literal,
+		    bs, maxlit);
+		return 1;
+	}
+	mdsync_sig_free(&sig2);
+
+	bfd = file_of("basis", basis, blen);
+	dfd = file_of("delta", delta->p, delta->len);
+	out.len = 0;
+	if (mdsync_patch(bfd, dfd, membuf_write, &out) != 0) {
+		perror("mdsync_patch");
+		return 1;
+	}
+	close(bfd);
+	close(dfd);
+	if (out.len != tlen || memcmp(out.p, target, tlen) != 0) {
+		fprintf(stderr, "Patch of %zu bytes with blocks of %u "
+		    "failed.\n", tlen, bs);
+		return 1;
+	}
+	free(out.p);
+
+	return 0;
+}
+
+static int
+test_edits(int algo, const uint8_t *basis)
+{
+	static const uint32_t sizes[3] = { 64, 700, 4096 };
+	struct membuf delta;
+	uint8_t *target;
+	size_t tlen;
+	size_t i;
+
+	memset(&delta, 0, sizeof(delta));
+	if ((target = malloc(BASISSIZE + 2000)) == NULL)
+		return 1;
+
+	/* Insert, delete, overwrite and append. */
+	tlen = 0;
+	memcpy(target, basis, 5000);
+	tlen += 5000;
+	for (i = 0; i < 1000; i++)
+		target[tlen++] = rng();
+	memcpy(target + tlen, basis + 5000, 195000);
+	tlen += 195000;
+	memcpy(target + tlen, basis + 203000, BASISSIZE - 203000);
+	tlen += BASISSIZE - 203000;
+	target[600000] ^= 0xff;
+	for (i = 0; i < 777; i++)
+		target[tlen++] = rng();
+
+	for (i = 0; i < 3; i++) {
+		if (check(algo, sizes[i], basis, BASISSIZE, target, tlen,
+		    1000 + 777 + 3 * 2 * sizes[i], &delta) != 0)
+			return 1;
+	}
+
+	/* Unchanged, empty and short files. */
+	if (check(algo, 700, basis, BASISSIZE, basis, BASISSIZE, 0,
+	    &delta) != 0 ||
+	    check(algo, 700, basis, 0, basis, 5000, 5000, &delta) != 0 ||
+	    check(algo, 700, basis, 5000, basis, 0, 0, &delta) != 0 ||
+	    check(algo, 700, basis, 300, basis, 300, 0, &delta) != 0 ||
+	    check(algo, 700, basis, 1000, basis + 700, 300, 0, &delta) != 0)
+		return 1;
+
+	free(target);
+	free(delta.p);
+	printf("%s deltas: ok\n", algo == MDFILE_MD4 ? "MD4" : "MD5");
+	return 0;
+}
+
+/*
+ * A damaged delta or the wrong basis must be refused.
+ */
+static int
+test_damaged(const uint8_t *basis)
+{
+	struct membuf delta;
+	struct membuf out;
+	int bfd;
+	int dfd;
+
+	memset(&delta, 0, sizeof(delta));
+	memset(&out, 0, sizeof(out));
+	if (check(MDFILE_MD5, 700, basis, 10000, basis + 5, 10000, 10000,
+	    &delta) != 0)
+		return 1;
+
+	/* A literal byte changed. */
+	delta.p[100] ^= 1;
+	bfd = file_of("basis", basis, 10000);
+	dfd = file_of("delta", delta.p, delta.len);
+	if (mdsync_patch(bfd, dfd, membuf_write, &out) == 0 ||
+	    errno != EBADMSG) {
+		fprintf(stderr, "Damaged delta accepted.\n");
+		return 1;
+	}
+	close(bfd);
+	close(dfd);
+	delta.p[100] ^= 1;
+
+	/* A basis of another length. */
+	bfd = file_of("basis", basis, 9999);
+	dfd = file_of("delta", delta.p, delta.len);
+	if (mdsync_patch(bfd, dfd, membuf_write, &out) == 0 ||
+	    errno != EINVAL) {
+		fprintf(stderr, "Wrong basis accepted.\n");
+		return 1;
+	}
+	close(bfd);
+	close(dfd);
+
+	/* Cut short. */
+	bfd = file_of("basis", basis, 10000);
+	dfd = file_of("delta", delta.p, delta.len - 1);
+	if (mdsync_patch(bfd, dfd, membuf_write, &out) == 0) {
+		fprintf(stderr, "Truncated delta accepted.\n");
+		return 1;
+	}
+	close(bfd);
+	close(dfd);
+
+	free(delta.p);
+	free(out.p);
+	printf("Damaged deltas: ok\n");
+	return 0;
+}
+
+int
+main(void)
+{
+	char path[64];
+	uint8_t *basis;
+	size_t i;
+	int ret;
+
+	if ((basis = malloc(BASISSIZE)) == NULL)
+		exit(1);
+	for (i = 0; i < BASISSIZE; i++)
+		basis[i] = rng();
+	if (mkdtemp(dir) == NULL) {
+		perror("mkdtemp");
+		exit(1);
+	}
+
+	ret = test_edits(MDFILE_MD5, basis) != 0 ||
+	    test_edits(MDFILE_MD4, basis) != 0 ||
+	    test_damaged(basis) != 0;
+
+	snprintf(path, sizeof(path), "%s/sig", dir);
+	unlink(path);
+	snprintf(path, sizeof(path), "%s/basis", dir);
+	unlink(path);
+	snprintf(path, sizeof(path), "%s/delta", dir);
+	unlink(path);
+	rmdir(dir);
+	free(basis);
+	return ret;
+}
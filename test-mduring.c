@@ -0,0 +1,174 @@
+/*-
+ * Copyright (c) 2023, Collin Funk
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHORS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "md4.h"
+#include "md5.h"
+#include "mduring.h"
+#include "test-file.h"
+#include "test.h"
+
+#define NFILES 100
+
+struct check {
+	char *paths[NFILES + 1];
+	size_t sizes[NFILES + 1];
+	uint8_t expected[2][NFILES + 1][16];
+	int seen[NFILES + 1];
+	size_t next;
+	int algo;
+	int ordered;
+	int failed;
+};
+
+static void
+check_result(const struct mdfiles_result *r, void *arg)
+{
+	struct check *c;
+
+	c = arg;
+	if (c->ordered && r->index != c->next++) {
+		fprintf(stderr, "%s reported out of order.\n", r->path);
+		c->failed = 1;
+	}
+	c->seen[r->index]++;
+	if (r->index == NFILES) {
+		/* The last path does not exist. */
+		if (r->error == 0) {
+			fprintf(stderr, "Missing file hashed.\n");
+			c->failed = 1;
+		}
+	} else if (r->error != 0 || r->size != c->sizes[r->index] ||
+	    memcmp(r->digest, c->expected[c->algo][r->index], 16) != 0) {
+		fprintf(stderr, "%s failed.\n", r->path);
+		c->failed = 1;
+	}
+}
+
+/*
+ * Every combination of queue depth, buffer size, order and backend,
+ * with depths below the number of files so slots are reused.
+ */
+static int
+test_hash(struct check *c)
+{
+	static const int depths[] = { 1, 3, 32 };
+	static const size_t bufsizes[] = { 4096, 10000, 1 << 17 };
+	struct mduring_opts opts;
+	size_t d;
+	size_t b;
+	size_t i;
+	int ret;
+
+	for (d = 0; d < sizeof(depths) / sizeof(depths[0]); d++)
+	for (b = 0; b < sizeof(bufsizes) / sizeof(bufsizes[0]); b++)
+	for (i = 0; i < 8; i++) {
+		memset(c->seen, 0, sizeof(c->seen));
+		c->next = 0;
+		c->algo = i & 1;
+		c->ordered = (i >> 1) & 1;
+		mduring_opts_init(&opts);
+		opts.algo = c->algo == 0 ? MDFILE_MD5 : MDFILE_MD4;
+		opts.depth = depths[d];
+		opts.bufsize = bufsizes[b];
+		opts.ordered = c->ordered;
+		opts.pread = (i >> 2) & 1;
+		ret = mduring_hash((const char *const *)c->paths, NFILES + 1,
+		    &opts, check_result, c);
+		if (ret != 1 || c->failed) {
+			fprintf(stderr, "Depth %d, %zu byte buffers, %s "
+			    "failed.\n", opts.depth, opts.bufsize,
+			    opts.pread ? "pread" : "io_uring");
+			return 1;
+		}
+		for (c->next = 0; c->next <= NFILES; c->next++) {
+			if (c->seen[c->next] != 1) {
+				fprintf(stderr, "%s reported %d times.\n",
+				    c->paths[c->next], c->seen[c->next]);
+				return 1;
+			}
+		}
+	}
+
+	printf("Hash (%s): ok\n", mduring_available() ? "io_uring" :
+	    "pread only");
+	return 0;
+}
+
+int
+main(void)
+{
+	static struct check c;
+	char dir[] = "/tmp/test-mduring.XXXXXX";
+	uint8_t *buf;
+	size_t bufsize;
+	size_t i;
+	int ret;
+
+	bufsize = 1 << 19;
+	if ((buf = malloc(bufsize)) == NULL)
+		exit(1);
+	for (i = 0; i < bufsize; i++)
+		buf[i] = rng() & 0xff;
+
+	if (mkdtemp(dir) == NULL) {
+		perror("mkdtemp");
+		exit(1);
+	}
+	for (i = 0; i <= NFILES; i++) {
+		if ((c.paths[i] = malloc(256)) == NULL)
+			exit(1);
+		snprintf(c.paths[i], 256, "%s/%s%03zu", dir,
+		    i == NFILES ? "missing" : "f", i);
+		if (i == NFILES)
+			break;
+		c.sizes[i] = rng() % 8 == 0 ? rng() % bufsize : rng() % 9000;
+		if (i % 25 == 0)
+			c.sizes[i] = 0;
+		md5_digest(c.expected[0][i], buf, c.sizes[i]);
+		md4_digest(c.expected[1][i], buf, c.sizes[i]);
+		if (write_file(c.paths[i], buf, c.sizes[i]) != 0)
+			exit(1);
+	}
+
+	ret = test_hash(&c);
+
+	for (i = 0; i < NFILES; i++)
+		unlink(c.paths[i]);
+	for (i = 0; i <= NFILES; i++)
+		free(c.paths[i]);
+	rmdir(dir);
+	free(buf);
+
+	if (ret != 0)
+		exit(1);
+	return 0;
+}